@@ -0,0 +1,223 @@
+/*
+ * Microbenchmark of the access module lookups: the first matching rule
+ * of a list of random IPv4 allow and deny rules is searched linearly,
+ * as for short lists, and in a radix tree compiled as the module does
+ * for longer ones.  Both lookups are checked to agree.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include "ngx_palloc.c"
+#include "ngx_radix_tree.c"
+
+
+typedef struct {
+    uint32_t    mask;
+    uint32_t    addr;
+    ngx_uint_t  deny;
+} rule_t;
+
+
+ngx_uint_t  ngx_pagesize = 4096;
+
+static volatile uintptr_t  sink;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+#if (NGX_HAVE_POSIX_MEMALIGN || NGX_HAVE_MEMALIGN)
+
+void *
+ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
+{
+    void  *p;
+
+    if (posix_memalign(&p, alignment, size) != 0) {
+        return NULL;
+    }
+
+    return p;
+}
+
+#endif
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+/* as ngx_http_access_covered() */
+
+static ngx_uint_t
+covered(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
+{
+    uint32_t           bit;
+    ngx_radix_node_t  *node;
+
+    bit = 0x80000000;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return 1;
+        }
+
+        if ((mask & bit) == 0) {
+            break;
+        }
+
+        node = (key & bit) ? node->right : node->left;
+
+        bit >>= 1;
+    }
+
+    return 0;
+}
+
+
+static uintptr_t
+linear(rule_t *rules, ngx_uint_t n, uint32_t addr)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < n; i++) {
+        if ((addr & rules[i].mask) == rules[i].addr) {
+            return rules[i].deny;
+        }
+    }
+
+    return NGX_RADIX_NO_VALUE;
+}
+
+
+static double
+elapsed(struct timespec *start)
+{
+    struct timespec  end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+
+static void
+run(ngx_uint_t n, ngx_uint_t lookups)
+{
+    double             ns_linear, ns_tree;
+    rule_t            *rules;
+    uint32_t          *addrs, len;
+    uintptr_t          sum, sum_linear, sum_tree;
+    ngx_uint_t         i;
+    ngx_pool_t        *pool;
+    ngx_radix_tree_t  *tree;
+    struct timespec    start;
+
+    rules = malloc(n * sizeof(rule_t));
+    addrs = malloc(lookups * sizeof(uint32_t));
+
+    /* prefixes of 8 to 32 bits, mostly /24 as in blocklists */
+
+    for (i = 0; i < n; i++) {
+        len = (random() % 4) ? 24 : 8 + random() % 25;
+
+        rules[i].mask = (uint32_t) (0xffffffff << (32 - len));
+        rules[i].addr = (uint32_t) random() & rules[i].mask;
+        rules[i].deny = random() % 2;
+    }
+
+    /* half of the addresses are in the rules' prefixes */
+
+    for (i = 0; i < lookups; i++) {
+        addrs[i] = (uint32_t) random();
+
+        if (i % 2) {
+            rule_t  *r = &rules[random() % n];
+
+            addrs[i] = r->addr | (addrs[i] & ~r->mask);
+        }
+    }
+
+    pool = ngx_create_pool(16384, NULL);
+    tree = ngx_radix_tree_create(pool, -1);
+
+    for (i = 0; i < n; i++) {
+        if (!covered(tree, rules[i].addr, rules[i].mask)) {
+            ngx_radix32tree_insert(tree, rules[i].addr, rules[i].mask,
+                                   rules[i].deny);
+        }
+    }
+
+    sum = 0;
+    sum_linear = 0;
+    sum_tree = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < lookups; i++) {
+        sum += ngx_radix32tree_find(tree, addrs[i]);
+    }
+
+    ns_tree = elapsed(&start) / lookups;
+    sink = sum;
+
+    /* the linear search is slow with many rules, fewer lookups suffice */
+
+    if (n > 1000) {
+        lookups /= 100;
+    }
+
+    for (i = 0; i < lookups; i++) {
+        sum_tree += ngx_radix32tree_find(tree, addrs[i]) + 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < lookups; i++) {
+        sum_linear += linear(rules, n, addrs[i]) + 1;
+    }
+
+    ns_linear = elapsed(&start) / lookups;
+
+    printf("%7lu rules: linear %10.1f ns, radix tree %6.1f ns%s\n",
+           (unsigned long) n, ns_linear, ns_tree,
+           (sum_linear == sum_tree) ? "" : ", MISMATCH");
+
+    ngx_destroy_pool(pool);
+    free(addrs);
+    free(rules);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ngx_uint_t  lookups;
+
+    lookups = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 1000000;
+
+    srandom(1);
+
+    run(8, lookups);
+    run(16, lookups);
+    run(32, lookups);
+    run(64, lookups);
+    run(96, lookups);
+    run(128, lookups);
+    run(1000, lookups);
+    run(100000, lookups);
+
+    return 0;
+}
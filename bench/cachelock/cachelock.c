@@ -0,0 +1,446 @@
+/*
+ * Microbenchmark of the proxy cache keys zone mutex: a number of worker
+ * processes serve requests for random cache keys, each request locks the
+ * shard of its key twice, as ngx_http_file_cache_exists() does to find or
+ * create the node and ngx_http_file_cache_free() does to release it.  The
+ * time spent waiting for the mutexes is measured for 1 to 16 shards.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "ngx_slab.c"
+#include "ngx_shmtx.c"
+#include "ngx_rbtree.c"
+
+
+ngx_uint_t     ngx_pagesize;
+ngx_uint_t     ngx_pagesize_shift;
+ngx_uint_t     ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+ngx_int_t      ngx_ncpu;
+ngx_pid_t      ngx_pid;
+ngx_uint_t     ngx_process;
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+static ngx_log_t    log;
+static ngx_cycle_t  cycle;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+void *
+ngx_calloc(size_t size, ngx_log_t *log)
+{
+    return calloc(1, size);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+    abort();
+}
+
+
+#define KEY_LEN    16
+
+
+/* the layout of ngx_http_file_cache_node_t */
+
+typedef struct {
+    ngx_rbtree_node_t     node;
+    ngx_queue_t           queue;
+    u_char                key[KEY_LEN - sizeof(ngx_rbtree_key_t)];
+    unsigned              count:20;
+    unsigned              uses:10;
+    unsigned              exists:1;
+    time_t                expire;
+    time_t                valid_sec;
+    size_t                body_start;
+    off_t                 fs_size;
+    ngx_msec_t            lock_time;
+} node_t;
+
+
+typedef struct {
+    ngx_rbtree_t          rbtree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_queue_t           queue;
+    ngx_uint_t            count;
+    ngx_slab_pool_t      *shpool;
+} shard_t;
+
+
+typedef struct {
+    uint64_t              wait;
+    uint64_t              locks;
+    uint64_t              busy;
+} stat_t;
+
+
+#define ZONE_SIZE  (16 * 1024 * 1024)
+#define KEYS       200000
+
+
+static ngx_inline uint64_t
+now_ns(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    node_t              *n, *t;
+    ngx_rbtree_node_t  **p;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else {
+            n = (node_t *) node;
+            t = (node_t *) temp;
+
+            p = (ngx_memcmp(n->key, t->key, sizeof(n->key)) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static node_t *
+lookup(shard_t *sh, u_char *key)
+{
+    ngx_int_t           rc;
+    ngx_rbtree_key_t    node_key;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    ngx_memcpy(&node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key != node->key) {
+            node = (node_key < node->key) ? node->left : node->right;
+            continue;
+        }
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)],
+                        ((node_t *) node)->key,
+                        KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return (node_t *) node;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+/* ngx_http_file_cache_exists() */
+
+static node_t *
+exists(shard_t *sh, u_char *key, time_t now)
+{
+    node_t       *fcn;
+    ngx_queue_t  *q;
+
+    fcn = lookup(sh, key);
+
+    if (fcn) {
+        ngx_queue_remove(&fcn->queue);
+        fcn->uses++;
+        fcn->count++;
+        goto done;
+    }
+
+    for ( ;; ) {
+        fcn = ngx_slab_calloc_locked(sh->shpool, sizeof(node_t));
+        if (fcn) {
+            break;
+        }
+
+        /* forced expire of the least recently used unlocked node */
+
+        for (q = ngx_queue_last(&sh->queue);
+             q != ngx_queue_sentinel(&sh->queue);
+             q = ngx_queue_prev(q))
+        {
+            fcn = ngx_queue_data(q, node_t, queue);
+
+            if (fcn->count == 0) {
+                break;
+            }
+        }
+
+        if (q == ngx_queue_sentinel(&sh->queue)) {
+            return NULL;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(sh->shpool, fcn);
+        sh->count--;
+    }
+
+    sh->count++;
+
+    ngx_memcpy(&fcn->node.key, key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(fcn->key, &key[sizeof(ngx_rbtree_key_t)],
+               KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    ngx_rbtree_insert(&sh->rbtree, &fcn->node);
+
+    fcn->uses = 1;
+    fcn->count = 1;
+    fcn->exists = 1;
+
+done:
+
+    fcn->expire = now + 600;
+
+    ngx_queue_insert_head(&sh->queue, &fcn->queue);
+
+    return fcn;
+}
+
+
+/*
+ * only the time to get a busy mutex is counted, so the wait does not
+ * include the time a worker is preempted outside of the mutex
+ */
+
+static ngx_inline void
+lock(ngx_shmtx_t *mtx, stat_t *st)
+{
+    uint64_t  start;
+
+    st->locks++;
+
+    if (ngx_shmtx_trylock(mtx)) {
+        return;
+    }
+
+    start = now_ns();
+
+    ngx_shmtx_lock(mtx);
+
+    st->wait += now_ns() - start;
+    st->busy++;
+}
+
+
+static void
+worker(shard_t *shards, ngx_uint_t nshards, ngx_uint_t ops, ngx_uint_t seed,
+    stat_t *st)
+{
+    u_char       key[KEY_LEN];
+    shard_t     *sh;
+    node_t      *fcn;
+    uint64_t     h;
+    ngx_uint_t   i, j, k, rnd;
+
+    rnd = seed;
+
+    for (i = 0; i < ops; i++) {
+        rnd = rnd * 1103515245 + 12345;
+        k = (rnd >> 8) % KEYS;
+
+        /* a stand-in for the md5 of the key */
+
+        h = (k + 1) * 0x9e3779b97f4a7c15ULL;
+
+        for (j = 0; j < KEY_LEN; j++) {
+            h ^= h >> 29;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            key[j] = (u_char) (h >> 32);
+        }
+
+        /* as in ngx_http_file_cache_shard() */
+
+        sh = &shards[(key[KEY_LEN - 1] | key[KEY_LEN - 2] << 8) % nshards];
+
+        lock(&sh->shpool->mutex, st);
+
+        fcn = exists(sh, key, (time_t) (i >> 10));
+
+        ngx_shmtx_unlock(&sh->shpool->mutex);
+
+        if (fcn == NULL) {
+            continue;
+        }
+
+        /* ngx_http_file_cache_free() */
+
+        lock(&sh->shpool->mutex, st);
+
+        fcn->count--;
+
+        ngx_shmtx_unlock(&sh->shpool->mutex);
+    }
+}
+
+
+static double
+run(ngx_uint_t nshards, ngx_uint_t workers, ngx_uint_t ops, stat_t *total)
+{
+    int               status;
+    shard_t          *shards;
+    stat_t           *stats;
+    ngx_uint_t        i;
+    ngx_slab_pool_t  *sp, *pools[16];
+    struct timespec   start, end;
+
+    sp = mmap(NULL, ZONE_SIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED,
+              -1, 0);
+    if (sp == MAP_FAILED) {
+        exit(1);
+    }
+
+    sp->end = (u_char *) sp + ZONE_SIZE;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        exit(1);
+    }
+
+    ngx_slab_init(sp);
+
+    shards = ngx_slab_alloc(sp, nshards * sizeof(shard_t));
+    stats = ngx_slab_calloc(sp, workers * sizeof(stat_t));
+    if (shards == NULL || stats == NULL) {
+        exit(1);
+    }
+
+    if (nshards == 1) {
+        pools[0] = sp;
+
+    } else if (ngx_slab_split(sp, pools, nshards) != NGX_OK) {
+        exit(1);
+    }
+
+    for (i = 0; i < nshards; i++) {
+        ngx_rbtree_init(&shards[i].rbtree, &shards[i].sentinel, insert_value);
+        ngx_queue_init(&shards[i].queue);
+        shards[i].count = 0;
+        shards[i].shpool = pools[i];
+    }
+
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < workers; i++) {
+        switch (fork()) {
+
+        case -1:
+            exit(1);
+
+        case 0:
+            ngx_pid = getpid();
+            ngx_process = NGX_PROCESS_WORKER;
+            worker(shards, nshards, ops, i + 1, &stats[i]);
+            exit(0);
+        }
+    }
+
+    while (wait(&status) > 0) { /* void */ }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    total->wait = 0;
+    total->locks = 0;
+    total->busy = 0;
+
+    for (i = 0; i < workers; i++) {
+        total->wait += stats[i].wait;
+        total->locks += stats[i].locks;
+        total->busy += stats[i].busy;
+    }
+
+    munmap(sp, ZONE_SIZE);
+
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double      ns;
+    stat_t      st;
+    ngx_uint_t  n, workers, ops;
+
+    workers = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 8;
+    ops = (argc > 2) ? (ngx_uint_t) atol(argv[2]) : 1000000;
+
+    cycle.log = &log;
+    ngx_cycle = &cycle;
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("%lu workers, %lu requests each, %ld cpus\n",
+           (unsigned long) workers, (unsigned long) ops, (long) ngx_ncpu);
+
+    for (n = 1; n <= 16; n *= 2) {
+        ns = run(n, workers, ops, &st);
+
+        printf("shards %2lu: %8.0f requests/s, %6.3f%% locks busy, "
+               "wait %8.1f ms, %6.1f ns/lock\n",
+               (unsigned long) n, workers * ops / ns * 1e9,
+               100.0 * st.busy / st.locks, st.wait / 1e6,
+               (double) st.wait / st.locks);
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# fills a cache with fake files, then compares the start without
+# a snapshot, indexed by the loader, and the start with a snapshot;
+# run from this directory with nginx in $PATH or $NGINX
+#
+#   cachesnap.sh [number]
+
+n=${1:-100000}
+nginx=${NGINX:-nginx}
+prefix=/dev/shm/cachesnap
+
+ms() {
+    echo $(( `date +%s%N` / 1000000 ))
+}
+
+rm -rf $prefix
+mkdir -p $prefix/logs $prefix/conf $prefix/snap
+chmod 777 $prefix/snap
+cp nginx.conf $prefix/conf/
+
+python3 mkcache.py $n $prefix/cache
+
+# cold start: the loader starts a minute after nginx and walks the tree
+
+start=`ms`
+$nginx -p $prefix/ -c conf/nginx.conf
+echo "start without snapshot: $(( `ms` - start )) ms"
+
+while ! grep -q "http file cache: $prefix/cache " $prefix/logs/error.log
+do
+    sleep 1
+done
+
+echo "index loaded by the loader: $(( `ms` - start )) ms"
+
+# graceful shutdown saves the snapshot
+
+start=`ms`
+$nginx -p $prefix/ -c conf/nginx.conf -s quit
+
+while [ -f $prefix/logs/nginx.pid ]; do
+    sleep 0.1
+done
+
+echo "shutdown with snapshot: $(( `ms` - start )) ms"
+
+ls -l $prefix/snap
+
+start=`ms`
+$nginx -p $prefix/ -c conf/nginx.conf
+echo "start with snapshot: $(( `ms` - start )) ms"
+
+grep restored $prefix/logs/error.log
+
+$nginx -p $prefix/ -c conf/nginx.conf -s stop
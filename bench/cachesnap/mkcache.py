@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+
+# Fills a cache directory with levels=1:2 with the given number of files
+# named as cache files, 1k each.  The loader only checks the names and
+# the sizes, so the contents are zeroes.
+#
+#   mkcache.py number dir
+
+import hashlib, os, sys
+
+n, top = int(sys.argv[1]), sys.argv[2]
+data = bytes(1024)
+
+for i in range(n):
+    key = hashlib.md5(b'http://backend/item/%d' % i).hexdigest()
+    d = os.path.join(top, key[-1], key[-3:-1])
+    os.makedirs(d, exist_ok=True)
+    with open(os.path.join(d, key), 'wb') as f:
+        f.write(data)
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+# compares the epoll and io_uring event methods serving the files of
+# ../webserver/content: the request rate, and the system calls of the
+# worker per request; run from this directory after make as root, with
+# nginx in $PATH or $NGINX; SENDFILE=off makes responses read into memory
+#
+#   events.sh [connections] [seconds]
+
+c=${1:-50}
+t=${2:-10}
+nginx=${NGINX:-nginx}
+sendfile=${SENDFILE:-on}
+unset NGINX
+prefix=/dev/shm/events
+
+requests() {
+    curl -s http://127.0.0.1:8094/status | sed -n 3p | awk '{ print $3 }'
+}
+
+rm -rf $prefix
+mkdir -p $prefix/logs $prefix/conf $prefix/html
+cp ../webserver/content/1kb ../webserver/content/16kb \
+   ../webserver/content/128kb $prefix/html/
+
+for m in epoll io_uring; do
+    sed -e "s/METHOD/$m/" -e "s/SENDFILE/$sendfile/" nginx.conf \
+        > $prefix/conf/nginx.conf
+
+    $nginx -p $prefix/ -c conf/nginx.conf &
+    sleep 1
+
+    worker=`pgrep -P $(cat $prefix/logs/nginx.pid)`
+
+    for f in 1kb 16kb 128kb; do
+        echo "$m $f: `./httpload 8094 /$f $c $t`"
+
+        # the worker is traced once the connections are established,
+        # for 3 seconds, and only then: tracing slows it down
+
+        ./httpload 8094 /$f $c 5 > /dev/null &
+        load=$!
+        sleep 1
+
+        r=`requests`
+        ./syscount $worker sleep 3 > $prefix/syscalls
+        r=$((`requests` - r - 1))
+
+        wait $load
+
+        awk -v r=$r -v m=$m -v f=$f '
+            { printf "    %-16s %8.3f per request\n", $2, $1 / r }
+            END { printf "    (%s %s, %d requests traced)\n", m, f, r }
+        ' $prefix/syscalls
+    done
+
+    $nginx -p $prefix/ -c conf/nginx.conf -s stop
+    sleep 1
+done
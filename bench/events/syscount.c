@@ -0,0 +1,209 @@
+/*
+ * Counts the system calls of a running process while a command runs:
+ *
+ *     syscount pid command [args]
+ *
+ * The process is traced with ptrace() from the start to the end of the
+ * command, and the calls are printed by count, with the total.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+
+#define NSYSCALLS  1024
+
+
+static struct {
+    long          nr;
+    const char   *name;
+} names[] = {
+    { SYS_read, "read" },
+    { SYS_write, "write" },
+    { SYS_readv, "readv" },
+    { SYS_writev, "writev" },
+    { SYS_recvfrom, "recvfrom" },
+    { SYS_sendto, "sendto" },
+    { SYS_sendfile, "sendfile" },
+    { SYS_pread64, "pread64" },
+    { SYS_openat, "openat" },
+    { SYS_close, "close" },
+    { SYS_fstat, "fstat" },
+    { SYS_newfstatat, "newfstatat" },
+    { SYS_accept4, "accept4" },
+    { SYS_setsockopt, "setsockopt" },
+    { SYS_getsockopt, "getsockopt" },
+    { SYS_ioctl, "ioctl" },
+    { SYS_epoll_wait, "epoll_wait" },
+    { SYS_epoll_pwait, "epoll_pwait" },
+    { SYS_epoll_ctl, "epoll_ctl" },
+    { SYS_io_uring_enter, "io_uring_enter" },
+    { SYS_gettimeofday, "gettimeofday" },
+    { SYS_clock_gettime, "clock_gettime" },
+    { SYS_futex, "futex" },
+    { 0, NULL }
+};
+
+
+static unsigned long  counts[NSYSCALLS];
+
+
+static const char *
+name(long nr)
+{
+    int          i;
+    static char  buf[32];
+
+    for (i = 0; names[i].name; i++) {
+        if (names[i].nr == nr) {
+            return names[i].name;
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "syscall %ld", nr);
+
+    return buf;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                            status, done;
+    long                           i, best;
+    pid_t                          pid, cmd, p;
+    unsigned long                  total;
+    struct __ptrace_syscall_info   info;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: syscount pid command [args]\n");
+        return 1;
+    }
+
+    pid = atoi(argv[1]);
+
+    if (ptrace(PTRACE_SEIZE, pid, 0, PTRACE_O_TRACESYSGOOD) == -1) {
+        perror("ptrace(PTRACE_SEIZE)");
+        return 1;
+    }
+
+    if (ptrace(PTRACE_INTERRUPT, pid, 0, 0) == -1) {
+        perror("ptrace(PTRACE_INTERRUPT)");
+        return 1;
+    }
+
+    if (waitpid(pid, &status, __WALL) == -1) {
+        perror("waitpid");
+        return 1;
+    }
+
+    cmd = fork();
+
+    if (cmd == -1) {
+        perror("fork");
+        return 1;
+    }
+
+    if (cmd == 0) {
+        execvp(argv[2], &argv[2]);
+        perror(argv[2]);
+        _exit(1);
+    }
+
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    done = 0;
+
+    for ( ;; ) {
+        p = waitpid(-1, &status, __WALL);
+
+        if (p == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("waitpid");
+            return 1;
+        }
+
+        if (p == cmd) {
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                done = 1;
+                ptrace(PTRACE_INTERRUPT, pid, 0, 0);
+            }
+
+            continue;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            fprintf(stderr, "traced process exited\n");
+            break;
+        }
+
+        if (done) {
+            ptrace(PTRACE_DETACH, pid, 0, 0);
+            break;
+        }
+
+        if (WSTOPSIG(status) == (SIGTRAP|0x80)) {
+
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0
+                && info.op == PTRACE_SYSCALL_INFO_ENTRY
+                && info.entry.nr < NSYSCALLS)
+            {
+                counts[info.entry.nr]++;
+            }
+
+            ptrace(PTRACE_SYSCALL, pid, 0, 0);
+            continue;
+        }
+
+        /* group stop or a signal, which is passed on */
+
+        if (status >> 16 == PTRACE_EVENT_STOP) {
+            ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+        } else {
+            ptrace(PTRACE_SYSCALL, pid, 0, WSTOPSIG(status));
+        }
+    }
+
+    if (!done) {
+        waitpid(cmd, &status, 0);
+    }
+
+    total = 0;
+
+    for (i = 0; i < NSYSCALLS; i++) {
+        total += counts[i];
+    }
+
+    for ( ;; ) {
+        best = -1;
+
+        for (i = 0; i < NSYSCALLS; i++) {
+            if (counts[i] && (best == -1 || counts[i] > counts[best])) {
+                best = i;
+            }
+        }
+
+        if (best == -1) {
+            break;
+        }
+
+        printf("%10lu  %s\n", counts[best], name(best));
+        counts[best] = 0;
+    }
+
+    printf("%10lu  total\n", total);
+
+    return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# starts the slow backend, then measures the latency through both
+# upstreams in turn; nginx must already run with nginx.conf
+
+delay=${1:-50}
+conns=${2:-20}
+seconds=${3:-10}
+
+python3 `dirname $0`/slow.py 8094 $delay 2>/dev/null &
+slow=$!
+
+sleep 1
+
+for i in 1 2 3; do
+    ./latency 8080 /least_conn/1k $conns $seconds
+    ./latency 8080 /ewma/1k $conns $seconds
+done
+
+kill $slow
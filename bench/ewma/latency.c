@@ -0,0 +1,245 @@
+/*
+ * A keep-alive HTTP/1.1 load generator which measures latency: a number
+ * of connections repeatedly request the same URI, one request at a time
+ * each, for a given time.  The rate of responses and the percentiles of
+ * the response time are printed.  Responses must have Content-Length.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+
+#define BUFSIZE  (16 * 1024)
+
+
+typedef struct {
+    int      fd;
+    size_t   have;
+    long     need;      /* the response length, -1 if unknown yet */
+    double   sent;
+    char     buf[BUFSIZE];
+} conn_t;
+
+
+static char     request[1024];
+static size_t   request_len;
+
+static double  *samples;
+static long     nsamples, size;
+
+
+static double
+now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int
+connect_to(struct sockaddr_in *sin)
+{
+    int  fd, one;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+
+    if (connect(fd, (struct sockaddr *) sin, sizeof(*sin)) == -1) {
+        perror("connect");
+        exit(1);
+    }
+
+    one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    (void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+
+static void
+send_request(conn_t *c)
+{
+    if (write(c->fd, request, request_len) != (ssize_t) request_len) {
+        perror("write");
+        exit(1);
+    }
+
+    c->have = 0;
+    c->need = -1;
+    c->sent = now();
+}
+
+
+/* returns 1 when a complete response was read */
+
+static int
+read_response(conn_t *c)
+{
+    char     *p, *end;
+    ssize_t   n;
+
+    for ( ;; ) {
+        n = read(c->fd, c->buf + c->have, BUFSIZE - c->have - 1);
+
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+
+            perror("read");
+            exit(1);
+        }
+
+        if (n == 0) {
+            fprintf(stderr, "connection closed\n");
+            exit(1);
+        }
+
+        c->have += n;
+
+        if (c->need == -1) {
+            c->buf[c->have] = '\0';
+
+            end = strstr(c->buf, "\r\n\r\n");
+            if (end == NULL) {
+                continue;
+            }
+
+            p = strstr(c->buf, "Content-Length: ");
+            if (p == NULL || p > end) {
+                fprintf(stderr, "no Content-Length in response\n");
+                exit(1);
+            }
+
+            c->need = (end + 4 - c->buf) + atol(p + 16);
+        }
+
+        if ((long) c->have >= c->need) {
+            return 1;
+        }
+    }
+}
+
+
+static int
+cmp_samples(const void *one, const void *two)
+{
+    const double  *a = one, *b = two;
+
+    return (*a > *b) - (*a < *b);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                  ep, i, n, nconns, seconds;
+    double               start, t;
+    conn_t              *conns;
+    struct sockaddr_in   sin;
+    struct epoll_event   ev, events[256];
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: latency port uri [connections] [seconds]\n");
+        return 1;
+    }
+
+    nconns = (argc > 3) ? atoi(argv[3]) : 20;
+    seconds = (argc > 4) ? atoi(argv[4]) : 10;
+
+    request_len = snprintf(request, sizeof(request),
+                           "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                           argv[2]);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(atoi(argv[1]));
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    conns = calloc(nconns, sizeof(conn_t));
+    if (conns == NULL) {
+        return 1;
+    }
+
+    size = 1024 * 1024;
+    samples = malloc(size * sizeof(double));
+    if (samples == NULL) {
+        return 1;
+    }
+
+    ep = epoll_create1(0);
+
+    for (i = 0; i < nconns; i++) {
+        conns[i].fd = connect_to(&sin);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conns[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].fd, &ev);
+
+        send_request(&conns[i]);
+    }
+
+    start = now();
+
+    for ( ;; ) {
+        n = epoll_wait(ep, events, 256, 1000);
+
+        for (i = 0; i < n; i++) {
+            conn_t  *c = events[i].data.ptr;
+
+            if (read_response(c)) {
+                if (nsamples == size) {
+                    size *= 2;
+                    samples = realloc(samples, size * sizeof(double));
+                    if (samples == NULL) {
+                        return 1;
+                    }
+                }
+
+                samples[nsamples++] = now() - c->sent;
+                send_request(c);
+            }
+        }
+
+        t = now() - start;
+
+        if (t >= seconds) {
+            break;
+        }
+    }
+
+    if (nsamples == 0) {
+        fprintf(stderr, "no responses\n");
+        return 1;
+    }
+
+    qsort(samples, nsamples, sizeof(double), cmp_samples);
+
+    printf("%s: %ld responses, %.0f requests/s, ms: "
+           "p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f\n",
+           argv[2], nsamples, nsamples / t,
+           samples[nsamples * 50 / 100] * 1e3,
+           samples[nsamples * 90 / 100] * 1e3,
+           samples[nsamples * 99 / 100] * 1e3,
+           samples[nsamples * 999 / 1000] * 1e3);
+
+    return 0;
+}
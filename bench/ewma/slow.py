@@ -0,0 +1,29 @@
+#!/usr/bin/env python3
+
+# a backend which answers each request after a delay:
+# slow.py port delay_ms
+
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_GET(self):
+        time.sleep(delay)
+        body = b'slow\n'
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+port = int(sys.argv[1])
+delay = int(sys.argv[2]) / 1000.0
+
+ThreadingHTTPServer(('127.0.0.1', port), Handler).serve_forever()
@@ -0,0 +1,24 @@
+#!/usr/bin/env python3
+
+# writes a javascript-like text file of about the given size in bytes
+
+import random
+import sys
+
+words = ['function', 'var', 'return', 'this', 'document', 'window',
+         'length', 'prototype', 'null', 'if', 'else', 'for', 'i', 'x',
+         'callback', 'undefined', 'Object', 'Array', 'push', 'call']
+
+size = int(sys.argv[1])
+random.seed(size)
+
+out = []
+n = 0
+
+while n < size:
+    w = random.choice(words) + random.choice(' ;\n(){}.,=')
+    out.append(w)
+    n += len(w)
+
+with open(sys.argv[2], 'w') as f:
+    f.write(''.join(out)[:size])
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+# requests the files over one connection with nghttp, each with its own
+# weight, and prints the time spent and the mean completion time of the
+# responses by weight
+
+n=${1:-1000}
+
+shift 1 2>/dev/null
+
+uris=
+weights=
+
+for i in `seq 1 $n`; do
+    uris="$uris http://127.0.0.1:8080/a$i"
+    weights="$weights -p $(( (i * 97) % 256 + 1 ))"
+done
+
+start=`date +%s%N`
+
+nghttp -ns -M $n $weights "$@" $uris > /tmp/h2sched.$$
+
+end=`date +%s%N`
+
+echo "$n streams in $(( (end - start) / 1000000 )) ms"
+
+# statistics lines are "id responseEnd requestStart process code size path"
+
+awk 'function t(s) {
+         if (sub(/ms$/, "", s)) return s * 1000;
+         if (sub(/us$/, "", s)) return s;
+         sub(/s$/, "", s); return s * 1000000
+     }
+     $5 == 200 {
+         i = substr($7, 3);
+         w = (i * 97) % 256 + 1;
+         b = int((w - 1) / 64);
+         sum[b] += t(substr($2, 2)); cnt[b]++; done++
+     }
+     END {
+         printf "%d responses\n", done;
+         for (b = 0; b < 4; b++) {
+             printf "weight %3d-%3d: %8.1f ms mean completion\n",
+                    b * 64 + 1, b * 64 + 64, sum[b] / cnt[b] / 1000
+         }
+     }' /tmp/h2sched.$$
+
+rm -f /tmp/h2sched.$$
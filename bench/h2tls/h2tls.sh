@@ -0,0 +1,24 @@
+#!/bin/sh
+
+# loads the page of small assets n times, each over a new connection,
+# and prints the time spent
+
+n=${1:-100}
+assets=${2:-100}
+
+shift 2 2>/dev/null
+
+uris=
+for i in `seq 1 $assets`; do
+    uris="$uris https://127.0.0.1:8443/a$i"
+done
+
+start=`date +%s%N`
+
+for i in `seq 1 $n`; do
+    nghttp -n "$@" $uris || exit 1
+done
+
+end=`date +%s%N`
+
+echo "$n pages of $assets assets in $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+# requests the files over one connection with nghttp and prints
+# the number of responses and header block octets per response
+
+port=${1:-8081}
+n=${2:-120}
+
+shift 2 2>/dev/null
+
+uris=
+for i in `seq 1 $n`; do
+    uris="$uris http://127.0.0.1:$port/a$i.css"
+done
+
+nghttp -nv "$@" $uris \
+    | sed -n 's/.*recv HEADERS frame <length=\([0-9]*\).*/\1/p' \
+    | awk -v port=$port '{ s += $1 }
+          END { printf "%s: %d responses, %.1f header octets per response\n",
+                port, NR, s / NR }'
@@ -0,0 +1,155 @@
+/*
+ * Microbenchmark of the nginx HTTP/1.x request parser. The parser is
+ * compiled into this binary, so the vector fast path can be switched
+ * off by predefining NGX_HAVE_SSE42 and NGX_HAVE_AVX2 to 0.
+ */
+
+#include "ngx_http_parse.c"
+
+#include <stdio.h>
+#include <time.h>
+
+
+/* symbols used by the parts of ngx_http_parse.c not benchmarked here */
+
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...) { }
+void *ngx_pnalloc(ngx_pool_t *pool, size_t size) { return NULL; }
+u_char *ngx_strlcasestrn(u_char *s1, u_char *last, u_char *s2, size_t n)
+    { return NULL; }
+ngx_int_t ngx_strncasecmp(u_char *s1, u_char *s2, size_t n) { return 0; }
+void ngx_unescape_uri(u_char **dst, u_char **src, size_t size,
+    ngx_uint_t type) { }
+
+
+static struct {
+    char  *name;
+    char  *request;
+} sets[] = {
+
+    { "chrome-document",
+      "GET /index.html HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", "
+      "\"Not=A?Brand\";v=\"99\"\r\n"
+      "sec-ch-ua-mobile: ?0\r\n"
+      "sec-ch-ua-platform: \"Linux\"\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "image/avif,image/webp,image/apng,*/*;q=0.8,"
+      "application/signed-exchange;v=b3;q=0.7\r\n"
+      "Sec-Fetch-Site: none\r\n"
+      "Sec-Fetch-Mode: navigate\r\n"
+      "Sec-Fetch-User: ?1\r\n"
+      "Sec-Fetch-Dest: document\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Accept-Language: en-US,en;q=0.9\r\n"
+      "\r\n" },
+
+    { "firefox-subresource",
+      "GET /static/js/vendor.3f9a1c2e.min.js?v=20231017 HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:118.0) "
+      "Gecko/20100101 Firefox/118.0\r\n"
+      "Accept: */*\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Referer: https://www.example.com/\r\n"
+      "Connection: keep-alive\r\n"
+      "Cookie: _ga=GA1.2.1415926535.1697500000; "
+      "_gid=GA1.2.2718281828.1697500000; "
+      "session=8f14e45fceea167a5a36dedd4bea2543d1b2c3e4f5a6b7c8; "
+      "consent=necessary%2Canalytics; theme=dark\r\n"
+      "Sec-Fetch-Dest: script\r\n"
+      "Sec-Fetch-Mode: no-cors\r\n"
+      "Sec-Fetch-Site: same-origin\r\n"
+      "If-Modified-Since: Tue, 17 Oct 2023 10:00:00 GMT\r\n"
+      "If-None-Match: \"652e5c40-1c3a\"\r\n"
+      "\r\n" },
+
+    { "ab",
+      "GET /0kb HTTP/1.0\r\n"
+      "Connection: Keep-Alive\r\n"
+      "Host: localhost\r\n"
+      "User-Agent: ApacheBench/2.3\r\n"
+      "Accept: */*\r\n"
+      "\r\n" }
+};
+
+
+static ngx_int_t
+parse(ngx_http_request_t *r, u_char *start, size_t len)
+{
+    ngx_buf_t  b;
+    ngx_int_t  rc;
+
+    ngx_memzero(r, sizeof(ngx_http_request_t));
+
+    b.pos = start;
+    b.last = start + len;
+
+    rc = ngx_http_parse_request_line(r, &b);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    do {
+        rc = ngx_http_parse_header_line(r, &b, 1);
+    } while (rc == NGX_OK);
+
+    return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    size_t               len;
+    u_char              *p;
+    ngx_uint_t           i, n, iterations;
+    struct timespec      start, end;
+    ngx_http_request_t  *r;
+
+    iterations = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 1000000;
+
+    r = malloc(sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        return 1;
+    }
+
+#if (NGX_HAVE_AVX2)
+    printf("parser: avx2\n");
+#elif (NGX_HAVE_SSE42)
+    printf("parser: sse4.2\n");
+#else
+    printf("parser: scalar\n");
+#endif
+
+    for (i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        p = (u_char *) sets[i].request;
+        len = strlen(sets[i].request);
+
+        if (parse(r, p, len) != NGX_HTTP_PARSE_HEADER_DONE) {
+            printf("%s: parse error\n", sets[i].name);
+            return 1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (n = 0; n < iterations; n++) {
+            (void) parse(r, p, len);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("%-20s %4zu bytes %8.1f ns/request\n", sets[i].name, len,
+               ((end.tv_sec - start.tv_sec) * 1e9
+                + (end.tv_nsec - start.tv_nsec)) / iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * Microbenchmark of the HPACK Huffman coder. Both coders are compiled
+ * into this binary; the decoder is timed with the byte-wide table and
+ * with the nibble state machine it is derived from, on header values
+ * as sent by current browsers and returned by typical origins.
+ */
+
+#include "ngx_http_v2_huff_decode.c"
+#include "ngx_http_v2_huff_encode.c"
+
+#include <stdio.h>
+#include <time.h>
+
+
+static char  *values[] = {
+
+    /* request */
+
+    "www.example.com",
+    "/static/js/vendor.3f9a1c2e.min.js?v=20231017",
+    "/api/v2/users/1415926535/timeline?since_id=2718281828&count=50",
+    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36",
+    "text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,image/apng,*/*;q=0.8,"
+    "application/signed-exchange;v=b3;q=0.7",
+    "\"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", "
+    "\"Not=A?Brand\";v=\"99\"",
+    "en-US,en;q=0.9",
+    "https://www.example.com/products/category/shoes?page=2",
+    "_ga=GA1.2.1415926535.1697500000; _gid=GA1.2.2718281828.1697500000; "
+    "session=8f14e45fceea167a5a36dedd4bea2543d1b2c3e4f5a6b7c8; "
+    "consent=necessary%2Canalytics; theme=dark",
+    "Bearer eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiIxMjM0NTY3OD"
+    "kwIiwibmFtZSI6IkpvaG4gRG9lIiwiaWF0IjoxNTE2MjM5MDIyfQ."
+    "SflKxwRJSMeKKF2QT4fwpMeJf36POk6yJV_adQssw5c",
+
+    /* response */
+
+    "Tue, 17 Oct 2023 10:00:00 GMT",
+    "text/html; charset=utf-8",
+    "\"652e5c40-1c3a\"",
+    "public, max-age=31536000, immutable",
+    "id=a3fWa; Expires=Wed, 21 Oct 2026 07:28:00 GMT; Path=/; "
+    "Secure; HttpOnly; SameSite=Lax",
+    "max-age=63072000; includeSubDomains; preload",
+    "default-src 'self'; img-src 'self' https://cdn.example.com; "
+    "script-src 'self' 'unsafe-inline'"
+};
+
+
+static ngx_int_t
+decode_nibble(u_char *state, u_char *src, size_t len, u_char **dst)
+{
+    u_char  *end, ch, ending;
+
+    ending = 1;
+    end = src + len;
+
+    while (src != end) {
+        ch = *src++;
+
+        if (ngx_http_v2_huff_decode_bits(state, &ending, ch >> 4, dst)
+            != NGX_OK
+            || ngx_http_v2_huff_decode_bits(state, &ending, ch & 0xf, dst)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return ending ? NGX_OK : NGX_ERROR;
+}
+
+
+static double
+elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9
+           + (end->tv_nsec - start->tv_nsec);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    u_char            *p, state, *plain[32], *huff[32], out[1024];
+    size_t             len[32], hlen[32], total, htotal;
+    ngx_uint_t         i, n, k, iterations;
+    struct timespec    start, end;
+    double             t;
+
+    iterations = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 100000;
+    n = sizeof(values) / sizeof(values[0]);
+
+    ngx_http_v2_huff_decode_init();
+
+    total = 0;
+    htotal = 0;
+
+    for (i = 0; i < n; i++) {
+        plain[i] = (u_char *) values[i];
+        len[i] = strlen(values[i]);
+
+        huff[i] = malloc(len[i]);
+        if (huff[i] == NULL) {
+            return 1;
+        }
+
+        hlen[i] = ngx_http_v2_huff_encode(plain[i], len[i], huff[i], 0);
+
+        if (hlen[i] == 0) {
+            printf("value %lu is not compressible\n", (unsigned long) i);
+            return 1;
+        }
+
+        /* both decoders must restore the original value */
+
+        state = 0;
+        p = out;
+
+        if (ngx_http_v2_huff_decode(&state, huff[i], hlen[i], &p, 1, NULL)
+            != NGX_OK
+            || (size_t) (p - out) != len[i]
+            || ngx_memcmp(out, plain[i], len[i]) != 0)
+        {
+            printf("value %lu: byte decoder mismatch\n", (unsigned long) i);
+            return 1;
+        }
+
+        state = 0;
+        p = out;
+
+        if (decode_nibble(&state, huff[i], hlen[i], &p) != NGX_OK
+            || (size_t) (p - out) != len[i]
+            || ngx_memcmp(out, plain[i], len[i]) != 0)
+        {
+            printf("value %lu: nibble decoder mismatch\n", (unsigned long) i);
+            return 1;
+        }
+
+        total += len[i];
+        htotal += hlen[i];
+    }
+
+    printf("%lu values, %lu bytes, %lu bytes encoded\n",
+           (unsigned long) n, (unsigned long) total, (unsigned long) htotal);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (k = 0; k < iterations; k++) {
+        for (i = 0; i < n; i++) {
+            (void) ngx_http_v2_huff_encode(plain[i], len[i], out, 0);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    t = elapsed(&start, &end);
+
+    printf("%-16s %8.1f ns/value %8.1f MB/s\n", "encode",
+           t / iterations / n, total * iterations * 1e3 / t);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (k = 0; k < iterations; k++) {
+        for (i = 0; i < n; i++) {
+            state = 0;
+            p = out;
+            (void) decode_nibble(&state, huff[i], hlen[i], &p);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    t = elapsed(&start, &end);
+
+    printf("%-16s %8.1f ns/value %8.1f MB/s\n", "decode (nibble)",
+           t / iterations / n, total * iterations * 1e3 / t);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (k = 0; k < iterations; k++) {
+        for (i = 0; i < n; i++) {
+            state = 0;
+            p = out;
+            (void) ngx_http_v2_huff_decode(&state, huff[i], hlen[i], &p, 1,
+                                           NULL);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    t = elapsed(&start, &end);
+
+    printf("%-16s %8.1f ns/value %8.1f MB/s\n", "decode (byte)",
+           t / iterations / n, total * iterations * 1e3 / t);
+
+    return 0;
+}
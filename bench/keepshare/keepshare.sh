@@ -0,0 +1,40 @@
+#!/bin/sh
+
+# compares upstream keepalive connections cached by each worker with
+# those also handed over between workers with "keepalive 4 shared=64";
+# run from this directory after make with nginx in $PATH or $NGINX
+#
+#   keepshare.sh [connections] [seconds]
+
+c=${1:-50}
+t=${2:-10}
+nginx=${NGINX:-nginx}
+unset NGINX
+prefix=/dev/shm/keepshare
+
+accepts() {
+    curl -s http://127.0.0.1:8201/status | sed -n 3p | awk '{ print $1 }'
+}
+
+rm -rf $prefix
+mkdir -p $prefix/logs $prefix/conf $prefix/html
+cp backend.conf nginx.conf $prefix/conf/
+
+head -c 1024 /dev/urandom > $prefix/html/1kb
+
+for u in local shared; do
+    $nginx -p $prefix/ -c conf/backend.conf &
+    $nginx -p $prefix/ -c conf/nginx.conf &
+    sleep 1
+
+    a=`accepts`
+    r=`./httpload 8200 /$u/1kb $c $t`
+    a=$((`accepts` - a - 1))
+
+    echo "$r, $a backend connections"
+    curl -s -D - -o /dev/null http://127.0.0.1:8200/$u/1kb | grep X-Keepalive
+
+    $nginx -p $prefix/ -c conf/nginx.conf -s stop
+    $nginx -p $prefix/ -c conf/backend.conf -s stop
+    sleep 1
+done
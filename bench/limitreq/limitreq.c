@@ -0,0 +1,349 @@
+/*
+ * Microbenchmark of a sharded limit_req zone: a number of worker processes
+ * look up and update nodes of random keys in one shared zone, each lookup
+ * under the mutex of the shard the key hash selects, as the limit_req
+ * module does.  The zone is split into 1 to 16 shards with ngx_slab_split().
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "ngx_slab.c"
+#include "ngx_shmtx.c"
+#include "ngx_rbtree.c"
+#include "ngx_crc32.c"
+
+
+ngx_uint_t     ngx_pagesize;
+ngx_uint_t     ngx_pagesize_shift;
+ngx_uint_t     ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+ngx_int_t      ngx_ncpu;
+ngx_pid_t      ngx_pid;
+ngx_uint_t     ngx_process;
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+static ngx_log_t    log;
+static ngx_cycle_t  cycle;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+void *
+ngx_calloc(size_t size, ngx_log_t *log)
+{
+    return calloc(1, size);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+    abort();
+}
+
+
+typedef struct {
+    u_char                color;
+    u_char                dummy;
+    u_short               len;
+    ngx_queue_t           queue;
+    ngx_msec_t            last;
+    ngx_uint_t            excess;
+    ngx_uint_t            count;
+    u_char                data[1];
+} node_t;
+
+
+typedef struct {
+    ngx_rbtree_t          rbtree;
+    ngx_rbtree_node_t     sentinel;
+    ngx_queue_t           queue;
+    ngx_slab_pool_t      *shpool;
+} shard_t;
+
+
+#define ZONE_SIZE  (16 * 1024 * 1024)
+#define KEYS       100000
+#define RATE       10000
+
+
+static ngx_int_t
+keycmp(u_char *s1, u_char *s2, size_t n1, size_t n2)
+{
+    ngx_int_t  m;
+
+    m = ngx_memcmp(s1, s2, ngx_min(n1, n2));
+
+    if (m || n1 == n2) {
+        return m;
+    }
+
+    return (n1 < n2) ? -1 : 1;
+}
+
+
+static void
+insert_value(ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel)
+{
+    node_t              *n, *t;
+    ngx_rbtree_node_t  **p;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+            p = &temp->right;
+
+        } else {
+            n = (node_t *) &node->color;
+            t = (node_t *) &temp->color;
+
+            p = (keycmp(n->data, t->data, n->len, t->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+lookup(shard_t *sh, uint32_t hash, u_char *key, size_t len, ngx_msec_t now)
+{
+    size_t              size;
+    ngx_int_t           rc, excess;
+    ngx_queue_t        *q;
+    node_t             *lr;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash != node->key) {
+            node = (hash < node->key) ? node->left : node->right;
+            continue;
+        }
+
+        lr = (node_t *) &node->color;
+
+        rc = keycmp(key, lr->data, len, (size_t) lr->len);
+
+        if (rc == 0) {
+            ngx_queue_remove(&lr->queue);
+            ngx_queue_insert_head(&sh->queue, &lr->queue);
+
+            excess = lr->excess - RATE * (now - lr->last) / 1000 + 1000;
+
+            lr->excess = (excess < 0) ? 0 : excess;
+            lr->last = now;
+
+            return;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    size = offsetof(ngx_rbtree_node_t, color) + offsetof(node_t, data) + len;
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(sh->shpool, size);
+        if (node) {
+            break;
+        }
+
+        /* expire the oldest node by force */
+
+        q = ngx_queue_last(&sh->queue);
+        lr = ngx_queue_data(q, node_t, queue);
+
+        ngx_queue_remove(q);
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&sh->rbtree, node);
+        ngx_slab_free_locked(sh->shpool, node);
+    }
+
+    node->key = hash;
+
+    lr = (node_t *) &node->color;
+
+    lr->len = (u_short) len;
+    lr->excess = 0;
+    lr->last = now;
+    lr->count = 0;
+
+    ngx_memcpy(lr->data, key, len);
+
+    ngx_rbtree_insert(&sh->rbtree, node);
+    ngx_queue_insert_head(&sh->queue, &lr->queue);
+}
+
+
+static void
+worker(shard_t *shards, ngx_uint_t nshards, ngx_uint_t ops, ngx_uint_t seed)
+{
+    size_t       len;
+    u_char       key[NGX_INET_ADDRSTRLEN];
+    uint32_t     hash;
+    shard_t     *sh;
+    ngx_uint_t   i, k, rnd;
+
+    rnd = seed;
+
+    for (i = 0; i < ops; i++) {
+        rnd = rnd * 1103515245 + 12345;
+        k = (rnd >> 8) % KEYS;
+
+        len = snprintf((char *) key, sizeof(key), "10.%lu.%lu.%lu",
+                       (unsigned long) k >> 16, (unsigned long) (k >> 8) & 0xff,
+                       (unsigned long) k & 0xff);
+
+        hash = ngx_crc32_short(key, len);
+
+        sh = &shards[hash % nshards];
+
+        ngx_shmtx_lock(&sh->shpool->mutex);
+
+        lookup(sh, hash, key, len, i);
+
+        ngx_shmtx_unlock(&sh->shpool->mutex);
+    }
+}
+
+
+static double
+run(ngx_uint_t nshards, ngx_uint_t workers, ngx_uint_t ops)
+{
+    int               status;
+    shard_t          *shards;
+    ngx_uint_t        i;
+    ngx_slab_pool_t  *sp, *pools[16];
+    struct timespec   start, end;
+
+    sp = mmap(NULL, ZONE_SIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED,
+              -1, 0);
+    if (sp == MAP_FAILED) {
+        exit(1);
+    }
+
+    sp->end = (u_char *) sp + ZONE_SIZE;
+    sp->min_shift = 3;
+    sp->addr = sp;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        exit(1);
+    }
+
+    ngx_slab_init(sp);
+
+    shards = ngx_slab_alloc(sp, nshards * sizeof(shard_t));
+    if (shards == NULL) {
+        exit(1);
+    }
+
+    if (nshards == 1) {
+        pools[0] = sp;
+
+    } else if (ngx_slab_split(sp, pools, nshards) != NGX_OK) {
+        exit(1);
+    }
+
+    for (i = 0; i < nshards; i++) {
+        ngx_rbtree_init(&shards[i].rbtree, &shards[i].sentinel, insert_value);
+        ngx_queue_init(&shards[i].queue);
+        shards[i].shpool = pools[i];
+    }
+
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < workers; i++) {
+        switch (fork()) {
+
+        case -1:
+            exit(1);
+
+        case 0:
+            ngx_pid = getpid();
+            ngx_process = NGX_PROCESS_WORKER;
+            worker(shards, nshards, ops, i + 1);
+            exit(0);
+        }
+    }
+
+    while (wait(&status) > 0) { /* void */ }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    munmap(sp, ZONE_SIZE);
+
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double      ns;
+    ngx_uint_t  n, workers, ops;
+
+    workers = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 8;
+    ops = (argc > 2) ? (ngx_uint_t) atol(argv[2]) : 1000000;
+
+    cycle.log = &log;
+    ngx_cycle = &cycle;
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("%lu workers, %lu lookups each, %ld cpus\n",
+           (unsigned long) workers, (unsigned long) ops, (long) ngx_ncpu);
+
+    for (n = 1; n <= 16; n *= 2) {
+        ns = run(n, workers, ops);
+
+        printf("shards %2lu: %8.0f lookups/s, %6.1f ns/lookup\n",
+               (unsigned long) n, workers * ops / ns * 1e9,
+               ns / (workers * ops));
+    }
+
+    return 0;
+}
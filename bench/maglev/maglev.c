@@ -0,0 +1,313 @@
+/*
+ * Microbenchmark of the consistent hash methods of the upstream hash
+ * module.  For a number of peers both lookup structures are built the
+ * way the module builds them: the ring of 160 points per unit of weight
+ * for "consistent", and the table of slots for "consistent=maglev".
+ * Random keys are then looked up in both, and the share of keys which
+ * move to another peer when one of the peers is removed is counted.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include "ngx_crc32.c"
+#include "ngx_murmurhash.c"
+
+
+ngx_uint_t  ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    return malloc(size);
+}
+
+
+#define NKEYS  1000000
+
+
+typedef struct {
+    uint32_t     hash;
+    ngx_str_t   *server;
+} point_t;
+
+
+typedef struct {
+    ngx_uint_t   number;
+    point_t     *point;
+} ring_t;
+
+
+typedef struct {
+    ngx_uint_t   number;
+    uint32_t    *slot;
+} table_t;
+
+
+static ngx_str_t   servers[1000];
+static u_char      names[1000][32];
+
+
+static int
+cmp_points(const void *one, const void *two)
+{
+    const point_t  *first = one, *second = two;
+
+    return (first->hash > second->hash) - (first->hash < second->hash);
+}
+
+
+static void
+ring_build(ring_t *ring, ngx_uint_t npeers, ngx_uint_t skip)
+{
+    uint32_t    hash, base_hash, prev;
+    ngx_uint_t  i, j, n;
+
+    ring->point = malloc(sizeof(point_t) * npeers * 160);
+    n = 0;
+
+    for (i = 0; i < npeers; i++) {
+        if (i == skip) {
+            continue;
+        }
+
+        /* "host:port" split as in ngx_http_upstream_init_chash() */
+
+        ngx_crc32_init(base_hash);
+        ngx_crc32_update(&base_hash, servers[i].data, servers[i].len - 3);
+        ngx_crc32_update(&base_hash, (u_char *) "", 1);
+        ngx_crc32_update(&base_hash, servers[i].data + servers[i].len - 2, 2);
+
+        prev = 0;
+
+        for (j = 0; j < 160; j++) {
+            hash = base_hash;
+            ngx_crc32_update(&hash, (u_char *) &prev, 4);
+            ngx_crc32_final(hash);
+
+            ring->point[n].hash = hash;
+            ring->point[n].server = &servers[i];
+            n++;
+
+            prev = hash;
+        }
+    }
+
+    qsort(ring->point, n, sizeof(point_t), cmp_points);
+
+    ring->number = n;
+}
+
+
+static ngx_uint_t
+ring_lookup(ring_t *ring, ngx_uint_t npeers, uint32_t hash)
+{
+    ngx_str_t   *server;
+    ngx_uint_t   i, j, k;
+
+    i = 0;
+    j = ring->number;
+
+    while (i < j) {
+        k = (i + j) / 2;
+
+        if (hash > ring->point[k].hash) {
+            i = k + 1;
+
+        } else if (hash < ring->point[k].hash) {
+            j = k;
+
+        } else {
+            i = k;
+            break;
+        }
+    }
+
+    server = ring->point[i % ring->number].server;
+
+    /* the peer is then found by its name, as in the module */
+
+    for (k = 0; k < npeers; k++) {
+        if (servers[k].len == server->len
+            && ngx_strncmp(servers[k].data, server->data, server->len) == 0)
+        {
+            return k;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+table_build(table_t *table, ngx_uint_t npeers, ngx_uint_t skip)
+{
+    uint32_t    *pos, *step;
+    ngx_uint_t   n, number, filled;
+
+    /* as NGX_HTTP_UPSTREAM_MAGLEV_SIZE */
+
+    number = 65537;
+
+    table->number = number;
+    table->slot = malloc(sizeof(uint32_t) * number);
+    ngx_memset(table->slot, 0xff, sizeof(uint32_t) * number);
+
+    pos = malloc(sizeof(uint32_t) * 2 * npeers);
+    step = pos + npeers;
+
+    for (n = 0; n < npeers; n++) {
+        pos[n] = ngx_crc32_long(servers[n].data, servers[n].len) % number;
+        step[n] = ngx_murmur_hash2(servers[n].data, servers[n].len)
+                  % (number - 1) + 1;
+    }
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (n = 0; n < npeers; n++) {
+            if (n == skip) {
+                continue;
+            }
+
+            while (table->slot[pos[n]] != (uint32_t) -1) {
+                pos[n] = (pos[n] + step[n]) % number;
+            }
+
+            table->slot[pos[n]] = n;
+            pos[n] = (pos[n] + step[n]) % number;
+
+            if (++filled == number) {
+                free(pos);
+                return;
+            }
+        }
+    }
+}
+
+
+static double
+now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double       t, ring_ns, table_ns;
+    ring_t       ring, ring1;
+    table_t      table, table1;
+    uint32_t    *keys;
+    ngx_uint_t   i, k, npeers, ring_moved, table_moved, sum;
+    ngx_uint_t   ring_max, table_max, count[1000];
+
+    static ngx_uint_t  tests[] = { 3, 10, 41, 100, 500 };
+
+    ngx_crc32_table_init();
+
+    for (i = 0; i < 1000; i++) {
+        servers[i].data = names[i];
+        servers[i].len = sprintf((char *) names[i], "10.0.%u.%u:80",
+                                 (unsigned) (i / 250),
+                                 (unsigned) (i % 250 + 1));
+    }
+
+    keys = malloc(sizeof(uint32_t) * NKEYS);
+
+    for (i = 0; i < NKEYS; i++) {
+        u_char  buf[32];
+
+        keys[i] = ngx_crc32_long(buf, sprintf((char *) buf, "/item/%u",
+                                              (unsigned) i));
+    }
+
+    printf("%6s %10s %10s %8s %8s %8s %8s %7s %7s\n", "peers",
+           "ring KB", "table KB", "ring ns", "tbl ns", "ring mv", "tbl mv",
+           "ring mx", "tbl mx");
+
+    for (k = 0; k < sizeof(tests) / sizeof(ngx_uint_t); k++) {
+        npeers = tests[k];
+
+        ring_build(&ring, npeers, (ngx_uint_t) -1);
+        ring_build(&ring1, npeers, 0);
+        table_build(&table, npeers, (ngx_uint_t) -1);
+        table_build(&table1, npeers, 0);
+
+        sum = 0;
+
+        t = now();
+
+        for (i = 0; i < NKEYS; i++) {
+            sum += ring_lookup(&ring, npeers, keys[i]);
+        }
+
+        ring_ns = (now() - t) * 1e9 / NKEYS;
+
+        t = now();
+
+        for (i = 0; i < NKEYS; i++) {
+            sum += table.slot[keys[i] % table.number];
+        }
+
+        table_ns = (now() - t) * 1e9 / NKEYS;
+
+        /* keys moved when peer 0 is removed, and the largest share */
+
+        ring_moved = 0;
+        table_moved = 0;
+
+        ngx_memzero(count, sizeof(count));
+
+        for (i = 0; i < NKEYS; i++) {
+            ngx_uint_t  p = ring_lookup(&ring, npeers, keys[i]);
+
+            count[p]++;
+            ring_moved += (p != ring_lookup(&ring1, npeers, keys[i]));
+        }
+
+        for (ring_max = 0, i = 0; i < npeers; i++) {
+            ring_max = ngx_max(ring_max, count[i]);
+        }
+
+        ngx_memzero(count, sizeof(count));
+
+        for (i = 0; i < NKEYS; i++) {
+            ngx_uint_t  p = table.slot[keys[i] % table.number];
+
+            count[p]++;
+            table_moved += (p != table1.slot[keys[i] % table1.number]);
+        }
+
+        for (table_max = 0, i = 0; i < npeers; i++) {
+            table_max = ngx_max(table_max, count[i]);
+        }
+
+        printf("%6lu %10.1f %10.1f %8.1f %8.1f %7.2f%% %7.2f%% %7.2f %7.2f\n",
+               (unsigned long) npeers,
+               ring.number * sizeof(point_t) / 1024.0,
+               table.number * sizeof(uint32_t) / 1024.0,
+               ring_ns, table_ns,
+               100.0 * ring_moved / NKEYS, 100.0 * table_moved / NKEYS,
+               (double) ring_max * npeers / NKEYS,
+               (double) table_max * npeers / NKEYS);
+
+        free(ring.point);
+        free(ring1.point);
+        free(table.slot);
+        free(table1.slot);
+    }
+
+    return sum == 42;
+}
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+# Writes a synthetic mp4 file of the given duration in seconds with
+# a video track, 25 samples/s, and an audio track, 44100/1024 samples/s,
+# interleaved in chunks, with the "moov" atom at the end ("end") or
+# before the "mdat" atom ("fast").  A 2 hours file has a 2.1M "moov".
+#
+#   mkmp4.py seconds end|fast file
+
+import struct, sys
+
+def atom(name, *payload):
+    data = b''.join(payload)
+    return struct.pack('>I', 8 + len(data)) + name + data
+
+def full(name, ver, flags, *payload):
+    return atom(name, struct.pack('>I', (ver << 24) | flags), *payload)
+
+def build(seconds, moov_first, path):
+    # video 25 fps, 400 byte samples, 10 per chunk, keyframe every 50
+    # audio 44100/1024, 100 byte samples, 20 per chunk
+    vn = seconds * 25
+    an = seconds * 44100 // 1024
+    vsize, asize = 400, 100
+    vchunk, achunk = 10, 20
+
+    chunks = []   # (track, first sample, count)
+    vi = ai = 0
+    while vi < vn or ai < an:
+        if ai >= an or (vi < vn and vi * 40 / 1000 <= ai * 1024 / 44100):
+            c = min(vchunk, vn - vi); chunks.append((0, vi, c)); vi += c
+        else:
+            c = min(achunk, an - ai); chunks.append((1, ai, c)); ai += c
+
+    def trak(tid, n, size, per, timescale, delta, handler, sync, offsets):
+        dur = n * delta
+        tkhd = full(b'tkhd', 0, 3, struct.pack('>IIIII', 0, 0, tid, 0, dur),
+                    b'\0' * 60, struct.pack('>II', 320 << 16, 240 << 16))
+        mdhd = full(b'mdhd', 0, 0, struct.pack('>IIIIHH', 0, 0, timescale,
+                                                 dur, 0x55c4, 0))
+        hdlr = full(b'hdlr', 0, 0, b'\0' * 4, handler, b'\0' * 12, b'h\0')
+        mh = full(b'vmhd', 0, 1, b'\0' * 8) if handler == b'vide' else \
+             full(b'smhd', 0, 0, b'\0' * 4)
+        dinf = atom(b'dinf', full(b'dref', 0, 0, struct.pack('>I', 1),
+                                  full(b'url ', 0, 1)))
+        stsd = full(b'stsd', 0, 0, struct.pack('>I', 1),
+                    atom(b'avc1' if handler == b'vide' else b'mp4a',
+                         b'\0' * 6 + struct.pack('>H', 1) + b'\0' * 20))
+        stts = full(b'stts', 0, 0, struct.pack('>III', 1, n, delta))
+        parts = [stsd, stts]
+        if sync:
+            ks = list(range(1, n + 1, 50))
+            parts.append(full(b'stss', 0, 0, struct.pack('>I', len(ks)),
+                              struct.pack('>%dI' % len(ks), *ks)))
+        stsc = [(1, per, 1)]
+        if n % per:
+            stsc.append((len(offsets), n % per, 1))
+        parts.append(full(b'stsc', 0, 0, struct.pack('>I', len(stsc)),
+                          b''.join(struct.pack('>III', *e) for e in stsc)))
+        parts.append(full(b'stsz', 0, 0, struct.pack('>II', 0, n),
+                          struct.pack('>%dI' % n, *([size] * n))))
+        parts.append(full(b'stco', 0, 0, struct.pack('>I', len(offsets)),
+                          struct.pack('>%dI' % len(offsets), *offsets)))
+        stbl = atom(b'stbl', *parts)
+        return atom(b'trak', tkhd,
+                    atom(b'mdia', mdhd, hdlr, atom(b'minf', mh, dinf, stbl)))
+
+    def moov(base):
+        voff, aoff = [], []
+        pos = base
+        for t, first, c in chunks:
+            (voff if t == 0 else aoff).append(pos)
+            pos += c * (vsize if t == 0 else asize)
+        mvhd = full(b'mvhd', 0, 0, struct.pack('>IIII', 0, 0, 1000,
+                                                 seconds * 1000),
+                    struct.pack('>IH', 0x10000, 0x100), b'\0' * 10,
+                    b'\0' * 36, b'\0' * 24, struct.pack('>I', 3))
+        return atom(b'moov', mvhd,
+                    trak(1, vn, vsize, vchunk, 1000, 40, b'vide', 1, voff),
+                    trak(2, an, asize, achunk, 44100, 1024, b'soun', 0, aoff))
+
+    mdat = bytearray()
+    for t, first, c in chunks:
+        for i in range(first, first + c):
+            s = vsize if t == 0 else asize
+            mdat += struct.pack('>BI', t, i) * (s // 5)
+
+    ftyp = atom(b'ftyp', b'isom', struct.pack('>I', 512), b'isomavc1')
+    mdat_atom = struct.pack('>I', 8 + len(mdat)) + b'mdat' + bytes(mdat)
+
+    if moov_first:
+        m = moov(0)
+        m = moov(len(ftyp) + len(m) + 8)
+        out = ftyp + m + mdat_atom
+    else:
+        out = ftyp + mdat_atom + moov(len(ftyp) + 8)
+
+    open(path, 'wb').write(out)
+
+build(int(sys.argv[1]), sys.argv[2] == 'fast', sys.argv[3])
@@ -0,0 +1,166 @@
+/*
+ * Microbenchmark of the pool allocator: keep-alive HTTP connections are
+ * simulated by a connection pool that lives for a number of requests and
+ * a request pool per request, with allocations shaped after those of
+ * the http core module.  The system allocator calls are counted.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+
+
+static ngx_uint_t  allocs;
+static ngx_uint_t  frees;
+
+
+static void
+bench_free(void *p)
+{
+    frees++;
+    free(p);
+}
+
+
+#undef  ngx_free
+#define ngx_free  bench_free
+
+#include "ngx_palloc.c"
+
+
+ngx_uint_t  ngx_pagesize = 4096;
+
+
+void *
+ngx_alloc(size_t size, ngx_log_t *log)
+{
+    allocs++;
+    return malloc(size);
+}
+
+
+#if (NGX_HAVE_POSIX_MEMALIGN || NGX_HAVE_MEMALIGN)
+
+void *
+ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
+{
+    void  *p;
+
+    allocs++;
+
+    if (posix_memalign(&p, alignment, size) != 0) {
+        return NULL;
+    }
+
+    return p;
+}
+
+#endif
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+/* request pool allocations, about 6K, as in a typical GET request */
+
+static size_t  request_allocs[] = {
+    1400, 64, 20 * 48, 20 * 48, 256, 128, 32, 32, 48, 96, 512, 64,
+    160, 320, 40, 40, 24, 128, 256, 1024
+};
+
+
+static double
+elapsed(struct timespec *start)
+{
+    struct timespec  end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+
+static void
+run(ngx_uint_t requests, ngx_uint_t keepalive)
+{
+    void             *buf;
+    double            ns;
+    ngx_uint_t        i, j, n, conns;
+    ngx_pool_t       *c, *r;
+    struct timespec   start;
+
+    allocs = 0;
+    frees = 0;
+
+    conns = requests / keepalive;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (n = 0; n < conns; n++) {
+
+        /* ngx_event_accept() and ngx_http_init_connection() */
+
+        c = ngx_create_pool(512, NULL);
+        if (c == NULL) {
+            exit(1);
+        }
+
+        (void) ngx_pcalloc(c, 360);
+        (void) ngx_pcalloc(c, 120);
+
+        buf = ngx_palloc(c, 1024);
+
+        for (i = 0; i < keepalive; i++) {
+
+            /* ngx_http_alloc_request() and the request processing */
+
+            r = ngx_create_pool(4096, NULL);
+            if (r == NULL) {
+                exit(1);
+            }
+
+            for (j = 0; j < sizeof(request_allocs) / sizeof(size_t); j++) {
+                (void) ngx_palloc(r, request_allocs[j]);
+            }
+
+            ngx_destroy_pool(r);
+        }
+
+        ngx_pfree(c, buf);
+        ngx_destroy_pool(c);
+    }
+
+    ns = elapsed(&start);
+
+    printf("keepalive %3lu: %6.1f ns/request, "
+           "%5.2f allocs/request, %5.2f frees/request\n",
+           (unsigned long) keepalive, ns / requests,
+           (double) allocs / requests, (double) frees / requests);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ngx_uint_t  requests;
+
+    requests = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 1000000;
+
+#if (NGX_POOL_CACHE_BLOCKS)
+    printf("pool blocks: cached\n");
+#else
+    printf("pool blocks: not cached\n");
+#endif
+
+    run(requests, 1);
+    run(requests, 10);
+    run(requests, 100);
+
+    return 0;
+}
@@ -0,0 +1,381 @@
+/*
+ * Microbenchmark of the upstream zone peer state: a number of worker
+ * processes select and release peers of one upstream in shared memory,
+ * as ngx_http_upstream_get_round_robin_peer() and
+ * ngx_http_upstream_free_round_robin_peer() do for each request.  The
+ * previous scheme, with the peers write locked to select a peer, is
+ * compared to the per worker slots.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "ngx_rwlock.c"
+
+
+ngx_int_t      ngx_ncpu;
+
+
+#define PEERS      3
+#define WORKERS    64
+
+
+/* the fields of ngx_http_upstream_rr_peer_t used to select a peer */
+
+typedef struct {
+    ngx_int_t             current_weight;
+    ngx_int_t             effective_weight;
+    ngx_uint_t            conns;
+} shard_t;
+
+
+typedef struct {
+    shard_t               state;
+    shard_t              *shard;
+
+    ngx_int_t             weight;
+    ngx_uint_t            max_conns;
+
+    ngx_uint_t            fails;
+    time_t                accessed;
+    time_t                checked;
+
+    ngx_uint_t            max_fails;
+    time_t                fail_timeout;
+
+    ngx_atomic_t          lock;
+} peer_t;
+
+
+typedef struct {
+    ngx_atomic_t          rwlock;
+    size_t                shard_size;
+    ngx_uint_t            nshards;
+    peer_t                peer[PEERS];
+    ngx_uint_t            selected[WORKERS][PEERS];
+} peers_t;
+
+
+static ngx_uint_t  weights[PEERS] = { 3, 2, 1 };
+
+
+#define own_shard(peers, peer, w)                                             \
+    ((shard_t *) ((u_char *) (peer)->shard + (w) * (peers)->shard_size))
+
+
+/* before: the peers are write locked to select a peer */
+
+static peer_t *
+get_locked(peers_t *peers, time_t now)
+{
+    ngx_int_t    total;
+    ngx_uint_t   i;
+    peer_t      *peer, *best;
+
+    ngx_rwlock_wlock(&peers->rwlock);
+
+    best = NULL;
+    total = 0;
+
+    for (i = 0; i < PEERS; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (peer->max_conns && peer->state.conns >= peer->max_conns) {
+            continue;
+        }
+
+        peer->state.current_weight += peer->state.effective_weight;
+        total += peer->state.effective_weight;
+
+        if (peer->state.effective_weight < peer->weight) {
+            peer->state.effective_weight++;
+        }
+
+        if (best == NULL
+            || peer->state.current_weight > best->state.current_weight)
+        {
+            best = peer;
+        }
+    }
+
+    best->state.current_weight -= total;
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    best->state.conns++;
+
+    ngx_rwlock_unlock(&peers->rwlock);
+
+    return best;
+}
+
+
+static void
+free_locked(peers_t *peers, peer_t *peer)
+{
+    ngx_rwlock_rlock(&peers->rwlock);
+    ngx_rwlock_wlock(&peer->lock);
+
+    if (peer->accessed < peer->checked) {
+        peer->fails = 0;
+    }
+
+    peer->state.conns--;
+
+    ngx_rwlock_unlock(&peer->lock);
+    ngx_rwlock_unlock(&peers->rwlock);
+}
+
+
+/* after: the weights and connections are in the slots of the worker */
+
+static ngx_uint_t
+conns(peers_t *peers, peer_t *peer)
+{
+    ngx_uint_t  i, n;
+
+    n = 0;
+
+    for (i = 0; i < peers->nshards; i++) {
+        n += own_shard(peers, peer, i)->conns;
+    }
+
+    return n;
+}
+
+
+static peer_t *
+get_sharded(peers_t *peers, ngx_uint_t w, time_t now)
+{
+    ngx_int_t    total;
+    ngx_uint_t   i;
+    peer_t      *peer, *best;
+    shard_t     *shard, *best_shard;
+
+    best = NULL;
+    best_shard = NULL;
+    total = 0;
+
+    for (i = 0; i < PEERS; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (peer->max_conns && conns(peers, peer) >= peer->max_conns) {
+            continue;
+        }
+
+        shard = own_shard(peers, peer, w);
+
+        shard->current_weight += shard->effective_weight;
+        total += shard->effective_weight;
+
+        if (shard->effective_weight < peer->weight) {
+            shard->effective_weight++;
+        }
+
+        if (best == NULL || shard->current_weight > best_shard->current_weight)
+        {
+            best = peer;
+            best_shard = shard;
+        }
+    }
+
+    best_shard->current_weight -= total;
+
+    if (best->fails && now - best->checked > best->fail_timeout) {
+        ngx_rwlock_rlock(&peers->rwlock);
+        ngx_rwlock_wlock(&best->lock);
+
+        if (now - best->checked > best->fail_timeout) {
+            best->checked = now;
+        }
+
+        ngx_rwlock_unlock(&best->lock);
+        ngx_rwlock_unlock(&peers->rwlock);
+    }
+
+    best_shard->conns++;
+
+    return best;
+}
+
+
+static void
+free_sharded(peers_t *peers, peer_t *peer, ngx_uint_t w)
+{
+    if (peer->fails && peer->accessed < peer->checked) {
+        ngx_rwlock_rlock(&peers->rwlock);
+        ngx_rwlock_wlock(&peer->lock);
+
+        if (peer->accessed < peer->checked) {
+            peer->fails = 0;
+        }
+
+        ngx_rwlock_unlock(&peer->lock);
+        ngx_rwlock_unlock(&peers->rwlock);
+    }
+
+    own_shard(peers, peer, w)->conns--;
+}
+
+
+static void
+worker(peers_t *peers, ngx_uint_t sharded, ngx_uint_t w, ngx_uint_t ops)
+{
+    time_t       now;
+    peer_t      *peer;
+    ngx_uint_t   i, selected[PEERS];
+
+    ngx_memzero(selected, sizeof(selected));
+
+    for (i = 0; i < ops; i++) {
+        now = (time_t) (i >> 16);
+
+        if (sharded) {
+            peer = get_sharded(peers, w, now);
+            free_sharded(peers, peer, w);
+
+        } else {
+            peer = get_locked(peers, now);
+            free_locked(peers, peer);
+        }
+
+        selected[peer - peers->peer]++;
+    }
+
+    ngx_memcpy(peers->selected[w], selected, sizeof(selected));
+}
+
+
+static double
+run(ngx_uint_t sharded, ngx_uint_t max_conns, ngx_uint_t workers,
+    ngx_uint_t ops, ngx_uint_t *selected)
+{
+    int               status;
+    u_char           *p;
+    size_t            size;
+    peers_t          *peers;
+    shard_t          *shard;
+    ngx_uint_t        i, w;
+    struct timespec   start, end;
+
+    size = ngx_align(PEERS * sizeof(shard_t), NGX_CPU_CACHE_LINE);
+
+    p = mmap(NULL, sizeof(peers_t) + NGX_CPU_CACHE_LINE + workers * size,
+             PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    if (p == MAP_FAILED) {
+        exit(1);
+    }
+
+    peers = (peers_t *) p;
+    p = ngx_align_ptr(p + sizeof(peers_t), NGX_CPU_CACHE_LINE);
+
+    peers->shard_size = size;
+    peers->nshards = workers;
+
+    for (i = 0; i < PEERS; i++) {
+        peers->peer[i].weight = weights[i];
+        peers->peer[i].state.effective_weight = weights[i];
+        peers->peer[i].max_conns = max_conns;
+        peers->peer[i].max_fails = 1;
+        peers->peer[i].fail_timeout = 10;
+        peers->peer[i].shard = (shard_t *) p + i;
+
+        for (w = 0; w < workers; w++) {
+            shard = own_shard(peers, &peers->peer[i], w);
+            shard->effective_weight = weights[i];
+        }
+    }
+
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (w = 0; w < workers; w++) {
+        switch (fork()) {
+
+        case -1:
+            exit(1);
+
+        case 0:
+            worker(peers, sharded, w, ops);
+            exit(0);
+        }
+    }
+
+    while (wait(&status) > 0) { /* void */ }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < PEERS; i++) {
+        selected[i] = 0;
+
+        for (w = 0; w < workers; w++) {
+            selected[i] += peers->selected[w][i];
+        }
+    }
+
+    munmap(peers, sizeof(peers_t) + NGX_CPU_CACHE_LINE + workers * size);
+
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double      ns;
+    ngx_uint_t  w, workers, ops, sharded, max_conns;
+    ngx_uint_t  selected[PEERS];
+
+    workers = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 8;
+    ops = (argc > 2) ? (ngx_uint_t) atol(argv[2]) : 10000000;
+
+    if (workers > WORKERS) {
+        workers = WORKERS;
+    }
+
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("up to %lu workers, %lu requests each, %ld cpus, "
+           "peers weighted 3:2:1\n",
+           (unsigned long) workers, (unsigned long) ops, (long) ngx_ncpu);
+
+    for (max_conns = 0; max_conns <= 100; max_conns += 100) {
+        for (w = 1; w <= workers; w *= 2) {
+            for (sharded = 0; sharded < 2; sharded++) {
+                ns = run(sharded, max_conns, w, ops, selected);
+
+                printf("%-7s max_conns %3lu, workers %2lu: "
+                       "%9.0f requests/s, %5.1f ns/request, "
+                       "selected %lu:%lu:%lu\n",
+                       sharded ? "slots" : "locked", (unsigned long) max_conns,
+                       (unsigned long) w, w * ops / ns * 1e9, ns / (w * ops),
+                       (unsigned long) selected[0],
+                       (unsigned long) selected[1],
+                       (unsigned long) selected[2]);
+            }
+        }
+    }
+
+    return 0;
+}
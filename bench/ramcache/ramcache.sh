@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# compares the rate of proxy cache hits served from the cache files,
+# from the cache files with the open file cache, and from the memory
+# copies; run from this directory after make with nginx in $PATH or $NGINX
+#
+#   ramcache.sh [connections] [seconds]
+
+c=${1:-50}
+t=${2:-10}
+nginx=${NGINX:-nginx}
+unset NGINX
+prefix=/dev/shm/ramcache
+
+rm -rf $prefix
+mkdir -p $prefix/logs $prefix/conf $prefix/html $prefix/cache
+cp nginx.conf $prefix/conf/
+
+for s in 1 4 16 64; do
+    head -c $((s * 1024)) /dev/urandom > $prefix/html/${s}kb
+done
+
+$nginx -p $prefix/ -c conf/nginx.conf &
+sleep 1
+
+for f in 1kb 4kb 16kb 64kb; do
+    for port in 8091 8092 8093; do
+
+        # the first request stores the file, the next ones make it hot
+
+        for i in 1 2 3; do
+            curl -s -o /dev/null http://127.0.0.1:$port/$f
+        done
+
+        echo "$f $port: `./httpload $port /$f $c $t`"
+    done
+done
+
+$nginx -p $prefix/ -c conf/nginx.conf -s stop
@@ -0,0 +1,205 @@
+/*
+ * Microbenchmark of the shared memory slab allocator: a worker keeps
+ * a working set of chunks of the sizes of rbtree nodes in limit_req and
+ * limit_conn zones and replaces random chunks with chunks of random sizes.
+ * The zone mutex acquisitions and the time the mutex is held are
+ * measured.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#include "ngx_slab.c"
+
+
+ngx_uint_t     ngx_pagesize;
+ngx_uint_t     ngx_pagesize_shift;
+ngx_uint_t     ngx_process = NGX_PROCESS_WORKER;
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+static ngx_log_t    log;
+static ngx_cycle_t  cycle;
+
+static ngx_uint_t   locks;
+
+/* the time the mutex is held, measured in a separate pass */
+static ngx_uint_t   timed;
+static double       held;
+static struct timespec  locked;
+
+
+ngx_int_t
+ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_shmtx_lock(ngx_shmtx_t *mtx)
+{
+    locks++;
+
+    if (timed) {
+        clock_gettime(CLOCK_MONOTONIC, &locked);
+    }
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+    struct timespec  end;
+
+    if (timed) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        held += (end.tv_sec - locked.tv_sec) * 1e9
+                + (end.tv_nsec - locked.tv_nsec);
+    }
+}
+
+
+void *
+ngx_calloc(size_t size, ngx_log_t *log)
+{
+    return calloc(1, size);
+}
+
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void
+ngx_debug_point(void)
+{
+    abort();
+}
+
+
+#define ZONE_SIZE  (1024 * 1024)
+#define CHUNKS     1024
+
+
+static size_t  chunk_sizes[] = { 64, 72, 96, 128 };
+
+
+static double
+elapsed(struct timespec *start)
+{
+    struct timespec  end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+
+static void
+replace(ngx_slab_pool_t *sp, void **chunks, ngx_uint_t ops, ngx_uint_t *rnd)
+{
+    ngx_uint_t  i, n;
+
+    for (i = 0; i < ops; i++) {
+        *rnd = *rnd * 1103515245 + 12345;
+        n = (*rnd >> 16) % CHUNKS;
+
+        ngx_slab_free(sp, chunks[n]);
+
+        chunks[n] = ngx_slab_alloc(sp, chunk_sizes[(*rnd >> 8) % 4]);
+        if (chunks[n] == NULL) {
+            exit(1);
+        }
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    void             *chunks[CHUNKS];
+    double            ns, overhead;
+    ngx_uint_t        i, n, ops, rnd, nlocks;
+    ngx_slab_pool_t  *sp;
+    struct timespec   start;
+
+    ops = (argc > 1) ? (ngx_uint_t) atol(argv[1]) : 10000000;
+
+    cycle.log = &log;
+    ngx_cycle = &cycle;
+
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    sp = malloc(ZONE_SIZE);
+    if (sp == NULL) {
+        return 1;
+    }
+
+    ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+    sp->end = (u_char *) sp + ZONE_SIZE;
+    sp->min_shift = 3;
+    sp->addr = sp;
+    sp->log_ctx = (u_char *) "";
+
+    ngx_slab_init(sp);
+
+    rnd = 1;
+
+    for (i = 0; i < CHUNKS; i++) {
+        chunks[i] = ngx_slab_alloc(sp, chunk_sizes[i % 4]);
+        if (chunks[i] == NULL) {
+            return 1;
+        }
+    }
+
+    locks = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    replace(sp, chunks, ops, &rnd);
+
+    ns = elapsed(&start);
+
+    nlocks = locks;
+
+    /* the cost of the clock itself, as in an empty critical section */
+
+    timed = 1;
+
+    for (i = 0; i < 1000000; i++) {
+        ngx_shmtx_lock(&sp->mutex);
+        ngx_shmtx_unlock(&sp->mutex);
+    }
+
+    overhead = held / 1000000;
+
+    held = 0;
+    locks = 0;
+
+    replace(sp, chunks, ops, &rnd);
+
+    held -= overhead * locks;
+
+#if (NGX_SLAB_MAGAZINES)
+    printf("slab magazines: on\n");
+#else
+    printf("slab magazines: off\n");
+#endif
+
+    printf("%6.1f ns/op, %5.3f locks/op, held %6.1f ns/lock, %5.1f ns/op\n",
+           ns / (2 * ops), (double) nlocks / (2 * ops),
+           locks ? held / locks : 0, held / (2 * ops));
+
+    return 0;
+}
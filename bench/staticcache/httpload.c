@@ -0,0 +1,224 @@
+/*
+ * A minimal keep-alive HTTP/1.1 load generator: a number of connections
+ * repeatedly request the same URI, one request at a time each, for
+ * a given time, and the rate of complete responses is printed.  An extra
+ * request header may be given; chunked responses are expected to end
+ * with a read.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+
+#define BUFSIZE  (256 * 1024)
+
+
+typedef struct {
+    int      fd;
+    size_t   have;
+    long     need;      /* the response length, -1 if unknown yet,
+                           or -2 if chunked */
+    char     buf[BUFSIZE];
+} conn_t;
+
+
+static char     request[1024];
+static size_t   request_len;
+
+
+static int
+connect_to(struct sockaddr_in *sin)
+{
+    int  fd, one;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+
+    if (connect(fd, (struct sockaddr *) sin, sizeof(*sin)) == -1) {
+        perror("connect");
+        exit(1);
+    }
+
+    one = 1;
+    (void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    (void) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+
+static void
+send_request(conn_t *c)
+{
+    if (write(c->fd, request, request_len) != (ssize_t) request_len) {
+        perror("write");
+        exit(1);
+    }
+
+    c->have = 0;
+    c->need = -1;
+}
+
+
+/* returns 1 when a complete response was read */
+
+static int
+read_response(conn_t *c)
+{
+    char     *p, *end, *last;
+    size_t    off;
+    ssize_t   n;
+
+    for ( ;; ) {
+        off = (c->need == -1) ? c->have : 0;
+
+        n = read(c->fd, c->buf + off,
+                 c->need == -1 ? BUFSIZE - c->have - 1 : BUFSIZE);
+
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+
+            perror("read");
+            exit(1);
+        }
+
+        if (n == 0) {
+            fprintf(stderr, "connection closed\n");
+            exit(1);
+        }
+
+        c->have += n;
+        last = c->buf + off + n;
+
+        if (c->need == -1) {
+            c->buf[c->have] = '\0';
+
+            end = strstr(c->buf, "\r\n\r\n");
+            if (end == NULL) {
+                continue;
+            }
+
+            p = strstr(c->buf, "Transfer-Encoding: chunked");
+
+            if (p && p < end) {
+                c->need = -2;
+
+            } else {
+                p = strstr(c->buf, "Content-Length: ");
+                if (p == NULL || p > end) {
+                    fprintf(stderr, "no Content-Length in response\n");
+                    exit(1);
+                }
+
+                c->need = (end + 4 - c->buf) + atol(p + 16);
+            }
+        }
+
+        if (c->need == -2) {
+            if (last - c->buf >= 5 && memcmp(last - 5, "0\r\n\r\n", 5) == 0) {
+                return 1;
+            }
+
+            continue;
+        }
+
+        if ((long) c->have >= c->need) {
+            return 1;
+        }
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int                  ep, i, n, nconns, seconds;
+    long                 done;
+    double               t;
+    conn_t              *conns;
+    struct timespec      start, now;
+    struct sockaddr_in   sin;
+    struct epoll_event   ev, events[256];
+
+    if (argc < 3) {
+        fprintf(stderr,
+                "usage: httpload port uri [connections] [seconds] "
+                "[header]\n");
+        return 1;
+    }
+
+    nconns = (argc > 3) ? atoi(argv[3]) : 50;
+    seconds = (argc > 4) ? atoi(argv[4]) : 10;
+
+    request_len = snprintf(request, sizeof(request),
+                           "GET %s HTTP/1.1\r\nHost: localhost\r\n%s%s\r\n",
+                           argv[2], (argc > 5) ? argv[5] : "",
+                           (argc > 5) ? "\r\n" : "");
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(atoi(argv[1]));
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    conns = calloc(nconns, sizeof(conn_t));
+    if (conns == NULL) {
+        return 1;
+    }
+
+    ep = epoll_create1(0);
+
+    for (i = 0; i < nconns; i++) {
+        conns[i].fd = connect_to(&sin);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conns[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].fd, &ev);
+
+        send_request(&conns[i]);
+    }
+
+    done = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for ( ;; ) {
+        n = epoll_wait(ep, events, 256, 1000);
+
+        for (i = 0; i < n; i++) {
+            conn_t  *c = events[i].data.ptr;
+
+            if (read_response(c)) {
+                done++;
+                send_request(c);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        t = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (t >= seconds) {
+            break;
+        }
+    }
+
+    printf("%s: %ld responses in %.1f s, %.0f requests/s\n",
+           argv[2], done, t, done / t);
+
+    return 0;
+}
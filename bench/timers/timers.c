@@ -0,0 +1,127 @@
+/*
+ * Microbenchmark of the event timers: the rbtree or, if nginx is built
+ * with --with-timer-wheel (or NGX_TIMER_WHEEL is predefined to 1), the
+ * timing wheel.  Every simulated millisecond a part of the connections
+ * re-arm their timers as keep-alive connections do on reads and writes,
+ * and the due timers are expired.
+ */
+
+#include "ngx_rbtree.c"
+#include "ngx_event_timer.c"
+
+#include <stdio.h>
+#include <time.h>
+
+
+volatile ngx_msec_t  ngx_current_msec;
+
+static ngx_uint_t    expired;
+
+
+static void
+handler(ngx_event_t *ev)
+{
+    expired++;
+}
+
+
+static double
+elapsed(struct timespec *start)
+{
+    struct timespec  end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+
+static void
+run(ngx_uint_t n)
+{
+    double            add, expire;
+    unsigned int      seed;
+    ngx_uint_t        i, tick, ticks, rearm, ops;
+    ngx_event_t      *ev, *events;
+    struct timespec   start;
+
+    events = calloc(n, sizeof(ngx_event_t));
+    if (events == NULL) {
+        exit(1);
+    }
+
+    seed = 1;
+    ngx_current_msec = 1000000;
+    ngx_event_timer_init(NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n; i++) {
+        ev = &events[i];
+        ev->handler = handler;
+        ngx_add_timer(ev, 1 + rand_r(&seed) % 60000);
+    }
+
+    add = elapsed(&start);
+    ops = n;
+
+    /* about 1% of the connections are active every millisecond */
+
+    ticks = 5000;
+    rearm = n / 100 + 1;
+    expired = 0;
+    expire = 0;
+
+    for (tick = 0; tick < ticks; tick++) {
+        ngx_current_msec++;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < rearm; i++) {
+            ev = &events[rand_r(&seed) % n];
+            ngx_add_timer(ev, 1000 + rand_r(&seed) % 60000);
+        }
+
+        add += elapsed(&start);
+        ops += rearm;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        (void) ngx_event_find_timer();
+        ngx_event_expire_timers();
+
+        expire += elapsed(&start);
+    }
+
+    printf("%8lu timers: %6.1f ns/add, %8.1f ns/expire run, %lu expired\n",
+           (unsigned long) n, add / ops, expire / ticks,
+           (unsigned long) expired);
+
+    free(events);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int  i;
+
+#if (NGX_TIMER_WHEEL)
+    printf("timers: wheel\n");
+#else
+    printf("timers: rbtree\n");
+#endif
+
+    if (argc == 1) {
+        run(10000);
+        run(100000);
+        run(1000000);
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        run((ngx_uint_t) atol(argv[i]));
+    }
+
+    return 0;
+}
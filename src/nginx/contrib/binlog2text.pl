@@ -0,0 +1,186 @@
+#!/usr/bin/perl -w
+
+# (C) Nginx, Inc.
+#
+# Converts binary access logs, as written by the "access_log" directive
+# with the "binary" parameter, to text, as the log format would render
+# it.  The formats are defined in the log itself.
+#
+#   binlog2text.pl < access.bin > access.log
+
+use warnings;
+use strict;
+
+my @months = qw(Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec);
+
+my $TEXT = 0;
+my $PIPE = 1;
+my $TIME_LOCAL = 2;
+my $TIME_ISO8601 = 3;
+my $MSEC = 4;
+my $REQUEST_TIME = 5;
+my $STATUS = 6;
+my $BYTES_SENT = 7;
+my $BODY_BYTES_SENT = 8;
+my $REQUEST_LENGTH = 9;
+my $VARIABLE = 10;
+
+my $MAGIC = 0x4c58474e;
+
+binmode STDIN;
+binmode STDOUT;
+
+my $data = do { local $/; <STDIN> };
+my $len = length $data;
+
+exit 0 if $len == 0;
+
+# the byte order of the worker, from the magic of the first definition
+
+my $e;
+
+if (unpack("L<", substr($data, 5, 4)) == $MAGIC) {
+    $e = '<';
+
+} elsif (unpack("L>", substr($data, 5, 4)) == $MAGIC) {
+    $e = '>';
+
+} else {
+    die "not a binary access log\n";
+}
+
+# formats, by pid and format id: [ json, [ type, text or name ], ... ]
+
+my %formats;
+
+my $pos = 0;
+
+while ($pos + 5 <= $len) {
+    my ($size, $type) = unpack("L${e} C", substr($data, $pos, 5));
+
+    die "truncated record at $pos\n" if $size < 5 || $pos + $size > $len;
+
+    my $rec = substr($data, $pos + 5, $size - 5);
+    $pos += $size;
+
+    if ($type == 0) {
+        define($rec);
+
+    } elsif ($type == 1) {
+        print render($rec), "\n";
+
+    } else {
+        die "unknown record type $type\n";
+    }
+}
+
+die "truncated record at $pos\n" if $pos != $len;
+
+
+sub define {
+    my ($rec) = @_;
+
+    my ($magic, $id, $pid, $json) = unpack("L${e} S${e} L${e} C", $rec);
+    my $p = 11;
+    my @ops;
+
+    while ($p < length $rec) {
+        my $type = unpack("C", substr($rec, $p++, 1));
+
+        if ($type == $TEXT || $type == $VARIABLE) {
+            my $n = unpack("S${e}", substr($rec, $p, 2));
+            push @ops, [ $type, substr($rec, $p + 2, $n) ];
+            $p += 2 + $n;
+
+        } else {
+            push @ops, [ $type ];
+        }
+    }
+
+    $formats{"$pid:$id"} = [ $json, @ops ];
+}
+
+
+sub render {
+    my ($rec) = @_;
+
+    my ($id, $pid, $sec, $msec, $gmtoff) =
+        unpack("S${e} L${e} Q${e} S${e} s${e}", $rec);
+
+    my $f = $formats{"$pid:$id"}
+        or die "no format $id defined by process $pid\n";
+
+    my ($json, @ops) = @$f;
+    my $p = 18;
+    my $line = '';
+
+    for my $op (@ops) {
+        my $type = $op->[0];
+
+        if ($type == $TEXT) {
+            $line .= $op->[1];
+
+        } elsif ($type == $PIPE) {
+            $line .= substr($rec, $p++, 1);
+
+        } elsif ($type == $TIME_LOCAL) {
+            my @tm = gmtime($sec + $gmtoff * 60);
+            $line .= sprintf("%02d/%s/%d:%02d:%02d:%02d %s%02d%02d",
+                             $tm[3], $months[$tm[4]], $tm[5] + 1900,
+                             $tm[2], $tm[1], $tm[0], $gmtoff < 0 ? '-' : '+',
+                             abs($gmtoff) / 60, abs($gmtoff) % 60);
+
+        } elsif ($type == $TIME_ISO8601) {
+            my @tm = gmtime($sec + $gmtoff * 60);
+            $line .= sprintf("%4d-%02d-%02dT%02d:%02d:%02d%s%02d:%02d",
+                             $tm[5] + 1900, $tm[4] + 1, $tm[3],
+                             $tm[2], $tm[1], $tm[0], $gmtoff < 0 ? '-' : '+',
+                             abs($gmtoff) / 60, abs($gmtoff) % 60);
+
+        } elsif ($type == $MSEC) {
+            $line .= sprintf("%d.%03d", $sec, $msec);
+
+        } elsif ($type == $REQUEST_TIME) {
+            my $ms = unpack("L${e}", substr($rec, $p, 4));
+            $line .= sprintf("%d.%03d", $ms / 1000, $ms % 1000);
+            $p += 4;
+
+        } elsif ($type == $STATUS) {
+            $line .= sprintf("%03d", unpack("S${e}", substr($rec, $p, 2)));
+            $p += 2;
+
+        } elsif ($type == $BYTES_SENT || $type == $BODY_BYTES_SENT
+                 || $type == $REQUEST_LENGTH)
+        {
+            $line .= unpack("Q${e}", substr($rec, $p, 8));
+            $p += 8;
+
+        } elsif ($type == $VARIABLE) {
+            my $n = unpack("S${e}", substr($rec, $p, 2));
+            $p += 2;
+
+            if ($n == 0xffff) {
+                $line .= $json ? '' : '-';
+                next;
+            }
+
+            my $v = substr($rec, $p, $n);
+            $p += $n;
+
+            if ($json) {
+                $v =~ s/(["\\])/\\$1/g;
+                $v =~ s/([\x00-\x1f])/sprintf("\\u%04X", ord($1))/ge;
+
+            } else {
+                $v =~ s/([\x00-\x1f"\\\x7f-\xff])/sprintf("\\x%02X", ord($1))/ge;
+            }
+
+            $line .= $v;
+
+        } else {
+            die "unknown field type $type\n";
+        }
+    }
+
+    return $line;
+}
@@ -21,6 +21,89 @@
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+#if (NGX_HAVE_INOTIFY)
+
+/*
+ * the shared open file cache keeps stat() info of directories and files,
+ * and errors, in a shared memory zone; the directories the entries are in
+ * are watched with inotify, and one worker process reads inotify events
+ * and invalidates the entries
+ *
+ * the zone stamp is incremented on every change seen; an entry is valid
+ * for a stamp taken before the entry was tested if the entry has not been
+ * invalidated, and none of the directories in its path has been changed,
+ * since the stamp
+ */
+
+#define NGX_OPEN_FILE_WATCH_MASK                                             \
+    (IN_ATTRIB|IN_MODIFY|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO        \
+     |IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR|IN_EXCL_UNLINK)
+
+#define NGX_OPEN_FILE_EVICT  8
+
+
+typedef struct ngx_open_file_watch_s  ngx_open_file_watch_t;
+
+struct ngx_open_file_watch_s {
+    ngx_str_node_t                   sn;
+    ngx_rbtree_node_t                wd_node;
+    ngx_open_file_watch_t           *parent;
+
+    /* a stamp of the last change of the directory itself or its path */
+    ngx_uint_t                       changed;
+
+    /* a stamp of the last change of any entry in the directory */
+    ngx_uint_t                       modified;
+
+    ngx_uint_t                       count;
+    int                              wd;
+    u_char                           name[1];
+};
+
+
+typedef struct {
+    ngx_str_node_t                   sn;
+    ngx_queue_t                      queue;
+    ngx_open_file_watch_t           *watch;
+    ngx_uint_t                       stamp;
+
+    ngx_file_uniq_t                  uniq;
+    time_t                           mtime;
+    off_t                            size;
+    off_t                            fs_size;
+    ngx_err_t                        err;
+
+    unsigned                         is_dir:1;
+    unsigned                         is_file:1;
+    unsigned                         is_link:1;
+    unsigned                         is_exec:1;
+
+    u_char                           name[1];
+} ngx_open_file_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    ngx_rbtree_t                     watches;
+    ngx_rbtree_node_t                watches_sentinel;
+    ngx_rbtree_t                     wds;
+    ngx_rbtree_node_t                wds_sentinel;
+    ngx_uint_t                       stamp;
+    ngx_uint_t                       flushed;
+} ngx_open_file_shctx_t;
+
+
+struct ngx_open_file_shared_s {
+    ngx_open_file_shctx_t           *sh;
+    ngx_slab_pool_t                 *shpool;
+    int                              fd;
+};
+
+#endif
+
+
 static void ngx_open_file_cache_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
@@ -51,6 +134,45 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+#if (NGX_HAVE_INOTIFY)
+static ngx_uint_t ngx_open_file_shareable(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, ngx_open_file_info_t *of);
+static ngx_uint_t ngx_open_file_watch(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_info(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    ngx_uint_t *stamp);
+static ngx_uint_t ngx_open_file_unchanged(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_uint_t stamp);
+static ngx_uint_t ngx_open_file_shared_update(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    ngx_uint_t stamp);
+static size_t ngx_open_file_dirname(u_char *name, size_t len);
+static ngx_uint_t ngx_open_file_watched(ngx_open_file_shctx_t *sh,
+    ngx_open_file_watch_t *watch, ngx_uint_t stamp);
+static ngx_open_file_watch_t *ngx_open_file_get_watch(
+    ngx_open_file_shared_t *shared, u_char *name, size_t len, ngx_log_t *log);
+static ngx_open_file_watch_t *ngx_open_file_lookup_watch(
+    ngx_open_file_shctx_t *sh, u_char *name, size_t len);
+static void ngx_open_file_free_watch(ngx_open_file_shared_t *shared,
+    ngx_open_file_watch_t *watch);
+static void ngx_open_file_release_watch(ngx_open_file_shared_t *shared,
+    ngx_open_file_watch_t *watch);
+static void ngx_open_file_detach_watch(ngx_open_file_shctx_t *sh,
+    ngx_open_file_watch_t *watch);
+static void ngx_open_file_delete_node(ngx_open_file_shared_t *shared,
+    ngx_open_file_node_t *node);
+static void *ngx_open_file_shared_alloc(ngx_open_file_shared_t *shared,
+    size_t size);
+static void ngx_open_file_watch_handler(ngx_event_t *ev);
+static void ngx_open_file_watch_event(ngx_open_file_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log);
+static void ngx_open_file_invalidate(ngx_open_file_shared_t *shared,
+    u_char *name, size_t len);
+static ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_open_file_shared_cleanup(void *data);
+#endif
 
 
 ngx_open_file_cache_t *
@@ -64,6 +186,10 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
         return NULL;
     }
 
+#if (NGX_HAVE_INOTIFY)
+    cache->shared = NULL;
+#endif
+
     ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
                     ngx_open_file_cache_rbtree_insert_value);
 
@@ -148,6 +274,9 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t                        hash;
     ngx_int_t                       rc;
     ngx_file_info_t                 fi;
+#if (NGX_HAVE_INOTIFY)
+    ngx_uint_t                      stamp;
+#endif
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
     ngx_pool_cleanup_file_t        *clnf;
@@ -206,6 +335,10 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     hash = ngx_crc32_long(name->data, name->len);
 
+#if (NGX_HAVE_INOTIFY)
+    stamp = 0;
+#endif
+
     file = ngx_open_file_lookup(cache, name, hash);
 
     if (file) {
@@ -218,6 +351,10 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
+#if (NGX_HAVE_INOTIFY)
+            stamp = ngx_open_file_watch(cache, name, of, pool->log);
+#endif
+
             rc = ngx_open_and_stat_file(name, of, pool->log);
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
@@ -227,6 +364,23 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             goto add_event;
         }
 
+#if (NGX_HAVE_INOTIFY)
+
+        /*
+         * the entry is known to be unchanged while the shared node
+         * it was validated against is neither invalidated nor replaced
+         */
+
+        if (file->stamp
+            && file->event == NULL
+            && now - file->created >= of->valid
+            && ngx_open_file_unchanged(cache, name, hash, file->stamp))
+        {
+            file->created = now;
+        }
+
+#endif
+
         if (file->use_event
             || (file->event == NULL
                 && (of->uniq == 0 || of->uniq == file->uniq)
@@ -286,6 +440,10 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
+#if (NGX_HAVE_INOTIFY)
+        stamp = ngx_open_file_watch(cache, name, of, pool->log);
+#endif
+
         rc = ngx_open_and_stat_file(name, of, pool->log);
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
@@ -351,7 +509,18 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
+#if (NGX_HAVE_INOTIFY)
+
+    rc = ngx_open_file_shared_info(cache, name, hash, of, &stamp);
+
+    if (rc == NGX_DECLINED) {
+        stamp = ngx_open_file_watch(cache, name, of, pool->log);
+        rc = ngx_open_and_stat_file(name, of, pool->log);
+    }
+
+#else
     rc = ngx_open_and_stat_file(name, of, pool->log);
+#endif
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -421,6 +590,12 @@ update:
         }
     }
 
+#if (NGX_HAVE_INOTIFY)
+    file->stamp = stamp ? ngx_open_file_shared_update(cache, name, hash, of,
+                                                      stamp)
+                        : 0;
+#endif
+
     file->created = now;
 
 found:
@@ -1251,3 +1426,963 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+#if (NGX_HAVE_INOTIFY)
+
+char *
+ngx_open_file_cache_set_shared(ngx_conf_t *cf, ngx_open_file_cache_t *cache,
+    ngx_str_t *zone, void *tag)
+{
+    u_char                  *p;
+    ssize_t                  size;
+    ngx_str_t                name, s;
+    ngx_shm_zone_t          *shm_zone;
+    ngx_pool_cleanup_t      *cln;
+    ngx_open_file_shared_t  *shared;
+
+    name = *zone;
+    size = 0;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p) {
+        name.len = p - name.data;
+
+        s.data = p + 1;
+        s.len = zone->data + zone->len - s.data;
+
+        size = ngx_parse_size(&s);
+
+        if (size == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid shared zone size \"%V\"", zone);
+            return NGX_CONF_ERROR;
+        }
+
+        if (size < (ssize_t) (8 * ngx_pagesize)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "shared zone \"%V\" is too small", zone);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid shared zone \"%V\"", zone);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, tag);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shared = shm_zone->data;
+
+    if (shared == NULL) {
+        shared = ngx_pcalloc(cf->pool, sizeof(ngx_open_file_shared_t));
+        if (shared == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        shared->fd = -1;
+
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln->handler = ngx_open_file_shared_cleanup;
+        cln->data = shared;
+
+        shm_zone->init = ngx_open_file_cache_init_zone;
+        shm_zone->data = shared;
+
+    } else if (shm_zone->init != ngx_open_file_cache_init_zone) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "shared zone \"%V\" is already used "
+                           "for another purpose", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->shared = shared;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_shared_t  *oshared = data;
+
+    size_t                   len;
+    ngx_open_file_shared_t  *shared;
+
+    shared = shm_zone->data;
+
+    if (oshared) {
+        shared->sh = oshared->sh;
+        shared->shpool = oshared->shpool;
+
+        shared->fd = dup(oshared->fd);
+
+        if (shared->fd == -1) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, ngx_errno,
+                          "dup() failed");
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    shared->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "shared open file cache \"%V\" cannot be inherited",
+                      &shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    shared->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (shared->fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, ngx_errno,
+                      "inotify_init1() failed");
+        return NGX_ERROR;
+    }
+
+    shared->sh = ngx_slab_alloc(shared->shpool,
+                                sizeof(ngx_open_file_shctx_t));
+    if (shared->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->shpool->data = shared->sh;
+
+    ngx_rbtree_init(&shared->sh->rbtree, &shared->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&shared->sh->queue);
+
+    ngx_rbtree_init(&shared->sh->watches, &shared->sh->watches_sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_rbtree_init(&shared->sh->wds, &shared->sh->wds_sentinel,
+                    ngx_rbtree_insert_value);
+
+    shared->sh->stamp = 1;
+    shared->sh->flushed = 0;
+
+    len = sizeof(" in open file cache \"\"") + shm_zone->shm.name.len;
+
+    shared->shpool->log_ctx = ngx_slab_alloc(shared->shpool, len);
+    if (shared->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shared->shpool->log_ctx, " in open file cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shared->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_open_file_shared_cleanup(void *data)
+{
+    ngx_open_file_shared_t  *shared = data;
+
+    if (shared->fd != -1 && close(shared->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "inotify close() failed");
+    }
+}
+
+
+ngx_int_t
+ngx_open_file_cache_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t               i;
+    ngx_event_t             *rev;
+    ngx_list_part_t         *part;
+    ngx_shm_zone_t          *shm_zone;
+    ngx_connection_t        *c;
+    ngx_open_file_shared_t  *shared;
+
+    if ((ngx_process != NGX_PROCESS_WORKER
+         && ngx_process != NGX_PROCESS_SINGLE)
+        || ngx_worker != 0)
+    {
+        return NGX_OK;
+    }
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_open_file_cache_init_zone) {
+            continue;
+        }
+
+        shared = shm_zone[i].data;
+
+        c = ngx_get_connection(shared->fd, cycle->log);
+        if (c == NULL) {
+            return NGX_ERROR;
+        }
+
+        c->data = shared;
+        c->pool = cycle->pool;
+
+        /* let graceful shutdown close the connection */
+        c->idle = 1;
+
+        rev = c->read;
+        rev->log = cycle->log;
+        c->write->log = cycle->log;
+
+        rev->handler = ngx_open_file_watch_handler;
+
+        if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_open_file_shareable(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_open_file_info_t *of)
+{
+    u_char  *p, *last, *start;
+
+    if (cache->shared == NULL || of->log) {
+        return 0;
+    }
+
+#if (NGX_HAVE_OPENAT)
+    if (of->disable_symlinks != NGX_DISABLE_SYMLINKS_OFF) {
+        return 0;
+    }
+#endif
+
+    if (name->len < 2 || name->len >= NGX_MAX_PATH || name->data[0] != '/') {
+        return 0;
+    }
+
+    /* only normalized absolute paths are watched by their directories */
+
+    last = name->data + name->len;
+
+    for (p = name->data + 1; p <= last; p++) {
+        start = p;
+
+        while (p < last && *p != '/') {
+            p++;
+        }
+
+        if (p == start
+            || (p - start == 1 && start[0] == '.')
+            || (p - start == 2 && start[0] == '.' && start[1] == '.'))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static size_t
+ngx_open_file_dirname(u_char *name, size_t len)
+{
+    u_char  *p;
+
+    for (p = name + len - 1; p > name; p--) {
+        if (*p == '/') {
+            return p - name;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_uint_t
+ngx_open_file_watch(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    ngx_uint_t               stamp;
+    ngx_open_file_shared_t  *shared;
+
+    if (!ngx_open_file_shareable(cache, name, of)) {
+        return 0;
+    }
+
+    shared = cache->shared;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    if (ngx_open_file_get_watch(shared, name->data,
+                                ngx_open_file_dirname(name->data, name->len),
+                                log)
+        != NULL)
+    {
+        stamp = shared->sh->stamp;
+
+    } else {
+        stamp = 0;
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return stamp;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_info(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_uint_t *stamp)
+{
+    ngx_int_t                rc;
+    ngx_open_file_node_t    *node;
+    ngx_open_file_shared_t  *shared;
+
+    if (!ngx_open_file_shareable(cache, name, of)) {
+        return NGX_DECLINED;
+    }
+
+    shared = cache->shared;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    node = (ngx_open_file_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, name, hash);
+
+    /* regular files have to be opened anyway */
+
+    if (node == NULL
+        || (node->err == 0 && !node->is_dir)
+        || (node->err && !of->errors)
+        || !ngx_open_file_watched(shared->sh, node->watch, node->stamp))
+    {
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (node->err) {
+        of->err = node->err;
+        of->failed = ngx_open_file_n;
+
+        rc = NGX_ERROR;
+
+    } else {
+        of->fd = NGX_INVALID_FILE;
+        of->uniq = node->uniq;
+        of->mtime = node->mtime;
+        of->size = node->size;
+        of->fs_size = node->fs_size;
+        of->is_dir = node->is_dir;
+        of->is_file = node->is_file;
+        of->is_link = node->is_link;
+        of->is_exec = node->is_exec;
+
+        rc = NGX_OK;
+    }
+
+    *stamp = node->stamp;
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&shared->sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: %V, e:%d, s:%ui",
+                   name, of->err, *stamp);
+
+    return rc;
+}
+
+
+static ngx_uint_t
+ngx_open_file_unchanged(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_uint_t stamp)
+{
+    ngx_uint_t               unchanged;
+    ngx_open_file_node_t    *node;
+    ngx_open_file_shared_t  *shared;
+
+    shared = cache->shared;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    node = (ngx_open_file_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, name, hash);
+
+    unchanged = (node
+                 && node->stamp == stamp
+                 && ngx_open_file_watched(shared->sh, node->watch, stamp));
+
+    if (unchanged) {
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&shared->sh->queue, &node->queue);
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: %V, unchanged:%ui", name, unchanged);
+
+    return unchanged;
+}
+
+
+static ngx_uint_t
+ngx_open_file_shared_update(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_uint_t stamp)
+{
+    ngx_open_file_node_t    *node;
+    ngx_open_file_watch_t   *watch;
+    ngx_open_file_shctx_t   *sh;
+    ngx_open_file_shared_t  *shared;
+
+    shared = cache->shared;
+    sh = shared->sh;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    watch = ngx_open_file_lookup_watch(sh, name->data,
+                                 ngx_open_file_dirname(name->data, name->len));
+
+    if (watch == NULL || !ngx_open_file_watched(sh, watch, stamp)) {
+        goto declined;
+    }
+
+    node = (ngx_open_file_node_t *)
+               ngx_str_rbtree_lookup(&sh->rbtree, name, hash);
+
+    if (node
+        && node->err == of->err
+        && (of->err
+            || (node->uniq == of->uniq
+                && node->mtime == of->mtime
+                && node->size == of->size
+                && node->is_dir == of->is_dir
+                && node->is_file == of->is_file
+                && node->is_link == of->is_link
+                && node->is_exec == of->is_exec))
+        && ngx_open_file_watched(sh, watch, node->stamp))
+    {
+        /* the same info is already stored and is still valid */
+
+        stamp = node->stamp;
+        goto done;
+    }
+
+    /*
+     * a change seen in the directory after the stamp was taken
+     * might be a change of the entry after it was tested
+     */
+
+    if (watch->modified > stamp) {
+        goto declined;
+    }
+
+    if (node) {
+        if (node->stamp > stamp) {
+            goto declined;
+        }
+
+    } else {
+        watch->count++;
+
+        node = ngx_open_file_shared_alloc(shared,
+                              offsetof(ngx_open_file_node_t, name) + name->len);
+        if (node == NULL) {
+            ngx_open_file_release_watch(shared, watch);
+            goto declined;
+        }
+
+        ngx_memcpy(node->name, name->data, name->len);
+
+        node->sn.node.key = hash;
+        node->sn.str.len = name->len;
+        node->sn.str.data = node->name;
+
+        ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+        ngx_queue_insert_head(&sh->queue, &node->queue);
+
+        node->watch = watch;
+    }
+
+    node->stamp = stamp;
+    node->err = of->err;
+
+    if (of->err == 0) {
+        node->uniq = of->uniq;
+        node->mtime = of->mtime;
+        node->size = of->size;
+        node->fs_size = of->fs_size;
+        node->is_dir = of->is_dir;
+        node->is_file = of->is_file;
+        node->is_link = of->is_link;
+        node->is_exec = of->is_exec;
+    }
+
+done:
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file update: %V, s:%ui", name, stamp);
+
+    return stamp;
+
+declined:
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_open_file_watched(ngx_open_file_shctx_t *sh, ngx_open_file_watch_t *watch,
+    ngx_uint_t stamp)
+{
+    if (sh->flushed > stamp) {
+        return 0;
+    }
+
+    while (watch) {
+        if (watch->wd == -1 || watch->changed > stamp) {
+            return 0;
+        }
+
+        watch = watch->parent;
+    }
+
+    return 1;
+}
+
+
+static ngx_open_file_watch_t *
+ngx_open_file_get_watch(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len, ngx_log_t *log)
+{
+    int                     wd;
+    ngx_rbtree_node_t      *node, *sentinel;
+    ngx_open_file_watch_t  *watch, *parent;
+
+    watch = ngx_open_file_lookup_watch(shared->sh, name, len);
+
+    if (watch && watch->wd != -1) {
+        return watch;
+    }
+
+    if (watch == NULL) {
+
+        parent = NULL;
+
+        if (len > 1) {
+            parent = ngx_open_file_get_watch(shared, name,
+                                            ngx_open_file_dirname(name, len),
+                                            log);
+            if (parent == NULL) {
+                return NULL;
+            }
+
+            parent->count++;
+        }
+
+        watch = ngx_open_file_shared_alloc(shared,
+                                  offsetof(ngx_open_file_watch_t, name) + len);
+        if (watch == NULL) {
+            if (parent) {
+                ngx_open_file_release_watch(shared, parent);
+            }
+
+            return NULL;
+        }
+
+        ngx_memcpy(watch->name, name, len);
+        watch->name[len] = '\0';
+
+        watch->sn.node.key = ngx_crc32_long(name, len);
+        watch->sn.str.len = len;
+        watch->sn.str.data = watch->name;
+
+        ngx_rbtree_insert(&shared->sh->watches, &watch->sn.node);
+
+        watch->parent = parent;
+        watch->changed = 0;
+        watch->modified = 0;
+        watch->count = 0;
+        watch->wd = -1;
+
+    } else if (watch->parent && watch->parent->wd == -1) {
+
+        /* the parent directory was removed or renamed, try it again */
+
+        if (ngx_open_file_get_watch(shared, watch->parent->name,
+                                    watch->parent->sn.str.len, log)
+            == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    wd = inotify_add_watch(shared->fd, (char *) watch->name,
+                           NGX_OPEN_FILE_WATCH_MASK);
+
+    if (wd == -1) {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, ngx_errno,
+                       "inotify_add_watch(\"%s\") failed, c:%ui",
+                       watch->name, watch->count);
+
+        ngx_open_file_free_watch(shared, watch);
+        return NULL;
+    }
+
+    /* the directory might be already watched under another name */
+
+    node = shared->sh->wds.root;
+    sentinel = shared->sh->wds.sentinel;
+
+    while (node != sentinel) {
+
+        if ((ngx_rbtree_key_t) wd != node->key) {
+            node = ((ngx_rbtree_key_t) wd < node->key) ? node->left
+                                                        : node->right;
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                       "inotify watch \"%s\" duplicates wd:%d",
+                       watch->name, wd);
+
+        ngx_open_file_free_watch(shared, watch);
+        return NULL;
+    }
+
+    watch->wd = wd;
+    watch->wd_node.key = wd;
+    ngx_rbtree_insert(&shared->sh->wds, &watch->wd_node);
+
+    watch->changed = ++shared->sh->stamp;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify watch \"%s\" wd:%d, s:%ui",
+                   watch->name, wd, watch->changed);
+
+    return watch;
+}
+
+
+static ngx_open_file_watch_t *
+ngx_open_file_lookup_watch(ngx_open_file_shctx_t *sh, u_char *name,
+    size_t len)
+{
+    ngx_str_t  str;
+
+    str.len = len;
+    str.data = name;
+
+    return (ngx_open_file_watch_t *)
+               ngx_str_rbtree_lookup(&sh->watches, &str,
+                                     ngx_crc32_long(name, len));
+}
+
+
+static void
+ngx_open_file_free_watch(ngx_open_file_shared_t *shared,
+    ngx_open_file_watch_t *watch)
+{
+    ngx_open_file_watch_t  *parent;
+
+    if (watch->count) {
+        return;
+    }
+
+    if (watch->wd != -1) {
+        (void) inotify_rm_watch(shared->fd, watch->wd);
+        ngx_open_file_detach_watch(shared->sh, watch);
+    }
+
+    ngx_rbtree_delete(&shared->sh->watches, &watch->sn.node);
+
+    parent = watch->parent;
+
+    ngx_slab_free_locked(shared->shpool, watch);
+
+    if (parent) {
+        ngx_open_file_release_watch(shared, parent);
+    }
+}
+
+
+static void
+ngx_open_file_release_watch(ngx_open_file_shared_t *shared,
+    ngx_open_file_watch_t *watch)
+{
+    if (--watch->count == 0) {
+        ngx_open_file_free_watch(shared, watch);
+    }
+}
+
+
+static void
+ngx_open_file_detach_watch(ngx_open_file_shctx_t *sh,
+    ngx_open_file_watch_t *watch)
+{
+    ngx_rbtree_delete(&sh->wds, &watch->wd_node);
+    watch->wd = -1;
+}
+
+
+static void
+ngx_open_file_delete_node(ngx_open_file_shared_t *shared,
+    ngx_open_file_node_t *node)
+{
+    ngx_open_file_watch_t  *watch;
+
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&shared->sh->rbtree, &node->sn.node);
+
+    watch = node->watch;
+
+    ngx_slab_free_locked(shared->shpool, node);
+
+    ngx_open_file_release_watch(shared, watch);
+}
+
+
+static void *
+ngx_open_file_shared_alloc(ngx_open_file_shared_t *shared, size_t size)
+{
+    void                  *p;
+    ngx_uint_t             n;
+    ngx_queue_t           *q;
+    ngx_open_file_node_t  *node;
+
+    for (n = 0; /* void */ ; n++) {
+
+        p = ngx_slab_alloc_locked(shared->shpool, size);
+
+        if (p || n == NGX_OPEN_FILE_EVICT) {
+            return p;
+        }
+
+        if (ngx_queue_empty(&shared->sh->queue)) {
+            return NULL;
+        }
+
+        q = ngx_queue_last(&shared->sh->queue);
+        node = ngx_queue_data(q, ngx_open_file_node_t, queue);
+
+        ngx_open_file_delete_node(shared, node);
+    }
+}
+
+
+static void
+ngx_open_file_watch_handler(ngx_event_t *ev)
+{
+    u_char                  *p;
+    ssize_t                  n;
+    ngx_err_t                err;
+    ngx_connection_t        *c;
+    struct inotify_event    *ie;
+    ngx_open_file_shared_t  *shared;
+    ngx_uint_t               buf[4096 / sizeof(ngx_uint_t)];
+
+    c = ev->data;
+    shared = c->data;
+
+    if (c->close) {
+        ngx_close_connection(c);
+        shared->fd = -1;
+        return;
+    }
+
+    for ( ;; ) {
+
+        n = read(c->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        for (p = (u_char *) buf;
+             p < (u_char *) buf + n;
+             p += sizeof(struct inotify_event) + ie->len)
+        {
+            ie = (struct inotify_event *) p;
+            ngx_open_file_watch_event(shared, ie, ev->log);
+        }
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+    }
+
+    if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        shared->fd = -1;
+    }
+}
+
+
+static void
+ngx_open_file_watch_event(ngx_open_file_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log)
+{
+    size_t                  len;
+    u_char                 *p;
+    ngx_rbtree_node_t      *node, *sentinel;
+    ngx_open_file_shctx_t  *sh;
+    ngx_open_file_watch_t  *watch;
+    u_char                  name[NGX_MAX_PATH];
+
+    sh = shared->sh;
+
+    if (ie->mask & IN_Q_OVERFLOW) {
+        ngx_log_error(NGX_LOG_WARN, log, 0, "inotify queue overflowed");
+
+        sh->flushed = ++sh->stamp;
+        return;
+    }
+
+    node = sh->wds.root;
+    sentinel = sh->wds.sentinel;
+
+    while (node != sentinel) {
+
+        if ((ngx_rbtree_key_t) ie->wd != node->key) {
+            node = ((ngx_rbtree_key_t) ie->wd < node->key) ? node->left
+                                                            : node->right;
+            continue;
+        }
+
+        break;
+    }
+
+    if (node == sentinel) {
+        /* the watch is already removed */
+        return;
+    }
+
+    watch = (ngx_open_file_watch_t *)
+                ((u_char *) node - offsetof(ngx_open_file_watch_t, wd_node));
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify event \"%s\" wd:%d, m:%xD, \"%s\"",
+                   watch->name, ie->wd, ie->mask, ie->len ? ie->name : "");
+
+    /* any change changes the directory modification time as well */
+
+    ngx_open_file_invalidate(shared, watch->name, watch->sn.str.len);
+
+    if (ie->len == 0) {
+
+        /* the directory itself was changed */
+
+        watch->changed = ++sh->stamp;
+
+        if (ie->mask & IN_MOVE_SELF) {
+            (void) inotify_rm_watch(shared->fd, watch->wd);
+            ngx_open_file_detach_watch(sh, watch);
+
+        } else if (ie->mask & IN_IGNORED) {
+            ngx_open_file_detach_watch(sh, watch);
+        }
+
+        return;
+    }
+
+    watch->modified = ++sh->stamp;
+
+    len = watch->sn.str.len;
+
+    if (len + 1 + ngx_strlen(ie->name) >= NGX_MAX_PATH) {
+        watch->changed = watch->modified;
+        return;
+    }
+
+    p = name;
+
+    if (len > 1) {
+        p = ngx_cpymem(p, watch->name, len);
+    }
+
+    *p++ = '/';
+    p = ngx_cpymem(p, ie->name, ngx_strlen(ie->name));
+
+    ngx_open_file_invalidate(shared, name, p - name);
+
+    /* the entry might be a watched directory */
+
+    watch = ngx_open_file_lookup_watch(sh, name, p - name);
+
+    if (watch) {
+        watch->changed = sh->stamp;
+    }
+}
+
+
+static void
+ngx_open_file_invalidate(ngx_open_file_shared_t *shared, u_char *name,
+    size_t len)
+{
+    ngx_str_t              str;
+    ngx_open_file_node_t  *node;
+
+    str.len = len;
+    str.data = name;
+
+    node = (ngx_open_file_node_t *)
+               ngx_str_rbtree_lookup(&shared->sh->rbtree, &str,
+                                     ngx_crc32_long(name, len));
+
+    if (node) {
+        ngx_open_file_delete_node(shared, node);
+    }
+}
+
+#endif
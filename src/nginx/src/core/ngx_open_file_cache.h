@@ -53,6 +53,10 @@ typedef struct {
 
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
 
+#if (NGX_HAVE_INOTIFY)
+typedef struct ngx_open_file_shared_s  ngx_open_file_shared_t;
+#endif
+
 struct ngx_cached_open_file_s {
     ngx_rbtree_node_t        node;
     ngx_queue_t              queue;
@@ -69,6 +73,10 @@ struct ngx_cached_open_file_s {
 
     uint32_t                 uses;
 
+#if (NGX_HAVE_INOTIFY)
+    ngx_uint_t               stamp;
+#endif
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -96,6 +104,10 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+#if (NGX_HAVE_INOTIFY)
+    ngx_open_file_shared_t  *shared;
+#endif
 } ngx_open_file_cache_t;
 
 
@@ -125,5 +137,11 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
 
+#if (NGX_HAVE_INOTIFY)
+char *ngx_open_file_cache_set_shared(ngx_conf_t *cf,
+    ngx_open_file_cache_t *cache, ngx_str_t *zone, void *tag);
+ngx_int_t ngx_open_file_cache_init_process(ngx_cycle_t *cycle);
+#endif
+
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
@@ -13,6 +13,37 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_alloc_block(size_t size, ngx_log_t *log);
+static void ngx_pool_free_block(ngx_pool_t *p);
+
+
+#if !(NGX_DEBUG_PALLOC)
+
+/*
+ * Blocks of the destroyed pools are kept in the per-process free lists,
+ * one list for each block size, and are reused by the next pools of the
+ * same size, e.g., by the connection and request pools.  Pools are only
+ * created and destroyed by the main thread of a process, so the lists
+ * need no locking.
+ */
+
+#define NGX_POOL_CACHE_SIZES   8
+
+#ifndef NGX_POOL_CACHE_BLOCKS
+#define NGX_POOL_CACHE_BLOCKS  64
+#endif
+
+
+typedef struct {
+    size_t                size;
+    ngx_uint_t            nblocks;
+    ngx_pool_t           *free;
+} ngx_pool_cache_t;
+
+
+static ngx_pool_cache_t  ngx_pool_cache[NGX_POOL_CACHE_SIZES];
+
+#endif
 
 
 ngx_pool_t *
@@ -20,7 +51,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_alloc_block(size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -87,7 +118,7 @@ ngx_destroy_pool(ngx_pool_t *pool)
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_free_block(p);
 
         if (n == NULL) {
             break;
@@ -183,7 +214,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_alloc_block(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -210,6 +241,79 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 }
 
 
+static void *
+ngx_pool_alloc_block(size_t size, ngx_log_t *log)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    ngx_pool_t        *p;
+    ngx_pool_cache_t  *cache;
+
+    for (cache = ngx_pool_cache;
+         cache < ngx_pool_cache + NGX_POOL_CACHE_SIZES && cache->size;
+         cache++)
+    {
+        if (cache->size != size) {
+            continue;
+        }
+
+        p = cache->free;
+
+        if (p == NULL) {
+            break;
+        }
+
+        cache->free = p->d.next;
+        cache->nblocks--;
+
+        return p;
+    }
+
+#endif
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+
+static void
+ngx_pool_free_block(ngx_pool_t *p)
+{
+#if !(NGX_DEBUG_PALLOC)
+
+    size_t             size;
+    ngx_pool_cache_t  *cache;
+
+    size = (size_t) (p->d.end - (u_char *) p);
+
+    for (cache = ngx_pool_cache;
+         cache < ngx_pool_cache + NGX_POOL_CACHE_SIZES;
+         cache++)
+    {
+        if (cache->size == 0) {
+            cache->size = size;
+        }
+
+        if (cache->size != size) {
+            continue;
+        }
+
+        if (cache->nblocks == NGX_POOL_CACHE_BLOCKS) {
+            break;
+        }
+
+        p->d.next = cache->free;
+        cache->free = p;
+        cache->nblocks++;
+
+        return;
+    }
+
+#endif
+
+    ngx_free(p);
+}
+
+
 static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
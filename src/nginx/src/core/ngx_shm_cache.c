@@ -0,0 +1,287 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_SHM_CACHE_EVICT  16
+
+
+static void *ngx_shm_cache_alloc(ngx_shm_cache_t *cache, size_t size);
+static ngx_int_t ngx_shm_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+
+ngx_shm_cache_node_t *
+ngx_shm_cache_lookup(ngx_shm_cache_t *cache, ngx_str_t *key, uint32_t hash)
+{
+    return (ngx_shm_cache_node_t *)
+               ngx_str_rbtree_lookup(&cache->sh->rbtree, key, hash);
+}
+
+
+ngx_shm_cache_node_t *
+ngx_shm_cache_insert(ngx_shm_cache_t *cache, ngx_str_t *key, uint32_t hash,
+    size_t size)
+{
+    ngx_shm_cache_node_t  *node;
+
+    node = ngx_shm_cache_alloc(cache, size + key->len);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    node->sn.node.key = hash;
+    node->sn.str.len = key->len;
+    node->sn.str.data = (u_char *) node + size;
+
+    ngx_memcpy(node->sn.str.data, key->data, key->len);
+
+    node->count = 0;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+
+    return node;
+}
+
+
+static void *
+ngx_shm_cache_alloc(ngx_shm_cache_t *cache, size_t size)
+{
+    void                  *p;
+    ngx_uint_t             n;
+    ngx_queue_t           *q, *prev;
+    ngx_shm_cache_node_t  *node;
+
+    p = ngx_slab_alloc_locked(cache->shpool, size);
+
+    if (p) {
+        return p;
+    }
+
+    /* evict the least recently used nodes not referenced */
+
+    q = ngx_queue_last(&cache->sh->queue);
+
+    for (n = 0; n < NGX_SHM_CACHE_EVICT; n++) {
+
+        if (q == ngx_queue_sentinel(&cache->sh->queue)) {
+            break;
+        }
+
+        prev = ngx_queue_prev(q);
+
+        node = ngx_queue_data(q, ngx_shm_cache_node_t, queue);
+
+        if (node->count == 0) {
+            ngx_shm_cache_delete(cache, node);
+
+            p = ngx_slab_alloc_locked(cache->shpool, size);
+
+            if (p) {
+                return p;
+            }
+        }
+
+        q = prev;
+    }
+
+    return NULL;
+}
+
+
+void
+ngx_shm_cache_hold(ngx_shm_cache_t *cache, ngx_shm_cache_node_t *node)
+{
+    node->count++;
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+}
+
+
+void
+ngx_shm_cache_delete(ngx_shm_cache_t *cache, ngx_shm_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, &node->sn.node);
+
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+void
+ngx_shm_cache_release(void *data)
+{
+    ngx_shm_cache_cleanup_t  *sccln = data;
+
+    ngx_shmtx_lock(&sccln->cache->shpool->mutex);
+
+    sccln->node->count--;
+
+    ngx_shmtx_unlock(&sccln->cache->shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_shm_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_shm_cache_t  *ocache = data;
+
+    size_t            len;
+    ngx_shm_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        /* nodes keyed by the previous configuration are not used */
+
+        cache->generation = ++cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        cache->generation = ++cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_shm_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    cache->sh->generation = 0;
+    cache->generation = 0;
+
+    len = sizeof(" in  zone \"\"") + ngx_strlen(cache->name)
+          + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in %s zone \"%V\"%Z",
+                cache->name, &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+ngx_shm_cache_t *
+ngx_shm_cache_add(ngx_conf_t *cf, size_t max_object, char *name, void *tag)
+{
+    u_char           *p;
+    ssize_t           size, max;
+    ngx_str_t        *value, zone, s;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_shm_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    zone = value[1];
+
+    p = (u_char *) ngx_strchr(zone.data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NULL;
+    }
+
+    zone.len = p - zone.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", &value[1]);
+        return NULL;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NULL;
+    }
+
+    max = max_object;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "max_object=", 11) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NULL;
+        }
+
+        s.data = value[2].data + 11;
+        s.len = value[2].len - 11;
+
+        max = ngx_parse_size(&s);
+
+        if (max == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid max_object value \"%V\"", &value[2]);
+            return NULL;
+        }
+    }
+
+    if (max > size / 8) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for max_object=%z",
+                           &value[1], max);
+        return NULL;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &zone, size, tag);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &zone);
+        return NULL;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_shm_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->max_object = max;
+    cache->name = name;
+
+    shm_zone->init = ngx_shm_cache_init_zone;
+    shm_zone->data = cache;
+
+    return cache;
+}
@@ -0,0 +1,67 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_SHM_CACHE_H_INCLUDED_
+#define _NGX_SHM_CACHE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * A cache of objects in a shared memory zone, keyed by a string and
+ * evicted in the least recently used order.  A module node starts with
+ * ngx_shm_cache_node_t and the key is stored after the node.  Nodes
+ * referenced by requests are not evicted.  Nodes are looked up, inserted,
+ * held and deleted with the zone mutex locked.
+ */
+
+
+typedef struct {
+    ngx_str_node_t                sn;
+    ngx_queue_t                   queue;
+    ngx_uint_t                    count;
+} ngx_shm_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                  rbtree;
+    ngx_rbtree_node_t             sentinel;
+    ngx_queue_t                   queue;
+    ngx_uint_t                    generation;
+} ngx_shm_cache_sh_t;
+
+
+typedef struct {
+    ngx_shm_cache_sh_t           *sh;
+    ngx_slab_pool_t              *shpool;
+    size_t                        max_object;
+    ngx_uint_t                    generation;
+    char                         *name;
+} ngx_shm_cache_t;
+
+
+typedef struct {
+    ngx_shm_cache_t              *cache;
+    ngx_shm_cache_node_t         *node;
+} ngx_shm_cache_cleanup_t;
+
+
+ngx_shm_cache_node_t *ngx_shm_cache_lookup(ngx_shm_cache_t *cache,
+    ngx_str_t *key, uint32_t hash);
+ngx_shm_cache_node_t *ngx_shm_cache_insert(ngx_shm_cache_t *cache,
+    ngx_str_t *key, uint32_t hash, size_t size);
+void ngx_shm_cache_hold(ngx_shm_cache_t *cache, ngx_shm_cache_node_t *node);
+void ngx_shm_cache_delete(ngx_shm_cache_t *cache, ngx_shm_cache_node_t *node);
+void ngx_shm_cache_release(void *data);
+
+ngx_shm_cache_t *ngx_shm_cache_add(ngx_conf_t *cf, size_t max_object,
+    char *name, void *tag);
+
+
+#endif /* _NGX_SHM_CACHE_H_INCLUDED_ */
@@ -69,6 +69,8 @@
 
 #endif
 
+static void *ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -77,6 +79,57 @@ static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level,
     char *text);
 
 
+
+#if (NGX_SLAB_MAGAZINES)
+
+/*
+ * A worker process keeps per-process magazines of free chunks, one for
+ * each slot of a pool.  Most allocations and frees of small chunks are
+ * served by the magazines without touching the pool, and ngx_slab_alloc()
+ * and ngx_slab_free() take the pool mutex only to refill or to drain
+ * a magazine by a batch of chunks.  The chunks in magazines are accounted
+ * as used in the pool statistics.  Magazines live in the process memory
+ * and are returned to the pool when the worker exits, so the chunks cached
+ * by a worker that crashed are lost, much like the chunks it had allocated.
+ */
+
+#define NGX_SLAB_MAGAZINE_SIZE   8
+#define NGX_SLAB_MAGAZINE_BATCH  4
+
+
+typedef struct {
+    ngx_uint_t                  n;
+    void                       *chunks[NGX_SLAB_MAGAZINE_SIZE];
+} ngx_slab_magazine_t;
+
+
+typedef struct ngx_slab_magazines_s  ngx_slab_magazines_t;
+
+struct ngx_slab_magazines_s {
+    ngx_slab_pool_t            *pool;
+    ngx_slab_magazines_t       *next;
+
+    ngx_uint_t                  hits;
+    ngx_uint_t                  locks;
+
+    ngx_uint_t                  nslots;
+    ngx_slab_magazine_t         slots[1];
+};
+
+
+static ngx_int_t ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size,
+    ngx_uint_t locked, void **p);
+static ngx_int_t ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p,
+    ngx_uint_t locked);
+static ngx_slab_magazines_t *ngx_slab_get_magazines(ngx_slab_pool_t *pool);
+static void ngx_slab_drain_magazines(ngx_slab_magazines_t *mags);
+
+
+static ngx_slab_magazines_t  *ngx_slab_magazines;
+
+#endif
+
+
 static ngx_uint_t  ngx_slab_max_size;
 static ngx_uint_t  ngx_slab_exact_size;
 static ngx_uint_t  ngx_slab_exact_shift;
@@ -162,14 +215,73 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 }
 
 
+ngx_int_t
+ngx_slab_split(ngx_slab_pool_t *pool, ngx_slab_pool_t **pools, ngx_uint_t n)
+{
+#if (NGX_HAVE_ATOMIC_OPS)
+
+    size_t            size;
+    ngx_uint_t        i;
+    ngx_slab_pool_t  *sp;
+
+    /*
+     * the free pages of the pool are divided between n pools,
+     * each with its own mutex, so the shards of a zone
+     * do not contend with each other
+     */
+
+    size = (pool->pfree / n) << ngx_pagesize_shift;
+
+    for (i = 0; i < n; i++) {
+        sp = ngx_slab_alloc(pool, size);
+        if (sp == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(sp, sizeof(ngx_slab_pool_t));
+
+        sp->end = (u_char *) sp + size;
+        sp->min_shift = pool->min_shift;
+        sp->addr = sp;
+
+        if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_slab_init(sp);
+
+        pools[i] = sp;
+    }
+
+    return NGX_OK;
+
+#else
+
+    /* the mutexes of file based locks cannot be created here */
+
+    ngx_slab_error(pool, NGX_LOG_EMERG,
+                   "ngx_slab_split(): not supported without atomic operations");
+
+    return NGX_ERROR;
+
+#endif
+}
+
+
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
+#if (NGX_SLAB_MAGAZINES)
+    if (ngx_slab_magazine_alloc(pool, size, 0, &p) == NGX_OK) {
+        return p;
+    }
+#endif
+
     ngx_shmtx_lock(&pool->mutex);
 
-    p = ngx_slab_alloc_locked(pool, size);
+    p = ngx_slab_alloc_chunk(pool, size);
 
     ngx_shmtx_unlock(&pool->mutex);
 
@@ -179,6 +291,21 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+#if (NGX_SLAB_MAGAZINES)
+    void  *p;
+
+    if (ngx_slab_magazine_alloc(pool, size, 1, &p) == NGX_OK) {
+        return p;
+    }
+#endif
+
+    return ngx_slab_alloc_chunk(pool, size);
+}
+
+
+static void *
+ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
@@ -440,9 +567,15 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+#if (NGX_SLAB_MAGAZINES)
+    if (ngx_slab_magazine_free(pool, p, 0) == NGX_OK) {
+        return;
+    }
+#endif
+
     ngx_shmtx_lock(&pool->mutex);
 
-    ngx_slab_free_locked(pool, p);
+    ngx_slab_free_chunk(pool, p);
 
     ngx_shmtx_unlock(&pool->mutex);
 }
@@ -450,6 +583,19 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+#if (NGX_SLAB_MAGAZINES)
+    if (ngx_slab_magazine_free(pool, p, 1) == NGX_OK) {
+        return;
+    }
+#endif
+
+    ngx_slab_free_chunk(pool, p);
+}
+
+
+static void
+ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -663,6 +809,262 @@ fail:
 }
 
 
+#if (NGX_SLAB_MAGAZINES)
+
+static ngx_int_t
+ngx_slab_magazine_alloc(ngx_slab_pool_t *pool, size_t size, ngx_uint_t locked,
+    void **p)
+{
+    size_t                 s;
+    ngx_uint_t             slot, shift, log_nomem;
+    ngx_slab_magazine_t   *mag;
+    ngx_slab_magazines_t  *mags;
+
+    if (size > ngx_slab_max_size || ngx_process != NGX_PROCESS_WORKER) {
+        return NGX_DECLINED;
+    }
+
+    mags = ngx_slab_get_magazines(pool);
+    if (mags == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+        slot = shift - pool->min_shift;
+
+    } else {
+        slot = 0;
+    }
+
+    mag = &mags->slots[slot];
+
+    if (mag->n) {
+        mags->hits++;
+        *p = mag->chunks[--mag->n];
+        return NGX_OK;
+    }
+
+    if (!locked) {
+        ngx_shmtx_lock(&pool->mutex);
+    }
+
+    mags->locks++;
+
+    /* a partial refill is not an allocation failure */
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    while (mag->n < NGX_SLAB_MAGAZINE_BATCH) {
+        *p = ngx_slab_alloc_chunk(pool, size);
+        if (*p == NULL) {
+            break;
+        }
+
+        mag->chunks[mag->n++] = *p;
+    }
+
+    pool->log_nomem = log_nomem;
+
+    if (mag->n) {
+        *p = mag->chunks[--mag->n];
+
+    } else {
+
+        /* return the chunks cached for other slots and retry */
+
+        ngx_slab_drain_magazines(mags);
+
+        *p = ngx_slab_alloc_chunk(pool, size);
+    }
+
+    if (!locked) {
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_slab_magazine_free(ngx_slab_pool_t *pool, void *p, ngx_uint_t locked)
+{
+    uintptr_t              slab, m, *bitmap;
+    ngx_uint_t             i, n, shift;
+    ngx_slab_page_t       *page;
+    ngx_slab_magazine_t   *mag;
+    ngx_slab_magazines_t  *mags;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        || (u_char *) p < pool->start || (u_char *) p >= pool->end)
+    {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the type and the chunk size of a page, as well as the busy bit
+     * of a chunk, cannot change while the chunk is allocated, so they
+     * are read without the pool mutex
+     */
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+    page = &pool->pages[n];
+    slab = page->slab;
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+
+        n = ((uintptr_t) p & (ngx_pagesize - 1)) >> shift;
+        m = (uintptr_t) 1 << (n % (sizeof(uintptr_t) * 8));
+        n /= sizeof(uintptr_t) * 8;
+        bitmap = (uintptr_t *)
+                             ((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1));
+
+        slab = bitmap[n];
+        break;
+
+    case NGX_SLAB_EXACT:
+
+        shift = ngx_slab_exact_shift;
+        m = (uintptr_t) 1 <<
+                (((uintptr_t) p & (ngx_pagesize - 1)) >> ngx_slab_exact_shift);
+        break;
+
+    case NGX_SLAB_BIG:
+
+        shift = slab & NGX_SLAB_SHIFT_MASK;
+        m = (uintptr_t) 1 << ((((uintptr_t) p & (ngx_pagesize - 1)) >> shift)
+                              + NGX_SLAB_MAP_SHIFT);
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_DECLINED;
+    }
+
+    /* wrong and already free chunks are reported by ngx_slab_free_chunk() */
+
+    if (((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)) || !(slab & m)) {
+        return NGX_DECLINED;
+    }
+
+    mags = ngx_slab_get_magazines(pool);
+    if (mags == NULL) {
+        return NGX_DECLINED;
+    }
+
+    mag = &mags->slots[shift - pool->min_shift];
+
+    for (i = 0; i < mag->n; i++) {
+        if (mag->chunks[i] == p) {
+            ngx_slab_error(pool, NGX_LOG_ALERT,
+                           "ngx_slab_free(): chunk is already free");
+            return NGX_OK;
+        }
+    }
+
+    if (mag->n == NGX_SLAB_MAGAZINE_SIZE) {
+
+        if (!locked) {
+            ngx_shmtx_lock(&pool->mutex);
+        }
+
+        mags->locks++;
+
+        while (mag->n > NGX_SLAB_MAGAZINE_SIZE - NGX_SLAB_MAGAZINE_BATCH) {
+            ngx_slab_free_chunk(pool, mag->chunks[--mag->n]);
+        }
+
+        if (!locked) {
+            ngx_shmtx_unlock(&pool->mutex);
+        }
+
+    } else {
+        mags->hits++;
+    }
+
+    mag->chunks[mag->n++] = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_slab_magazines_t *
+ngx_slab_get_magazines(ngx_slab_pool_t *pool)
+{
+    size_t                 size;
+    ngx_uint_t             n;
+    ngx_slab_magazines_t  *mags;
+
+    for (mags = ngx_slab_magazines; mags; mags = mags->next) {
+        if (mags->pool == pool) {
+            return mags;
+        }
+    }
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    size = sizeof(ngx_slab_magazines_t) + (n - 1) * sizeof(ngx_slab_magazine_t);
+
+    mags = ngx_calloc(size, ngx_cycle->log);
+    if (mags == NULL) {
+        return NULL;
+    }
+
+    mags->pool = pool;
+    mags->nslots = n;
+
+    mags->next = ngx_slab_magazines;
+    ngx_slab_magazines = mags;
+
+    return mags;
+}
+
+
+static void
+ngx_slab_drain_magazines(ngx_slab_magazines_t *mags)
+{
+    ngx_uint_t            i;
+    ngx_slab_magazine_t  *mag;
+
+    for (i = 0; i < mags->nslots; i++) {
+        mag = &mags->slots[i];
+
+        while (mag->n) {
+            ngx_slab_free_chunk(mags->pool, mag->chunks[--mag->n]);
+        }
+    }
+}
+
+
+void
+ngx_slab_flush_magazines(ngx_log_t *log)
+{
+    ngx_slab_pool_t       *pool;
+    ngx_slab_magazines_t  *mags;
+
+    for (mags = ngx_slab_magazines; mags; mags = mags->next) {
+        pool = mags->pool;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "slab magazines%s: %ui hits, %ui locks",
+                       pool->log_ctx, mags->hits, mags->locks);
+
+        ngx_shmtx_lock(&pool->mutex);
+
+        ngx_slab_drain_magazines(mags);
+
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+}
+
+#endif
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
@@ -60,6 +60,8 @@ typedef struct {
 
 
 void ngx_slab_init(ngx_slab_pool_t *pool);
+ngx_int_t ngx_slab_split(ngx_slab_pool_t *pool, ngx_slab_pool_t **pools,
+    ngx_uint_t n);
 void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
@@ -67,5 +69,9 @@ void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
 
+#if (NGX_SLAB_MAGAZINES)
+void ngx_slab_flush_magazines(ngx_log_t *log);
+#endif
+
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -0,0 +1,1741 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism:
+ * every active event is a multishot IORING_OP_POLL_ADD request, so
+ * an armed event keeps posting completions until it is removed, much
+ * like an EPOLLET registration.  Poll additions and removals are queued
+ * in the submission ring and are passed to the kernel together with
+ * waiting for completions by a single io_uring_enter() call per cycle.
+ *
+ * Client connections which have started a request, that is, keep-alive
+ * HTTP connections, use completion-based I/O instead.  Their reads are
+ * IORING_OP_RECV requests into buffers the kernel selects from a group
+ * provided at startup, so an idle connection holds no buffer, and
+ * ngx_recv() copies the data from there.  The end of a response, if it
+ * is in memory and is not larger than NGX_IOURING_SEND_SIZE, is copied
+ * and sent by IORING_OP_SEND; until the send completes the connection
+ * is NGX_LOWLEVEL_BUFFERED and its write event is not ready.  Other
+ * connections, file buffers, and the beginning of larger responses use
+ * the usual calls.
+ *
+ * The user data of a request is the operation, the connection index
+ * and a generation of the registration, so completions of a removed
+ * registration are recognized even if the same one is added again.
+ */
+
+
+#define NGX_IOURING_OP_NONE       0
+#define NGX_IOURING_OP_POLL       1
+#define NGX_IOURING_OP_RECV       2
+#define NGX_IOURING_OP_SEND       3
+#define NGX_IOURING_OP_NOTIFY     4
+
+#define NGX_IOURING_MAX_INDEX     0x0fffffff
+
+#define ngx_iouring_data(op, write, index, gen)                               \
+    ((uint64_t) (gen) << 32 | (uint64_t) (index) << 4 | (write) << 3 | (op))
+
+#define ngx_iouring_op(data)      ((data) & 7)
+#define ngx_iouring_write(data)   (((data) >> 3) & 1)
+#define ngx_iouring_index(data)   (((data) >> 4) & NGX_IOURING_MAX_INDEX)
+#define ngx_iouring_gen(data)     ((uint32_t) ((data) >> 32))
+
+#define NGX_IOURING_RECV_GROUP    1
+#define NGX_IOURING_RECV_SIZE     4096
+#define NGX_IOURING_SEND_SIZE     65536
+
+
+typedef struct {
+    ngx_uint_t                entries;
+} ngx_iouring_conf_t;
+
+
+typedef struct {
+    /* the generations of the read and write polls, 0 if none */
+    uint32_t                  gen[2];
+
+    uint32_t                  recv_gen;
+    uint32_t                  send_gen;
+
+    /* the received data in a provided buffer */
+    u_char                   *recv_pos;
+    u_char                   *recv_last;
+    ngx_uint_t                recv_bid;
+    ngx_err_t                 recv_err;
+
+    u_char                   *send_buf;
+    u_char                   *send_pos;
+    u_char                   *send_last;
+    ngx_err_t                 send_err;
+
+    /* the submission ring tail after the last request of the connection */
+    u_int                     tail;
+
+    unsigned                  completion:1;
+    unsigned                  recv_busy:1;
+    unsigned                  recv_eof:1;
+    unsigned                  recv_nobufs:1;
+    unsigned                  recv_more:1;
+    unsigned                  send_busy:1;
+} ngx_iouring_conn_t;
+
+
+typedef struct {
+    u_char                   *ring;
+    size_t                    ring_size;
+    struct io_uring_sqe      *sqes;
+    size_t                    sqes_size;
+
+    u_int                    *sq_head;
+    u_int                    *sq_tail;
+    u_int                    *sq_array;
+    u_int                     sq_mask;
+    u_int                     sq_entries;
+
+    u_int                    *cq_head;
+    u_int                    *cq_tail;
+    u_int                     cq_mask;
+    struct io_uring_cqe      *cqes;
+
+    u_int                     tail;
+    u_int                     pending;
+} ngx_iouring_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries);
+static void ngx_iouring_close(ngx_log_t *log);
+static ngx_int_t ngx_iouring_test_multishot(ngx_cycle_t *cycle);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify_init(ngx_log_t *log);
+static void ngx_iouring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_conn(ngx_connection_t *c, ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static void ngx_iouring_recv_complete(ngx_connection_t *c,
+    ngx_iouring_conn_t *iuc, struct io_uring_cqe *cqe, ngx_uint_t flags);
+static void ngx_iouring_send_complete(ngx_connection_t *c,
+    ngx_iouring_conn_t *iuc, struct io_uring_cqe *cqe, ngx_uint_t flags);
+static void ngx_iouring_post_event(ngx_event_t *ev, ngx_uint_t flags);
+
+static ngx_iouring_conn_t *ngx_iouring_conn(ngx_connection_t *c);
+static ssize_t ngx_iouring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_iouring_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_iouring_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_iouring_poll_add(ngx_log_t *log, int fd, uint32_t events,
+    ngx_uint_t multishot, uint64_t data);
+static ngx_int_t ngx_iouring_poll_remove(ngx_log_t *log, uint64_t data);
+static ngx_int_t ngx_iouring_recv_add(ngx_connection_t *c,
+    ngx_iouring_conn_t *iuc);
+static ngx_int_t ngx_iouring_send_add(ngx_connection_t *c,
+    ngx_iouring_conn_t *iuc);
+static ngx_int_t ngx_iouring_cancel(ngx_log_t *log, uint64_t data);
+static ngx_int_t ngx_iouring_provide(ngx_log_t *log, ngx_uint_t bid,
+    ngx_uint_t n);
+static uint32_t ngx_iouring_next_gen(void);
+static int ngx_iouring_enter(u_int wait, u_int flags, struct timespec *ts);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                  ring_fd = -1;
+static ngx_iouring_t        uring;
+
+static ngx_iouring_conn_t  *conns;
+static ngx_uint_t           nconns;
+static uint32_t             generation;
+
+static u_char              *recv_bufs;
+static ngx_uint_t           nrecv_bufs;
+
+static ngx_os_io_t          ngx_iouring_io;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        NULL,                            /* add an connection */
+        ngx_iouring_del_conn,            /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_iouring_notify,              /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+extern ngx_module_t  ngx_epoll_module;
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage, because the library is not generally
+ * installed and only a few of its functions are needed.
+ */
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_iouring_conf_t  *iucf;
+    ngx_event_module_t  *module;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring_fd == -1) {
+
+        if (cycle->connection_n > NGX_IOURING_MAX_INDEX
+            || ngx_iouring_setup(cycle, iucf->entries) != NGX_OK
+            || ngx_iouring_test_multishot(cycle) != NGX_OK)
+        {
+            if (ring_fd != -1) {
+                ngx_iouring_close(cycle->log);
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring is not usable, falling back to epoll");
+
+            module = ngx_epoll_module.ctx;
+
+            return module->actions.init(cycle, timer);
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_iouring_notify_init(cycle->log) != NGX_OK) {
+            ngx_iouring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+        conns = ngx_calloc(sizeof(ngx_iouring_conn_t) * cycle->connection_n,
+                           cycle->log);
+        if (conns == NULL) {
+            return NGX_ERROR;
+        }
+
+        nconns = cycle->connection_n;
+
+        recv_bufs = ngx_alloc(iucf->entries * NGX_IOURING_RECV_SIZE,
+                              cycle->log);
+        if (recv_bufs == NULL) {
+            return NGX_ERROR;
+        }
+
+        nrecv_bufs = iucf->entries;
+
+        if (ngx_iouring_provide(cycle->log, 0, nrecv_bufs) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+
+    /* file AIO completions are reported via eventfd polled by epoll only */
+
+    ngx_file_aio = 0;
+
+#endif
+
+    ngx_iouring_io = ngx_os_io;
+    ngx_iouring_io.recv = ngx_iouring_recv;
+    ngx_iouring_io.send = ngx_iouring_send;
+    ngx_iouring_io.send_chain = ngx_iouring_send_chain;
+
+    ngx_io = ngx_iouring_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT|NGX_USE_GREEDY_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries)
+{
+    int                      fd;
+    u_char                  *p;
+    size_t                   sq_size, cq_size;
+    struct io_uring_params   params;
+
+    ngx_memzero(&params, sizeof(struct io_uring_params));
+
+    /*
+     * multishot polls may post several completions per submission,
+     * so the completion ring is made larger than the submission one
+     */
+
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    fd = syscall(SYS_io_uring_setup, entries, &params);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    ring_fd = fd;
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0
+        || (params.features & IORING_FEAT_NODROP) == 0
+        || (params.features & IORING_FEAT_EXT_ARG) == 0)
+    {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring features 0x%xD are not sufficient",
+                      params.features);
+        return NGX_ERROR;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(u_int);
+    cq_size = params.cq_off.cqes
+              + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    uring.ring_size = ngx_max(sq_size, cq_size);
+
+    p = mmap(NULL, uring.ring_size, PROT_READ|PROT_WRITE,
+             MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        uring.ring = NULL;
+        return NGX_ERROR;
+    }
+
+    uring.ring = p;
+
+    uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (uring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        uring.sqes = NULL;
+        return NGX_ERROR;
+    }
+
+    uring.sq_head = (u_int *) (p + params.sq_off.head);
+    uring.sq_tail = (u_int *) (p + params.sq_off.tail);
+    uring.sq_array = (u_int *) (p + params.sq_off.array);
+    uring.sq_mask = *(u_int *) (p + params.sq_off.ring_mask);
+    uring.sq_entries = params.sq_entries;
+
+    uring.cq_head = (u_int *) (p + params.cq_off.head);
+    uring.cq_tail = (u_int *) (p + params.cq_off.tail);
+    uring.cq_mask = *(u_int *) (p + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+    uring.tail = *uring.sq_tail;
+    uring.pending = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   fd, params.sq_entries, params.cq_entries);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_close(ngx_log_t *log)
+{
+    if (uring.sqes && munmap(uring.sqes, uring.sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "munmap() failed");
+    }
+
+    if (uring.ring && munmap(uring.ring, uring.ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "munmap() failed");
+    }
+
+    if (close(ring_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ngx_memzero(&uring, sizeof(ngx_iouring_t));
+    ring_fd = -1;
+}
+
+
+/*
+ * multishot polls appeared in Linux 5.13; older kernels either reject
+ * the IORING_POLL_ADD_MULTI flag or complete the poll after a single event
+ */
+
+static ngx_int_t
+ngx_iouring_test_multishot(ngx_cycle_t *cycle)
+{
+    int                   s[2];
+    u_int                 head;
+    ngx_int_t             rc;
+    struct io_uring_cqe  *cqe;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "socketpair() failed");
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_iouring_poll_add(cycle->log, s[0], POLLOUT, 1, 1) != NGX_OK) {
+        goto failed;
+    }
+
+    if (ngx_iouring_enter(1, 0, NULL) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring_enter() failed");
+        goto failed;
+    }
+
+    head = *uring.cq_head;
+    cqe = &uring.cqes[head & uring.cq_mask];
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE)) {
+        rc = NGX_OK;
+
+        /* the remove and the cancelled poll completions */
+
+        if (ngx_iouring_poll_remove(cycle->log, 1) != NGX_OK
+            || ngx_iouring_enter(3, 0, NULL) == -1)
+        {
+            rc = NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "testing io_uring multishot poll: %s, res:%d",
+                   rc == NGX_OK ? "success" : "fail", cqe->res);
+
+    ngx_memory_barrier();
+
+    *uring.cq_head = *uring.cq_tail;
+
+failed:
+
+    if (close(s[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    if (close(s[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() failed");
+    }
+
+    return rc;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_iouring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_iouring_poll_add(log, notify_fd, POLLIN, 1,
+                             ngx_iouring_data(NGX_IOURING_OP_NOTIFY, 0, 0, 0))
+        != NGX_OK)
+    {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    ngx_iouring_close(cycle->log);
+
+    /*
+     * the requests in flight are cancelled asynchronously when the ring
+     * is closed, so the receive and send buffers are left to the exit
+     */
+
+    ngx_free(conns);
+    conns = NULL;
+    nconns = 0;
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             events, gen;
+    ngx_uint_t           index;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *iuc;
+
+    c = ev->data;
+
+    index = c - ngx_cycle->connections;
+    iuc = &conns[index];
+
+    if (event == NGX_READ_EVENT && iuc->completion) {
+
+        /* a completion of the read request is the notification */
+
+        ev->active = 1;
+
+        if (iuc->recv_busy) {
+            return NGX_OK;
+        }
+
+        if (iuc->recv_pos == iuc->recv_last
+            && !iuc->recv_eof
+            && !iuc->recv_err)
+        {
+            return ngx_iouring_recv_add(c, iuc);
+        }
+
+        ev->ready = 1;
+        ngx_post_event(ev, &ngx_posted_events);
+
+        return NGX_OK;
+    }
+
+    if (event == NGX_WRITE_EVENT && iuc->send_busy && iuc->send_gen) {
+
+        /* a completion of the send request is the notification */
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+    if (event == NGX_READ_EVENT) {
+        events = POLLIN|POLLRDHUP;
+
+    } else {
+        events = POLLOUT;
+    }
+
+    /*
+     * the listening sockets are added without NGX_CLEAR_EVENT
+     * and rely on level-triggered notifications
+     */
+
+    ev->oneshot = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+
+    gen = ngx_iouring_next_gen();
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%08XD g:%uD l:%ui",
+                   c->fd, events, gen, (ngx_uint_t) ev->oneshot);
+
+    if (ngx_iouring_poll_add(ev->log, c->fd, events, !ev->oneshot,
+                             ngx_iouring_data(NGX_IOURING_OP_POLL, ev->write,
+                                              index, gen))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    iuc->gen[ev->write] = gen;
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             gen;
+    ngx_uint_t           index;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *iuc;
+
+    c = ev->data;
+
+    index = c - ngx_cycle->connections;
+    iuc = &conns[index];
+
+    gen = iuc->gen[ev->write];
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d w:%ui g:%uD",
+                   c->fd, (ngx_uint_t) ev->write, gen);
+
+    ev->active = 0;
+
+    if (gen == 0) {
+
+        /* a read request, or a poll which has failed */
+
+        return NGX_OK;
+    }
+
+    iuc->gen[ev->write] = 0;
+
+    /*
+     * unlike epoll, a pending poll holds a reference to the file,
+     * so the poll has to be removed even if the file descriptor
+     * is about to be closed, otherwise the socket is never released
+     */
+
+    return ngx_iouring_poll_remove(ev->log,
+                                   ngx_iouring_data(NGX_IOURING_OP_POLL,
+                                                    ev->write, index, gen));
+}
+
+
+static ngx_int_t
+ngx_iouring_del_conn(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_int_t            rc;
+    ngx_uint_t           index;
+    ngx_iouring_conn_t  *iuc;
+
+    rc = NGX_OK;
+
+    if (ngx_iouring_del_event(c->read, NGX_READ_EVENT, flags) != NGX_OK) {
+        rc = NGX_ERROR;
+    }
+
+    if (ngx_iouring_del_event(c->write, NGX_WRITE_EVENT, flags) != NGX_OK) {
+        rc = NGX_ERROR;
+    }
+
+    index = c - ngx_cycle->connections;
+    iuc = &conns[index];
+
+    if (!(flags & NGX_CLOSE_EVENT)) {
+
+        /* the connection is not closed, its requests are not cancelled */
+
+        return rc;
+    }
+
+    /*
+     * the requests in flight hold references to the socket and may
+     * not complete at all, so they are cancelled, and their buffers
+     * are released when their completions are seen
+     */
+
+    if (iuc->recv_busy
+        && iuc->recv_gen
+        && ngx_iouring_cancel(c->log,
+                              ngx_iouring_data(NGX_IOURING_OP_RECV, 0, index,
+                                               iuc->recv_gen))
+           != NGX_OK)
+    {
+        rc = NGX_ERROR;
+    }
+
+    if (iuc->send_busy
+        && iuc->send_gen
+        && ngx_iouring_cancel(c->log,
+                              ngx_iouring_data(NGX_IOURING_OP_SEND, 1, index,
+                                               iuc->send_gen))
+           != NGX_OK)
+    {
+        rc = NGX_ERROR;
+    }
+
+    if (iuc->recv_pos != iuc->recv_last) {
+        (void) ngx_iouring_provide(c->log, iuc->recv_bid, 1);
+    }
+
+    /*
+     * requests which are not submitted yet refer to the descriptor,
+     * which may be reused after it is closed
+     */
+
+    if ((iuc->recv_busy || iuc->send_busy)
+        && (int) (iuc->tail - *uring.sq_head) > 0
+        && ngx_iouring_enter(0, 0, NULL) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                      "io_uring_enter() failed");
+        rc = NGX_ERROR;
+    }
+
+    iuc->recv_gen = 0;
+    iuc->send_gen = 0;
+    iuc->recv_pos = NULL;
+    iuc->recv_last = NULL;
+    iuc->recv_err = 0;
+    iuc->send_err = 0;
+
+    iuc->completion = 0;
+    iuc->recv_eof = 0;
+    iuc->recv_nobufs = 0;
+    iuc->recv_more = 0;
+
+    return rc;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                   n;
+    u_int                 head, tail, wait;
+    uint64_t              data;
+    ngx_uint_t            level, index, w;
+    ngx_err_t             err;
+    ngx_event_t          *ev;
+    ngx_queue_t          *queue;
+    ngx_connection_t     *c;
+    struct timespec       ts, *tp;
+    struct io_uring_cqe  *cqe;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %ud", timer, uring.pending);
+
+    head = *uring.cq_head;
+
+    ngx_memory_barrier();
+
+    wait = (timer != 0 && head == *uring.cq_tail) ? 1 : 0;
+
+    err = 0;
+
+    if (wait || uring.pending) {
+
+        if (wait && timer != NGX_TIMER_INFINITE) {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (timer % 1000) * 1000000;
+            tp = &ts;
+
+        } else {
+            tp = NULL;
+        }
+
+        n = ngx_iouring_enter(wait, IORING_ENTER_GETEVENTS, tp);
+
+        if (n == -1) {
+            err = ngx_errno;
+        }
+    }
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME && err != NGX_EAGAIN && err != EBUSY) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    tail = *uring.cq_tail;
+
+    ngx_memory_barrier();
+
+    for ( /* void */ ; head != tail; head++) {
+
+        cqe = &uring.cqes[head & uring.cq_mask];
+
+        data = cqe->user_data;
+
+        switch (ngx_iouring_op(data)) {
+
+        case NGX_IOURING_OP_NONE:
+
+            /* poll removal, cancellation, or buffers provision */
+
+            if (cqe->res < 0 && cqe->res != -ENOENT && cqe->res != -EALREADY) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -cqe->res,
+                              "io_uring request failed");
+            }
+
+            continue;
+
+#if (NGX_HAVE_EVENTFD)
+
+        case NGX_IOURING_OP_NOTIFY:
+
+            if (cqe->res == -ECANCELED) {
+                continue;
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                (void) ngx_iouring_poll_add(cycle->log, notify_fd, POLLIN, 1,
+                                            data);
+            }
+
+            ev = &notify_event;
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(ev, &ngx_posted_events);
+
+            } else {
+                ev->handler(ev);
+            }
+
+            continue;
+
+#endif
+
+        case NGX_IOURING_OP_RECV:
+            c = &ngx_cycle->connections[ngx_iouring_index(data)];
+            ngx_iouring_recv_complete(c, &conns[ngx_iouring_index(data)],
+                                      cqe, flags);
+            continue;
+
+        case NGX_IOURING_OP_SEND:
+            c = &ngx_cycle->connections[ngx_iouring_index(data)];
+            ngx_iouring_send_complete(c, &conns[ngx_iouring_index(data)],
+                                      cqe, flags);
+            continue;
+
+        default: /* NGX_IOURING_OP_POLL */
+            break;
+        }
+
+        if (cqe->res == -ECANCELED) {
+            continue;
+        }
+
+        index = ngx_iouring_index(data);
+        w = ngx_iouring_write(data);
+
+        c = &ngx_cycle->connections[index];
+        ev = w ? c->write : c->read;
+
+        if (c->fd == -1
+            || ngx_iouring_gen(data) != conns[index].gen[w]
+            || !ev->active)
+        {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed or deleted in this iteration,
+             * or from a poll which was removed and added again
+             */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p g:%uD",
+                           ev, ngx_iouring_gen(data));
+            continue;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d res:%d f:%uD d:%p",
+                       c->fd, cqe->res, cqe->flags, ev);
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+
+            /*
+             * a level-triggered event is emulated by a single-shot poll
+             * that is rearmed after each completion; a multishot poll
+             * may also be terminated by the kernel, e.g., on completion
+             * ring overflow, and has to be rearmed as well
+             */
+
+            if (cqe->res < 0) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -cqe->res,
+                              "io_uring poll on fd:%d failed", c->fd);
+                conns[index].gen[w] = 0;
+                ev->active = 0;
+
+            } else if (ngx_iouring_poll_add(cycle->log, c->fd,
+                                            w ? POLLOUT : POLLIN|POLLRDHUP,
+                                            !ev->oneshot, data)
+                       != NGX_OK)
+            {
+                conns[index].gen[w] = 0;
+                ev->active = 0;
+            }
+        }
+
+        ev->ready = 1;
+
+        if (w) {
+#if (NGX_THREADS)
+            ev->complete = 1;
+#endif
+            queue = &ngx_posted_events;
+
+        } else {
+            queue = ev->accept ? &ngx_posted_accept_events
+                               : &ngx_posted_events;
+        }
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(ev, queue);
+
+        } else {
+            ev->handler(ev);
+        }
+    }
+
+    ngx_memory_barrier();
+
+    *uring.cq_head = head;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_recv_complete(ngx_connection_t *c, ngx_iouring_conn_t *iuc,
+    struct io_uring_cqe *cqe, ngx_uint_t flags)
+{
+    ngx_uint_t    bid;
+    ngx_event_t  *rev;
+
+    iuc->recv_busy = 0;
+
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (ngx_iouring_gen(cqe->user_data) != iuc->recv_gen) {
+
+        /*
+         * the connection was closed, and its log with it,
+         * the buffer is given back
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "io_uring: stale recv res:%d g:%uD",
+                       cqe->res, ngx_iouring_gen(cqe->user_data));
+
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            (void) ngx_iouring_provide(ngx_cycle->log, bid, 1);
+        }
+
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv: fd:%d res:%d f:%uD",
+                   c->fd, cqe->res, cqe->flags);
+
+    rev = c->read;
+
+    if (cqe->res > 0) {
+        iuc->recv_bid = bid;
+        iuc->recv_pos = recv_bufs + bid * NGX_IOURING_RECV_SIZE;
+        iuc->recv_last = iuc->recv_pos + cqe->res;
+        iuc->recv_more = (cqe->res == NGX_IOURING_RECV_SIZE);
+
+    } else {
+
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            (void) ngx_iouring_provide(c->log, bid, 1);
+        }
+
+        if (cqe->res == 0) {
+            iuc->recv_eof = 1;
+
+        } else if (cqe->res == -ENOBUFS) {
+
+            /*
+             * all buffers are in use, the connection switches back
+             * to the poll and the usual reads until it is closed;
+             * the poll reports the data already there
+             */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "io_uring recv: no buffers");
+
+            iuc->recv_nobufs = 1;
+            iuc->completion = 0;
+
+            if (!rev->active
+                || ngx_iouring_add_event(rev, NGX_READ_EVENT, NGX_CLEAR_EVENT)
+                   == NGX_OK)
+            {
+                return;
+            }
+
+            rev->error = 1;
+
+        } else if (cqe->res == -ECANCELED) {
+            return;
+
+        } else {
+            iuc->recv_err = -cqe->res;
+        }
+    }
+
+    rev->ready = 1;
+
+    ngx_iouring_post_event(rev, flags);
+}
+
+
+static void
+ngx_iouring_send_complete(ngx_connection_t *c, ngx_iouring_conn_t *iuc,
+    struct io_uring_cqe *cqe, ngx_uint_t flags)
+{
+    ngx_event_t  *wev;
+
+    iuc->send_busy = 0;
+
+    if (ngx_iouring_gen(cqe->user_data) != iuc->send_gen) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                       "io_uring: stale send res:%d g:%uD",
+                       cqe->res, ngx_iouring_gen(cqe->user_data));
+
+        ngx_free(iuc->send_buf);
+        iuc->send_buf = NULL;
+
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send: fd:%d res:%d", c->fd, cqe->res);
+
+    if (cqe->res >= 0) {
+        iuc->send_pos += cqe->res;
+
+        if (iuc->send_pos < iuc->send_last) {
+
+            /* a short send, the rest is sent by the next request */
+
+            if (ngx_iouring_send_add(c, iuc) == NGX_OK) {
+                return;
+            }
+
+            iuc->send_err = NGX_ENOMEM;
+        }
+
+    } else {
+        iuc->send_err = -cqe->res;
+    }
+
+    ngx_free(iuc->send_buf);
+    iuc->send_buf = NULL;
+
+    c->buffered &= ~NGX_LOWLEVEL_BUFFERED;
+
+    wev = c->write;
+
+    wev->ready = 1;
+#if (NGX_THREADS)
+    wev->complete = 1;
+#endif
+
+    if (wev->active && iuc->gen[1] == 0) {
+
+        /*
+         * the event waited for the send only, and is added again
+         * if the socket is not writable later
+         */
+
+        wev->active = 0;
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(wev, &ngx_posted_events);
+
+        } else {
+            wev->handler(wev);
+        }
+
+        return;
+    }
+
+    ngx_iouring_post_event(wev, flags);
+}
+
+
+static void
+ngx_iouring_post_event(ngx_event_t *ev, ngx_uint_t flags)
+{
+    if (!ev->active) {
+
+        /* the event is ready and is handled when it is added */
+
+        return;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(ev, &ngx_posted_events);
+
+    } else {
+        ev->handler(ev);
+    }
+}
+
+
+static ngx_iouring_conn_t *
+ngx_iouring_conn(ngx_connection_t *c)
+{
+    ngx_uint_t  index;
+
+    /*
+     * only connections which have started a request use completions:
+     * new connections may be closed after a single read, and upstream
+     * connections may be passed to another worker
+     */
+
+    if (c->requests == 0
+        || c < ngx_cycle->connections
+        || c >= ngx_cycle->connections + nconns)
+    {
+        return NULL;
+    }
+
+    index = c - ngx_cycle->connections;
+
+    return &conns[index];
+}
+
+
+static ssize_t
+ngx_iouring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t              n;
+    uint64_t             data;
+    ngx_event_t         *rev;
+    ngx_iouring_conn_t  *iuc;
+
+    iuc = ngx_iouring_conn(c);
+
+    if (iuc == NULL
+        || (!iuc->completion && (iuc->recv_busy || iuc->recv_nobufs)))
+    {
+        /*
+         * a new connection, a read of the previous connection in the slot
+         * which is not yet cancelled, or no provided buffers left
+         */
+
+        return ngx_unix_recv(c, buf, size);
+    }
+
+    rev = c->read;
+
+    if (iuc->recv_pos != iuc->recv_last) {
+        n = ngx_min(size, (size_t) (iuc->recv_last - iuc->recv_pos));
+
+        ngx_memcpy(buf, iuc->recv_pos, n);
+        iuc->recv_pos += n;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring recv: fd:%d %z of %uz", c->fd, n, size);
+
+        if (iuc->recv_pos == iuc->recv_last) {
+            iuc->recv_pos = NULL;
+            iuc->recv_last = NULL;
+
+            (void) ngx_iouring_provide(c->log, iuc->recv_bid, 1);
+        }
+
+        return n;
+    }
+
+    if (iuc->recv_eof) {
+        rev->ready = 0;
+        rev->eof = 1;
+        return 0;
+    }
+
+    if (iuc->recv_err) {
+        rev->ready = 0;
+        rev->error = 1;
+        ngx_connection_error(c, iuc->recv_err, "recv() failed");
+        return NGX_ERROR;
+    }
+
+    if (iuc->recv_busy) {
+        rev->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (iuc->recv_more) {
+
+        /*
+         * the last buffer was filled, so the rest of a request body
+         * is likely already there and is read at once
+         */
+
+        iuc->recv_more = 0;
+
+        n = ngx_unix_recv(c, buf, size);
+
+        if (n != NGX_AGAIN) {
+            if (n == (ssize_t) size) {
+                iuc->recv_more = 1;
+            }
+
+            return n;
+        }
+    }
+
+    rev->ready = 0;
+
+    if (!iuc->completion) {
+
+        /* the read poll is replaced by the read requests */
+
+        if (iuc->gen[0]) {
+            data = ngx_iouring_data(NGX_IOURING_OP_POLL, 0,
+                                    c - ngx_cycle->connections, iuc->gen[0]);
+
+            if (ngx_iouring_poll_remove(c->log, data) != NGX_OK) {
+                rev->error = 1;
+                return NGX_ERROR;
+            }
+
+            iuc->gen[0] = 0;
+        }
+
+        iuc->completion = 1;
+    }
+
+    if (ngx_iouring_recv_add(c, iuc) != NGX_OK) {
+        rev->error = 1;
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_iouring_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_iouring_conn_t  *iuc;
+
+    iuc = ngx_iouring_conn(c);
+
+    if (iuc && iuc->send_busy && iuc->send_gen) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    return ngx_unix_send(c, buf, size);
+}
+
+
+static ngx_chain_t *
+ngx_iouring_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    u_char              *p;
+    size_t               size;
+    ngx_buf_t           *b;
+    ngx_uint_t           last;
+    ngx_chain_t         *cl;
+    ngx_event_t         *wev;
+    ngx_iouring_conn_t  *iuc;
+
+    iuc = ngx_iouring_conn(c);
+
+    if (iuc == NULL) {
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    wev = c->write;
+
+    if (iuc->send_busy && iuc->send_gen) {
+        wev->ready = 0;
+        return in;
+    }
+
+    if (iuc->send_err) {
+        wev->error = 1;
+        ngx_connection_error(c, iuc->send_err, "send() failed");
+        return NGX_CHAIN_ERROR;
+    }
+
+    /*
+     * only the end of a response is sent by a request: the parts before
+     * it would otherwise wait for each completion instead of being sent
+     * back to back
+     */
+
+    size = 0;
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (b->last_buf) {
+            last = 1;
+        }
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!ngx_buf_in_memory(b)) {
+            return ngx_os_io.send_chain(c, in, limit);
+        }
+
+        size += b->last - b->pos;
+
+        if (size > NGX_IOURING_SEND_SIZE) {
+            return ngx_os_io.send_chain(c, in, limit);
+        }
+    }
+
+    if (size == 0) {
+        return in;
+    }
+
+    if (!last || iuc->send_busy || (limit && (off_t) size > limit)) {
+
+        /* a send of the previous connection is not yet cancelled */
+
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    p = ngx_alloc(size, c->log);
+    if (p == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    iuc->send_buf = p;
+    iuc->send_pos = p;
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (!ngx_buf_special(b)) {
+            p = ngx_cpymem(p, b->pos, b->last - b->pos);
+        }
+    }
+
+    iuc->send_last = p;
+    iuc->send_gen = ngx_iouring_next_gen();
+
+    if (ngx_iouring_send_add(c, iuc) != NGX_OK) {
+        ngx_free(iuc->send_buf);
+        iuc->send_buf = NULL;
+        return NGX_CHAIN_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send chain: fd:%d %uz", c->fd, size);
+
+    c->buffered |= NGX_LOWLEVEL_BUFFERED;
+    c->sent += size;
+
+    wev->ready = 0;
+
+    return ngx_chain_update_sent(in, size);
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    u_int                 index;
+    struct io_uring_sqe  *sqe;
+
+    if (uring.tail - *uring.sq_head == uring.sq_entries) {
+
+        /* the submission ring is full */
+
+        if (ngx_iouring_enter(0, 0, NULL) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NULL;
+        }
+
+        if (uring.pending) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission ring overflow");
+            return NULL;
+        }
+    }
+
+    index = uring.tail & uring.sq_mask;
+
+    sqe = &uring.sqes[index];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    uring.sq_array[index] = index;
+    uring.tail++;
+    uring.pending++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_log_t *log, int fd, uint32_t events,
+    ngx_uint_t multishot, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_remove(ngx_log_t *log, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_recv_add(ngx_connection_t *c, ngx_iouring_conn_t *iuc)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    iuc->recv_gen = ngx_iouring_next_gen();
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->len = NGX_IOURING_RECV_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NGX_IOURING_RECV_GROUP;
+    sqe->user_data = ngx_iouring_data(NGX_IOURING_OP_RECV, 0,
+                                      c - ngx_cycle->connections,
+                                      iuc->recv_gen);
+
+    iuc->recv_busy = 1;
+    iuc->tail = uring.tail;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_send_add(ngx_connection_t *c, ngx_iouring_conn_t *iuc)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) iuc->send_pos;
+    sqe->len = iuc->send_last - iuc->send_pos;
+    sqe->user_data = ngx_iouring_data(NGX_IOURING_OP_SEND, 1,
+                                      c - ngx_cycle->connections,
+                                      iuc->send_gen);
+
+    iuc->send_busy = 1;
+    iuc->tail = uring.tail;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_cancel(ngx_log_t *log, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_provide(ngx_log_t *log, ngx_uint_t bid, ngx_uint_t n)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = n;
+    sqe->addr = (uintptr_t) (recv_bufs + bid * NGX_IOURING_RECV_SIZE);
+    sqe->len = NGX_IOURING_RECV_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = NGX_IOURING_RECV_GROUP;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static uint32_t
+ngx_iouring_next_gen(void)
+{
+    /* 0 means no registration */
+
+    if (++generation == 0) {
+        generation = 1;
+    }
+
+    return generation;
+}
+
+
+static int
+ngx_iouring_enter(u_int wait, u_int flags, struct timespec *ts)
+{
+    int                            n;
+    struct io_uring_getevents_arg  arg;
+
+    ngx_memory_barrier();
+
+    *uring.sq_tail = uring.tail;
+
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    if (ts == NULL) {
+        n = syscall(SYS_io_uring_enter, ring_fd, uring.pending, wait, flags,
+                    NULL, 0);
+
+    } else {
+        ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+        arg.ts = (uintptr_t) ts;
+
+        n = syscall(SYS_io_uring_enter, ring_fd, uring.pending, wait,
+                    flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    if (n > 0) {
+        uring.pending -= ngx_min((u_int) n, uring.pending);
+    }
+
+    return n;
+}
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 512);
+
+    return NGX_CONF_OK;
+}
@@ -10,6 +10,393 @@
 #include <ngx_event.h>
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * A timer is placed on the level of the most significant 6-bit digit in
+ * which its expiry time differs from the current wheel time, in the slot
+ * given by that digit of the expiry time.  The slot is visited exactly
+ * when the wheel time reaches the expiry time with the lower digits
+ * cleared, and its timers are either expired or cascaded to lower levels.
+ * Timers that are already due are kept in a separate list.
+ */
+
+static void ngx_event_timer_wheel_advance(uint64_t now,
+    ngx_rbtree_node_t *list);
+static void ngx_event_timer_wheel_rebase(void);
+static ngx_inline uint64_t ngx_event_timer_wheel_now(void);
+static ngx_inline ngx_uint_t ngx_event_timer_wheel_ffs(uint64_t mask);
+static ngx_inline void ngx_event_timer_wheel_splice(ngx_rbtree_node_t *list,
+    ngx_rbtree_node_t *head);
+static ngx_int_t ngx_event_timer_list_cancelable(ngx_rbtree_node_t *head);
+static void ngx_event_timer_expire(ngx_rbtree_node_t *node);
+
+
+static ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+
+#define ngx_event_timer_list_init(head)                                       \
+    (head)->left = head;                                                      \
+    (head)->right = head
+
+#define ngx_event_timer_list_empty(head)                                      \
+    ((head)->right == head)
+
+
+ngx_int_t
+ngx_event_timer_init(ngx_log_t *log)
+{
+    ngx_uint_t                level, slot;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    w->current = ngx_current_msec;
+
+    ngx_event_timer_list_init(&w->expired);
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        w->occupied[level] = 0;
+
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SLOTS; slot++) {
+            ngx_event_timer_list_init(&w->slots[level][slot]);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    uint64_t                  expires, diff;
+    ngx_uint_t                level, slot;
+    ngx_msec_int_t            rem;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if ((ngx_msec_int_t) (ngx_current_msec - (ngx_msec_t) w->current) < 0) {
+        ngx_event_timer_wheel_rebase();
+    }
+
+    rem = (ngx_msec_int_t) (node->key - (ngx_msec_t) w->current);
+
+    if (rem <= 0) {
+        head = &w->expired;
+
+    } else {
+        expires = w->current + rem;
+        diff = expires ^ w->current;
+
+        for (level = 0; diff >> NGX_TIMER_WHEEL_BITS; level++) {
+            diff >>= NGX_TIMER_WHEEL_BITS;
+        }
+
+        slot = (expires >> (level * NGX_TIMER_WHEEL_BITS))
+               & NGX_TIMER_WHEEL_MASK;
+
+        head = &w->slots[level][slot];
+        w->occupied[level] |= (uint64_t) 1 << slot;
+    }
+
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    uint64_t                  mask, start, now;
+    ngx_uint_t                level, slot, shift;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if (!ngx_event_timer_list_empty(&w->expired)) {
+        return 0;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        for (mask = w->occupied[level]; mask; mask &= mask - 1) {
+            slot = ngx_event_timer_wheel_ffs(mask);
+
+            if (ngx_event_timer_list_empty(&w->slots[level][slot])) {
+                w->occupied[level] &= ~((uint64_t) 1 << slot);
+                continue;
+            }
+
+            /*
+             * the start of the slot is the earliest expiry time
+             * of the timers in it, it is exact on the lowest level
+             */
+
+            shift = level * NGX_TIMER_WHEEL_BITS;
+
+            start = (w->current >> shift >> NGX_TIMER_WHEEL_BITS
+                     << NGX_TIMER_WHEEL_BITS | slot) << shift;
+
+            now = ngx_event_timer_wheel_now();
+
+            return (ngx_msec_t) (start > now ? start - now : 0);
+        }
+    }
+
+    return NGX_TIMER_INFINITE;
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    uint64_t                  now;
+    ngx_rbtree_node_t         list, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    now = ngx_event_timer_wheel_now();
+
+    if (now < w->current) {
+        ngx_event_timer_wheel_rebase();
+
+    } else if (now > w->current) {
+        ngx_event_timer_list_init(&list);
+
+        ngx_event_timer_wheel_advance(now, &list);
+
+        while (!ngx_event_timer_list_empty(&list)) {
+            node = list.right;
+
+            ngx_event_timer_wheel_delete(node);
+
+            if ((ngx_msec_int_t) (node->key - ngx_current_msec) > 0) {
+                ngx_event_timer_wheel_insert(node);
+                continue;
+            }
+
+            ngx_event_timer_expire(node);
+        }
+    }
+
+    while (!ngx_event_timer_list_empty(&w->expired)) {
+        node = w->expired.right;
+
+        ngx_event_timer_wheel_delete(node);
+
+        ngx_event_timer_expire(node);
+    }
+}
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_uint_t                level, slot;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    if (ngx_event_timer_list_cancelable(&w->expired) != NGX_OK) {
+        return NGX_AGAIN;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SLOTS; slot++) {
+
+            if (ngx_event_timer_list_cancelable(&w->slots[level][slot])
+                != NGX_OK)
+            {
+                return NGX_AGAIN;
+            }
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_timer_wheel_advance(uint64_t now, ngx_rbtree_node_t *list)
+{
+    uint64_t                  ticks, pending;
+    ngx_uint_t                level, slot, shift;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = level * NGX_TIMER_WHEEL_BITS;
+
+        ticks = (now >> shift) - (w->current >> shift);
+
+        if (ticks == 0) {
+            break;
+        }
+
+        /* the slots passed on this level while moving to "now" */
+
+        if (ticks >= NGX_TIMER_WHEEL_SLOTS) {
+            pending = (uint64_t) -1;
+
+        } else {
+            slot = ((w->current >> shift) + 1) & NGX_TIMER_WHEEL_MASK;
+            pending = ((uint64_t) 1 << ticks) - 1;
+            pending = (pending << slot)
+                      | (slot ? pending >> (NGX_TIMER_WHEEL_SLOTS - slot) : 0);
+        }
+
+        for (pending &= w->occupied[level]; pending; pending &= pending - 1) {
+            slot = ngx_event_timer_wheel_ffs(pending);
+
+            ngx_event_timer_wheel_splice(list, &w->slots[level][slot]);
+            w->occupied[level] &= ~((uint64_t) 1 << slot);
+        }
+    }
+
+    w->current = now;
+}
+
+
+static void
+ngx_event_timer_wheel_rebase(void)
+{
+    ngx_uint_t                level, slot;
+    ngx_rbtree_node_t         list, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    /*
+     * the time went backwards: the timers are rescheduled relative
+     * to the new time, thus they expire as late as with the rbtree
+     */
+
+    w = &ngx_event_timer_wheel;
+
+    ngx_event_timer_list_init(&list);
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SLOTS; slot++) {
+            ngx_event_timer_wheel_splice(&list, &w->slots[level][slot]);
+        }
+
+        w->occupied[level] = 0;
+    }
+
+    w->current = ngx_event_timer_wheel_now();
+
+    while (!ngx_event_timer_list_empty(&list)) {
+        node = list.right;
+
+        ngx_event_timer_wheel_delete(node);
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+static ngx_inline uint64_t
+ngx_event_timer_wheel_now(void)
+{
+    ngx_msec_int_t  elapsed;
+
+    /* ngx_msec_t may wrap, the wheel time does not */
+
+    elapsed = (ngx_msec_int_t)
+                  (ngx_current_msec - (ngx_msec_t) ngx_event_timer_wheel.current);
+
+    return ngx_event_timer_wheel.current + elapsed;
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_event_timer_wheel_ffs(uint64_t mask)
+{
+#if (__GNUC__)
+
+    return __builtin_ctzll(mask);
+
+#else
+
+    ngx_uint_t  n;
+
+    for (n = 0; (mask & 1) == 0; n++) {
+        mask >>= 1;
+    }
+
+    return n;
+
+#endif
+}
+
+
+static ngx_inline void
+ngx_event_timer_wheel_splice(ngx_rbtree_node_t *list, ngx_rbtree_node_t *head)
+{
+    if (ngx_event_timer_list_empty(head)) {
+        return;
+    }
+
+    head->right->left = list->left;
+    head->left->right = list;
+    list->left->right = head->right;
+    list->left = head->left;
+
+    ngx_event_timer_list_init(head);
+}
+
+
+static ngx_int_t
+ngx_event_timer_list_cancelable(ngx_rbtree_node_t *head)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    for (node = head->right; node != head; node = node->right) {
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            return NGX_AGAIN;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_timer_expire(ngx_rbtree_node_t *node)
+{
+    ngx_event_t  *ev;
+
+    ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "event timer del: %d: %M",
+                   ngx_event_ident(ev->data), ev->timer.key);
+
+#if (NGX_DEBUG)
+    ev->timer.left = NULL;
+    ev->timer.right = NULL;
+    ev->timer.parent = NULL;
+#endif
+
+    ev->timer_set = 0;
+
+    ev->timedout = 1;
+
+    ev->handler(ev);
+}
+
+#else
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
@@ -124,3 +511,5 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+#endif
@@ -25,8 +25,56 @@ void ngx_event_expire_timers(void);
 ngx_int_t ngx_event_no_timers_left(void);
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * The hierarchical timing wheel keeps timers in doubly linked lists,
+ * using the timer node "left" and "right" fields as the previous and
+ * next pointers.  A level has 64 slots of 64^level milliseconds each,
+ * 11 levels cover the whole 64-bit time range.
+ */
+
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_SLOTS   (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SLOTS - 1)
+#define NGX_TIMER_WHEEL_LEVELS  11
+
+
+typedef struct {
+    uint64_t            current;
+    uint64_t            occupied[NGX_TIMER_WHEEL_LEVELS];
+    ngx_rbtree_node_t   expired;
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SLOTS];
+} ngx_event_timer_wheel_t;
+
+
+void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+
+
+static ngx_inline void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    /* the slot is marked as free lazily by ngx_event_find_timer() */
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+}
+
+
+#define ngx_event_timer_insert(node)  ngx_event_timer_wheel_insert(node)
+#define ngx_event_timer_delete(node)  ngx_event_timer_wheel_delete(node)
+
+#else
+
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timer_insert(node)                                          \
+    ngx_rbtree_insert(&ngx_event_timer_rbtree, node)
+#define ngx_event_timer_delete(node)                                          \
+    ngx_rbtree_delete(&ngx_event_timer_rbtree, node)
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -35,7 +83,7 @@ ngx_event_del_timer(ngx_event_t *ev)
                    "event timer del: %d: %M",
                     ngx_event_ident(ev->data), ev->timer.key);
 
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_delete(&ev->timer);
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
@@ -60,7 +108,7 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
         /*
          * Use a previous timer value if difference between it and a new
          * value is less than NGX_TIMER_LAZY_DELAY milliseconds: this allows
-         * to minimize the rbtree operations for fast connections.
+         * to minimize the timer operations for fast connections.
          */
 
         diff = (ngx_msec_int_t) (key - ev->timer.key);
@@ -81,7 +129,7 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_insert(&ev->timer);
 
     ev->timer_set = 1;
 }
@@ -10,6 +10,15 @@
 #include <ngx_http.h>
 
 
+/*
+ * longer lists of rules are compiled into radix trees, where the most
+ * specific prefix of the rules that are not covered by preceding ones
+ * is the first matching rule
+ */
+
+#define NGX_HTTP_ACCESS_LINEAR  64
+
+
 typedef struct {
     in_addr_t         mask;
     in_addr_t         addr;
@@ -36,8 +45,10 @@ typedef struct {
 
 typedef struct {
     ngx_array_t      *rules;     /* array of ngx_http_access_rule_t */
+    ngx_radix_tree_t *tree;
 #if (NGX_HAVE_INET6)
     ngx_array_t      *rules6;    /* array of ngx_http_access_rule6_t */
+    ngx_radix_tree_t *tree6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
     ngx_array_t      *rules_un;  /* array of ngx_http_access_rule_un_t */
@@ -62,6 +73,14 @@ static char *ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd,
 static void *ngx_http_access_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_access_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_access_compile(ngx_conf_t *cf,
+    ngx_http_access_loc_conf_t *alcf);
+static ngx_uint_t ngx_http_access_covered(ngx_radix_tree_t *tree,
+    uint32_t key, uint32_t mask);
+#if (NGX_HAVE_INET6)
+static ngx_uint_t ngx_http_access_covered6(ngx_radix_tree_t *tree,
+    u_char *key, u_char *mask);
+#endif
 static ngx_int_t ngx_http_access_init(ngx_conf_t *cf);
 
 
@@ -183,9 +202,23 @@ static ngx_int_t
 ngx_http_access_inet(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     in_addr_t addr)
 {
+    uintptr_t                deny;
     ngx_uint_t               i;
     ngx_http_access_rule_t  *rule;
 
+    if (alcf->tree) {
+        deny = ngx_radix32tree_find(alcf->tree, ntohl(addr));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "access: %08XD tree: %i", addr, (ngx_int_t) deny);
+
+        if (deny == NGX_RADIX_NO_VALUE) {
+            return NGX_DECLINED;
+        }
+
+        return ngx_http_access_found(r, deny);
+    }
+
     rule = alcf->rules->elts;
     for (i = 0; i < alcf->rules->nelts; i++) {
 
@@ -208,10 +241,24 @@ static ngx_int_t
 ngx_http_access_inet6(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     u_char *p)
 {
+    uintptr_t                 deny;
     ngx_uint_t                n;
     ngx_uint_t                i;
     ngx_http_access_rule6_t  *rule6;
 
+    if (alcf->tree6) {
+        deny = ngx_radix128tree_find(alcf->tree6, p);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "access: tree6: %i", (ngx_int_t) deny);
+
+        if (deny == NGX_RADIX_NO_VALUE) {
+            return NGX_DECLINED;
+        }
+
+        return ngx_http_access_found(r, deny);
+    }
+
     rule6 = alcf->rules6->elts;
     for (i = 0; i < alcf->rules6->nelts; i++) {
 
@@ -437,19 +484,186 @@ ngx_http_access_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         && conf->rules_un == NULL
 #endif
     ) {
+        if (ngx_http_access_compile(cf, prev) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
         conf->rules = prev->rules;
+        conf->tree = prev->tree;
 #if (NGX_HAVE_INET6)
         conf->rules6 = prev->rules6;
+        conf->tree6 = prev->tree6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
         conf->rules_un = prev->rules_un;
 #endif
+
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_http_access_compile(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
     }
 
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_access_compile(ngx_conf_t *cf, ngx_http_access_loc_conf_t *alcf)
+{
+    ngx_int_t                 rc;
+    ngx_uint_t                i;
+    ngx_http_access_rule_t   *rule;
+#if (NGX_HAVE_INET6)
+    ngx_http_access_rule6_t  *rule6;
+#endif
+
+    /*
+     * A rule covered by a preceding one never matches first and is
+     * skipped, so that a more specific prefix in the tree always belongs
+     * to a preceding rule.
+     */
+
+    if (alcf->rules
+        && alcf->tree == NULL
+        && alcf->rules->nelts > NGX_HTTP_ACCESS_LINEAR)
+    {
+        alcf->tree = ngx_radix_tree_create(cf->pool, -1);
+        if (alcf->tree == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule = alcf->rules->elts;
+        for (i = 0; i < alcf->rules->nelts; i++) {
+
+            if (ngx_http_access_covered(alcf->tree, ntohl(rule[i].addr),
+                                        ntohl(rule[i].mask)))
+            {
+                continue;
+            }
+
+            rc = ngx_radix32tree_insert(alcf->tree, ntohl(rule[i].addr),
+                                        ntohl(rule[i].mask), rule[i].deny);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#if (NGX_HAVE_INET6)
+
+    if (alcf->rules6
+        && alcf->tree6 == NULL
+        && alcf->rules6->nelts > NGX_HTTP_ACCESS_LINEAR)
+    {
+        alcf->tree6 = ngx_radix_tree_create(cf->pool, -1);
+        if (alcf->tree6 == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule6 = alcf->rules6->elts;
+        for (i = 0; i < alcf->rules6->nelts; i++) {
+
+            if (ngx_http_access_covered6(alcf->tree6, rule6[i].addr.s6_addr,
+                                         rule6[i].mask.s6_addr))
+            {
+                continue;
+            }
+
+            rc = ngx_radix128tree_insert(alcf->tree6, rule6[i].addr.s6_addr,
+                                         rule6[i].mask.s6_addr, rule6[i].deny);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_access_covered(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
+{
+    uint32_t           bit;
+    ngx_radix_node_t  *node;
+
+    /* tests if there is a value on the way to the prefix, inclusive */
+
+    bit = 0x80000000;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return 1;
+        }
+
+        if ((mask & bit) == 0) {
+            break;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+    }
+
+    return 0;
+}
+
+
+#if (NGX_HAVE_INET6)
+
+static ngx_uint_t
+ngx_http_access_covered6(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
+{
+    u_char             bit;
+    ngx_uint_t         i;
+    ngx_radix_node_t  *node;
+
+    i = 0;
+    bit = 0x80;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            return 1;
+        }
+
+        if (i == 16 || (mask[i] & bit) == 0) {
+            break;
+        }
+
+        if (key[i] & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+
+        if (bit == 0) {
+            i++;
+            bit = 0x80;
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_access_init(ngx_conf_t *cf)
 {
@@ -9,9 +9,12 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_crypt.h>
+#include <ngx_md5.h>
 
 
-#define NGX_HTTP_AUTH_BUF_SIZE  2048
+/* user files cached by a worker, the least recently used is dropped */
+
+#define NGX_HTTP_AUTH_BASIC_FILES  64
 
 
 typedef struct {
@@ -19,6 +22,30 @@ typedef struct {
 } ngx_http_auth_basic_ctx_t;
 
 
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_str_t                 passwd;
+    ngx_uint_t                verified;
+    u_char                    digest[16];
+} ngx_http_auth_basic_user_t;
+
+
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_queue_t               queue;
+
+    time_t                    mtime;
+    off_t                     size;
+    ngx_file_uniq_t           uniq;
+
+    u_char                   *data;
+    ngx_rbtree_t              users;
+    ngx_rbtree_node_t         sentinel;
+
+    ngx_pool_t               *pool;
+} ngx_http_auth_basic_file_t;
+
+
 typedef struct {
     ngx_http_complex_value_t  *realm;
     ngx_http_complex_value_t   user_file;
@@ -26,6 +53,12 @@ typedef struct {
 
 
 static ngx_int_t ngx_http_auth_basic_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_auth_basic_file(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_http_auth_basic_file_t **filep);
+static ngx_int_t ngx_http_auth_basic_parse(ngx_http_auth_basic_file_t *f);
+static ngx_int_t ngx_http_auth_basic_error(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_err_t err, char *op);
+static void ngx_http_auth_basic_free(ngx_http_auth_basic_file_t *f);
 static ngx_int_t ngx_http_auth_basic_crypt_handler(ngx_http_request_t *r,
     ngx_http_auth_basic_ctx_t *ctx, ngx_str_t *passwd, ngx_str_t *realm);
 static ngx_int_t ngx_http_auth_basic_set_realm(ngx_http_request_t *r,
@@ -92,25 +125,24 @@ ngx_module_t  ngx_http_auth_basic_module = {
 };
 
 
+static ngx_rbtree_t        ngx_http_auth_basic_files;
+static ngx_rbtree_node_t   ngx_http_auth_basic_sentinel;
+static ngx_queue_t         ngx_http_auth_basic_queue;
+static ngx_uint_t          ngx_http_auth_basic_nfiles;
+static u_char              ngx_http_auth_basic_salt[16];
+
+
 static ngx_int_t
 ngx_http_auth_basic_handler(ngx_http_request_t *r)
 {
-    off_t                            offset;
-    ssize_t                          n;
-    ngx_fd_t                         fd;
+    u_char                           digest[16];
+    ngx_md5_t                        md5;
     ngx_int_t                        rc;
-    ngx_err_t                        err;
-    ngx_str_t                        pwd, realm, user_file;
-    ngx_uint_t                       i, level, login, left, passwd;
-    ngx_file_t                       file;
+    ngx_str_t                        realm, user_file, passwd;
     ngx_http_auth_basic_ctx_t       *ctx;
+    ngx_http_auth_basic_file_t      *file;
+    ngx_http_auth_basic_user_t      *user;
     ngx_http_auth_basic_loc_conf_t  *alcf;
-    u_char                           buf[NGX_HTTP_AUTH_BUF_SIZE];
-    enum {
-        sw_login,
-        sw_passwd,
-        sw_skip
-    } state;
 
     alcf = ngx_http_get_module_loc_conf(r, ngx_http_auth_basic_module);
 
@@ -151,139 +183,306 @@ ngx_http_auth_basic_handler(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    fd = ngx_open_file(user_file.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    rc = ngx_http_auth_basic_file(r, &user_file, &file);
 
-    if (fd == NGX_INVALID_FILE) {
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    user = (ngx_http_auth_basic_user_t *)
+               ngx_str_rbtree_lookup(&file->users, &r->headers_in.user,
+                                     ngx_crc32_long(r->headers_in.user.data,
+                                                    r->headers_in.user.len));
+
+    if (user == NULL) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "user \"%V\" was not found in \"%V\"",
+                      &r->headers_in.user, &user_file);
+
+        return ngx_http_auth_basic_set_realm(r, &realm);
+    }
+
+    /*
+     * the password last verified for the user is remembered as a salted
+     * MD5 digest, so keep-alive requests do not repeat expensive crypt()
+     */
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, ngx_http_auth_basic_salt, 16);
+    ngx_md5_update(&md5, r->headers_in.passwd.data, r->headers_in.passwd.len);
+    ngx_md5_final(digest, &md5);
+
+    if (user->verified && ngx_memcmp(user->digest, digest, 16) == 0) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "user: \"%V\" verified", &r->headers_in.user);
+        return NGX_OK;
+    }
+
+    passwd = user->passwd;
+
+    rc = ngx_http_auth_basic_crypt_handler(r, NULL, &passwd, &realm);
+
+    if (rc == NGX_OK) {
+        ngx_memcpy(user->digest, digest, 16);
+        user->verified = 1;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_auth_basic_file(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_http_auth_basic_file_t **filep)
+{
+    size_t                       size;
+    ssize_t                      n;
+    uint32_t                     hash;
+    ngx_fd_t                     fd;
+    ngx_err_t                    err;
+    ngx_uint_t                   i;
+    ngx_file_t                   file;
+    ngx_pool_t                  *pool;
+    ngx_queue_t                 *q;
+    ngx_file_info_t              fi;
+    ngx_http_auth_basic_file_t  *f;
+
+    if (ngx_http_auth_basic_files.root == NULL) {
+        ngx_rbtree_init(&ngx_http_auth_basic_files,
+                        &ngx_http_auth_basic_sentinel,
+                        ngx_str_rbtree_insert_value);
+        ngx_queue_init(&ngx_http_auth_basic_queue);
+
+        for (i = 0; i < 16; i++) {
+            ngx_http_auth_basic_salt[i] = (u_char) ngx_random();
+        }
+    }
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
         err = ngx_errno;
+        return ngx_http_auth_basic_error(r, name, err, ngx_file_info_n);
+    }
+
+    hash = ngx_crc32_long(name->data, name->len);
 
-        if (err == NGX_ENOENT) {
-            level = NGX_LOG_ERR;
-            rc = NGX_HTTP_FORBIDDEN;
+    f = (ngx_http_auth_basic_file_t *)
+            ngx_str_rbtree_lookup(&ngx_http_auth_basic_files, name, hash);
 
-        } else {
-            level = NGX_LOG_CRIT;
-            rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (f) {
+        ngx_queue_remove(&f->queue);
+        ngx_queue_insert_head(&ngx_http_auth_basic_queue, &f->queue);
+
+        if (f->mtime == ngx_file_mtime(&fi)
+            && f->size == ngx_file_size(&fi)
+            && f->uniq == ngx_file_uniq(&fi))
+        {
+            *filep = f;
+            return NGX_OK;
         }
 
-        ngx_log_error(level, r->connection->log, err,
-                      ngx_open_file_n " \"%s\" failed", user_file.data);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "auth basic user file \"%V\" changed", name);
 
-        return rc;
+        ngx_http_auth_basic_free(f);
+    }
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+        return ngx_http_auth_basic_error(r, name, err, ngx_open_file_n);
     }
 
     ngx_memzero(&file, sizeof(ngx_file_t));
 
     file.fd = fd;
-    file.name = user_file;
+    file.name = *name;
     file.log = r->connection->log;
 
-    state = sw_login;
-    passwd = 0;
-    login = 0;
-    left = 0;
-    offset = 0;
+    pool = NULL;
 
-    for ( ;; ) {
-        i = left;
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
 
-        n = ngx_read_file(&file, buf + left, NGX_HTTP_AUTH_BUF_SIZE - left,
-                          offset);
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        goto failed;
+    }
 
-        if (n == NGX_ERROR) {
-            ngx_http_auth_basic_close(&file);
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
-        }
+    f = ngx_palloc(pool, sizeof(ngx_http_auth_basic_file_t));
+    if (f == NULL) {
+        goto failed;
+    }
 
-        if (n == 0) {
-            break;
-        }
+    f->sn.node.key = hash;
+    f->sn.str.len = name->len;
+    f->sn.str.data = ngx_pstrdup(pool, name);
+    if (f->sn.str.data == NULL) {
+        goto failed;
+    }
 
-        for (i = left; i < left + n; i++) {
-            switch (state) {
+    f->mtime = ngx_file_mtime(&fi);
+    f->size = ngx_file_size(&fi);
+    f->uniq = ngx_file_uniq(&fi);
+    f->pool = pool;
 
-            case sw_login:
-                if (login == 0) {
+    ngx_rbtree_init(&f->users, &f->sentinel, ngx_str_rbtree_insert_value);
 
-                    if (buf[i] == '#' || buf[i] == CR) {
-                        state = sw_skip;
-                        break;
-                    }
+    /* the passwords are parsed in place and need a terminating null */
 
-                    if (buf[i] == LF) {
-                        break;
-                    }
-                }
+    size = (size_t) f->size;
 
-                if (buf[i] != r->headers_in.user.data[login]) {
-                    state = sw_skip;
-                    break;
-                }
+    f->data = ngx_pnalloc(pool, size + 1);
+    if (f->data == NULL) {
+        goto failed;
+    }
 
-                if (login == r->headers_in.user.len) {
-                    state = sw_passwd;
-                    passwd = i + 1;
-                }
+    n = ngx_read_file(&file, f->data, size, 0);
 
-                login++;
+    if (n == NGX_ERROR) {
+        goto failed;
+    }
 
-                break;
+    if ((size_t) n != size) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " \"%s\" returned only %z bytes "
+                      "instead of %uz", name->data, n, size);
+        goto failed;
+    }
 
-            case sw_passwd:
-                if (buf[i] == LF || buf[i] == CR || buf[i] == ':') {
-                    buf[i] = '\0';
+    if (ngx_http_auth_basic_parse(f) != NGX_OK) {
+        goto failed;
+    }
 
-                    ngx_http_auth_basic_close(&file);
+    ngx_http_auth_basic_close(&file);
 
-                    pwd.len = i - passwd;
-                    pwd.data = &buf[passwd];
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "auth basic user file \"%V\" loaded", name);
 
-                    return ngx_http_auth_basic_crypt_handler(r, NULL, &pwd,
-                                                             &realm);
-                }
+    if (ngx_http_auth_basic_nfiles == NGX_HTTP_AUTH_BASIC_FILES) {
+        q = ngx_queue_last(&ngx_http_auth_basic_queue);
+        ngx_http_auth_basic_free(
+                     ngx_queue_data(q, ngx_http_auth_basic_file_t, queue));
+    }
 
-                break;
+    ngx_rbtree_insert(&ngx_http_auth_basic_files, &f->sn.node);
+    ngx_queue_insert_head(&ngx_http_auth_basic_queue, &f->queue);
+    ngx_http_auth_basic_nfiles++;
+
+    *filep = f;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_http_auth_basic_close(&file);
+
+    if (pool) {
+        ngx_destroy_pool(pool);
+    }
+
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_auth_basic_parse(ngx_http_auth_basic_file_t *f)
+{
+    u_char                      *p, *last, *eol, *colon, *passwd;
+    uint32_t                     hash;
+    ngx_str_t                    login;
+    ngx_http_auth_basic_user_t  *user;
+
+    /* "login:passwd[:comment]" lines, the first line of a login is used */
+
+    last = f->data + f->size;
 
-            case sw_skip:
-                if (buf[i] == LF) {
-                    state = sw_login;
-                    login = 0;
-                }
+    for (p = f->data; p < last; p = eol + 1) {
 
+        eol = ngx_strlchr(p, last, LF);
+        if (eol == NULL) {
+            eol = last;
+        }
+
+        if (*p == '#' || *p == CR) {
+            continue;
+        }
+
+        colon = ngx_strlchr(p, eol, ':');
+
+        if (colon == NULL || colon == p) {
+            continue;
+        }
+
+        for (passwd = colon + 1; passwd < eol; passwd++) {
+            if (*passwd == ':' || *passwd == CR) {
                 break;
             }
         }
 
-        if (state == sw_passwd) {
-            left = left + n - passwd;
-            ngx_memmove(buf, &buf[passwd], left);
-            passwd = 0;
+        *passwd = '\0';
 
-        } else {
-            left = 0;
+        login.len = colon - p;
+        login.data = p;
+
+        hash = ngx_crc32_long(login.data, login.len);
+
+        if (ngx_str_rbtree_lookup(&f->users, &login, hash) != NULL) {
+            continue;
+        }
+
+        user = ngx_palloc(f->pool, sizeof(ngx_http_auth_basic_user_t));
+        if (user == NULL) {
+            return NGX_ERROR;
         }
 
-        offset += n;
+        user->sn.node.key = hash;
+        user->sn.str = login;
+        user->passwd.len = passwd - colon - 1;
+        user->passwd.data = colon + 1;
+        user->verified = 0;
+
+        ngx_rbtree_insert(&f->users, &user->sn.node);
     }
 
-    ngx_http_auth_basic_close(&file);
+    return NGX_OK;
+}
 
-    if (state == sw_passwd) {
-        pwd.len = i - passwd;
-        pwd.data = ngx_pnalloc(r->pool, pwd.len + 1);
-        if (pwd.data == NULL) {
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
-        }
 
-        ngx_cpystrn(pwd.data, &buf[passwd], pwd.len + 1);
+static ngx_int_t
+ngx_http_auth_basic_error(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_err_t err, char *op)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  level;
+
+    if (err == NGX_ENOENT) {
+        level = NGX_LOG_ERR;
+        rc = NGX_HTTP_FORBIDDEN;
 
-        return ngx_http_auth_basic_crypt_handler(r, NULL, &pwd, &realm);
+    } else {
+        level = NGX_LOG_CRIT;
+        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                  "user \"%V\" was not found in \"%V\"",
-                  &r->headers_in.user, &user_file);
+    ngx_log_error(level, r->connection->log, err, "%s \"%s\" failed",
+                  op, name->data);
+
+    return rc;
+}
+
+
+static void
+ngx_http_auth_basic_free(ngx_http_auth_basic_file_t *f)
+{
+    ngx_rbtree_delete(&ngx_http_auth_basic_files, &f->sn.node);
+    ngx_queue_remove(&f->queue);
+    ngx_http_auth_basic_nfiles--;
 
-    return ngx_http_auth_basic_set_realm(r, &realm);
+    ngx_destroy_pool(f->pool);
 }
 
 
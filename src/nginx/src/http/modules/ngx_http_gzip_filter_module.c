@@ -26,10 +26,29 @@ typedef struct {
     size_t               memlevel;
     ssize_t              min_length;
 
+    ngx_shm_zone_t      *cache;
+
     ngx_array_t         *types_keys;
 } ngx_http_gzip_conf_t;
 
 
+/*
+ * The cache keeps compressed responses in a shared memory zone, keyed
+ * by the location, the compression parameters, the host name, the URI,
+ * and the "Last-Modified", "Content-Length" and "ETag" of the original
+ * response.  Only responses which may be shared between clients are
+ * cached.  A response is captured as it is compressed and on a hit the
+ * original body is discarded without being read.
+ */
+
+typedef struct {
+    ngx_shm_cache_node_t  node;
+    size_t                size;
+    off_t                 length;
+    u_char                data[1];
+} ngx_http_gzip_cache_node_t;
+
+
 typedef struct {
     ngx_chain_t         *in;
     ngx_chain_t         *free;
@@ -64,6 +83,12 @@ typedef struct {
     uint32_t             crc32;
     z_stream             zstream;
     ngx_http_request_t  *request;
+
+    ngx_str_t                    cache_key;
+    uint32_t                     cache_hash;
+    off_t                        cache_length;
+    ngx_buf_t                   *cache_buf;
+    ngx_http_gzip_cache_node_t  *cache_node;
 } ngx_http_gzip_ctx_t;
 
 
@@ -107,6 +132,16 @@ static void ngx_http_gzip_filter_free(void *opaque, void *address);
 static void ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
     ngx_http_gzip_ctx_t *ctx);
 
+static ngx_int_t ngx_http_gzip_cache_open(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_http_gzip_conf_t *conf);
+static ngx_int_t ngx_http_gzip_cache_shareable(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_cache_send(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_gzip_cache_capture(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+static void ngx_http_gzip_cache_store(ngx_http_request_t *r,
+    ngx_http_gzip_ctx_t *ctx);
+
 static ngx_int_t ngx_http_gzip_add_variables(ngx_conf_t *cf);
 static ngx_int_t ngx_http_gzip_ratio_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -117,6 +152,10 @@ static char *ngx_http_gzip_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static char *ngx_http_gzip_window(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_num_bounds_t  ngx_http_gzip_comp_level_bounds = {
@@ -193,6 +232,20 @@ static ngx_command_t  ngx_http_gzip_filter_commands[] = {
       offsetof(ngx_http_gzip_conf_t, min_length),
       NULL },
 
+    { ngx_string("gzip_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_gzip_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("gzip_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_gzip_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -292,6 +345,12 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
 
     ngx_http_gzip_filter_memory(r, ctx);
 
+    if (conf->cache) {
+        if (ngx_http_gzip_cache_open(r, ctx, conf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     h = ngx_list_push(&r->headers_out.headers);
     if (h == NULL) {
         return NGX_ERROR;
@@ -302,12 +361,17 @@ ngx_http_gzip_header_filter(ngx_http_request_t *r)
     ngx_str_set(&h->value, "gzip");
     r->headers_out.content_encoding = h;
 
-    r->main_filter_need_in_memory = 1;
-
     ngx_http_clear_content_length(r);
     ngx_http_clear_accept_ranges(r);
     ngx_http_weak_etag(r);
 
+    if (ctx->cache_node) {
+        r->headers_out.content_length_n = ctx->cache_node->size;
+
+    } else {
+        r->main_filter_need_in_memory = 1;
+    }
+
     return ngx_http_next_header_filter(r);
 }
 
@@ -326,6 +390,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return ngx_http_next_body_filter(r, in);
     }
 
+    if (ctx->cache_node) {
+        return ngx_http_gzip_cache_send(r, ctx, in);
+    }
+
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http gzip filter");
 
@@ -449,6 +517,10 @@ ngx_http_gzip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             }
         }
 
+        if (ctx->cache_key.len) {
+            ngx_http_gzip_cache_capture(r, ctx);
+        }
+
         rc = ngx_http_next_body_filter(r, ctx->out);
 
         if (rc == NGX_ERROR) {
@@ -1061,6 +1133,332 @@ ngx_http_gzip_filter_free_copy_buf(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_gzip_cache_open(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_http_gzip_conf_t *conf)
+{
+    size_t                       len;
+    ngx_str_t                    etag;
+    ngx_shm_cache_t             *cache;
+    ngx_pool_cleanup_t          *cln;
+    ngx_shm_cache_cleanup_t     *gccln;
+    ngx_http_gzip_cache_node_t  *node;
+
+    cache = conf->cache->data;
+
+    if (r != r->main
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.last_modified_time == -1
+        || r->headers_out.content_length_n < 0
+        || r->headers_out.content_length_n > (off_t) cache->max_object
+        || ngx_http_gzip_cache_shareable(r) != NGX_OK)
+    {
+        return NGX_OK;
+    }
+
+    if (r->headers_out.etag) {
+        etag = r->headers_out.etag->value;
+
+    } else {
+        ngx_str_null(&etag);
+    }
+
+    len = NGX_INT_T_LEN + NGX_PTR_SIZE * 2 + 3 * NGX_INT_T_LEN
+          + NGX_TIME_T_LEN + NGX_OFF_T_LEN + etag.len
+          + r->headers_in.server.len + r->uri.len + r->args.len + 10;
+
+    ctx->cache_key.data = ngx_pnalloc(r->pool, len);
+    if (ctx->cache_key.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->cache_key.len = ngx_sprintf(ctx->cache_key.data,
+                                     "%ui:%p:%i:%d:%d:%T:%O:%V:%V:%V?%V",
+                                     cache->generation, conf, conf->level,
+                                     ctx->wbits, ctx->memlevel,
+                                     r->headers_out.last_modified_time,
+                                     r->headers_out.content_length_n,
+                                     &etag, &r->headers_in.server, &r->uri,
+                                     &r->args)
+                         - ctx->cache_key.data;
+
+    ctx->cache_hash = ngx_crc32_short(ctx->cache_key.data,
+                                      ctx->cache_key.len);
+    ctx->cache_length = r->headers_out.content_length_n;
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_shm_cache_cleanup_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = (ngx_http_gzip_cache_node_t *)
+               ngx_shm_cache_lookup(cache, &ctx->cache_key, ctx->cache_hash);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http gzip cache miss: \"%V\"", &ctx->cache_key);
+
+        return NGX_OK;
+    }
+
+    ngx_shm_cache_hold(cache, &node->node);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip cache hit: \"%V\"", &ctx->cache_key);
+
+    cln->handler = ngx_shm_cache_release;
+    gccln = cln->data;
+
+    gccln->cache = cache;
+    gccln->node = &node->node;
+
+    ctx->cache_node = node;
+    ctx->zin = (size_t) node->length;
+    ctx->zout = node->size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_shareable(ngx_http_request_t *r)
+{
+    u_char           *start, *last;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header, **cc;
+
+    /*
+     * only responses which are the same for all clients are cached:
+     * "Cache-Control: private" and "no-store", "Set-Cookie", and "Vary"
+     * with anything but "Accept-Encoding" disable caching
+     */
+
+    cc = r->headers_out.cache_control.elts;
+
+    for (i = 0; i < r->headers_out.cache_control.nelts; i++) {
+
+        if (cc[i]->hash == 0) {
+            continue;
+        }
+
+        start = cc[i]->value.data;
+        last = start + cc[i]->value.len;
+
+        if (ngx_strlcasestrn(start, last, (u_char *) "no-store", 8 - 1)
+            != NULL
+            || ngx_strlcasestrn(start, last, (u_char *) "private", 7 - 1)
+               != NULL)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        if (header[i].key.len == sizeof("Set-Cookie") - 1
+            && ngx_strncasecmp(header[i].key.data, (u_char *) "Set-Cookie",
+                               sizeof("Set-Cookie") - 1)
+               == 0)
+        {
+            return NGX_DECLINED;
+        }
+
+        if (header[i].key.len == sizeof("Vary") - 1
+            && ngx_strncasecmp(header[i].key.data, (u_char *) "Vary",
+                               sizeof("Vary") - 1)
+               == 0
+            && (header[i].value.len != sizeof("Accept-Encoding") - 1
+                || ngx_strncasecmp(header[i].value.data,
+                                   (u_char *) "Accept-Encoding",
+                                   sizeof("Accept-Encoding") - 1)
+                   != 0))
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_gzip_cache_send(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_buf_t                   *b;
+    ngx_uint_t                   last;
+    ngx_chain_t                  out;
+    ngx_http_gzip_cache_node_t  *node;
+
+    /* the original response is discarded */
+
+    last = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        b->pos = b->last;
+        b->file_pos = b->file_last;
+
+        if (b->last_buf) {
+            last = 1;
+        }
+    }
+
+    if (!last) {
+        return NGX_OK;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    node = ctx->cache_node;
+
+    b->memory = 1;
+    b->pos = node->data;
+    b->last = b->pos + node->size;
+    b->last_buf = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    ctx->done = 1;
+
+    return ngx_http_next_body_filter(r, &out);
+}
+
+
+static void
+ngx_http_gzip_cache_capture(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    size_t                 size;
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl;
+    ngx_shm_cache_t       *cache;
+    ngx_http_gzip_conf_t  *conf;
+
+    if (ctx->cache_buf == NULL) {
+        conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+        cache = conf->cache->data;
+
+        /* deflate may expand incompressible data slightly */
+
+        size = (size_t) ctx->cache_length;
+        size += (size >> 10) + 64;
+
+        if (size > cache->max_object) {
+            size = cache->max_object;
+        }
+
+        ctx->cache_buf = ngx_create_temp_buf(r->pool, size);
+        if (ctx->cache_buf == NULL) {
+            ngx_str_null(&ctx->cache_key);
+            return;
+        }
+    }
+
+    b = ctx->cache_buf;
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+        size = cl->buf->last - cl->buf->pos;
+
+        if (size > (size_t) (b->end - b->last)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http gzip cache response is too large");
+
+            ngx_pfree(r->pool, b->start);
+            ctx->cache_buf = NULL;
+            ngx_str_null(&ctx->cache_key);
+            return;
+        }
+
+        b->last = ngx_cpymem(b->last, cl->buf->pos, size);
+    }
+
+    if (ctx->done) {
+        ngx_http_gzip_cache_store(r, ctx);
+
+        ngx_pfree(r->pool, b->start);
+        ctx->cache_buf = NULL;
+        ngx_str_null(&ctx->cache_key);
+    }
+}
+
+
+static void
+ngx_http_gzip_cache_store(ngx_http_request_t *r, ngx_http_gzip_ctx_t *ctx)
+{
+    ngx_buf_t                   *b;
+    ngx_shm_cache_t             *cache;
+    ngx_http_gzip_conf_t        *conf;
+    ngx_http_gzip_cache_node_t  *node;
+
+    if (ctx->zin != (size_t) ctx->cache_length) {
+        return;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_gzip_filter_module);
+    cache = conf->cache->data;
+
+    b = ctx->cache_buf;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (ngx_shm_cache_lookup(cache, &ctx->cache_key, ctx->cache_hash)) {
+        /* stored by another request meanwhile */
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    node = (ngx_http_gzip_cache_node_t *)
+               ngx_shm_cache_insert(cache, &ctx->cache_key, ctx->cache_hash,
+                                    offsetof(ngx_http_gzip_cache_node_t, data)
+                                    + (b->last - b->pos));
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    node->size = b->last - b->pos;
+    node->length = ctx->cache_length;
+
+    ngx_memcpy(node->data, b->pos, node->size);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http gzip cache store: \"%V\", %uz",
+                   &ctx->cache_key, node->size);
+}
+
+
 static ngx_int_t
 ngx_http_gzip_add_variables(ngx_conf_t *cf)
 {
@@ -1147,6 +1545,7 @@ ngx_http_gzip_create_conf(ngx_conf_t *cf)
     conf->wbits = NGX_CONF_UNSET_SIZE;
     conf->memlevel = NGX_CONF_UNSET_SIZE;
     conf->min_length = NGX_CONF_UNSET;
+    conf->cache = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -1171,6 +1570,7 @@ ngx_http_gzip_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->memlevel, prev->memlevel,
                               MAX_MEM_LEVEL - 1);
     ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+    ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
 
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
                              &prev->types_keys, &prev->types,
@@ -1243,3 +1643,45 @@ ngx_http_gzip_hash(ngx_conf_t *cf, void *post, void *data)
 
     return "must be 512, 1k, 2k, 4k, 8k, 16k, 32k, 64k, or 128k";
 }
+
+
+static char *
+ngx_http_gzip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    if (ngx_shm_cache_add(cf, 1024 * 1024, "gzip cache",
+                          &ngx_http_gzip_filter_module)
+        == NULL)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_gzip_conf_t *gcf = conf;
+
+    ngx_str_t  *value;
+
+    if (gcf->cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        gcf->cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    gcf->cache = ngx_shared_memory_add(cf, &value[1], 0,
+                                       &ngx_http_gzip_filter_module);
+    if (gcf->cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
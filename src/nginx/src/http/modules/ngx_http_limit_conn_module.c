@@ -19,14 +19,22 @@ typedef struct {
 
 
 typedef struct {
-    ngx_shm_zone_t            *shm_zone;
-    ngx_rbtree_node_t         *node;
+    ngx_rbtree_t              *rbtree;
+    ngx_slab_pool_t           *shpool;
+} ngx_http_limit_conn_shard_t;
+
+
+typedef struct {
+    ngx_shm_zone_t               *shm_zone;
+    ngx_http_limit_conn_shard_t  *shard;
+    ngx_rbtree_node_t            *node;
 } ngx_http_limit_conn_cleanup_t;
 
 
 typedef struct {
-    ngx_rbtree_t              *rbtree;
-    ngx_http_complex_value_t   key;
+    ngx_http_limit_conn_shard_t  *shards;
+    ngx_uint_t                    nshards;
+    ngx_http_complex_value_t      key;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -47,6 +55,8 @@ static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_str_t *key, uint32_t hash);
 static void ngx_http_limit_conn_cleanup(void *data);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
+static ngx_int_t ngx_http_limit_conn_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_conn_shard_t *shard);
 
 static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_conn_merge_conf(ngx_conf_t *cf, void *parent,
@@ -75,7 +85,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -151,6 +161,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
     ngx_http_limit_conn_node_t     *lc;
     ngx_http_limit_conn_conf_t     *lccf;
     ngx_http_limit_conn_limit_t    *limits;
+    ngx_http_limit_conn_shard_t    *shard;
     ngx_http_limit_conn_cleanup_t  *lccln;
 
     if (r->main->limit_conn_set) {
@@ -183,11 +194,12 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
-        shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
+        shard = &ctx->shards[hash % ctx->nshards];
+        shpool = shard->shpool;
 
         ngx_shmtx_lock(&shpool->mutex);
 
-        node = ngx_http_limit_conn_lookup(ctx->rbtree, &key, hash);
+        node = ngx_http_limit_conn_lookup(shard->rbtree, &key, hash);
 
         if (node == NULL) {
 
@@ -210,7 +222,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
             lc->conn = 1;
             ngx_memcpy(lc->data, key.data, key.len);
 
-            ngx_rbtree_insert(ctx->rbtree, node);
+            ngx_rbtree_insert(shard->rbtree, node);
 
         } else {
 
@@ -246,6 +258,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
         lccln = cln->data;
 
         lccln->shm_zone = limits[i].shm_zone;
+        lccln->shard = shard;
         lccln->node = node;
     }
 
@@ -340,11 +353,9 @@ ngx_http_limit_conn_cleanup(void *data)
 
     ngx_slab_pool_t             *shpool;
     ngx_rbtree_node_t           *node;
-    ngx_http_limit_conn_ctx_t   *ctx;
     ngx_http_limit_conn_node_t  *lc;
 
-    ctx = lccln->shm_zone->data;
-    shpool = (ngx_slab_pool_t *) lccln->shm_zone->shm.addr;
+    shpool = lccln->shard->shpool;
     node = lccln->node;
     lc = (ngx_http_limit_conn_node_t *) &node->color;
 
@@ -356,7 +367,7 @@ ngx_http_limit_conn_cleanup(void *data)
     lc->conn--;
 
     if (lc->conn == 0) {
-        ngx_rbtree_delete(ctx->rbtree, node);
+        ngx_rbtree_delete(lccln->shard->rbtree, node);
         ngx_slab_free_locked(shpool, node);
     }
 
@@ -385,9 +396,8 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_conn_ctx_t  *octx = data;
 
-    size_t                      len;
-    ngx_slab_pool_t            *shpool;
-    ngx_rbtree_node_t          *sentinel;
+    ngx_uint_t                  i;
+    ngx_slab_pool_t            *shpool, **pools;
     ngx_http_limit_conn_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -406,32 +416,95 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
-        ctx->rbtree = octx->rbtree;
+        if (ctx->nshards != octx->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->nshards, octx->nshards);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ctx->shards, octx->shards,
+                   ctx->nshards * sizeof(ngx_http_limit_conn_shard_t));
 
         return NGX_OK;
     }
 
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
+    if (ctx->nshards == 1) {
+        ctx->shards[0].shpool = shpool;
+
+    } else {
+
+        /*
+         * each shard is a separate slab pool with its own mutex,
+         * the zone pool keeps the array of the shard pools
+         */
+
+        if (shm_zone->shm.exists) {
+            pools = shpool->data;
+
+        } else {
+            pools = ngx_slab_alloc(shpool,
+                                   ctx->nshards * sizeof(ngx_slab_pool_t *));
+            if (pools == NULL) {
+                return NGX_ERROR;
+            }
+
+            shpool->data = pools;
+
+            if (ngx_slab_split(shpool, pools, ctx->nshards) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        for (i = 0; i < ctx->nshards; i++) {
+            ctx->shards[i].shpool = pools[i];
+        }
+    }
+
+    for (i = 0; i < ctx->nshards; i++) {
+        if (ngx_http_limit_conn_init_shard(shm_zone, &ctx->shards[i])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_limit_conn_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_limit_conn_shard_t *shard)
+{
+    size_t              len;
+    ngx_slab_pool_t    *shpool;
+    ngx_rbtree_node_t  *sentinel;
+
+    shpool = shard->shpool;
+
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+        shard->rbtree = shpool->data;
 
         return NGX_OK;
     }
 
-    ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
-    if (ctx->rbtree == NULL) {
+    shard->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
+    if (shard->rbtree == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = ctx->rbtree;
+    shpool->data = shard->rbtree;
 
     sentinel = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_node_t));
     if (sentinel == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_rbtree_init(ctx->rbtree, sentinel,
+    ngx_rbtree_init(shard->rbtree, sentinel,
                     ngx_http_limit_conn_rbtree_insert_value);
 
     len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
@@ -495,6 +568,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                            *p;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
+    ngx_int_t                          shards;
     ngx_uint_t                         i;
     ngx_shm_zone_t                    *shm_zone;
     ngx_http_limit_conn_ctx_t         *ctx;
@@ -518,6 +592,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     size = 0;
+    shards = 1;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
@@ -556,6 +631,19 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -568,6 +656,21 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (size / shards < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    ctx->nshards = shards;
+
+    ctx->shards = ngx_pcalloc(cf->pool,
+                              shards * sizeof(ngx_http_limit_conn_shard_t));
+    if (ctx->shards == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_conn_module);
     if (shm_zone == NULL) {
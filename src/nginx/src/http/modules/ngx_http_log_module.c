@@ -35,6 +35,13 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+
+#if (NGX_THREADS)
+    ngx_array_t                *fields;     /* array of ngx_http_log_field_t */
+    ngx_str_t                   definition;
+    size_t                      fixed;
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
+#endif
 } ngx_http_log_fmt_t;
 
 
@@ -55,6 +62,83 @@ typedef struct {
 } ngx_http_log_buf_t;
 
 
+#if (NGX_THREADS)
+
+/*
+ * Binary logs keep records in a per-worker ring, written to the file
+ * by a thread pool task.  The worker appends records at "tail" only
+ * outside of the data being written; "last" is the end of the data
+ * before the ring has wrapped, or NULL.
+ */
+
+typedef struct {
+    ngx_fd_t                    fd;
+    u_char                     *buf;
+    size_t                      size;
+    size_t                      written;
+    ngx_err_t                   err;
+    ngx_atomic_t                done;
+} ngx_http_log_ring_ctx_t;
+
+
+typedef struct {
+    u_char                     *start;
+    u_char                     *end;
+    u_char                     *head;
+    u_char                     *tail;
+    u_char                     *last;
+
+    ngx_open_file_t            *file;
+    ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t * */
+
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *task;
+
+    ngx_uint_t                  lost;
+    ngx_uint_t                  started;    /* unsigned  started:1 */
+} ngx_http_log_ring_t;
+
+
+typedef struct {
+    ngx_uint_t                  type;
+    ngx_int_t                   index;
+} ngx_http_log_field_t;
+
+
+/* field types, the ones in between are ngx_http_log_vars[] indices + 1 */
+
+#define NGX_HTTP_LOG_BIN_TEXT             0
+#define NGX_HTTP_LOG_BIN_PIPE             1
+#define NGX_HTTP_LOG_BIN_TIME_LOCAL       2
+#define NGX_HTTP_LOG_BIN_TIME_ISO8601     3
+#define NGX_HTTP_LOG_BIN_MSEC             4
+#define NGX_HTTP_LOG_BIN_REQUEST_TIME     5
+#define NGX_HTTP_LOG_BIN_STATUS           6
+#define NGX_HTTP_LOG_BIN_BYTES_SENT       7
+#define NGX_HTTP_LOG_BIN_BODY_BYTES_SENT  8
+#define NGX_HTTP_LOG_BIN_REQUEST_LENGTH   9
+#define NGX_HTTP_LOG_BIN_VARIABLE         10
+
+#define NGX_HTTP_LOG_BIN_FORMAT           0
+#define NGX_HTTP_LOG_BIN_ENTRY            1
+
+#define NGX_HTTP_LOG_BIN_MAGIC            0x4c58474e    /* "NGXL" */
+
+/* length, type, format id, pid, seconds, milliseconds and gmtoff */
+#define NGX_HTTP_LOG_BIN_ENTRY_HEADER     (4 + 1 + 2 + 4 + 8 + 2 + 2)
+
+/* length, type, magic, format id and pid */
+#define NGX_HTTP_LOG_BIN_FORMAT_HEADER    (4 + 1 + 4 + 2 + 4)
+
+#define NGX_HTTP_LOG_BIN_NOT_FOUND        0xffff
+#define NGX_HTTP_LOG_BIN_MAX_VALUE        0xfffe
+
+/* how long a flush waits for a write in progress, in milliseconds */
+#define NGX_HTTP_LOG_RING_FLUSH_WAIT      1000
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -69,6 +153,10 @@ typedef struct {
     ngx_syslog_peer_t          *syslog_peer;
     ngx_http_log_fmt_t         *format;
     ngx_http_complex_value_t   *filter;
+#if (NGX_THREADS)
+    ngx_http_log_ring_t        *ring;
+    ngx_uint_t                  id;
+#endif
 } ngx_http_log_t;
 
 
@@ -106,6 +194,21 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static void ngx_http_log_binary(ngx_http_request_t *r, ngx_http_log_t *log);
+static ngx_int_t ngx_http_log_ring_start(ngx_http_log_ring_t *ring,
+    ngx_log_t *log);
+static u_char *ngx_http_log_ring_reserve(ngx_http_log_ring_t *ring,
+    size_t len);
+static ngx_uint_t ngx_http_log_ring_chunk(ngx_http_log_ring_t *ring);
+static void ngx_http_log_ring_post(ngx_http_log_ring_t *ring, ngx_log_t *log);
+static void ngx_http_log_ring_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_ring_event_handler(ngx_event_t *ev);
+static void ngx_http_log_ring_complete(ngx_http_log_ring_t *ring,
+    ngx_log_t *log);
+static void ngx_http_log_ring_flush(ngx_open_file_t *file, ngx_log_t *log);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -148,6 +251,13 @@ static char *ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_log_compile_format(ngx_conf_t *cf,
     ngx_array_t *flushes, ngx_array_t *ops, ngx_array_t *args, ngx_uint_t s);
+static char *ngx_http_log_set_text(ngx_conf_t *cf, ngx_http_log_t *log);
+#if (NGX_THREADS)
+static char *ngx_http_log_set_ring(ngx_conf_t *cf, ngx_http_log_t *log,
+    size_t size, ngx_str_t *thread_pool);
+static ngx_int_t ngx_http_log_compile_binary(ngx_conf_t *cf,
+    ngx_http_log_fmt_t *fmt);
+#endif
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
@@ -289,6 +399,13 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         ngx_http_script_flush_no_cacheable_variables(r, log[l].format->flushes);
 
+#if (NGX_THREADS)
+        if (log[l].ring) {
+            ngx_http_log_binary(r, &log[l]);
+            continue;
+        }
+#endif
+
         len = 0;
         op = log[l].format->ops->elts;
         for (i = 0; i < log[l].format->ops->nelts; i++) {
@@ -312,7 +429,14 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         len += NGX_LINEFEED_SIZE;
 
-        buffer = log[l].file ? log[l].file->data : NULL;
+        /* the file data may be a binary log ring */
+
+        if (log[l].file && log[l].file->flush == ngx_http_log_flush) {
+            buffer = log[l].file->data;
+
+        } else {
+            buffer = NULL;
+        }
 
         if (buffer) {
 
@@ -409,7 +533,8 @@ ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log, u_char *buf,
         name = log->file->name.data;
 
 #if (NGX_ZLIB)
-        buffer = log->file->data;
+        buffer = (log->file->flush == ngx_http_log_flush) ? log->file->data
+                                                           : NULL;
 
         if (buffer && buffer->gzip) {
             n = ngx_http_log_gzip(log->file->fd, buf, len, buffer->gzip,
@@ -715,6 +840,12 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 
     buffer = file->data;
 
+    /* an unbuffered log */
+
+    if (buffer == NULL) {
+        return;
+    }
+
     len = buffer->pos - buffer->start;
 
     if (len == 0) {
@@ -760,6 +891,425 @@ ngx_http_log_flush_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_THREADS)
+
+static void
+ngx_http_log_binary(ngx_http_request_t *r, ngx_http_log_t *log)
+{
+    u_char                     *p;
+    size_t                      len;
+    int16_t                     i16;
+    uint16_t                    u16;
+    uint32_t                    u32;
+    uint64_t                    u64;
+    ngx_uint_t                  i;
+    ngx_time_t                 *tp;
+    ngx_msec_int_t              ms;
+    ngx_http_log_fmt_t         *fmt;
+    ngx_http_log_ring_t        *ring;
+    ngx_http_log_field_t       *field;
+    ngx_http_variable_value_t  *value;
+
+    ring = log->ring;
+    fmt = log->format;
+
+    if (!ring->started) {
+        if (ngx_http_log_ring_start(ring, r->connection->log) != NGX_OK) {
+            ring->lost++;
+            return;
+        }
+    }
+
+    len = fmt->fixed;
+
+    field = fmt->fields->elts;
+    for (i = 0; i < fmt->fields->nelts; i++) {
+
+        if (field[i].type != NGX_HTTP_LOG_BIN_VARIABLE) {
+            continue;
+        }
+
+        value = ngx_http_get_indexed_variable(r, field[i].index);
+
+        if (value && !value->not_found) {
+            len += ngx_min(value->len, NGX_HTTP_LOG_BIN_MAX_VALUE);
+        }
+    }
+
+    p = ngx_http_log_ring_reserve(ring, len);
+
+    if (p == NULL) {
+        ring->lost++;
+        return;
+    }
+
+    tp = ngx_timeofday();
+
+    u32 = (uint32_t) len;
+    p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+    *p++ = NGX_HTTP_LOG_BIN_ENTRY;
+    u16 = (uint16_t) log->id;
+    p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+    u32 = (uint32_t) ngx_pid;
+    p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+    u64 = (uint64_t) tp->sec;
+    p = ngx_cpymem(p, &u64, sizeof(uint64_t));
+    u16 = (uint16_t) tp->msec;
+    p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+    i16 = (int16_t) tp->gmtoff;
+    p = ngx_cpymem(p, &i16, sizeof(int16_t));
+
+    for (i = 0; i < fmt->fields->nelts; i++) {
+
+        switch (field[i].type) {
+
+        case NGX_HTTP_LOG_BIN_PIPE:
+            *p++ = r->pipeline ? 'p' : '.';
+            break;
+
+        case NGX_HTTP_LOG_BIN_REQUEST_TIME:
+            ms = (ngx_msec_int_t)
+                     ((tp->sec - r->start_sec) * 1000
+                      + (tp->msec - r->start_msec));
+            u32 = (uint32_t) ngx_max(ms, 0);
+            p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+            break;
+
+        case NGX_HTTP_LOG_BIN_STATUS:
+            if (r->err_status) {
+                u16 = (uint16_t) r->err_status;
+
+            } else if (r->headers_out.status) {
+                u16 = (uint16_t) r->headers_out.status;
+
+            } else if (r->http_version == NGX_HTTP_VERSION_9) {
+                u16 = 9;
+
+            } else {
+                u16 = 0;
+            }
+
+            p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+            break;
+
+        case NGX_HTTP_LOG_BIN_BYTES_SENT:
+            u64 = (uint64_t) r->connection->sent;
+            p = ngx_cpymem(p, &u64, sizeof(uint64_t));
+            break;
+
+        case NGX_HTTP_LOG_BIN_BODY_BYTES_SENT:
+            u64 = (r->connection->sent > (off_t) r->header_size)
+                  ? (uint64_t) (r->connection->sent - r->header_size) : 0;
+            p = ngx_cpymem(p, &u64, sizeof(uint64_t));
+            break;
+
+        case NGX_HTTP_LOG_BIN_REQUEST_LENGTH:
+            u64 = (uint64_t) r->request_length;
+            p = ngx_cpymem(p, &u64, sizeof(uint64_t));
+            break;
+
+        case NGX_HTTP_LOG_BIN_VARIABLE:
+            value = ngx_http_get_indexed_variable(r, field[i].index);
+
+            if (value == NULL || value->not_found) {
+                u16 = NGX_HTTP_LOG_BIN_NOT_FOUND;
+                p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+                break;
+            }
+
+            u16 = (uint16_t) ngx_min(value->len, NGX_HTTP_LOG_BIN_MAX_VALUE);
+            p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+            p = ngx_cpymem(p, value->data, u16);
+            break;
+
+        default: /* the time is in the header */
+            break;
+        }
+    }
+
+    ring->tail = p;
+
+    ngx_http_log_ring_post(ring, r->connection->log);
+}
+
+
+static ngx_int_t
+ngx_http_log_ring_start(ngx_http_log_ring_t *ring, ngx_log_t *log)
+{
+    u_char               *p;
+    size_t                len;
+    uint16_t              u16;
+    uint32_t              u32;
+    ngx_uint_t            i;
+    ngx_http_log_fmt_t  **fmt;
+
+    /* the definitions of the formats start each worker's records */
+
+    fmt = ring->formats.elts;
+
+    for (i = 0; i < ring->formats.nelts; i++) {
+
+        len = NGX_HTTP_LOG_BIN_FORMAT_HEADER + fmt[i]->definition.len;
+
+        p = ngx_http_log_ring_reserve(ring, len);
+
+        if (p == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "binary log \"%s\" buffer is too small",
+                          ring->file->name.data);
+            return NGX_ERROR;
+        }
+
+        u32 = (uint32_t) len;
+        p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+        *p++ = NGX_HTTP_LOG_BIN_FORMAT;
+        u32 = NGX_HTTP_LOG_BIN_MAGIC;
+        p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+        u16 = (uint16_t) i;
+        p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+        u32 = (uint32_t) ngx_pid;
+        p = ngx_cpymem(p, &u32, sizeof(uint32_t));
+        p = ngx_cpymem(p, fmt[i]->definition.data, fmt[i]->definition.len);
+
+        ring->tail = p;
+    }
+
+    ring->started = 1;
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_log_ring_reserve(ngx_http_log_ring_t *ring, size_t len)
+{
+    if (ring->head == ring->tail
+        && ring->last == NULL
+        && !ring->task->event.active)
+    {
+        ring->head = ring->start;
+        ring->tail = ring->start;
+    }
+
+    if (ring->last == NULL) {
+
+        /* the data are in between head and tail */
+
+        if ((size_t) (ring->end - ring->tail) >= len) {
+            return ring->tail;
+        }
+
+        if ((size_t) (ring->head - ring->start) >= len) {
+            ring->last = ring->tail;
+            ring->tail = ring->start;
+            return ring->start;
+        }
+
+        return NULL;
+    }
+
+    /* the data are in between head and last, and start and tail */
+
+    if ((size_t) (ring->head - ring->tail) >= len) {
+        return ring->tail;
+    }
+
+    return NULL;
+}
+
+
+static ngx_uint_t
+ngx_http_log_ring_chunk(ngx_http_log_ring_t *ring)
+{
+    u_char                   *last;
+    ngx_http_log_ring_ctx_t  *ctx;
+
+    if (ring->last && ring->head == ring->last) {
+        ring->head = ring->start;
+        ring->last = NULL;
+    }
+
+    last = ring->last ? ring->last : ring->tail;
+
+    if (last == ring->head) {
+        return 0;
+    }
+
+    ctx = ring->task->ctx;
+
+    ctx->fd = ring->file->fd;
+    ctx->buf = ring->head;
+    ctx->size = last - ring->head;
+    ctx->done = 0;
+
+    return 1;
+}
+
+
+static void
+ngx_http_log_ring_post(ngx_http_log_ring_t *ring, ngx_log_t *log)
+{
+    if (ring->task->event.active) {
+        return;
+    }
+
+    if (!ngx_http_log_ring_chunk(ring)) {
+        return;
+    }
+
+    if (ngx_thread_task_post(ring->thread_pool, ring->task) == NGX_OK) {
+        return;
+    }
+
+    /* write it in the worker */
+
+    ngx_http_log_ring_thread_handler(ring->task->ctx, log);
+    ngx_http_log_ring_complete(ring, log);
+}
+
+
+static void
+ngx_http_log_ring_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_ring_ctx_t *ctx = data;
+
+    u_char   *p;
+    size_t    size;
+    ssize_t   n;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "binary log write: %d, %uz", ctx->fd, ctx->size);
+
+    p = ctx->buf;
+    size = ctx->size;
+
+    ctx->err = 0;
+
+    while (size) {
+        n = ngx_write_fd(ctx->fd, p, size);
+
+        if (n == -1) {
+            ctx->err = ngx_errno;
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    ctx->written = p - ctx->buf;
+
+    ngx_memory_barrier();
+
+    ctx->done = 1;
+}
+
+
+static void
+ngx_http_log_ring_event_handler(ngx_event_t *ev)
+{
+    ngx_http_log_ring_t *ring = ev->data;
+
+    ngx_http_log_ring_complete(ring, ev->log);
+    ngx_http_log_ring_post(ring, ev->log);
+}
+
+
+static void
+ngx_http_log_ring_complete(ngx_http_log_ring_t *ring, ngx_log_t *log)
+{
+    ngx_http_log_ring_ctx_t  *ctx;
+
+    ctx = ring->task->ctx;
+
+    if (ctx->buf == NULL) {
+        return;
+    }
+
+    if (ctx->err) {
+        ngx_log_error(NGX_LOG_ALERT, log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ring->file->name.data);
+
+    } else if (ctx->written != ctx->size) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %uz of %uz",
+                      ring->file->name.data, ctx->written, ctx->size);
+    }
+
+    if (ring->lost) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "binary log \"%s\" buffer overflow, %ui records lost",
+                      ring->file->name.data, ring->lost);
+        ring->lost = 0;
+    }
+
+    ring->head = ctx->buf + ctx->size;
+    ctx->buf = NULL;
+
+    if (ring->head == ring->last) {
+        ring->head = ring->start;
+        ring->last = NULL;
+    }
+}
+
+
+static void
+ngx_http_log_ring_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_http_log_ring_t *ring = file->data;
+
+    ngx_uint_t                wait;
+    ngx_http_log_ring_ctx_t  *ctx;
+
+    ctx = ring->task->ctx;
+
+    if (ring->task->event.active) {
+
+        /* the completion handler is called later and finds nothing to do */
+
+        for (wait = 0; !ctx->done; wait++) {
+
+            if (wait == NGX_HTTP_LOG_RING_FLUSH_WAIT) {
+
+                /*
+                 * the task may wait behind others in the thread pool,
+                 * the rest is written by the completion handler if the
+                 * worker continues to run
+                 */
+
+                ngx_log_error(NGX_LOG_ALERT, log, 0,
+                              "binary log \"%s\" write has not completed, "
+                              "flush skipped", file->name.data);
+
+                ring->started = 0;
+                return;
+            }
+
+            ngx_msleep(1);
+            ngx_memory_barrier();
+        }
+    }
+
+    ngx_http_log_ring_complete(ring, log);
+
+    while (ngx_http_log_ring_chunk(ring)) {
+        ngx_http_log_ring_thread_handler(ctx, log);
+        ngx_http_log_ring_complete(ring, log);
+    }
+
+    /* the file may be reopened, the definitions go first there */
+
+    ring->started = 0;
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -1096,6 +1646,8 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    ngx_memzero(fmt, sizeof(ngx_http_log_fmt_t));
+
     ngx_str_set(&fmt->name, "combined");
 
     fmt->flushes = NULL;
@@ -1181,7 +1733,7 @@ ngx_http_log_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     log->format = &fmt[0];
     lmcf->combined_used = 1;
 
-    return NGX_CONF_OK;
+    return ngx_http_log_set_text(cf, log);
 }
 
 
@@ -1192,9 +1744,9 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ssize_t                            size;
     ngx_int_t                          gzip;
-    ngx_uint_t                         i, n;
+    ngx_uint_t                         i, n, binary;
     ngx_msec_t                         flush;
-    ngx_str_t                         *value, name, s;
+    ngx_str_t                         *value, name, s, *thread_pool;
     ngx_http_log_t                    *log;
     ngx_syslog_peer_t                 *peer;
     ngx_http_log_buf_t                *buffer;
@@ -1315,6 +1867,8 @@ process_formats:
     size = 0;
     flush = 0;
     gzip = 0;
+    binary = 0;
+    thread_pool = NULL;
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1381,6 +1935,31 @@ process_formats:
 #endif
         }
 
+        if (ngx_strcmp(value[i].data, "binary") == 0) {
+#if (NGX_THREADS)
+            binary = 1;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without threads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+#if (NGX_THREADS)
+            value[i].len -= 12;
+            value[i].data += 12;
+
+            thread_pool = &value[i];
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without threads support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1409,6 +1988,42 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (thread_pool && !binary) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"thread_pool\" requires binary access_log "
+                           "\"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_THREADS)
+
+    if (binary) {
+
+        if (log->script) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary logs cannot have variables in name");
+            return NGX_CONF_ERROR;
+        }
+
+        if (log->syslog_peer) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "logs to syslog cannot be binary");
+            return NGX_CONF_ERROR;
+        }
+
+        if (flush || gzip) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "binary logs cannot be flushed by timer "
+                               "or compressed");
+            return NGX_CONF_ERROR;
+        }
+
+        return ngx_http_log_set_ring(cf, log, size ? size : 1024 * 1024,
+                                     thread_pool);
+    }
+
+#endif
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1433,7 +2048,8 @@ process_formats:
         if (log->file->data) {
             buffer = log->file->data;
 
-            if (buffer->last - buffer->start != size
+            if (log->file->flush != ngx_http_log_flush
+                || buffer->last - buffer->start != size
                 || buffer->flush != flush
                 || buffer->gzip != gzip)
             {
@@ -1478,12 +2094,146 @@ process_formats:
 
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
+
+        return NGX_CONF_OK;
+    }
+
+    if (log->file) {
+        return ngx_http_log_set_text(cf, log);
     }
 
     return NGX_CONF_OK;
 }
 
 
+static char *
+ngx_http_log_set_text(ngx_conf_t *cf, ngx_http_log_t *log)
+{
+#if (NGX_THREADS)
+    if (log->file->flush == ngx_http_log_ring_flush) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "access_log \"%V\" is already defined as binary",
+                           &log->file->name);
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+    /* the file is marked as used by text logs for ngx_http_log_set_ring() */
+
+    if (log->file->flush == NULL) {
+        log->file->flush = ngx_http_log_flush;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static char *
+ngx_http_log_set_ring(ngx_conf_t *cf, ngx_http_log_t *log, size_t size,
+    ngx_str_t *thread_pool)
+{
+    ngx_uint_t            i;
+    ngx_thread_task_t    *task;
+    ngx_thread_pool_t    *tp;
+    ngx_http_log_fmt_t  **fmt;
+    ngx_http_log_ring_t  *ring;
+
+    tp = ngx_thread_pool_add(cf, thread_pool);
+    if (tp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->file->flush && log->file->flush != ngx_http_log_ring_flush) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "access_log \"%V\" is already defined as text",
+                           &log->file->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (log->file->data) {
+        ring = log->file->data;
+
+        if ((size_t) (ring->end - ring->start) != size
+            || ring->thread_pool != tp)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "access_log \"%V\" already defined "
+                               "with conflicting parameters",
+                               &log->file->name);
+            return NGX_CONF_ERROR;
+        }
+
+    } else {
+        ring = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_ring_t));
+        if (ring == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ring->start = ngx_pnalloc(cf->pool, size);
+        if (ring->start == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ring->end = ring->start + size;
+        ring->head = ring->start;
+        ring->tail = ring->start;
+
+        if (ngx_array_init(&ring->formats, cf->pool, 1,
+                           sizeof(ngx_http_log_fmt_t *))
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        task = ngx_thread_task_alloc(cf->pool,
+                                     sizeof(ngx_http_log_ring_ctx_t));
+        if (task == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        task->handler = ngx_http_log_ring_thread_handler;
+        task->event.handler = ngx_http_log_ring_event_handler;
+        task->event.data = ring;
+        task->event.log = &cf->cycle->new_log;
+
+        ring->file = log->file;
+        ring->thread_pool = tp;
+        ring->task = task;
+
+        log->file->flush = ngx_http_log_ring_flush;
+        log->file->data = ring;
+    }
+
+    fmt = ring->formats.elts;
+
+    for (i = 0; i < ring->formats.nelts; i++) {
+        if (fmt[i] == log->format) {
+            break;
+        }
+    }
+
+    if (i == ring->formats.nelts) {
+        fmt = ngx_array_push(&ring->formats);
+        if (fmt == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *fmt = log->format;
+    }
+
+    log->format->binary = 1;
+
+    log->ring = ring;
+    log->id = i;
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1512,6 +2262,8 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_memzero(fmt, sizeof(ngx_http_log_fmt_t));
+
     fmt->name = value[1];
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
@@ -1704,6 +2456,175 @@ invalid:
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_log_compile_binary(ngx_conf_t *cf, ngx_http_log_fmt_t *fmt)
+{
+    u_char                     *p;
+    size_t                      len;
+    uint16_t                    u16;
+    uintptr_t                   data;
+    ngx_uint_t                  i, k, json;
+    ngx_http_log_op_t          *op;
+    ngx_http_log_var_t         *v;
+    ngx_http_variable_t        *var;
+    ngx_http_log_field_t       *field;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    /*
+     * The definition of a format is the escaping followed by the format
+     * operations: a type byte, with the text or the variable name prefixed
+     * by its 16-bit length where applicable.  Entries have the fields
+     * in the same order, except text.
+     */
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    var = cmcf->variables.elts;
+
+    fmt->fields = ngx_array_create(cf->pool, 8, sizeof(ngx_http_log_field_t));
+    if (fmt->fields == NULL) {
+        return NGX_ERROR;
+    }
+
+    fmt->fixed = NGX_HTTP_LOG_BIN_ENTRY_HEADER;
+
+    len = 1;
+    json = 0;
+
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+
+        len++;
+
+        if (op[i].run == ngx_http_log_copy_short
+            || op[i].run == ngx_http_log_copy_long)
+        {
+            len += sizeof(uint16_t) + op[i].len;
+            continue;
+        }
+
+        field = ngx_array_push(fmt->fields);
+        if (field == NULL) {
+            return NGX_ERROR;
+        }
+
+        field->index = 0;
+
+        if (op[i].run == ngx_http_log_variable
+            || op[i].run == ngx_http_log_json_variable)
+        {
+            if (op[i].run == ngx_http_log_json_variable) {
+                json = 1;
+            }
+
+            field->type = NGX_HTTP_LOG_BIN_VARIABLE;
+            field->index = op[i].data;
+
+            len += sizeof(uint16_t) + var[op[i].data].name.len;
+            fmt->fixed += sizeof(uint16_t);
+
+            continue;
+        }
+
+        for (v = ngx_http_log_vars; v->name.len; v++) {
+            if (v->run == op[i].run) {
+                break;
+            }
+        }
+
+        if (v->name.len == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "log format \"%V\" cannot be binary",
+                               &fmt->name);
+            return NGX_ERROR;
+        }
+
+        field->type = v - ngx_http_log_vars + 1;
+
+        switch (field->type) {
+
+        case NGX_HTTP_LOG_BIN_PIPE:
+            fmt->fixed += 1;
+            break;
+
+        case NGX_HTTP_LOG_BIN_REQUEST_TIME:
+            fmt->fixed += sizeof(uint32_t);
+            break;
+
+        case NGX_HTTP_LOG_BIN_STATUS:
+            fmt->fixed += sizeof(uint16_t);
+            break;
+
+        case NGX_HTTP_LOG_BIN_BYTES_SENT:
+        case NGX_HTTP_LOG_BIN_BODY_BYTES_SENT:
+        case NGX_HTTP_LOG_BIN_REQUEST_LENGTH:
+            fmt->fixed += sizeof(uint64_t);
+            break;
+
+        default: /* the time is in the header */
+            break;
+        }
+    }
+
+    p = ngx_pnalloc(cf->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    fmt->definition.data = p;
+    fmt->definition.len = len;
+
+    *p++ = (u_char) json;
+
+    for (i = 0; i < fmt->ops->nelts; i++) {
+
+        if (op[i].run == ngx_http_log_copy_short) {
+            *p++ = NGX_HTTP_LOG_BIN_TEXT;
+            u16 = (uint16_t) op[i].len;
+            p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+
+            data = op[i].data;
+
+            for (k = 0; k < op[i].len; k++) {
+                *p++ = (u_char) (data & 0xff);
+                data >>= 8;
+            }
+
+            continue;
+        }
+
+        if (op[i].run == ngx_http_log_copy_long) {
+            *p++ = NGX_HTTP_LOG_BIN_TEXT;
+            u16 = (uint16_t) op[i].len;
+            p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+            p = ngx_cpymem(p, (u_char *) op[i].data, op[i].len);
+            continue;
+        }
+
+        if (op[i].run == ngx_http_log_variable
+            || op[i].run == ngx_http_log_json_variable)
+        {
+            *p++ = NGX_HTTP_LOG_BIN_VARIABLE;
+            u16 = (uint16_t) var[op[i].data].name.len;
+            p = ngx_cpymem(p, &u16, sizeof(uint16_t));
+            p = ngx_cpymem(p, var[op[i].data].name.data, u16);
+            continue;
+        }
+
+        for (v = ngx_http_log_vars; v->run != op[i].run; v++) {
+            /* void */
+        }
+
+        *p++ = (u_char) (v - ngx_http_log_vars + 1);
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static char *
 ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1821,6 +2742,9 @@ ngx_http_log_init(ngx_conf_t *cf)
     ngx_http_log_fmt_t         *fmt;
     ngx_http_log_main_conf_t   *lmcf;
     ngx_http_core_main_conf_t  *cmcf;
+#if (NGX_THREADS)
+    ngx_uint_t                  i;
+#endif
 
     lmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_log_module);
 
@@ -1844,6 +2768,20 @@ ngx_http_log_init(ngx_conf_t *cf)
         }
     }
 
+#if (NGX_THREADS)
+
+    fmt = lmcf->formats.elts;
+
+    for (i = 0; i < lmcf->formats.nelts; i++) {
+        if (fmt[i].binary) {
+            if (ngx_http_log_compile_binary(cf, &fmt[i]) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#endif
+
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
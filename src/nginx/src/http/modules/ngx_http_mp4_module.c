@@ -39,13 +39,43 @@
 
 #define NGX_HTTP_MP4_LAST_ATOM    NGX_HTTP_MP4_CO64_DATA
 
+#define NGX_HTTP_MP4_CACHE_STSZ   4
+
 
 typedef struct {
     size_t                buffer_size;
     size_t                max_buffer_size;
+    ngx_shm_zone_t       *index_cache;
 } ngx_http_mp4_conf_t;
 
 
+/*
+ * An index cache node keeps the file layout and the original "ftyp"
+ * atom and "moov" atom data, so a seek request to a cached file needs
+ * no file reads before the mdat data are sent.  The atoms are modified
+ * in place and are copied to the request, except for the sample sizes
+ * tables, which are only cut and are sent from the zone.  Nodes are
+ * keyed by the file name and validated by the file metadata.
+ */
+
+typedef struct {
+    ngx_shm_cache_node_t  node;
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
+    off_t                 size;
+    off_t                 moov_offset;
+    off_t                 mdat_last;
+    size_t                ftyp_size;
+    size_t                moov_size;
+    ngx_uint_t            nstsz;
+    size_t                stsz_start[NGX_HTTP_MP4_CACHE_STSZ];
+    size_t                stsz_end[NGX_HTTP_MP4_CACHE_STSZ];
+    unsigned              moov_first:1;
+    unsigned              ready:1;
+    u_char                data[1];
+} ngx_http_mp4_cache_node_t;
+
+
 typedef struct {
     u_char                chunk[4];
     u_char                samples[4];
@@ -131,6 +161,8 @@ typedef struct {
     ngx_uint_t            start;
     ngx_uint_t            length;
     uint32_t              timescale;
+    ngx_file_uniq_t       uniq;
+    time_t                mtime;
     ngx_http_request_t   *request;
     ngx_array_t           trak;
     ngx_http_mp4_trak_t   traks[2];
@@ -153,6 +185,10 @@ typedef struct {
 
     u_char                moov_atom_header[8];
     u_char                mdat_atom_header[16];
+
+    ngx_shm_cache_t            *cache;
+    ngx_http_mp4_cache_node_t  *cache_node;
+    u_char                     *cache_moov;
 } ngx_http_mp4_file_t;
 
 
@@ -219,6 +255,10 @@ static ngx_int_t ngx_http_mp4_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_mp4_atofp(u_char *line, size_t n, size_t point);
 
 static ngx_int_t ngx_http_mp4_process(ngx_http_mp4_file_t *mp4);
+static ngx_int_t ngx_http_mp4_cache_read(ngx_http_mp4_file_t *mp4);
+static void ngx_http_mp4_cache_write(ngx_http_mp4_file_t *mp4,
+    uint64_t atom_data_size);
+static void ngx_http_mp4_cache_done(ngx_http_mp4_file_t *mp4, ngx_int_t rc);
 static ngx_int_t ngx_http_mp4_read_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_atom_handler_t *atom, uint64_t atom_data_size);
 static ngx_int_t ngx_http_mp4_read(ngx_http_mp4_file_t *mp4, size_t size);
@@ -306,6 +346,10 @@ static void ngx_http_mp4_adjust_co64_atom(ngx_http_mp4_file_t *mp4,
     ngx_http_mp4_trak_t *trak, off_t adjustment);
 
 static char *ngx_http_mp4(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_mp4_index_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_mp4_index_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static void *ngx_http_mp4_create_conf(ngx_conf_t *cf);
 static char *ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child);
 
@@ -333,6 +377,20 @@ static ngx_command_t  ngx_http_mp4_commands[] = {
       offsetof(ngx_http_mp4_conf_t, max_buffer_size),
       NULL },
 
+    { ngx_string("mp4_index_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_mp4_index_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("mp4_index_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_mp4_index_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -572,6 +630,8 @@ ngx_http_mp4_handler(ngx_http_request_t *r)
         mp4->file.name = path;
         mp4->file.log = r->connection->log;
         mp4->end = of.size;
+        mp4->uniq = of.uniq;
+        mp4->mtime = of.mtime;
         mp4->start = (ngx_uint_t) start;
         mp4->length = length;
         mp4->request = r;
@@ -749,23 +809,39 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 
     mp4->buffer_size = conf->buffer_size;
 
-    rc = ngx_http_mp4_read_atom(mp4, ngx_http_mp4_atoms, mp4->end);
-    if (rc != NGX_OK) {
-        return rc;
+    if (conf->index_cache) {
+        mp4->cache = conf->index_cache->data;
+
+        rc = ngx_http_mp4_cache_read(mp4);
+
+    } else {
+        rc = NGX_DECLINED;
     }
 
-    if (mp4->trak.nelts == 0) {
-        ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
-                      "no mp4 trak atoms were found in \"%s\"",
-                      mp4->file.name.data);
-        return NGX_ERROR;
+    if (rc == NGX_DECLINED) {
+        rc = ngx_http_mp4_read_atom(mp4, ngx_http_mp4_atoms, mp4->end);
+
+        if (rc == NGX_OK && mp4->trak.nelts == 0) {
+            ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                          "no mp4 trak atoms were found in \"%s\"",
+                          mp4->file.name.data);
+            rc = NGX_ERROR;
+        }
+
+        if (rc == NGX_OK && mp4->mdat_atom.buf == NULL) {
+            ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
+                          "no mp4 mdat atom was found in \"%s\"",
+                          mp4->file.name.data);
+            rc = NGX_ERROR;
+        }
+
+        if (mp4->cache_node) {
+            ngx_http_mp4_cache_done(mp4, rc);
+        }
     }
 
-    if (mp4->mdat_atom.buf == NULL) {
-        ngx_log_error(NGX_LOG_ERR, mp4->file.log, 0,
-                      "no mp4 mdat atom was found in \"%s\"",
-                      mp4->file.name.data);
-        return NGX_ERROR;
+    if (rc != NGX_OK) {
+        return rc;
     }
 
     prev = &mp4->out;
@@ -886,6 +962,300 @@ ngx_http_mp4_process(ngx_http_mp4_file_t *mp4)
 }
 
 
+static ngx_int_t
+ngx_http_mp4_cache_read(ngx_http_mp4_file_t *mp4)
+{
+    u_char                     *p, *moov;
+    size_t                      pos;
+    uint32_t                    hash;
+    ngx_int_t                   rc;
+    ngx_buf_t                  *data;
+    ngx_uint_t                  i, n;
+    ngx_shm_cache_t            *cache;
+    ngx_pool_cleanup_t         *cln;
+    ngx_http_mp4_trak_t        *trak;
+    ngx_http_mp4_conf_t        *conf;
+    ngx_shm_cache_cleanup_t    *mccln;
+    ngx_http_mp4_cache_node_t  *node;
+
+    cache = mp4->cache;
+
+    hash = ngx_crc32_short(mp4->file.name.data, mp4->file.name.len);
+
+    cln = ngx_pool_cleanup_add(mp4->request->pool,
+                               sizeof(ngx_shm_cache_cleanup_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = (ngx_http_mp4_cache_node_t *)
+               ngx_shm_cache_lookup(cache, &mp4->file.name, hash);
+
+    if (node == NULL
+        || !node->ready
+        || node->uniq != mp4->uniq
+        || node->mtime != mp4->mtime
+        || node->size != mp4->end)
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                       "mp4 index cache miss: \"%V\"", &mp4->file.name);
+
+        return NGX_DECLINED;
+    }
+
+    if (node->moov_first && mp4->start == 0 && mp4->length == 0) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        /* send original file as ngx_http_mp4_read_moov_atom() does */
+
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(mp4->request, ngx_http_mp4_module);
+
+    if (node->moov_size > conf->max_buffer_size) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    /* the node is referenced until the response is sent */
+
+    ngx_shm_cache_hold(cache, &node->node);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    cln->handler = ngx_shm_cache_release;
+    mccln = cln->data;
+
+    mccln->cache = cache;
+    mccln->node = &node->node;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 index cache hit: \"%V\"", &mp4->file.name);
+
+    p = ngx_palloc(mp4->request->pool, node->ftyp_size + node->moov_size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (node->ftyp_size) {
+        ngx_memcpy(p, node->data, node->ftyp_size);
+
+        mp4->ftyp_atom_buf.temporary = 1;
+        mp4->ftyp_atom_buf.pos = p;
+        mp4->ftyp_atom_buf.last = p + node->ftyp_size;
+
+        mp4->ftyp_atom.buf = &mp4->ftyp_atom_buf;
+        mp4->ftyp_size = node->ftyp_size;
+        mp4->content_length = node->ftyp_size;
+
+        p += node->ftyp_size;
+    }
+
+    moov = node->data + node->ftyp_size;
+
+    pos = 0;
+
+    for (i = 0; i < node->nstsz; i++) {
+        ngx_memcpy(p + pos, moov + pos, node->stsz_start[i] - pos);
+        pos = node->stsz_end[i];
+    }
+
+    ngx_memcpy(p + pos, moov + pos, node->moov_size - pos);
+
+    mp4->buffer = p;
+    mp4->buffer_start = p;
+    mp4->buffer_pos = p;
+    mp4->buffer_end = p + node->moov_size;
+    mp4->buffer_size = node->moov_size;
+
+    data = &mp4->mdat_data_buf;
+    data->file = &mp4->file;
+    data->in_file = 1;
+    data->last_buf = (mp4->request == mp4->request->main) ? 1 : 0;
+    data->last_in_chain = 1;
+    data->file_last = node->mdat_last;
+
+    mp4->mdat_atom.buf = &mp4->mdat_atom_buf;
+    mp4->mdat_atom.next = &mp4->mdat_data;
+    mp4->mdat_data.buf = data;
+
+    mp4->offset = node->moov_offset;
+
+    /* the "moov" atom is parsed from the buffer without file reads */
+
+    mp4->cache = NULL;
+
+    rc = ngx_http_mp4_read_moov_atom(mp4, node->moov_size);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    /* the sample sizes tables not copied are used from the zone */
+
+    trak = mp4->trak.elts;
+    n = 0;
+
+    for (i = 0; i < mp4->trak.nelts; i++) {
+        data = trak[i].out[NGX_HTTP_MP4_STSZ_DATA].buf;
+
+        if (data == NULL) {
+            continue;
+        }
+
+        if (n == node->nstsz
+            || (size_t) (data->pos - p) != node->stsz_start[n]
+            || (size_t) (data->last - p) != node->stsz_end[n])
+        {
+            ngx_log_error(NGX_LOG_ALERT, mp4->file.log, 0,
+                          "mp4 index cache mismatch for \"%s\"",
+                          mp4->file.name.data);
+            return NGX_ERROR;
+        }
+
+        data->pos = moov + node->stsz_start[n];
+        data->last = moov + node->stsz_end[n];
+        data->temporary = 0;
+        data->memory = 1;
+
+        n++;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_mp4_cache_write(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
+{
+    u_char                     *p;
+    size_t                      size;
+    uint32_t                    hash;
+    ngx_shm_cache_t            *cache;
+    ngx_http_mp4_cache_node_t  *node;
+
+    cache = mp4->cache;
+
+    size = offsetof(ngx_http_mp4_cache_node_t, data)
+           + mp4->ftyp_size
+           + (size_t) atom_data_size;
+
+    hash = ngx_crc32_short(mp4->file.name.data, mp4->file.name.len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    node = (ngx_http_mp4_cache_node_t *)
+               ngx_shm_cache_lookup(cache, &mp4->file.name, hash);
+
+    if (node) {
+        if (node->node.count) {
+            /* the node is being stored or read */
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+
+        ngx_shm_cache_delete(cache, &node->node);
+    }
+
+    node = (ngx_http_mp4_cache_node_t *)
+               ngx_shm_cache_insert(cache, &mp4->file.name, hash, size);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    node->node.count = 1;
+    node->ready = 0;
+    node->uniq = mp4->uniq;
+    node->mtime = mp4->mtime;
+    node->size = mp4->end;
+    node->moov_offset = mp4->offset;
+    node->moov_first = (mp4->mdat_atom.buf == NULL);
+    node->ftyp_size = mp4->ftyp_size;
+    node->moov_size = (size_t) atom_data_size;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    /* the node is not used by others until it is ready */
+
+    p = node->data;
+
+    if (mp4->ftyp_size) {
+        p = ngx_cpymem(p, mp4->ftyp_atom_buf.pos, mp4->ftyp_size);
+    }
+
+    ngx_memcpy(p, ngx_mp4_atom_data(mp4), (size_t) atom_data_size);
+
+    mp4->cache_node = node;
+    mp4->cache_moov = ngx_mp4_atom_data(mp4);
+}
+
+
+static void
+ngx_http_mp4_cache_done(ngx_http_mp4_file_t *mp4, ngx_int_t rc)
+{
+    ngx_buf_t                  *data;
+    ngx_uint_t                  i;
+    ngx_shm_cache_t            *cache;
+    ngx_http_mp4_trak_t        *trak;
+    ngx_http_mp4_cache_node_t  *node;
+
+    cache = mp4->cache;
+    node = mp4->cache_node;
+
+    /* the sample sizes tables, in the order of the traks */
+
+    node->nstsz = 0;
+
+    if (rc == NGX_OK) {
+        trak = mp4->trak.elts;
+
+        for (i = 0; i < mp4->trak.nelts; i++) {
+            data = trak[i].out[NGX_HTTP_MP4_STSZ_DATA].buf;
+
+            if (data == NULL) {
+                continue;
+            }
+
+            if (node->nstsz == NGX_HTTP_MP4_CACHE_STSZ) {
+                node->nstsz = 0;
+                break;
+            }
+
+            node->stsz_start[node->nstsz] = data->pos - mp4->cache_moov;
+            node->stsz_end[node->nstsz] = data->last - mp4->cache_moov;
+            node->nstsz++;
+        }
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* an "ftyp" atom after the "moov" atom is not cached */
+
+    if (rc != NGX_OK || node->ftyp_size != mp4->ftyp_size) {
+        ngx_shm_cache_delete(cache, &node->node);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
+
+    node->mdat_last = mp4->mdat_data_buf.file_last;
+    node->ready = 1;
+    node->node.count--;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, mp4->file.log, 0,
+                   "mp4 index cache store: \"%V\", ftyp:%uz, moov:%uz",
+                   &mp4->file.name, node->ftyp_size, node->moov_size);
+}
+
+
 typedef struct {
     u_char    size[4];
     u_char    name[4];
@@ -1145,6 +1515,10 @@ ngx_http_mp4_read_moov_atom(ngx_http_mp4_file_t *mp4, uint64_t atom_data_size)
         return NGX_ERROR;
     }
 
+    if (mp4->cache && mp4->cache_node == NULL) {
+        ngx_http_mp4_cache_write(mp4, atom_data_size);
+    }
+
     mp4->trak.elts = &mp4->traks;
     mp4->trak.size = sizeof(ngx_http_mp4_trak_t);
     mp4->trak.nalloc = 2;
@@ -3529,6 +3903,7 @@ ngx_http_mp4_create_conf(ngx_conf_t *cf)
 
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
     conf->max_buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->index_cache = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -3544,5 +3919,48 @@ ngx_http_mp4_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->max_buffer_size, prev->max_buffer_size,
                               10 * 1024 * 1024);
 
+    ngx_conf_merge_ptr_value(conf->index_cache, prev->index_cache, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mp4_index_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    if (ngx_shm_cache_add(cf, 0, "mp4 index cache", &ngx_http_mp4_module)
+        == NULL)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mp4_index_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mp4_conf_t *mcf = conf;
+
+    ngx_str_t  *value;
+
+    if (mcf->index_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        mcf->index_cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    mcf->index_cache = ngx_shared_memory_add(cf, &value[1], 0,
+                                             &ngx_http_mp4_module);
+    if (mcf->index_cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
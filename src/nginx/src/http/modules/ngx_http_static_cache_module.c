@@ -0,0 +1,548 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The module keeps the contents of small static files in a shared memory
+ * zone.  A file is stored on a miss, when the static module serves it as
+ * is, and then is sent from the zone instead of the file.  The response
+ * header is built for each request from the file metadata, as the static
+ * module does, and passes through the filters.  Files are keyed by the
+ * location, the file name and whether the client accepts compressed
+ * responses, and are validated by the file metadata.
+ */
+
+
+typedef struct {
+    ngx_shm_cache_node_t            node;
+    ngx_file_uniq_t                 uniq;
+    time_t                          mtime;
+    off_t                           size;
+    ngx_uint_t                      ready;
+    u_char                          data[1];
+} ngx_http_static_cache_node_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *shm_zone;
+} ngx_http_static_cache_conf_t;
+
+
+typedef struct {
+    ngx_str_t                       key;
+    uint32_t                        hash;
+    ngx_str_t                       path;
+    ngx_fd_t                        fd;
+    ngx_file_uniq_t                 uniq;
+    time_t                          mtime;
+    off_t                           size;
+} ngx_http_static_cache_ctx_t;
+
+
+static ngx_int_t ngx_http_static_cache_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_static_cache_send(ngx_http_request_t *r,
+    ngx_shm_cache_t *zone, ngx_http_static_cache_node_t *node);
+static ngx_int_t ngx_http_static_cache_header_filter(ngx_http_request_t *r);
+static void ngx_http_static_cache_store(ngx_http_request_t *r,
+    ngx_http_static_cache_ctx_t *ctx);
+static void *ngx_http_static_cache_create_conf(ngx_conf_t *cf);
+static char *ngx_http_static_cache_merge_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_static_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_static_cache_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_static_cache_commands[] = {
+
+    { ngx_string("static_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_static_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("static_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_static_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_static_cache_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_static_cache_init,            /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_static_cache_create_conf,     /* create location configuration */
+    ngx_http_static_cache_merge_conf       /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_static_cache_module = {
+    NGX_MODULE_V1,
+    &ngx_http_static_cache_module_ctx,     /* module context */
+    ngx_http_static_cache_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+
+
+static ngx_int_t
+ngx_http_static_cache_handler(ngx_http_request_t *r)
+{
+    u_char                        *last;
+    size_t                         root;
+    ngx_str_t                      path;
+    ngx_open_file_info_t           of;
+    ngx_shm_cache_t               *zone;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_static_cache_ctx_t   *ctx;
+    ngx_http_static_cache_conf_t  *sccf;
+    ngx_http_static_cache_node_t  *node;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_DECLINED;
+    }
+
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    sccf = ngx_http_get_module_loc_conf(r, ngx_http_static_cache_module);
+
+    if (sccf->shm_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    /* responses which depend on the request are not cached */
+
+    if (r != r->main
+        || r->headers_in.range
+        || r->headers_in.if_modified_since
+        || r->headers_in.if_unmodified_since
+        || r->headers_in.if_match
+        || r->headers_in.if_none_match)
+    {
+        return NGX_DECLINED;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* errors are left to the static module */
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    zone = sccf->shm_zone->data;
+
+    if (!of.is_file || of.is_directio || of.size > (off_t) zone->max_object) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_static_cache_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->key.data = ngx_pnalloc(r->pool,
+                                NGX_INT_T_LEN + NGX_PTR_SIZE * 2 + 4
+                                + path.len);
+    if (ctx->key.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->key.len = ngx_sprintf(ctx->key.data, "%ui:%p:%d:%V",
+                               zone->generation, sccf,
+                               r->headers_in.accept_encoding ? 1 : 0, &path)
+                   - ctx->key.data;
+
+    ctx->hash = ngx_crc32_short(ctx->key.data, ctx->key.len);
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    node = (ngx_http_static_cache_node_t *)
+               ngx_shm_cache_lookup(zone, &ctx->key, ctx->hash);
+
+    if (node
+        && node->ready
+        && node->uniq == of.uniq
+        && node->mtime == of.mtime
+        && node->size == of.size)
+    {
+        ngx_shm_cache_hold(zone, &node->node);
+
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http static cache hit: \"%V\"", &ctx->key);
+
+        return ngx_http_static_cache_send(r, zone, node);
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache miss: \"%V\"", &ctx->key);
+
+    if (r->method != NGX_HTTP_GET) {
+        return NGX_DECLINED;
+    }
+
+    /* the file will be stored by the header filter */
+
+    ctx->path = path;
+    ctx->fd = of.fd;
+    ctx->uniq = of.uniq;
+    ctx->mtime = of.mtime;
+    ctx->size = of.size;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_static_cache_module);
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_send(ngx_http_request_t *r, ngx_shm_cache_t *zone,
+    ngx_http_static_cache_node_t *node)
+{
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_chain_t               out;
+    ngx_pool_cleanup_t       *cln;
+    ngx_shm_cache_cleanup_t  *sccln;
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_shm_cache_cleanup_t));
+    if (cln == NULL) {
+        ngx_shmtx_lock(&zone->shpool->mutex);
+        node->node.count--;
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    cln->handler = ngx_shm_cache_release;
+    sccln = cln->data;
+
+    sccln->cache = zone;
+    sccln->node = &node->node;
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    /* the header is built as ngx_http_static_handler() does */
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = node->size;
+    r->headers_out.last_modified_time = node->mtime;
+
+    if (ngx_http_set_etag(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->allow_ranges = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (node->size == 0) {
+        return ngx_http_send_special(r, NGX_HTTP_LAST);
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* the memory is read-only, filters that change it get a copy */
+
+    b->start = node->data;
+    b->pos = b->start;
+    b->end = b->start + node->size;
+    b->last = b->end;
+
+    b->memory = 1;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_header_filter(ngx_http_request_t *r)
+{
+    ngx_int_t                     rc;
+    ngx_http_static_cache_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_static_cache_module);
+
+    /* the file is stored if it is sent as is, as by the static module */
+
+    if (ctx == NULL
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.content_length_n != ctx->size
+        || r->headers_out.last_modified_time != ctx->mtime
+        || r->headers_out.content_encoding)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    rc = ngx_http_next_header_filter(r);
+
+    if (rc == NGX_ERROR || r->header_only) {
+        return rc;
+    }
+
+    ngx_http_static_cache_store(r, ctx);
+
+    return rc;
+}
+
+
+static void
+ngx_http_static_cache_store(ngx_http_request_t *r,
+    ngx_http_static_cache_ctx_t *ctx)
+{
+    ssize_t                        n;
+    ngx_file_t                     file;
+    ngx_shm_cache_t               *zone;
+    ngx_http_static_cache_conf_t  *sccf;
+    ngx_http_static_cache_node_t  *node;
+
+    sccf = ngx_http_get_module_loc_conf(r, ngx_http_static_cache_module);
+    zone = sccf->shm_zone->data;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    node = (ngx_http_static_cache_node_t *)
+               ngx_shm_cache_lookup(zone, &ctx->key, ctx->hash);
+
+    if (node) {
+        if (node->node.count) {
+            /* the response is being stored or sent */
+            ngx_shmtx_unlock(&zone->shpool->mutex);
+            return;
+        }
+
+        ngx_shm_cache_delete(zone, &node->node);
+    }
+
+    node = (ngx_http_static_cache_node_t *)
+               ngx_shm_cache_insert(zone, &ctx->key, ctx->hash,
+                                    offsetof(ngx_http_static_cache_node_t, data)
+                                    + ctx->size);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return;
+    }
+
+    node->node.count = 1;
+    node->ready = 0;
+    node->uniq = ctx->uniq;
+    node->mtime = ctx->mtime;
+    node->size = ctx->size;
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    /*
+     * the node is not used by others until it is ready; the file is read
+     * synchronously, as the header filter cannot wait for a thread or
+     * an aio read to complete, so a miss may block the worker on a file
+     * not in the page cache for up to max_object bytes
+     */
+
+    if (ctx->size) {
+        ngx_memzero(&file, sizeof(ngx_file_t));
+
+        file.fd = ctx->fd;
+        file.name = ctx->path;
+        file.log = r->connection->log;
+
+        n = ngx_read_file(&file, node->data, (size_t) ctx->size, 0);
+
+        if (n != (ssize_t) ctx->size) {
+            if (n != NGX_ERROR) {
+                ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                              ngx_read_file_n " read only %z of %O from \"%s\"",
+                              n, ctx->size, ctx->path.data);
+            }
+
+            ngx_shmtx_lock(&zone->shpool->mutex);
+            ngx_shm_cache_delete(zone, &node->node);
+            ngx_shmtx_unlock(&zone->shpool->mutex);
+
+            return;
+        }
+    }
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    node->ready = 1;
+    node->node.count--;
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache store: \"%V\", %O",
+                   &ctx->key, node->size);
+}
+
+
+static void *
+ngx_http_static_cache_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_static_cache_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_static_cache_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_static_cache_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_static_cache_conf_t *prev = parent;
+    ngx_http_static_cache_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_static_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    if (ngx_shm_cache_add(cf, 128 * 1024, "static cache",
+                          &ngx_http_static_cache_module)
+        == NULL)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_static_cache_conf_t *sccf = conf;
+
+    ngx_str_t  *value;
+
+    if (sccf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        sccf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    sccf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                           &ngx_http_static_cache_module);
+    if (sccf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_CONTENT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_static_cache_handler;
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_static_cache_header_filter;
+
+    return NGX_OK;
+}
@@ -22,9 +22,20 @@ typedef struct {
 } ngx_http_upstream_chash_points_t;
 
 
+typedef struct {
+    ngx_uint_t                          number;
+    ngx_http_upstream_rr_peer_t       **peer;
+    uint32_t                            slot[1];
+} ngx_http_upstream_maglev_t;
+
+
+#define NGX_HTTP_UPSTREAM_MAGLEV_SIZE  65537
+
+
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+    ngx_http_upstream_maglev_t         *maglev;
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -58,6 +69,13 @@ static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
 
+static ngx_int_t ngx_http_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc,
+    void *data);
+
 static void *ngx_http_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -242,7 +260,10 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        if (peer->max_conns
+            && ngx_http_upstream_rr_peer_conns(hp->rrp.peers, peer)
+               >= peer->max_conns)
+        {
             goto next;
         }
 
@@ -262,7 +283,7 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
+    ngx_http_upstream_rr_peer_shard(hp->rrp.peers, peer)->conns++;
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -494,6 +515,7 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     ngx_int_t                           total;
     ngx_uint_t                          i, n, best_i;
     ngx_http_upstream_rr_peer_t        *peer, *best;
+    ngx_http_upstream_rr_shard_t       *shard, *best_shard;
     ngx_http_upstream_chash_point_t    *point;
     ngx_http_upstream_chash_points_t   *points;
     ngx_http_upstream_hash_srv_conf_t  *hcf;
@@ -520,6 +542,7 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                        hp->hash, server);
 
         best = NULL;
+        best_shard = NULL;
         best_i = 0;
         total = 0;
 
@@ -552,25 +575,33 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->max_conns && peer->conns >= peer->max_conns) {
+            if (peer->max_conns
+                && ngx_http_upstream_rr_peer_conns(hp->rrp.peers, peer)
+                   >= peer->max_conns)
+            {
                 continue;
             }
 
-            peer->current_weight += peer->effective_weight;
-            total += peer->effective_weight;
+            shard = ngx_http_upstream_rr_peer_shard(hp->rrp.peers, peer);
 
-            if (peer->effective_weight < peer->weight) {
-                peer->effective_weight++;
+            shard->current_weight += shard->effective_weight;
+            total += shard->effective_weight;
+
+            if (shard->effective_weight < peer->weight) {
+                shard->effective_weight++;
             }
 
-            if (best == NULL || peer->current_weight > best->current_weight) {
+            if (best == NULL
+                || shard->current_weight > best_shard->current_weight)
+            {
                 best = peer;
+                best_shard = shard;
                 best_i = i;
             }
         }
 
         if (best) {
-            best->current_weight -= total;
+            best_shard->current_weight -= total;
             goto found;
         }
 
@@ -592,7 +623,7 @@ found:
     pc->socklen = best->socklen;
     pc->name = &best->name;
 
-    best->conns++;
+    best_shard->conns++;
 
     if (now - best->checked > best->fail_timeout) {
         best->checked = now;
@@ -609,6 +640,251 @@ found:
 }
 
 
+static ngx_int_t
+ngx_http_upstream_init_maglev(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    size_t                              size;
+    uint32_t                           *pos, *skip;
+    ngx_uint_t                          i, n, number, filled;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_maglev_t         *maglev;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_maglev_peer;
+
+    peers = us->peer.data;
+
+    /*
+     * The table size is a fixed prime: were it derived from the number
+     * of peers, adding or removing a peer could change the size and so
+     * move almost every key.  The price is a table larger than the ring
+     * of points below about 100 peers, and, with hundreds of peers, few
+     * slots per peer, so that removing a peer moves several times more
+     * keys than the ideal share.
+     */
+
+    number = NGX_HTTP_UPSTREAM_MAGLEV_SIZE;
+
+    size = sizeof(ngx_http_upstream_maglev_t)
+           + sizeof(uint32_t) * (number - 1);
+
+    maglev = ngx_palloc(cf->pool, size);
+    if (maglev == NULL) {
+        return NGX_ERROR;
+    }
+
+    maglev->number = number;
+    maglev->peer = NULL;
+
+    ngx_memset(maglev->slot, 0xff, sizeof(uint32_t) * number);
+
+    pos = ngx_palloc(cf->temp_pool, sizeof(uint32_t) * 2 * peers->number);
+    if (pos == NULL) {
+        return NGX_ERROR;
+    }
+
+    skip = pos + peers->number;
+
+    /*
+     * Each peer has its own permutation of slots, given by an offset
+     * and a step derived from the peer address.  Peers take turns to
+     * claim the next free slot of their permutations, as many per turn
+     * as their weight, until the table is full.  Removing a peer thus
+     * moves mostly the keys of its own slots.
+     */
+
+    for (peer = peers->peer, n = 0; peer; peer = peer->next, n++) {
+        pos[n] = ngx_crc32_long(peer->name.data, peer->name.len) % number;
+        skip[n] = ngx_murmur_hash2(peer->name.data, peer->name.len)
+                  % (number - 1) + 1;
+    }
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (peer = peers->peer, n = 0; peer; peer = peer->next, n++) {
+
+            for (i = 0; i < (ngx_uint_t) peer->weight; i++) {
+
+                while (maglev->slot[pos[n]] != (uint32_t) -1) {
+                    pos[n] = (pos[n] + skip[n]) % number;
+                }
+
+                maglev->slot[pos[n]] = n;
+                pos[n] = (pos[n] + skip[n]) % number;
+
+                if (++filled == number) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+    hcf->maglev = maglev;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_uint_t                           n;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_maglev_t          *maglev;
+    ngx_http_upstream_hash_srv_conf_t   *hcf;
+    ngx_http_upstream_hash_peer_data_t  *hp;
+
+    if (ngx_http_upstream_init_hash_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_maglev_peer;
+
+    hp = r->upstream->peer.data;
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    maglev = hcf->maglev;
+
+    if (maglev->peer == NULL) {
+
+        /*
+         * slots refer to peers by their index; the peers themselves
+         * may have been copied to a shared zone after configuration
+         */
+
+        ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
+
+        maglev->peer = ngx_palloc(ngx_cycle->pool,
+                                  sizeof(ngx_http_upstream_rr_peer_t *)
+                                  * hp->rrp.peers->number);
+        if (maglev->peer == NULL) {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+
+        for (peer = hp->rrp.peers->peer, n = 0; peer; peer = peer->next, n++)
+        {
+            maglev->peer[n] = peer;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+    }
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                        now;
+    uintptr_t                     m;
+    ngx_uint_t                    n, p;
+    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_maglev_t   *maglev;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get maglev hash peer, try: %ui", pc->tries);
+
+    ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
+
+    if (hp->tries > 20 || hp->rrp.peers->single) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    maglev = hp->conf->maglev;
+
+    for ( ;; ) {
+
+        /*
+         * an unavailable peer is replaced by the peer of the next slot,
+         * keys of other peers are not affected
+         */
+
+        p = maglev->slot[hp->hash % maglev->number];
+        peer = maglev->peer[p];
+
+        n = p / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+        if (hp->rrp.tried[n] & m) {
+            goto next;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get maglev hash peer, value:%uD, peer:%ui",
+                       hp->hash, p);
+
+        if (peer->down) {
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            goto next;
+        }
+
+        if (peer->max_conns
+            && ngx_http_upstream_rr_peer_conns(hp->rrp.peers, peer)
+               >= peer->max_conns)
+        {
+            goto next;
+        }
+
+        break;
+
+    next:
+
+        hp->hash++;
+
+        if (++hp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+    }
+
+    hp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    ngx_http_upstream_rr_peer_shard(hp->rrp.peers, peer)->conns++;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 {
@@ -620,6 +896,7 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = NULL;
 
     return conf;
 }
@@ -666,6 +943,9 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
         uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "consistent=maglev") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_maglev;
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
@@ -212,7 +212,10 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
             goto next;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        if (peer->max_conns
+            && ngx_http_upstream_rr_peer_conns(iphp->rrp.peers, peer)
+               >= peer->max_conns)
+        {
             goto next;
         }
 
@@ -232,7 +235,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
+    ngx_http_upstream_rr_peer_shard(iphp->rrp.peers, peer)->conns++;
 
     if (now - peer->checked > peer->fail_timeout) {
         peer->checked = now;
@@ -10,12 +10,48 @@
 #include <ngx_http.h>
 
 
+/*
+ * the counters of a worker process; the connections counter of a worker
+ * may go negative, as a connection opened by one worker may be handed
+ * over to and closed by another one
+ */
+
+typedef struct {
+    ngx_int_t                          connections;
+    ngx_int_t                          created;
+    ngx_int_t                          reused;
+    ngx_int_t                          received;
+} ngx_http_upstream_keepalive_stats_t;
+
+
+/*
+ * idle connections to a server address shared by the worker processes:
+ * a datagram socket pair, where descriptors are sent with SCM_RIGHTS
+ */
+
+typedef struct {
+    struct sockaddr                   *sockaddr;
+    socklen_t                          socklen;
+
+    ngx_socket_t                       fd[2];
+    ngx_atomic_t                      *queued;
+} ngx_http_upstream_keepalive_pool_t;
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
+    ngx_uint_t                         shared;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_array_t                       *pools;
+
+    ngx_shm_t                          shm;
+    u_char                            *stats;
+    size_t                             stats_size;
+    ngx_uint_t                         nstats;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -44,6 +80,9 @@ typedef struct {
     ngx_event_get_peer_pt              original_get_peer;
     ngx_event_free_peer_pt             original_free_peer;
 
+    /* the connection is counted in the connections of the worker */
+    unsigned                           counted:1;
+
 #if (NGX_HTTP_SSL)
     ngx_event_set_peer_session_pt      original_set_session;
     ngx_event_save_peer_session_pt     original_save_session;
@@ -52,6 +91,11 @@ typedef struct {
 } ngx_http_upstream_keepalive_peer_data_t;
 
 
+#define ngx_http_upstream_keepalive_stat(kcf)                                 \
+    ((ngx_http_upstream_keepalive_stats_t *)                                  \
+         ((kcf)->stats + ngx_worker * (kcf)->stats_size))
+
+
 static ngx_int_t ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
 static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
@@ -63,6 +107,17 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+static ngx_http_upstream_keepalive_pool_t *ngx_http_upstream_keepalive_pool(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, struct sockaddr *sockaddr,
+    socklen_t socklen);
+static ngx_int_t ngx_http_upstream_keepalive_hand_over(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item);
+static ngx_connection_t *ngx_http_upstream_keepalive_receive(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_peer_connection_t *pc);
+static ngx_connection_t *ngx_http_upstream_keepalive_adopt(ngx_socket_t s,
+    ngx_peer_connection_t *pc);
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -70,15 +125,22 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
     void *data);
 #endif
 
+static ngx_int_t ngx_http_upstream_keepalive_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_keepalive_add_variables(ngx_conf_t *cf);
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_int_t ngx_http_upstream_keepalive_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_keepalive_init_shared(ngx_cycle_t *cycle,
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_uint_t workers);
+static void ngx_http_upstream_keepalive_cleanup(void *data);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
       ngx_http_upstream_keepalive,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -89,7 +151,7 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
 
 static ngx_http_module_t  ngx_http_upstream_keepalive_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_keepalive_add_variables, /* preconfiguration */
     NULL,                                  /* postconfiguration */
 
     NULL,                                  /* create main configuration */
@@ -109,7 +171,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     ngx_http_upstream_keepalive_commands,    /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
+    ngx_http_upstream_keepalive_init_module, /* init module */
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
@@ -119,11 +181,43 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
 };
 
 
+static ngx_http_variable_t  ngx_http_upstream_keepalive_vars[] = {
+
+    { ngx_string("upstream_keepalive_connections"), NULL,
+      ngx_http_upstream_keepalive_variable,
+      offsetof(ngx_http_upstream_keepalive_stats_t, connections),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_created"), NULL,
+      ngx_http_upstream_keepalive_variable,
+      offsetof(ngx_http_upstream_keepalive_stats_t, created),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_reused"), NULL,
+      ngx_http_upstream_keepalive_variable,
+      offsetof(ngx_http_upstream_keepalive_stats_t, reused),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_received"), NULL,
+      ngx_http_upstream_keepalive_variable,
+      offsetof(ngx_http_upstream_keepalive_stats_t, received),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_keepalive_pooled"), NULL,
+      ngx_http_upstream_keepalive_variable,
+      (uintptr_t) -1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
 static ngx_int_t
 ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                               i;
+    ngx_uint_t                               i, j;
+    ngx_http_upstream_server_t              *server;
+    ngx_http_upstream_keepalive_pool_t      *pool;
     ngx_http_upstream_keepalive_srv_conf_t  *kcf;
     ngx_http_upstream_keepalive_cache_t     *cached;
 
@@ -157,6 +251,43 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         cached[i].conf = kcf;
     }
 
+    if (!kcf->shared || us->servers == NULL) {
+        return NGX_OK;
+    }
+
+    /* a pool for each server address, sockets are created in init module */
+
+    kcf->pools = ngx_array_create(cf->pool, 4,
+                                  sizeof(ngx_http_upstream_keepalive_pool_t));
+    if (kcf->pools == NULL) {
+        return NGX_ERROR;
+    }
+
+    server = us->servers->elts;
+
+    for (i = 0; i < us->servers->nelts; i++) {
+        for (j = 0; j < server[i].naddrs; j++) {
+
+            if (ngx_http_upstream_keepalive_pool(kcf,
+                                                 server[i].addrs[j].sockaddr,
+                                                 server[i].addrs[j].socklen))
+            {
+                continue;
+            }
+
+            pool = ngx_array_push(kcf->pools);
+            if (pool == NULL) {
+                return NGX_ERROR;
+            }
+
+            pool->sockaddr = server[i].addrs[j].sockaddr;
+            pool->socklen = server[i].addrs[j].socklen;
+            pool->fd[0] = (ngx_socket_t) -1;
+            pool->fd[1] = (ngx_socket_t) -1;
+            pool->queued = NULL;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -184,6 +315,7 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     }
 
     kp->conf = kcf;
+    kp->counted = 0;
     kp->upstream = r->upstream;
     kp->data = r->upstream->peer.data;
     kp->original_get_peer = r->upstream->peer.get;
@@ -210,9 +342,10 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_int_t          rc;
-    ngx_queue_t       *q, *cache;
-    ngx_connection_t  *c;
+    ngx_int_t                             rc;
+    ngx_queue_t                          *q, *cache;
+    ngx_connection_t                     *c;
+    ngx_http_upstream_keepalive_stats_t  *stat;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer");
@@ -247,6 +380,28 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         }
     }
 
+    stat = ngx_http_upstream_keepalive_stat(kp->conf);
+
+    /* an idle connection handed over by another worker process */
+
+    if (kp->conf->pools) {
+        c = ngx_http_upstream_keepalive_receive(kp->conf, pc);
+
+        if (c) {
+            stat->received++;
+            kp->counted = 1;
+
+            pc->connection = c;
+            pc->cached = 1;
+
+            return NGX_DONE;
+        }
+    }
+
+    stat->created++;
+    stat->connections++;
+    kp->counted = 1;
+
     return NGX_OK;
 
 found:
@@ -254,6 +409,9 @@ found:
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
+    ngx_http_upstream_keepalive_stat(kp->conf)->reused++;
+    kp->counted = 1;
+
     c->idle = 0;
     c->sent = 0;
     c->log = pc->log;
@@ -324,7 +482,12 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
-        ngx_http_upstream_keepalive_close(item->connection);
+        if (kp->conf->pools == NULL
+            || ngx_http_upstream_keepalive_hand_over(kp->conf, item) != NGX_OK)
+        {
+            ngx_http_upstream_keepalive_stat(kp->conf)->connections--;
+            ngx_http_upstream_keepalive_close(item->connection);
+        }
 
     } else {
         q = ngx_queue_head(&kp->conf->free);
@@ -338,6 +501,7 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     item->connection = c;
 
     pc->connection = NULL;
+    kp->counted = 0;
 
     if (c->read->timer_set) {
         ngx_del_timer(c->read);
@@ -363,8 +527,19 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
 
+    kp->original_free_peer(pc, kp->data, state);
+
+    return;
+
 invalid:
 
+    /* the connection, if any, is closed by the upstream */
+
+    if (kp->counted) {
+        ngx_http_upstream_keepalive_stat(kp->conf)->connections--;
+        kp->counted = 0;
+    }
+
     kp->original_free_peer(pc, kp->data, state);
 }
 
@@ -413,6 +588,8 @@ close:
     item = c->data;
     conf = item->conf;
 
+    ngx_http_upstream_keepalive_stat(conf)->connections--;
+
     ngx_http_upstream_keepalive_close(c);
 
     ngx_queue_remove(&item->queue);
@@ -443,6 +620,321 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+static ngx_http_upstream_keepalive_pool_t *
+ngx_http_upstream_keepalive_pool(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    struct sockaddr *sockaddr, socklen_t socklen)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    pool = kcf->pools->elts;
+
+    for (i = 0; i < kcf->pools->nelts; i++) {
+        if (ngx_memn2cmp((u_char *) pool[i].sockaddr, (u_char *) sockaddr,
+                         pool[i].socklen, socklen)
+            == 0)
+        {
+            return &pool[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_hand_over(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item)
+{
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+    u_char                               ch;
+    ssize_t                              n;
+    struct iovec                         iov[1];
+    struct msghdr                        msg;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    union {
+        struct cmsghdr                   cm;
+        char                             space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+
+    c = item->connection;
+
+#if (NGX_HTTP_SSL)
+
+    /* the SSL state is in the memory of the worker */
+
+    if (c->ssl) {
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    pool = ngx_http_upstream_keepalive_pool(kcf, (struct sockaddr *)
+                                            &item->sockaddr, item->socklen);
+    if (pool == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_atomic_fetch_add(pool->queued, 1) >= kcf->shared) {
+        (void) ngx_atomic_fetch_add(pool->queued, -1);
+        return NGX_DECLINED;
+    }
+
+    /*
+     * the socket stays open after the descriptor is closed,
+     * so it is explicitly removed from the events of the worker
+     */
+
+    if (ngx_del_conn) {
+        if (ngx_del_conn(c, 0) != NGX_OK) {
+            goto failed;
+        }
+
+    } else {
+        if (c->read->active || c->read->disabled) {
+            if (ngx_del_event(c->read, NGX_READ_EVENT, 0) != NGX_OK) {
+                goto failed;
+            }
+        }
+
+        if (c->write->active || c->write->disabled) {
+            if (ngx_del_event(c->write, NGX_WRITE_EVENT, 0) != NGX_OK) {
+                goto failed;
+            }
+        }
+    }
+
+    ngx_memzero(&cmsg, sizeof(cmsg));
+
+    cmsg.cm.cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg.cm.cmsg_level = SOL_SOCKET;
+    cmsg.cm.cmsg_type = SCM_RIGHTS;
+
+    ngx_memcpy(CMSG_DATA(&cmsg.cm), &c->fd, sizeof(int));
+
+    ch = 0;
+
+    iov[0].iov_base = (char *) &ch;
+    iov[0].iov_len = 1;
+
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = (caddr_t) &cmsg;
+    msg.msg_controllen = sizeof(cmsg);
+    msg.msg_flags = 0;
+
+    n = sendmsg(pool->fd[0], &msg, 0);
+
+    if (n == -1) {
+        if (ngx_errno != NGX_EAGAIN) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                          "sendmsg() of upstream connection failed");
+        }
+
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "keepalive connection %d handed over", c->fd);
+
+    ngx_destroy_pool(c->pool);
+    ngx_close_connection(c);
+
+    return NGX_OK;
+
+failed:
+
+    (void) ngx_atomic_fetch_add(pool->queued, -1);
+
+    return NGX_ERROR;
+
+#else
+
+    return NGX_DECLINED;
+
+#endif
+}
+
+
+static ngx_connection_t *
+ngx_http_upstream_keepalive_receive(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_peer_connection_t *pc)
+{
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+    int                                  fd;
+    u_char                               ch;
+    ssize_t                              n;
+    ngx_err_t                            err;
+    struct iovec                         iov[1];
+    struct msghdr                        msg;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    union {
+        struct cmsghdr                   cm;
+        char                             space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+
+    pool = ngx_http_upstream_keepalive_pool(kcf, pc->sockaddr, pc->socklen);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    while (*pool->queued) {
+
+        iov[0].iov_base = (char *) &ch;
+        iov[0].iov_len = 1;
+
+        msg.msg_name = NULL;
+        msg.msg_namelen = 0;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = (caddr_t) &cmsg;
+        msg.msg_controllen = sizeof(cmsg);
+
+        n = recvmsg(pool->fd[1], &msg, 0);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, pc->log, err,
+                              "recvmsg() of upstream connection failed");
+            }
+
+            return NULL;
+        }
+
+        (void) ngx_atomic_fetch_add(pool->queued, -1);
+
+        if (msg.msg_controllen < sizeof(struct cmsghdr)
+            || cmsg.cm.cmsg_len < (socklen_t) CMSG_LEN(sizeof(int))
+            || cmsg.cm.cmsg_level != SOL_SOCKET
+            || cmsg.cm.cmsg_type != SCM_RIGHTS)
+        {
+            ngx_log_error(NGX_LOG_ALERT, pc->log, 0,
+                          "recvmsg() returned no upstream connection");
+            return NULL;
+        }
+
+        ngx_memcpy(&fd, CMSG_DATA(&cmsg.cm), sizeof(int));
+
+        /* the server might have closed the connection while it was idle */
+
+        n = recv(fd, &ch, 1, MSG_PEEK);
+
+        if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+
+            c = ngx_http_upstream_keepalive_adopt(fd, pc);
+
+            if (c == NULL) {
+                ngx_http_upstream_keepalive_stat(kcf)->connections--;
+                return NULL;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                           "get keepalive peer: received connection %p, fd:%d",
+                           c, fd);
+
+            return c;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get keepalive peer: received closed connection %d",
+                       fd);
+
+        ngx_http_upstream_keepalive_stat(kcf)->connections--;
+
+        if (ngx_close_socket(fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, pc->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+    }
+
+#endif
+
+    return NULL;
+}
+
+
+static ngx_connection_t *
+ngx_http_upstream_keepalive_adopt(ngx_socket_t s, ngx_peer_connection_t *pc)
+{
+    ngx_int_t          event;
+    ngx_connection_t  *c;
+
+    /* as ngx_event_connect_peer() does for a connected socket */
+
+    c = ngx_get_connection(s, pc->log);
+
+    if (c == NULL) {
+        if (ngx_close_socket(s) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, pc->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        return NULL;
+    }
+
+    c->type = SOCK_STREAM;
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+
+    c->sendfile = 1;
+
+    if (pc->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+
+#if (NGX_SOLARIS)
+        /* Solaris's sendfilev() supports AF_NCA, AF_INET, and AF_INET6 */
+        c->sendfile = 0;
+#endif
+    }
+
+    c->log_error = pc->log_error;
+
+    c->read->log = pc->log;
+    c->write->log = pc->log;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    if (ngx_add_conn) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            goto failed;
+        }
+
+    } else {
+        event = (ngx_event_flags & NGX_USE_CLEAR_EVENT) ? NGX_CLEAR_EVENT:
+                                                          NGX_LEVEL_EVENT;
+
+        if (ngx_add_event(c->read, NGX_READ_EVENT, event) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    c->write->ready = 1;
+
+    return c;
+
+failed:
+
+    ngx_close_connection(c);
+
+    return NULL;
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -466,6 +958,95 @@ ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc, void *data)
 #endif
 
 
+static ngx_int_t
+ngx_http_upstream_keepalive_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                                  *p;
+    ngx_int_t                                n;
+    ngx_uint_t                               i;
+    ngx_http_upstream_srv_conf_t            *uscf;
+    ngx_http_upstream_keepalive_pool_t      *pool;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (r->upstream == NULL || r->upstream->upstream == NULL) {
+        goto not_found;
+    }
+
+    uscf = r->upstream->upstream;
+
+    if (uscf->srv_conf == NULL) {
+        goto not_found;
+    }
+
+    kcf = ngx_http_conf_upstream_srv_conf(uscf,
+                                          ngx_http_upstream_keepalive_module);
+
+    if (kcf->stats == NULL) {
+        goto not_found;
+    }
+
+    n = 0;
+
+    if (data == (uintptr_t) -1) {
+
+        if (kcf->pools) {
+            pool = kcf->pools->elts;
+
+            for (i = 0; i < kcf->pools->nelts; i++) {
+                n += *pool[i].queued;
+            }
+        }
+
+    } else {
+
+        /* the sum of the counters of all worker processes */
+
+        for (i = 0; i < kcf->nstats; i++) {
+            n += *(ngx_int_t *) (kcf->stats + i * kcf->stats_size + data);
+        }
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%i", n) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+
+not_found:
+
+    v->not_found = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_upstream_keepalive_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 {
@@ -483,6 +1064,9 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->shared = 0;
+     *     conf->pools = NULL;
+     *     conf->stats = NULL;
      */
 
     return conf;
@@ -517,6 +1101,33 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     kcf->max_cached = n;
 
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "shared=", 7) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+        n = ngx_atoi(value[2].data + 7, value[2].len - 7);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid value \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        kcf->shared = n;
+
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"shared\" is not supported on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
 
     kcf->original_init_upstream = uscf->peer.init_upstream
@@ -527,3 +1138,157 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_module(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                               i;
+    ngx_core_conf_t                         *ccf;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                            ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached == 0) {
+            continue;
+        }
+
+        if (ngx_http_upstream_keepalive_init_shared(cycle, kcf,
+                                                    ccf->worker_processes)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_keepalive_init_shared(ngx_cycle_t *cycle,
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, ngx_uint_t workers)
+{
+    u_char                              *p;
+    size_t                               size;
+    ngx_uint_t                           i, npools;
+    ngx_pool_cleanup_t                  *cln;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    /*
+     * the counters of each worker process are in a separate cache line,
+     * followed by the number of connections queued in each pool
+     */
+
+    npools = kcf->pools ? kcf->pools->nelts : 0;
+
+    kcf->stats_size = ngx_align(sizeof(ngx_http_upstream_keepalive_stats_t),
+                                ngx_cacheline_size);
+    kcf->nstats = workers;
+
+    size = kcf->stats_size * workers + npools * sizeof(ngx_atomic_t);
+
+    kcf->shm.size = size;
+    ngx_str_set(&kcf->shm.name, "nginx_upstream_keepalive");
+    kcf->shm.log = cycle->log;
+
+    if (ngx_shm_alloc(&kcf->shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (cln == NULL) {
+        ngx_shm_free(&kcf->shm);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_upstream_keepalive_cleanup;
+    cln->data = kcf;
+
+    kcf->stats = kcf->shm.addr;
+
+    p = kcf->stats + kcf->stats_size * workers;
+
+    if (npools == 0) {
+        return NGX_OK;
+    }
+
+    pool = kcf->pools->elts;
+
+    for (i = 0; i < npools; i++) {
+        pool[i].queued = (ngx_atomic_t *) p;
+        p += sizeof(ngx_atomic_t);
+
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pool[i].fd) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                          "socketpair() failed");
+            return NGX_ERROR;
+        }
+
+        if (ngx_nonblocking(pool[i].fd[0]) == -1
+            || ngx_nonblocking(pool[i].fd[1]) == -1)
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed");
+            return NGX_ERROR;
+        }
+
+        if (fcntl(pool[i].fd[0], F_SETFD, FD_CLOEXEC) == -1
+            || fcntl(pool[i].fd[1], F_SETFD, FD_CLOEXEC) == -1)
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "fcntl(FD_CLOEXEC) failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_cleanup(void *data)
+{
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf = data;
+
+    ngx_uint_t                           i;
+    ngx_http_upstream_keepalive_pool_t  *pool;
+
+    if (kcf->pools) {
+        pool = kcf->pools->elts;
+
+        for (i = 0; i < kcf->pools->nelts; i++) {
+
+            if (pool[i].fd[0] != (ngx_socket_t) -1) {
+                ngx_close_socket(pool[i].fd[0]);
+                pool[i].fd[0] = (ngx_socket_t) -1;
+            }
+
+            if (pool[i].fd[1] != (ngx_socket_t) -1) {
+                ngx_close_socket(pool[i].fd[1]);
+                pool[i].fd[1] = (ngx_socket_t) -1;
+            }
+        }
+    }
+
+    ngx_shm_free(&kcf->shm);
+}
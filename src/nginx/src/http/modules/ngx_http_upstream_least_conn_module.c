@@ -104,9 +104,10 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     time_t                         now;
     uintptr_t                      m;
     ngx_int_t                      rc, total;
-    ngx_uint_t                     i, n, p, many;
+    ngx_uint_t                     i, n, p, many, conns, best_conns;
     ngx_http_upstream_rr_peer_t   *peer, *best;
     ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_rr_shard_t  *shard, *best_shard;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get least conn peer, try: %ui", pc->tries);
@@ -130,6 +131,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 #if (NGX_SUPPRESS_WARN)
     many = 0;
     p = 0;
+    best_conns = 0;
 #endif
 
     for (peer = peers->peer, i = 0;
@@ -154,7 +156,9 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
             continue;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        conns = ngx_http_upstream_rr_peer_conns(peers, peer);
+
+        if (peer->max_conns && conns >= peer->max_conns) {
             continue;
         }
 
@@ -165,13 +169,14 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
          */
 
         if (best == NULL
-            || peer->conns * best->weight < best->conns * peer->weight)
+            || conns * best->weight < best_conns * peer->weight)
         {
             best = peer;
+            best_conns = conns;
             many = 0;
             p = i;
 
-        } else if (peer->conns * best->weight == best->conns * peer->weight) {
+        } else if (conns * best->weight == best_conns * peer->weight) {
             many = 1;
         }
     }
@@ -183,6 +188,8 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
         goto failed;
     }
 
+    best_shard = ngx_http_upstream_rr_peer_shard(peers, best);
+
     if (many) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "get least conn peer, many");
@@ -202,7 +209,9 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->conns * best->weight != best->conns * peer->weight) {
+            conns = ngx_http_upstream_rr_peer_conns(peers, peer);
+
+            if (conns * best->weight != best_conns * peer->weight) {
                 continue;
             }
 
@@ -213,25 +222,28 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
                 continue;
             }
 
-            if (peer->max_conns && peer->conns >= peer->max_conns) {
+            if (peer->max_conns && conns >= peer->max_conns) {
                 continue;
             }
 
-            peer->current_weight += peer->effective_weight;
-            total += peer->effective_weight;
+            shard = ngx_http_upstream_rr_peer_shard(peers, peer);
+
+            shard->current_weight += shard->effective_weight;
+            total += shard->effective_weight;
 
-            if (peer->effective_weight < peer->weight) {
-                peer->effective_weight++;
+            if (shard->effective_weight < peer->weight) {
+                shard->effective_weight++;
             }
 
-            if (peer->current_weight > best->current_weight) {
+            if (shard->current_weight > best_shard->current_weight) {
                 best = peer;
+                best_shard = shard;
                 p = i;
             }
         }
     }
 
-    best->current_weight -= total;
+    best_shard->current_weight -= total;
 
     if (now - best->checked > best->fail_timeout) {
         best->checked = now;
@@ -241,7 +253,7 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
     pc->socklen = best->socklen;
     pc->name = &best->name;
 
-    best->conns++;
+    best_shard->conns++;
 
     rrp->current = best;
 
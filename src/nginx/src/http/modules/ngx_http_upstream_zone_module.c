@@ -16,6 +16,10 @@ static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
+static ngx_int_t ngx_http_upstream_zone_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_zone_alloc_shards(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t nshards);
+static ngx_int_t ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -52,8 +56,8 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     ngx_http_upstream_zone_commands,       /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_module,    /* init module */
+    ngx_http_upstream_zone_init_process,   /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -244,3 +248,139 @@ done:
 
     return peers;
 }
+
+
+/*
+ * the weights and connections of the peers are kept by each worker process
+ * in its own slots, the slots of a worker fill whole cache lines
+ */
+
+static ngx_int_t
+ngx_http_upstream_zone_init_module(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i;
+    ngx_core_conf_t                *ccf;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+            if (ngx_http_upstream_zone_alloc_shards(peers,
+                                                    ccf->worker_processes)
+                != NGX_OK)
+            {
+                ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                              "could not allocate peer state of upstream "
+                              "\"%V\" in upstream zone \"%V\"",
+                              &uscf->host, &uscf->shm_zone->shm.name);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_alloc_shards(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t nshards)
+{
+    u_char                        *p;
+    size_t                         size;
+    ngx_uint_t                     i, n;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_shard_t  *shard;
+
+    size = ngx_align(peers->number * sizeof(ngx_http_upstream_rr_shard_t),
+                     ngx_cacheline_size);
+
+    p = ngx_slab_alloc(peers->shpool, size * nshards);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    peers->nshards = nshards;
+    peers->shard_size = size;
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+
+        peer->shard = (ngx_http_upstream_rr_shard_t *) p + i;
+
+        for (n = 0; n < nshards; n++) {
+            shard = (ngx_http_upstream_rr_shard_t *) (p + n * size) + i;
+
+            shard->current_weight = 0;
+            shard->effective_weight = peer->weight;
+            shard->conns = 0;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_rr_shard_t   *shard;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    /* a respawned worker clears the connections left by the exited one */
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+            for (peer = peers->peer; peer; peer = peer->next) {
+                shard = ngx_http_upstream_rr_peer_shard(peers, peer);
+
+                shard->current_weight = 0;
+                shard->effective_weight = peer->weight;
+                shard->conns = 0;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
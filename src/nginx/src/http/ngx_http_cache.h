@@ -36,6 +36,9 @@ typedef struct {
 } ngx_http_cache_valid_t;
 
 
+typedef struct ngx_http_file_cache_ram_s  ngx_http_file_cache_ram_t;
+
+
 typedef struct {
     ngx_rbtree_node_t                node;
     ngx_queue_t                      queue;
@@ -51,7 +54,8 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+    unsigned                         restored:1;
+                                     /* 9 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -59,6 +63,8 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+
+    ngx_http_file_cache_ram_t       *ram;
 } ngx_http_file_cache_node_t;
 
 
@@ -94,6 +100,7 @@ struct ngx_http_cache_s {
 
     ngx_http_file_cache_t           *file_cache;
     ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_ram_t       *ram;
 
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t               *thread_task;
@@ -120,6 +127,8 @@ struct ngx_http_cache_s {
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+
+    unsigned                         ram_lookup:1;
 };
 
 
@@ -146,11 +155,39 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
-    ngx_atomic_t                     cold;
-    ngx_atomic_t                     loading;
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+    ngx_slab_pool_t                 *shpool;
+
+    ngx_queue_t                      ram_queue;
+    size_t                           ram_size;
+    size_t                           ram_max;
+} ngx_http_file_cache_shard_t;
+
+
+/*
+ * a complete cache file of a small hot response kept in the shard pool,
+ * it is detached from the node when the file is replaced or deleted and
+ * freed when the last request sending it is finalized
+ */
+
+struct ngx_http_file_cache_ram_s {
+    ngx_queue_t                      queue;
+    ngx_http_file_cache_node_t      *node;
+    ngx_http_file_cache_shard_t     *shard;
+    ngx_uint_t                       count;
+    size_t                           size;
+    off_t                            length;
+    time_t                           valid_sec;
+    u_char                           data[1];
+};
+
+
+typedef struct {
+    ngx_atomic_t                     cold;
+    ngx_atomic_t                     loading;
+    ngx_http_file_cache_shard_t     *shards[1];
 } ngx_http_file_cache_sh_t;
 
 
@@ -158,6 +195,13 @@ struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
 
+    ngx_uint_t                       nshards;
+    ngx_uint_t                       shard;
+
+    size_t                           ram;
+    size_t                           ram_max_object;
+    ngx_uint_t                       ram_min_uses;
+
     ngx_path_t                      *path;
 
     off_t                            max_size;
@@ -177,6 +221,10 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+    ngx_str_t                        snapshot;
+    time_t                           snapshot_interval;
+    time_t                           snapshot_time;
+
     ngx_shm_zone_t                  *shm_zone;
 
     ngx_uint_t                       use_temp_path;
@@ -65,6 +65,9 @@ static char *ngx_http_core_try_files(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_INOTIFY)
+static ngx_int_t ngx_http_core_init_process(ngx_cycle_t *cycle);
+#endif
 static char *ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -672,7 +675,7 @@ static ngx_command_t  ngx_http_core_commands[] = {
       NULL },
 
     { ngx_string("open_file_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE123,
       ngx_http_core_open_file_cache,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_core_loc_conf_t, open_file_cache),
@@ -789,7 +792,11 @@ ngx_module_t  ngx_http_core_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
+#if (NGX_HAVE_INOTIFY)
+    ngx_http_core_init_process,            /* init process */
+#else
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -4960,7 +4967,7 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_core_loc_conf_t *clcf = conf;
 
     time_t       inactive;
-    ngx_str_t   *value, s;
+    ngx_str_t   *value, s, shared;
     ngx_int_t    max;
     ngx_uint_t   i;
 
@@ -4972,6 +4979,7 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     max = 0;
     inactive = 60;
+    ngx_str_null(&shared);
 
     for (i = 1; i < cf->args->nelts; i++) {
 
@@ -4998,6 +5006,23 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shared=", 7) == 0) {
+
+#if (NGX_HAVE_INOTIFY)
+
+            shared.len = value[i].len - 7;
+            shared.data = value[i].data + 7;
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"open_file_cache\" \"shared\" parameter "
+                               "is not supported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strcmp(value[i].data, "off") == 0) {
 
             clcf->open_file_cache = NULL;
@@ -5024,14 +5049,34 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     clcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
-    if (clcf->open_file_cache) {
-        return NGX_CONF_OK;
+    if (clcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
     }
 
-    return NGX_CONF_ERROR;
+#if (NGX_HAVE_INOTIFY)
+
+    if (shared.len) {
+        return ngx_open_file_cache_set_shared(cf, clcf->open_file_cache,
+                                              &shared, &ngx_http_core_module);
+    }
+
+#endif
+
+    return NGX_CONF_OK;
 }
 
 
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_int_t
+ngx_http_core_init_process(ngx_cycle_t *cycle)
+{
+    return ngx_open_file_cache_init_process(cycle);
+}
+
+#endif
+
+
 static char *
 ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
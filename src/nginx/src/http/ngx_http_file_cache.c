@@ -11,6 +11,28 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_CACHE_SNAPSHOT_VERSION  1
+
+
+typedef struct {
+    ngx_uint_t                       version;
+    size_t                           bsize;
+    time_t                           time;
+    ngx_uint_t                       number;
+} ngx_http_file_cache_snapshot_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    time_t                           valid_sec;
+    time_t                           expire;
+    size_t                           body_start;
+    off_t                            fs_size;
+    u_short                          uses;
+    u_short                          valid_msec;
+} ngx_http_file_cache_snapshot_node_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -33,7 +55,8 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard,
+    u_char *key);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary,
@@ -45,10 +68,13 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
-static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -62,7 +88,20 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
-static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_set_watermark(
+    ngx_http_file_cache_shard_t *shard);
+static ngx_int_t ngx_http_file_cache_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_shard_t **shardp, ngx_slab_pool_t *shpool);
+static void ngx_http_file_cache_restore(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
+static void ngx_http_file_cache_save(void *data);
+static void ngx_http_file_cache_ram_admit(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_http_file_cache_ram_t *ngx_http_file_cache_ram_alloc(
+    ngx_http_file_cache_shard_t *shard, ngx_uint_t uses, size_t size);
+static void ngx_http_file_cache_ram_drop(ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_ram_cleanup(void *data);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -79,14 +118,28 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+/* the last bytes of the key select the shard, the first ones are node keys */
+
+#define ngx_http_file_cache_shard(cache, key)                                 \
+    (cache)->sh->shards[((key)[NGX_HTTP_CACHE_KEY_LEN - 1]                    \
+                         | (key)[NGX_HTTP_CACHE_KEY_LEN - 2] << 8)            \
+                        % (cache)->nshards]
+
+
+/* the number of memory copies evicted to admit or to free a node */
+
+#define NGX_HTTP_FILE_CACHE_RAM_EVICT  8
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    ngx_uint_t                    n;
+    ngx_slab_pool_t             **pools;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     cache = shm_zone->data;
 
@@ -110,6 +163,15 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->nshards != ocache->nshards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, cache->nshards,
+                          ocache->nshards);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -117,6 +179,16 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
         cache->max_size /= cache->bsize;
 
+        /* the memory size may change while the zone size is the same */
+
+        for (n = 0; n < cache->nshards; n++) {
+            shard = cache->sh->shards[n];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
+            shard->ram_max = cache->ram / cache->nshards;
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+        }
+
         if (!cache->sh->cold || cache->sh->loading) {
             cache->path->loader = NULL;
         }
@@ -133,39 +205,104 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_sh_t));
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_file_cache_sh_t)
+                               + (cache->nshards - 1)
+                                 * sizeof(ngx_http_file_cache_shard_t *));
     if (cache->sh == NULL) {
         return NGX_ERROR;
     }
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
-
-    ngx_queue_init(&cache->sh->queue);
-
     cache->sh->cold = 1;
     cache->sh->loading = 0;
-    cache->sh->size = 0;
-    cache->sh->count = 0;
-    cache->sh->watermark = (ngx_uint_t) -1;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
 
+    pools = ngx_slab_alloc(cache->shpool,
+                           cache->nshards * sizeof(ngx_slab_pool_t *));
+    if (pools == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (cache->nshards == 1) {
+        pools[0] = cache->shpool;
+
+    } else {
+
+        /*
+         * each shard is a separate slab pool with its own mutex,
+         * the zone pool keeps the state shared by all shards
+         */
+
+        if (ngx_slab_split(cache->shpool, pools, cache->nshards) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    for (n = 0; n < cache->nshards; n++) {
+        if (ngx_http_file_cache_init_shard(shm_zone, &cache->sh->shards[n],
+                                           pools[n])
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (cache->snapshot.len) {
+        ngx_http_file_cache_restore(cache, shm_zone->shm.log);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_init_shard(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_shard_t **shardp, ngx_slab_pool_t *shpool)
+{
+    size_t                        len;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
+
+    cache = shm_zone->data;
+
+    shard = ngx_slab_alloc(shpool, sizeof(ngx_http_file_cache_shard_t));
+    if (shard == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&shard->queue);
+
+    shard->size = 0;
+    shard->count = 0;
+    shard->watermark = (ngx_uint_t) -1;
+    shard->shpool = shpool;
+
+    ngx_queue_init(&shard->ram_queue);
+
+    shard->ram_size = 0;
+    shard->ram_max = cache->ram / cache->nshards;
+
     len = sizeof(" in cache keys zone \"\"") + shm_zone->shm.name.len;
 
-    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
-    if (cache->shpool->log_ctx == NULL) {
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_sprintf(cache->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
+    ngx_sprintf(shpool->log_ctx, " in cache keys zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
-    cache->shpool->log_nomem = 0;
+    shpool->log_nomem = 0;
+
+    *shardp = shard;
 
     return NGX_OK;
 }
@@ -291,10 +428,24 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
         cln->handler = ngx_http_file_cache_cleanup;
         cln->data = c;
+
+        if (cache->ram_max_object) {
+            cln = ngx_pool_cleanup_add(r->pool, 0);
+            if (cln == NULL) {
+                return NGX_ERROR;
+            }
+
+            cln->handler = ngx_http_file_cache_ram_cleanup;
+            cln->data = c;
+
+            c->ram_lookup = 1;
+        }
     }
 
     rc = ngx_http_file_cache_exists(cache, c);
 
+    c->ram_lookup = 0;
+
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache exists: %i e:%d", rc, c->exists);
 
@@ -342,6 +493,23 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->ram) {
+
+        /* the file is in memory, it is neither opened nor read */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache ram: %O", c->ram->length);
+
+        c->length = c->ram->length;
+
+        c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+        if (c->buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        return ngx_http_file_cache_read(r, c);
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -401,8 +569,9 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_msec_t                 now, timer;
-    ngx_http_file_cache_t     *cache;
+    ngx_msec_t                    now, timer;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!c->lock) {
         return NGX_DECLINED;
@@ -411,8 +580,9 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
     now = ngx_current_msec;
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     timer = c->node->lock_time - now;
 
@@ -423,7 +593,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->lock_time = c->node->lock_time;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache lock u:%d wt:%M",
@@ -480,9 +650,10 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 static void
 ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_uint_t              wait;
-    ngx_msec_t              now, timer;
-    ngx_http_file_cache_t  *cache;
+    ngx_uint_t                    wait;
+    ngx_msec_t                    now, timer;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     now = ngx_current_msec;
 
@@ -496,9 +667,10 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
     }
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     timer = c->node->lock_time - now;
 
@@ -506,7 +678,7 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     if (wait) {
         ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
@@ -531,12 +703,19 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_int_t                      rc;
     ngx_uint_t                     i;
     ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->ram) {
+        n = (ssize_t) ngx_min((off_t) c->body_start, c->length);
+        ngx_memcpy(c->buf->pos, c->ram->data, n);
 
-    if (n < 0) {
-        return n;
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
     }
 
     if ((size_t) n < c->header_start) {
@@ -613,10 +792,11 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     r->cached = 1;
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -625,10 +805,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
-            cache->sh->size += c->fs_size;
+            shard->size += c->fs_size;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
     }
 
     now = ngx_time();
@@ -637,7 +817,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->stale_updating = c->valid_sec + c->updating_sec >= now;
         c->stale_error = c->valid_sec + c->error_sec >= now;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -649,7 +829,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -658,6 +838,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->ram_max_object && c->ram == NULL) {
+        ngx_http_file_cache_ram_admit(r, c);
+    }
+
     return NGX_OK;
 }
 
@@ -818,22 +1002,33 @@ ngx_http_cache_thread_event_handler(ngx_event_t *ev)
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                     rc;
+    ngx_uint_t                    n;
+    ngx_http_file_cache_ram_t    *ram;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     fcn = c->node;
 
     if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+        fcn = ngx_http_file_cache_lookup(shard, c->key);
     }
 
     if (fcn) {
         ngx_queue_remove(&fcn->queue);
 
         if (c->node == NULL) {
-            fcn->uses++;
+
+            /* the uses saturate to stay comparable for memory admission */
+
+            if (fcn->uses < 1023) {
+                fcn->uses++;
+            }
+
             fcn->count++;
         }
 
@@ -855,6 +1050,16 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
                 c->body_start = fcn->body_start;
             }
 
+            if (c->ram_lookup && fcn->exists && fcn->ram
+                && fcn->ram->valid_sec >= ngx_time())
+            {
+                c->ram = fcn->ram;
+                c->ram->count++;
+
+                ngx_queue_remove(&c->ram->queue);
+                ngx_queue_insert_head(&shard->ram_queue, &c->ram->queue);
+            }
+
             rc = NGX_OK;
 
             goto done;
@@ -865,35 +1070,52 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
-    fcn = ngx_slab_calloc_locked(cache->shpool,
+    fcn = ngx_slab_calloc_locked(shard->shpool,
                                  sizeof(ngx_http_file_cache_node_t));
+
+    /* memory copies of responses yield to the keys */
+
+    for (n = 0;
+         fcn == NULL && n < NGX_HTTP_FILE_CACHE_RAM_EVICT
+         && !ngx_queue_empty(&shard->ram_queue);
+         n++)
+    {
+        ram = ngx_queue_data(ngx_queue_last(&shard->ram_queue),
+                             ngx_http_file_cache_ram_t, queue);
+
+        ngx_http_file_cache_ram_drop(shard, ram->node);
+
+        fcn = ngx_slab_calloc_locked(shard->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+    }
+
     if (fcn == NULL) {
-        ngx_http_file_cache_set_watermark(cache);
+        ngx_http_file_cache_set_watermark(shard);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+        (void) ngx_http_file_cache_forced_expire(cache, shard);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
+        fcn = ngx_slab_calloc_locked(shard->shpool,
                                      sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", cache->shpool->log_ctx);
+                          "could not allocate node%s", shard->shpool->log_ctx);
             rc = NGX_ERROR;
             goto failed;
         }
     }
 
-    cache->sh->count++;
+    shard->count++;
 
     ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
     ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_rbtree_insert(&shard->rbtree, &fcn->node);
 
     fcn->uses = 1;
     fcn->count = 1;
@@ -902,6 +1124,8 @@ renew:
 
     rc = NGX_DECLINED;
 
+    ngx_http_file_cache_ram_drop(shard, fcn);
+
     fcn->valid_msec = 0;
     fcn->error = 0;
     fcn->exists = 0;
@@ -914,7 +1138,7 @@ done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
@@ -922,7 +1146,7 @@ done:
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return rc;
 }
@@ -964,7 +1188,7 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 
 
 static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key)
 {
     ngx_int_t                    rc;
     ngx_rbtree_key_t             node_key;
@@ -973,8 +1197,8 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -1206,7 +1430,8 @@ ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
 static ngx_int_t
 ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache reopen");
@@ -1219,13 +1444,16 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
     }
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     c->node->count--;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_ram_cleanup(c);
 
     c->secondary = 1;
     c->file.name.len = 0;
@@ -1305,7 +1533,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 static ngx_int_t
 ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!c->secondary) {
         return NGX_OK;
@@ -1323,17 +1552,18 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
      */
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache main key");
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     c->node->count--;
     c->node->updating = 0;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     c->file.name.len = 0;
 
@@ -1354,13 +1584,14 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 void
 ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+    off_t                         fs_size;
+    ngx_int_t                     rc;
+    ngx_file_uniq_t               uniq;
+    ngx_file_info_t               fi;
+    ngx_http_cache_t             *c;
+    ngx_ext_rename_file_t         ext;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     c = r->cache;
 
@@ -1406,23 +1637,28 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    ngx_http_file_cache_ram_drop(shard, c->node);
 
     c->node->count--;
     c->node->error = 0;
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
 
-    cache->sh->size += fs_size - c->node->fs_size;
+    shard->size += fs_size - c->node->fs_size;
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
         c->node->exists = 1;
+        c->node->restored = 0;
     }
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 }
 
 
@@ -1434,6 +1670,8 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     ngx_file_t                     file;
     ngx_file_info_t                fi;
     ngx_http_cache_t              *c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
     ngx_http_file_cache_header_t   h;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1549,6 +1787,19 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    cache = c->file_cache;
+
+    if (cache->ram_max_object) {
+
+        /* the memory copy has the old header */
+
+        shard = ngx_http_file_cache_shard(cache, c->key);
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+        ngx_http_file_cache_ram_drop(shard, c->node);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1582,9 +1833,11 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (c->ram == NULL) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
     rc = ngx_http_send_header(r);
@@ -1593,16 +1846,28 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
-
-    b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    if (c->ram) {
+
+        /* the body is sent from the shared memory */
+
+        b->pos = c->ram->data + c->body_start;
+        b->last = c->ram->data + c->length;
+
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
 
     out.buf = b;
     out.next = NULL;
@@ -1614,19 +1879,21 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (c->updated || c->node == NULL) {
         return;
     }
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     fcn = c->node;
     fcn->count--;
@@ -1645,13 +1912,13 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->count--;
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     c->updated = 1;
     c->updating = 0;
@@ -1698,7 +1965,8 @@ ngx_http_file_cache_cleanup(void *data)
 
 
 static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard)
 {
     u_char                      *name;
     size_t                       len;
@@ -1724,10 +1992,10 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     wait = 10;
     tries = 20;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
+    for (q = ngx_queue_last(&shard->queue);
+         q != ngx_queue_sentinel(&shard->queue);
          q = ngx_queue_prev(q))
     {
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
@@ -1738,7 +2006,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, shard, q, name);
             wait = 0;
 
         } else {
@@ -1752,7 +2020,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
         break;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     ngx_free(name);
 
@@ -1763,14 +2031,11 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 static time_t
 ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_msec_t                   elapsed;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    u_char      *name;
+    size_t       len;
+    time_t       now, wait, w;
+    ngx_uint_t   n;
+    ngx_path_t  *path;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache expire");
@@ -1786,8 +2051,48 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
     ngx_memcpy(name, path->name.data, path->name.len);
 
     now = ngx_time();
+    wait = 10;
+
+    /*
+     * shards are expired in turn, the next call resumes with the shard
+     * where the manager ran out of its files or time limits
+     */
+
+    for (n = 0; n < cache->nshards; n++) {
+
+        w = ngx_http_file_cache_expire_shard(cache,
+                                             cache->sh->shards[cache->shard],
+                                             name, now);
+        if (w < wait) {
+            wait = w;
+        }
+
+        if (wait == 0 || ngx_quit || ngx_terminate) {
+            break;
+        }
+
+        cache->shard = (cache->shard + 1) % cache->nshards;
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+
+static time_t
+ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name, time_t now)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       wait;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     for ( ;; ) {
 
@@ -1796,12 +2101,12 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
             break;
         }
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        if (ngx_queue_empty(&shard->queue)) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        q = ngx_queue_last(&shard->queue);
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
@@ -1818,7 +2123,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
                        fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, shard, q, name);
             goto next;
         }
 
@@ -1840,7 +2145,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
@@ -1863,17 +2168,15 @@ next:
         }
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return wait;
 }
 
 
 static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name)
 {
     u_char                      *p;
     size_t                       len;
@@ -1882,8 +2185,10 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
+    ngx_http_file_cache_ram_drop(shard, fcn);
+
     if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        shard->size -= fcn->fs_size;
 
         path = cache->path;
         p = name + path->name.len + 1 + path->len;
@@ -1895,7 +2200,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
 
         fcn->count++;
         fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
@@ -1908,16 +2213,16 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
     }
 
     if (fcn->count == 0) {
         ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->count--;
     }
 }
 
@@ -1927,10 +2232,25 @@ ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    off_t       size;
-    time_t      wait;
-    ngx_msec_t  elapsed, next;
-    ngx_uint_t  count, watermark;
+    off_t                         size, total, max;
+    time_t                        wait, expire;
+    ngx_msec_t                    elapsed, next;
+    ngx_uint_t                    n, count, watermark;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard, *full, *oldest;
+
+    if (cache->snapshot.len) {
+
+        if (cache->snapshot_time == 0) {
+            cache->snapshot_time = ngx_time();
+
+        } else if (ngx_time() - cache->snapshot_time
+                   >= cache->snapshot_interval)
+        {
+            ngx_http_file_cache_save(cache);
+            ngx_time_update();
+        }
+    }
 
     cache->last = ngx_current_msec;
     cache->files = 0;
@@ -1943,23 +2263,70 @@ ngx_http_file_cache_manager(void *data)
     }
 
     for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
 
-        size = cache->sh->size;
-        count = cache->sh->count;
-        watermark = cache->sh->watermark;
+        /*
+         * the size is the sum of the shard sizes, each one is read
+         * under its own mutex, so the total is approximate
+         */
+
+        total = 0;
+        expire = 0;
+        max = 0;
+        full = NULL;
+        oldest = NULL;
+
+        for (n = 0; n < cache->nshards; n++) {
+            shard = cache->sh->shards[n];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
+
+            size = shard->size;
+            count = shard->count;
+            watermark = shard->watermark;
+
+            if (!ngx_queue_empty(&shard->queue)) {
+                fcn = ngx_queue_data(ngx_queue_last(&shard->queue),
+                                     ngx_http_file_cache_node_t, queue);
+
+                /* of equally old shards the largest one is chosen */
+
+                if (oldest == NULL
+                    || fcn->expire < expire
+                    || (fcn->expire == expire && size > max))
+                {
+                    oldest = shard;
+                    expire = fcn->expire;
+                    max = size;
+                }
+            }
+
+            ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache size: %O c:%ui w:%i s:%ui",
+                           size, count, (ngx_int_t) watermark, n);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+            total += size;
 
-        if (size < cache->max_size && count < watermark) {
+            if (count >= watermark) {
+                full = shard;
+            }
+        }
+
+        if (full) {
+            shard = full;
+
+        } else if (total >= cache->max_size && oldest) {
+
+            /* the shard with the least recently used node */
+
+            shard = oldest;
+
+        } else {
             break;
         }
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+        wait = ngx_http_file_cache_forced_expire(cache, shard);
 
         if (wait > 0) {
             next = (ngx_msec_t) wait * 1000;
@@ -2002,7 +2369,12 @@ ngx_http_file_cache_loader(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    ngx_tree_ctx_t  tree;
+    off_t                         size;
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q;
+    ngx_tree_ctx_t                tree;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!cache->sh->cold || cache->sh->loading) {
         return;
@@ -2032,13 +2404,55 @@ ngx_http_file_cache_loader(void *data)
         return;
     }
 
+    size = 0;
+
+    for (n = 0; n < cache->nshards; n++) {
+        shard = cache->sh->shards[n];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        if (cache->snapshot.len) {
+
+            /*
+             * entries restored from a snapshot whose files were not found
+             * by the walk were removed after the snapshot had been saved
+             */
+
+            q = ngx_queue_head(&shard->queue);
+
+            while (q != ngx_queue_sentinel(&shard->queue)) {
+                fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+                q = ngx_queue_next(q);
+
+                if (!fcn->restored || fcn->count) {
+                    continue;
+                }
+
+                if (fcn->exists) {
+                    shard->size -= fcn->fs_size;
+                }
+
+                ngx_http_file_cache_ram_drop(shard, fcn);
+
+                ngx_queue_remove(&fcn->queue);
+                ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+                ngx_slab_free_locked(shard->shpool, fcn);
+                shard->count--;
+            }
+        }
+
+        size += shard->size;
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
     cache->sh->cold = 0;
     cache->sh->loading = 0;
 
     ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
                   "http file cache: %V %.3fM, bsize: %uz",
                   &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  ((double) size * cache->bsize) / (1024 * 1024),
                   cache->bsize);
 }
 
@@ -2164,43 +2578,61 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
 static ngx_int_t
 ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
     if (fcn == NULL) {
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
+        fcn = ngx_slab_calloc_locked(shard->shpool,
                                      sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+            ngx_http_file_cache_set_watermark(shard);
 
             if (cache->fail_time != ngx_time()) {
                 cache->fail_time = ngx_time();
                 ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
+                           "could not allocate node%s", shard->shpool->log_ctx);
             }
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
             return NGX_ERROR;
         }
 
-        cache->sh->count++;
+        shard->count++;
 
         ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
         ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                    NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        ngx_rbtree_insert(&shard->rbtree, &fcn->node);
 
         fcn->uses = 1;
         fcn->exists = 1;
         fcn->fs_size = c->fs_size;
 
-        cache->sh->size += c->fs_size;
+        shard->size += c->fs_size;
+
+    } else if (fcn->restored) {
+
+        /* keep the restored position in the queue, correct the size */
+
+        fcn->restored = 0;
+
+        if (fcn->exists) {
+            shard->size += c->fs_size - fcn->fs_size;
+            fcn->fs_size = c->fs_size;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        return NGX_OK;
 
     } else {
         ngx_queue_remove(&fcn->queue);
@@ -2208,9 +2640,9 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return NGX_OK;
 }
@@ -2232,54 +2664,573 @@ ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 
 
 static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_shard_t *shard)
 {
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    shard->watermark = shard->count - shard->count / 8;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+                   "http file cache watermark: %ui", shard->watermark);
 }
 
 
-time_t
-ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+static void
+ngx_http_file_cache_restore(ngx_http_file_cache_t *cache, ngx_log_t *log)
 {
-    ngx_uint_t               i;
-    ngx_http_cache_valid_t  *valid;
+    u_char                                 *buf;
+    size_t                                  size, len;
+    time_t                                  now, expire;
+    ssize_t                                 n;
+    ngx_fd_t                                fd;
+    ngx_uint_t                              i, restored, nomem;
+    ngx_file_info_t                         fi;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_shard_t            *shard;
+    ngx_http_file_cache_snapshot_node_t    *sn;
+    ngx_http_file_cache_snapshot_header_t  *h;
+
+    fd = ngx_open_file(cache->snapshot.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed",
+                          cache->snapshot.data);
+        }
 
-    if (cache_valid == NULL) {
-        return 0;
+        return;
     }
 
-    valid = cache_valid->elts;
-    for (i = 0; i < cache_valid->nelts; i++) {
+    buf = NULL;
 
-        if (valid[i].status == 0) {
-            return valid[i].valid;
-        }
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", cache->snapshot.data);
+        goto done;
+    }
 
-        if (valid[i].status == status) {
-            return valid[i].valid;
-        }
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_file_cache_snapshot_header_t)) {
+        goto invalid;
     }
 
-    return 0;
-}
+    buf = ngx_alloc(size, log);
+    if (buf == NULL) {
+        goto done;
+    }
 
+    for (len = 0; len < size; len += n) {
+        n = ngx_read_fd(fd, buf + len, size - len);
 
-char *
-ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_read_fd_n " \"%s\" failed",
+                          cache->snapshot.data);
+            goto done;
+        }
+
+        if (n == 0) {
+            goto invalid;
+        }
+    }
+
+    h = (ngx_http_file_cache_snapshot_header_t *) buf;
+
+    if (h->version != NGX_HTTP_CACHE_SNAPSHOT_VERSION
+        || h->bsize != cache->bsize
+        || size != sizeof(ngx_http_file_cache_snapshot_header_t)
+                   + h->number * sizeof(ngx_http_file_cache_snapshot_node_t))
+    {
+        goto invalid;
+    }
+
+    sn = (ngx_http_file_cache_snapshot_node_t *)
+             (buf + sizeof(ngx_http_file_cache_snapshot_header_t));
+
+    now = ngx_time();
+    restored = 0;
+    nomem = 0;
+
+    /* nodes are saved from the most recently used one in each shard */
+
+    for (i = 0; i < h->number; i++, sn++) {
+
+        shard = ngx_http_file_cache_shard(cache, sn->key);
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        if (ngx_http_file_cache_lookup(shard, sn->key)) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+            continue;
+        }
+
+        fcn = ngx_slab_calloc_locked(shard->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+
+            if (!nomem) {
+                ngx_log_error(NGX_LOG_WARN, log, 0,
+                              "could not allocate node%s",
+                              shard->shpool->log_ctx);
+                nomem = 1;
+            }
+
+            continue;
+        }
+
+        shard->count++;
+
+        ngx_memcpy((u_char *) &fcn->node.key, sn->key,
+                   sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &sn->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&shard->rbtree, &fcn->node);
+
+        fcn->uses = sn->uses;
+        fcn->valid_msec = sn->valid_msec;
+        fcn->exists = 1;
+        fcn->restored = 1;
+        fcn->valid_sec = sn->valid_sec;
+        fcn->body_start = sn->body_start;
+        fcn->fs_size = sn->fs_size;
+
+        /* the time nginx was not running does not count as inactive */
+
+        expire = ngx_min(sn->expire, cache->inactive);
+        fcn->expire = now + ngx_max(expire, 0);
+
+        ngx_queue_insert_tail(&shard->queue, &fcn->queue);
+
+        shard->size += fcn->fs_size;
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        restored++;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V restored %ui of %ui entries "
+                  "from \"%V\" saved %T seconds ago",
+                  &cache->path->name, restored, h->number,
+                  &cache->snapshot, now - h->time);
+
+    goto done;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "cache snapshot \"%V\" is invalid, ignored",
+                  &cache->snapshot);
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", cache->snapshot.data);
+    }
+}
+
+
+static void
+ngx_http_file_cache_save(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    u_char                                 *buf, *name;
+    size_t                                  size, len;
+    time_t                                  now;
+    ssize_t                                 n;
+    ngx_fd_t                                fd;
+    ngx_uint_t                              i, number;
+    ngx_queue_t                            *q;
+    ngx_http_file_cache_node_t             *fcn;
+    ngx_http_file_cache_shard_t            *shard;
+    ngx_http_file_cache_snapshot_node_t    *sn;
+    ngx_http_file_cache_snapshot_header_t  *h;
+
+    name = ngx_alloc(cache->snapshot.len + sizeof(".tmp"), ngx_cycle->log);
+    if (name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(name, "%V.tmp%Z", &cache->snapshot);
+
+    now = ngx_time();
+
+    /*
+     * the index is copied shard by shard under the shard mutexes and
+     * written after they are released, most recently used nodes first;
+     * the shards may grow while being copied, nodes which do not fit
+     * are left for the cache loader to find
+     */
+
+    number = 0;
+
+    for (i = 0; i < cache->nshards; i++) {
+        number += cache->sh->shards[i]->count;
+    }
+
+    number += number / 8;
+
+    size = sizeof(ngx_http_file_cache_snapshot_header_t)
+           + number * sizeof(ngx_http_file_cache_snapshot_node_t);
+
+    buf = ngx_alloc(size, ngx_cycle->log);
+    if (buf == NULL) {
+        ngx_free(name);
+        return;
+    }
+
+    h = (ngx_http_file_cache_snapshot_header_t *) buf;
+
+    h->version = NGX_HTTP_CACHE_SNAPSHOT_VERSION;
+    h->bsize = cache->bsize;
+    h->time = now;
+    h->number = 0;
+
+    sn = (ngx_http_file_cache_snapshot_node_t *)
+             (buf + sizeof(ngx_http_file_cache_snapshot_header_t));
+
+    len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+
+    for (i = 0; i < cache->nshards; i++) {
+        shard = cache->sh->shards[i];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        for (q = ngx_queue_head(&shard->queue);
+             q != ngx_queue_sentinel(&shard->queue) && h->number < number;
+             q = ngx_queue_next(q))
+        {
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            if (!fcn->exists) {
+                continue;
+            }
+
+            ngx_memcpy(sn->key, (u_char *) &fcn->node.key,
+                       sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&sn->key[sizeof(ngx_rbtree_key_t)], fcn->key, len);
+
+            sn->valid_sec = fcn->valid_sec;
+            sn->expire = fcn->expire - now;
+            sn->body_start = fcn->body_start;
+            sn->fs_size = fcn->fs_size;
+            sn->uses = (u_short) fcn->uses;
+            sn->valid_msec = (u_short) fcn->valid_msec;
+
+            sn++;
+            h->number++;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    size = (u_char *) sn - buf;
+
+    fd = ngx_open_file(name, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    for (len = 0; len < size; len += n) {
+        n = ngx_write_fd(fd, buf + len, size - len);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_write_fd_n " \"%s\" failed", name);
+            break;
+        }
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (len < size) {
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", name);
+        }
+
+        goto failed;
+    }
+
+    if (ngx_rename_file(name, cache->snapshot.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      name, cache->snapshot.data);
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache snapshot: \"%V\" %ui entries",
+                   &cache->snapshot, h->number);
+
+failed:
+
+    cache->snapshot_time = now;
+
+    ngx_free(buf);
+    ngx_free(name);
+}
+
+
+static void
+ngx_http_file_cache_ram_admit(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                        size;
+    ssize_t                       n;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_ram_t    *ram;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    cache = c->file_cache;
+    fcn = c->node;
+
+    if (c->length > (off_t) cache->ram_max_object) {
+        return;
+    }
+
+    /* the uses are checked without the mutex first, as a hint */
+
+    if (fcn->ram == NULL && fcn->uses < cache->ram_min_uses) {
+        return;
+    }
+
+    size = offsetof(ngx_http_file_cache_ram_t, data) + (size_t) c->length;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    if (fcn->ram) {
+
+        if (fcn->ram->valid_sec >= c->valid_sec) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+            return;
+        }
+
+        /* the copy was made before the file header was updated */
+
+        ngx_http_file_cache_ram_drop(shard, fcn);
+    }
+
+    if (!fcn->exists || fcn->uses < cache->ram_min_uses) {
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+        return;
+    }
+
+    ram = ngx_http_file_cache_ram_alloc(shard, fcn->uses, size);
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    if (ram == NULL) {
+        return;
+    }
+
+    /*
+     * the file is read at once and synchronously even with aio,
+     * as it is small and has just been read
+     */
+
+    n = ngx_read_file(&c->file, ram->data, (size_t) c->length, 0);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    /* the file may have been replaced or copied by another request */
+
+    if (n != (ssize_t) c->length
+        || !fcn->exists
+        || (fcn->uniq && fcn->uniq != c->uniq)
+        || fcn->ram)
+    {
+        shard->ram_size -= size;
+        ngx_slab_free_locked(shard->shpool, ram);
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+        return;
+    }
+
+    ram->node = fcn;
+    ram->shard = shard;
+    ram->count = 0;
+    ram->length = c->length;
+    ram->valid_sec = c->valid_sec;
+
+    ngx_queue_insert_head(&shard->ram_queue, &ram->queue);
+
+    fcn->ram = ram;
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram admit: %O u:%d",
+                   c->length, fcn->uses);
+}
+
+
+static ngx_http_file_cache_ram_t *
+ngx_http_file_cache_ram_alloc(ngx_http_file_cache_shard_t *shard,
+    ngx_uint_t uses, size_t size)
+{
+    ngx_uint_t                   n;
+    ngx_http_file_cache_ram_t   *ram;
+    ngx_http_file_cache_node_t  *fcn;
+
+    if (size > shard->ram_max) {
+        return NULL;
+    }
+
+    for (n = 0; /* void */ ; n++) {
+
+        if (shard->ram_size + size <= shard->ram_max) {
+            ram = ngx_slab_alloc_locked(shard->shpool, size);
+
+            if (ram) {
+                ram->size = size;
+                shard->ram_size += size;
+                return ram;
+            }
+        }
+
+        if (n == NGX_HTTP_FILE_CACHE_RAM_EVICT
+            || ngx_queue_empty(&shard->ram_queue))
+        {
+            return NULL;
+        }
+
+        ram = ngx_queue_data(ngx_queue_last(&shard->ram_queue),
+                             ngx_http_file_cache_ram_t, queue);
+        fcn = ram->node;
+
+        /*
+         * TinyLFU-like admission: the least recently used copy is replaced
+         * only by a response used more often, the uses of a copy that
+         * stays are halved so that the past popularity decays
+         */
+
+        if (fcn->uses >= uses) {
+            fcn->uses /= 2;
+            return NULL;
+        }
+
+        ngx_http_file_cache_ram_drop(shard, fcn);
+    }
+}
+
+
+static void
+ngx_http_file_cache_ram_drop(ngx_http_file_cache_shard_t *shard,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_ram_t  *ram;
+
+    ram = fcn->ram;
+
+    if (ram == NULL) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache ram drop: %O #%ui",
+                   ram->length, ram->count);
+
+    ngx_queue_remove(&ram->queue);
+    shard->ram_size -= ram->size;
+
+    fcn->ram = NULL;
+    ram->node = NULL;
+
+    /* a copy being sent is freed by the last request */
+
+    if (ram->count == 0) {
+        ngx_slab_free_locked(shard->shpool, ram);
+    }
+}
+
+
+static void
+ngx_http_file_cache_ram_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    ngx_http_file_cache_ram_t    *ram;
+    ngx_http_file_cache_shard_t  *shard;
+
+    ram = c->ram;
+
+    if (ram == NULL) {
+        return;
+    }
+
+    c->ram = NULL;
+    shard = ram->shard;
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    if (--ram->count == 0 && ram->node == NULL) {
+        ngx_slab_free_locked(shard->shpool, ram);
+    }
+
+    ngx_shmtx_unlock(&shard->shpool->mutex);
+}
+
+
+time_t
+ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+{
+    ngx_uint_t               i;
+    ngx_http_cache_valid_t  *valid;
+
+    if (cache_valid == NULL) {
+        return 0;
+    }
+
+    valid = cache_valid->elts;
+    for (i = 0; i < cache_valid->nelts; i++) {
+
+        if (valid[i].status == 0) {
+            return valid[i].valid;
+        }
+
+        if (valid[i].status == status) {
+            return valid[i].valid;
+        }
+    }
+
+    return 0;
+}
+
+
+char *
+ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     char  *confp = conf;
 
     off_t                   max_size;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
+    ssize_t                 size, ram, ram_max_object;
     ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    ngx_int_t               loader_files, manager_files, shards,
+                            ram_min_uses;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
+    time_t                  snapshot_interval;
     ngx_uint_t              i, n, use_temp_path;
     ngx_array_t            *caches;
     ngx_http_file_cache_t  *cache, **ce;
@@ -2306,6 +3257,14 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     manager_sleep = 50;
     manager_threshold = 200;
 
+    snapshot_interval = 300;
+
+    shards = 1;
+
+    ram = 0;
+    ram_max_object = 64 * 1024;
+    ram_min_uses = 2;
+
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
@@ -2405,6 +3364,61 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             return NGX_CONF_ERROR;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of shards \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram=", 4) == 0) {
+
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            ram = ngx_parse_size(&s);
+            if (ram == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ram size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_max_object=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            ram_max_object = ngx_parse_size(&s);
+            if (ram_max_object == NGX_ERROR || ram_max_object == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_max_object value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_min_uses=", 13) == 0) {
+
+            ram_min_uses = ngx_atoi(value[i].data + 13, value[i].len - 13);
+            if (ram_min_uses <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_min_uses value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2519,6 +3533,35 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "snapshot=", 9) == 0) {
+
+            cache->snapshot.len = value[i].len - 9;
+            cache->snapshot.data = value[i].data + 9;
+
+            if (ngx_conf_full_name(cf->cycle, &cache->snapshot, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "snapshot_interval=", 18) == 0) {
+
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            snapshot_interval = ngx_parse_time(&s, 1);
+            if (snapshot_interval == (time_t) NGX_ERROR
+                || snapshot_interval == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid snapshot_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2531,6 +3574,31 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (shards > 1 && size / shards < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "keys zone \"%V\" is too small for %i shards",
+                           &name, shards);
+        return NGX_CONF_ERROR;
+    }
+
+    cache->nshards = shards;
+
+    if (ram) {
+
+        if (ram / shards < ram_max_object) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "ram size of cache \"%V\" is too small "
+                               "for ram_max_object", &name);
+            return NGX_CONF_ERROR;
+        }
+
+        /* the copies share the zone and its shards with the keys */
+
+        cache->ram = ram;
+        cache->ram_max_object = ram_max_object;
+        cache->ram_min_uses = ram_min_uses;
+    }
+
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
     cache->path->data = cache;
@@ -2543,11 +3611,31 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
 
+    if (cache->snapshot.len) {
+
+        /* the loader removes files it does not recognize */
+
+        if (cache->snapshot.len > cache->path->name.len
+            && cache->snapshot.data[cache->path->name.len] == '/'
+            && ngx_strncmp(cache->snapshot.data, cache->path->name.data,
+                           cache->path->name.len)
+               == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "cache snapshot \"%V\" must not be "
+                               "in the cache directory", &cache->snapshot);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->path->saver = ngx_http_file_cache_save;
+        cache->snapshot_interval = snapshot_interval;
+    }
+
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
-    cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
+    cache->shm_zone = ngx_shared_memory_add(cf, &name, size + ram, cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
     }
@@ -11,10 +11,110 @@
 #include <nginx.h>
 
 
+#define NGX_HTTP_HEADER_TEMPLATE_DATE           0
+#define NGX_HTTP_HEADER_TEMPLATE_LENGTH         1
+#define NGX_HTTP_HEADER_TEMPLATE_LAST_MODIFIED  2
+#define NGX_HTTP_HEADER_TEMPLATE_ETAG           3
+
+#define NGX_HTTP_HEADER_TEMPLATE_HOLES          4
+
+/* templates rebuilt that many times without a single hit are given up */
+#define NGX_HTTP_HEADER_TEMPLATE_FAILURES       16
+
+
+typedef struct {
+    size_t                            off;
+    ngx_uint_t                        type;
+} ngx_http_header_template_hole_t;
+
+
+/*
+ * A rendered response header with the per-response values cut out:
+ * the Date, Content-Length, Last-Modified and ETag values are inserted
+ * at the holes.  The content type, the charset and the headers list
+ * are compared against the rendered bytes to check that the template
+ * matches a response.
+ */
+
+typedef struct {
+    ngx_uint_t                        status;
+    ngx_uint_t                        hits;
+
+    size_t                            content_type;
+    size_t                            content_type_len;
+    size_t                            charset;
+    size_t                            charset_len;
+
+    size_t                            headers;
+    ngx_uint_t                        nheaders;
+    size_t                           *lens;
+    ngx_uint_t                        etag;      /* ETag index + 1, or 0 */
+
+    ngx_uint_t                        nholes;
+    ngx_http_header_template_hole_t   holes[NGX_HTTP_HEADER_TEMPLATE_HOLES];
+
+    unsigned                          keepalive:1;
+    unsigned                          chunked:1;
+    unsigned                          gzip_vary:1;
+    unsigned                          content_length:1;
+    unsigned                          last_modified:1;
+
+    size_t                            len;
+    u_char                           *data;
+} ngx_http_header_template_t;
+
+
+typedef struct {
+    ngx_flag_t                        enable;
+
+    /* per-process state */
+    ngx_http_header_template_t       *template;
+    ngx_uint_t                        failures;
+    ngx_uint_t                        disabled;  /* unsigned  disabled:1; */
+} ngx_http_header_filter_loc_conf_t;
+
+
+/* the positions of the values rendered by ngx_http_header_filter() */
+
+typedef struct {
+    u_char                           *date;
+    u_char                           *content_type;
+    size_t                            content_type_len;
+    u_char                           *charset;
+    u_char                           *content_length;
+    u_char                           *content_length_end;
+    u_char                           *last_modified;
+    u_char                           *headers;
+    ngx_uint_t                        nheaders;
+} ngx_http_header_marks_t;
+
+
+static ngx_uint_t ngx_http_header_template_eligible(ngx_http_request_t *r);
+static ngx_int_t ngx_http_header_template_send(ngx_http_request_t *r,
+    ngx_http_header_template_t *t);
+static void ngx_http_header_template_build(ngx_http_request_t *r,
+    ngx_http_header_filter_loc_conf_t *hlcf, ngx_buf_t *b,
+    ngx_http_header_marks_t *marks);
+static void *ngx_http_header_filter_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_header_filter_merge_loc_conf(ngx_conf_t *cf,
+    void *parent, void *child);
 static ngx_int_t ngx_http_header_filter_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_header_filter(ngx_http_request_t *r);
 
 
+static ngx_command_t  ngx_http_header_filter_commands[] = {
+
+    { ngx_string("header_template"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_header_filter_loc_conf_t, enable),
+      NULL },
+
+      ngx_null_command
+};
+
+
 static ngx_http_module_t  ngx_http_header_filter_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_header_filter_init,           /* postconfiguration */
@@ -25,15 +125,15 @@ static ngx_http_module_t  ngx_http_header_filter_module_ctx = {
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
-    NULL,                                  /* merge location configuration */
+    ngx_http_header_filter_create_loc_conf, /* create location configuration */
+    ngx_http_header_filter_merge_loc_conf  /* merge location configuration */
 };
 
 
 ngx_module_t  ngx_http_header_filter_module = {
     NGX_MODULE_V1,
     &ngx_http_header_filter_module_ctx,    /* module context */
-    NULL,                                  /* module directives */
+    ngx_http_header_filter_commands,       /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
@@ -158,6 +258,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
     u_char                    *p;
     size_t                     len;
     ngx_str_t                  host, *status_line;
+    ngx_int_t                  rc;
     ngx_buf_t                 *b;
     ngx_uint_t                 status, i, port;
     ngx_chain_t                out;
@@ -166,8 +267,11 @@ ngx_http_header_filter(ngx_http_request_t *r)
     ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_header_marks_t    marks;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
 
+    ngx_http_header_filter_loc_conf_t  *hlcf;
+
     if (r->header_sent) {
         return NGX_OK;
     }
@@ -278,6 +382,35 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+#if (NGX_HTTP_GZIP)
+    if (r->gzip_vary && !clcf->gzip_vary) {
+        r->gzip_vary = 0;
+    }
+#endif
+
+    ngx_memzero(&marks, sizeof(ngx_http_header_marks_t));
+
+    hlcf = ngx_http_get_module_loc_conf(r, ngx_http_header_filter_module);
+
+    if (hlcf->enable && !hlcf->disabled) {
+        if (ngx_http_header_template_eligible(r)) {
+
+            if (hlcf->template) {
+                rc = ngx_http_header_template_send(r, hlcf->template);
+
+                if (rc != NGX_DECLINED) {
+                    return rc;
+                }
+            }
+
+        } else {
+            hlcf = NULL;
+        }
+
+    } else {
+        hlcf = NULL;
+    }
+
     if (r->headers_out.server == NULL) {
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
             len += sizeof(ngx_http_server_full_string) - 1;
@@ -398,12 +531,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
-        if (clcf->gzip_vary) {
-            len += sizeof("Vary: Accept-Encoding" CRLF) - 1;
-
-        } else {
-            r->gzip_vary = 0;
-        }
+        len += sizeof("Vary: Accept-Encoding" CRLF) - 1;
     }
 #endif
 
@@ -428,6 +556,8 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
         len += header[i].key.len + sizeof(": ") - 1 + header[i].value.len
                + sizeof(CRLF) - 1;
+
+        marks.nheaders++;
     }
 
     b = ngx_create_temp_buf(r->pool, len);
@@ -466,6 +596,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
     if (r->headers_out.date == NULL) {
         b->last = ngx_cpymem(b->last, "Date: ", sizeof("Date: ") - 1);
+        marks.date = b->last;
         b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
                              ngx_cached_http_time.len);
 
@@ -476,6 +607,9 @@ ngx_http_header_filter(ngx_http_request_t *r)
         b->last = ngx_cpymem(b->last, "Content-Type: ",
                              sizeof("Content-Type: ") - 1);
         p = b->last;
+        marks.content_type = p;
+        marks.content_type_len = r->headers_out.content_type.len;
+
         b->last = ngx_copy(b->last, r->headers_out.content_type.data,
                            r->headers_out.content_type.len);
 
@@ -484,6 +618,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
         {
             b->last = ngx_cpymem(b->last, "; charset=",
                                  sizeof("; charset=") - 1);
+            marks.charset = b->last;
             b->last = ngx_copy(b->last, r->headers_out.charset.data,
                                r->headers_out.charset.len);
 
@@ -499,8 +634,10 @@ ngx_http_header_filter(ngx_http_request_t *r)
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
+        marks.content_length = b->last + sizeof("Content-Length: ") - 1;
         b->last = ngx_sprintf(b->last, "Content-Length: %O" CRLF,
                               r->headers_out.content_length_n);
+        marks.content_length_end = b->last - 2;
     }
 
     if (r->headers_out.last_modified == NULL
@@ -508,6 +645,7 @@ ngx_http_header_filter(ngx_http_request_t *r)
     {
         b->last = ngx_cpymem(b->last, "Last-Modified: ",
                              sizeof("Last-Modified: ") - 1);
+        marks.last_modified = b->last;
         b->last = ngx_http_time(b->last, r->headers_out.last_modified_time);
 
         *b->last++ = CR; *b->last++ = LF;
@@ -575,6 +713,8 @@ ngx_http_header_filter(ngx_http_request_t *r)
     }
 #endif
 
+    marks.headers = b->last;
+
     part = &r->headers_out.headers.part;
     header = part->elts;
 
@@ -609,6 +749,213 @@ ngx_http_header_filter(ngx_http_request_t *r)
 
     r->header_size = b->last - b->pos;
 
+    if (hlcf) {
+        ngx_http_header_template_build(r, hlcf, b, &marks);
+    }
+
+    if (r->header_only) {
+        b->last_buf = 1;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_write_filter(r, &out);
+}
+
+
+static ngx_uint_t
+ngx_http_header_template_eligible(ngx_http_request_t *r)
+{
+    /* the headers rendered from anything but the headers list and scalars */
+
+    return r->headers_out.status_line.len == 0
+           && r->headers_out.status != NGX_HTTP_SWITCHING_PROTOCOLS
+           && r->headers_out.server == NULL
+           && r->headers_out.date == NULL
+           && r->headers_out.content_length == NULL
+           && r->headers_out.last_modified == NULL
+           && r->headers_out.location == NULL;
+}
+
+
+static ngx_int_t
+ngx_http_header_template_send(ngx_http_request_t *r,
+    ngx_http_header_template_t *t)
+{
+    u_char           *p, *src, *ct;
+    size_t            len, n;
+    ngx_uint_t        i, h;
+    ngx_buf_t        *b;
+    ngx_chain_t       out;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header, *etag;
+
+    if (t->status != r->headers_out.status
+        || t->keepalive != r->keepalive
+        || t->chunked != r->chunked
+#if (NGX_HTTP_GZIP)
+        || t->gzip_vary != r->gzip_vary
+#endif
+        || t->content_length != (r->headers_out.content_length_n >= 0)
+        || t->last_modified != (r->headers_out.last_modified_time != -1)
+        || t->content_type_len != r->headers_out.content_type.len)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_memcmp(t->data + t->content_type,
+                   r->headers_out.content_type.data, t->content_type_len)
+        != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (r->headers_out.content_type.len
+        && r->headers_out.content_type_len == r->headers_out.content_type.len)
+    {
+        n = r->headers_out.charset.len;
+
+    } else {
+        n = 0;
+    }
+
+    if (t->charset_len != n
+        || ngx_memcmp(t->data + t->charset, r->headers_out.charset.data, n)
+           != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    etag = r->headers_out.etag;
+    len = 0;
+
+    p = t->data + t->headers;
+    h = 0;
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        if (h == t->nheaders
+            || header[i].key.len != t->lens[2 * h]
+            || ngx_memcmp(p, header[i].key.data, header[i].key.len) != 0)
+        {
+            return NGX_DECLINED;
+        }
+
+        p += header[i].key.len + sizeof(": ") - 1;
+
+        if (&header[i] == etag) {
+            if (t->etag != h + 1) {
+                return NGX_DECLINED;
+            }
+
+            len += header[i].value.len;
+
+        } else {
+            if (header[i].value.len != t->lens[2 * h + 1]
+                || ngx_memcmp(p, header[i].value.data, header[i].value.len)
+                   != 0)
+            {
+                return NGX_DECLINED;
+            }
+
+            p += header[i].value.len;
+        }
+
+        p += sizeof(CRLF) - 1;
+        h++;
+    }
+
+    if (h != t->nheaders) {
+        return NGX_DECLINED;
+    }
+
+    t->hits++;
+
+    len += t->len + NGX_OFF_T_LEN
+           + 2 * (sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = b->last;
+    src = t->data;
+    ct = NULL;
+
+    for (i = 0; /* void */; i++) {
+
+        n = ((i < t->nholes) ? t->data + t->holes[i].off : t->data + t->len)
+            - src;
+
+        if (ct == NULL && t->data + t->content_type < src + n) {
+            ct = p + (t->data + t->content_type - src);
+        }
+
+        p = ngx_cpymem(p, src, n);
+        src += n;
+
+        if (i == t->nholes) {
+            break;
+        }
+
+        switch (t->holes[i].type) {
+
+        case NGX_HTTP_HEADER_TEMPLATE_DATE:
+            p = ngx_cpymem(p, ngx_cached_http_time.data,
+                           ngx_cached_http_time.len);
+            break;
+
+        case NGX_HTTP_HEADER_TEMPLATE_LENGTH:
+            p = ngx_sprintf(p, "%O", r->headers_out.content_length_n);
+            break;
+
+        case NGX_HTTP_HEADER_TEMPLATE_LAST_MODIFIED:
+            p = ngx_http_time(p, r->headers_out.last_modified_time);
+            break;
+
+        default: /* NGX_HTTP_HEADER_TEMPLATE_ETAG */
+            p = ngx_copy(p, etag->value.data, etag->value.len);
+            break;
+        }
+    }
+
+    b->last = p;
+
+    if (t->charset_len) {
+
+        /* update r->headers_out.content_type for possible logging */
+
+        r->headers_out.content_type.len = t->content_type_len
+                                          + sizeof("; charset=") - 1
+                                          + t->charset_len;
+        r->headers_out.content_type.data = ct;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http header template:\n%*s",
+                   (size_t) (b->last - b->pos), b->pos);
+
+    r->header_size = b->last - b->pos;
+
     if (r->header_only) {
         b->last_buf = 1;
     }
@@ -620,6 +967,239 @@ ngx_http_header_filter(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_header_template_build(ngx_http_request_t *r,
+    ngx_http_header_filter_loc_conf_t *hlcf, ngx_buf_t *b,
+    ngx_http_header_marks_t *marks)
+{
+    u_char                      *p, *src, *dst;
+    size_t                       skip;
+    ngx_uint_t                   i, h, n;
+    ngx_list_part_t             *part;
+    ngx_table_elt_t             *header;
+    ngx_http_header_template_t  *t;
+    u_char                      *start[NGX_HTTP_HEADER_TEMPLATE_HOLES];
+    u_char                      *end[NGX_HTTP_HEADER_TEMPLATE_HOLES];
+    ngx_uint_t                   type[NGX_HTTP_HEADER_TEMPLATE_HOLES];
+
+    if (hlcf->template) {
+
+        if (hlcf->template->hits) {
+            hlcf->failures = 0;
+
+        } else if (++hlcf->failures >= NGX_HTTP_HEADER_TEMPLATE_FAILURES) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http header template disabled");
+
+            ngx_free(hlcf->template);
+            hlcf->template = NULL;
+            hlcf->disabled = 1;
+            return;
+        }
+    }
+
+    t = ngx_alloc(sizeof(ngx_http_header_template_t)
+                  + 2 * marks->nheaders * sizeof(size_t)
+                  + (b->last - b->pos),
+                  r->connection->log);
+    if (t == NULL) {
+        return;
+    }
+
+    t->lens = (size_t *) &t[1];
+    t->data = (u_char *) &t->lens[2 * marks->nheaders];
+
+    /* the holes, in the order they are rendered */
+
+    n = 0;
+
+    start[n] = marks->date;
+    end[n] = marks->date + ngx_cached_http_time.len;
+    type[n++] = NGX_HTTP_HEADER_TEMPLATE_DATE;
+
+    skip = end[0] - start[0];
+
+    if (r->headers_out.content_length_n >= 0) {
+        start[n] = marks->content_length;
+        end[n] = marks->content_length_end;
+        type[n++] = NGX_HTTP_HEADER_TEMPLATE_LENGTH;
+    }
+
+    if (r->headers_out.last_modified_time != -1) {
+        start[n] = marks->last_modified;
+        end[n] = marks->last_modified
+                 + sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1;
+        type[n++] = NGX_HTTP_HEADER_TEMPLATE_LAST_MODIFIED;
+    }
+
+    t->headers = marks->headers - b->pos;
+
+    for (i = 0; i < n; i++) {
+        t->headers -= end[i] - start[i];
+    }
+
+    t->etag = 0;
+
+    p = marks->headers;
+    h = 0;
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        t->lens[2 * h] = header[i].key.len;
+        p += header[i].key.len + sizeof(": ") - 1;
+
+        if (&header[i] == r->headers_out.etag) {
+            start[n] = p;
+            end[n] = p + header[i].value.len;
+            type[n++] = NGX_HTTP_HEADER_TEMPLATE_ETAG;
+
+            t->etag = h + 1;
+            t->lens[2 * h + 1] = 0;
+
+        } else {
+            t->lens[2 * h + 1] = header[i].value.len;
+        }
+
+        p += header[i].value.len + sizeof(CRLF) - 1;
+        h++;
+    }
+
+    t->nheaders = h;
+
+    src = b->pos;
+    dst = t->data;
+
+    for (i = 0; i < n; i++) {
+        dst = ngx_cpymem(dst, src, start[i] - src);
+
+        t->holes[i].off = dst - t->data;
+        t->holes[i].type = type[i];
+
+        src = end[i];
+    }
+
+    dst = ngx_cpymem(dst, src, b->last - src);
+
+    t->nholes = n;
+    t->len = dst - t->data;
+
+    if (r->headers_out.content_type.len) {
+        t->content_type = marks->content_type - b->pos - skip;
+        t->content_type_len = marks->content_type_len;
+
+    } else {
+        t->content_type = 0;
+        t->content_type_len = 0;
+    }
+
+    if (marks->charset) {
+        t->charset = marks->charset - b->pos - skip;
+        t->charset_len = r->headers_out.charset.len;
+
+    } else {
+        t->charset = 0;
+        t->charset_len = 0;
+    }
+
+    t->status = r->headers_out.status;
+    t->hits = 0;
+    t->keepalive = r->keepalive;
+    t->chunked = r->chunked;
+#if (NGX_HTTP_GZIP)
+    t->gzip_vary = r->gzip_vary;
+#endif
+    t->content_length = (r->headers_out.content_length_n >= 0);
+    t->last_modified = (r->headers_out.last_modified_time != -1);
+
+    if (hlcf->template) {
+        ngx_free(hlcf->template);
+    }
+
+    hlcf->template = t;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http header template: %uz bytes, %ui holes", t->len, n);
+}
+
+
+static void
+ngx_http_header_filter_cleanup(void *data)
+{
+    ngx_http_header_filter_loc_conf_t  *hlcf = data;
+
+    if (hlcf->template) {
+        ngx_free(hlcf->template);
+        hlcf->template = NULL;
+    }
+}
+
+
+static void *
+ngx_http_header_filter_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_header_filter_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_header_filter_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->template = NULL;
+     *     conf->failures = 0;
+     *     conf->disabled = 0;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_header_filter_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_http_header_filter_loc_conf_t *prev = parent;
+    ngx_http_header_filter_loc_conf_t *conf = child;
+
+    ngx_pool_cleanup_t  *cln;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    if (conf->enable) {
+        cln = ngx_pool_cleanup_add(cf->pool, 0);
+        if (cln == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cln->handler = ngx_http_header_filter_cleanup;
+        cln->data = conf;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_header_filter_init(ngx_conf_t *cf)
 {
@@ -98,6 +98,138 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_SSE42)
+
+#include <nmmintrin.h>
+
+#if (NGX_HAVE_AVX2)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * the vector scanners below never read past "last": they return
+ * either the first byte of interest or the start of a tail shorter
+ * than a vector, which is then handled by the state machines as usual
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_skip_uri(u_char *p, u_char *last)
+{
+    int      n, len;
+    __m128i  set, v;
+
+    /* the bytes that are not "usual" in URI */
+
+#if (NGX_WIN32)
+    set = _mm_setr_epi8('\0', LF, CR, ' ', '#', '%', '+', '.', '/', '?',
+                        '\\', 0, 0, 0, 0, 0);
+    len = 11;
+#else
+    set = _mm_setr_epi8('\0', LF, CR, ' ', '#', '%', '+', '.', '/', '?',
+                        0, 0, 0, 0, 0, 0);
+    len = 10;
+#endif
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        n = _mm_cmpestri(set, len, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip_name(u_char *p, u_char *last)
+{
+    int      n;
+    __m128i  ranges, v;
+
+    /* '_' is left to the state machine as it depends on configuration */
+
+    ranges = _mm_setr_epi8('0', '9', 'A', 'Z', 'a', 'z', '-', '-',
+                           0, 0, 0, 0, 0, 0, 0, 0);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        n = _mm_cmpestri(ranges, 8, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip_value(u_char *p, u_char *last)
+{
+    int      n;
+    __m128i  set, v;
+
+#if (NGX_HAVE_AVX2)
+    int      mask;
+    __m256i  cr, lf, nul, w;
+
+    cr = _mm256_set1_epi8(CR);
+    lf = _mm256_set1_epi8(LF);
+    nul = _mm256_setzero_si256();
+
+    while (last - p >= 32) {
+        w = _mm256_loadu_si256((const __m256i *) p);
+
+        mask = _mm256_movemask_epi8(
+                   _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(w, cr),
+                                                   _mm256_cmpeq_epi8(w, lf)),
+                                   _mm256_cmpeq_epi8(w, nul)));
+
+        if (mask) {
+            return p + __builtin_ctz((unsigned int) mask);
+        }
+
+        p += 32;
+    }
+#endif
+
+    set = _mm_setr_epi8(CR, LF, '\0', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        n = _mm_cmpestri(set, 3, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -541,6 +673,9 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+#if (NGX_HAVE_SSE42)
+                p = ngx_http_parse_skip_uri(p + 1, b->last) - 1;
+#endif
                 break;
             }
 
@@ -627,6 +762,9 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+#if (NGX_HAVE_SSE42)
+                p = ngx_http_parse_skip_uri(p + 1, b->last) - 1;
+#endif
                 break;
             }
 
@@ -837,6 +975,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HAVE_SSE42)
+    u_char     *m;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -926,6 +1067,18 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 hash = ngx_hash(hash, c);
                 r->lowcase_header[i++] = c;
                 i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+
+#if (NGX_HAVE_SSE42)
+                m = ngx_http_parse_skip_name(p + 1, b->last);
+
+                while (p + 1 < m) {
+                    c = lowcase[*++p];
+                    hash = ngx_hash(hash, c);
+                    r->lowcase_header[i++] = c;
+                    i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+                }
+#endif
+
                 break;
             }
 
@@ -1020,6 +1173,26 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 goto done;
             case '\0':
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+#if (NGX_HAVE_SSE42)
+            default:
+
+                /*
+                 * skip to the end of the line, trailing spaces are
+                 * accounted as the byte-at-a-time path would do it
+                 */
+
+                m = ngx_http_parse_skip_value(p + 1, b->last);
+
+                for (p = m - 1; *p == ' '; p--) { /* void */ }
+
+                if (p + 1 != m) {
+                    r->header_end = p + 1;
+                    state = sw_space_after_value;
+                }
+
+                p = m - 1;
+                break;
+#endif
             }
             break;
 
@@ -75,6 +75,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         peers->number = n;
         peers->weighted = (w != n);
         peers->total_weight = w;
+        peers->nshards = 1;
         peers->name = &us->host;
 
         n = 0;
@@ -90,8 +91,8 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].socklen = server[i].addrs[j].socklen;
                 peer[n].name = server[i].addrs[j].name;
                 peer[n].weight = server[i].weight;
-                peer[n].effective_weight = server[i].weight;
-                peer[n].current_weight = 0;
+                peer[n].shard = &peer[n].local;
+                peer[n].local.effective_weight = server[i].weight;
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
@@ -139,6 +140,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         backup->number = n;
         backup->weighted = (w != n);
         backup->total_weight = w;
+        backup->nshards = 1;
         backup->name = &us->host;
 
         n = 0;
@@ -154,8 +156,8 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].socklen = server[i].addrs[j].socklen;
                 peer[n].name = server[i].addrs[j].name;
                 peer[n].weight = server[i].weight;
-                peer[n].effective_weight = server[i].weight;
-                peer[n].current_weight = 0;
+                peer[n].shard = &peer[n].local;
+                peer[n].local.effective_weight = server[i].weight;
                 peer[n].max_conns = server[i].max_conns;
                 peer[n].max_fails = server[i].max_fails;
                 peer[n].fail_timeout = server[i].fail_timeout;
@@ -214,6 +216,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     peers->number = n;
     peers->weighted = 0;
     peers->total_weight = n;
+    peers->nshards = 1;
     peers->name = &us->host;
 
     peerp = &peers->peer;
@@ -223,8 +226,8 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         peer[i].socklen = u.addrs[i].socklen;
         peer[i].name = u.addrs[i].name;
         peer[i].weight = 1;
-        peer[i].effective_weight = 1;
-        peer[i].current_weight = 0;
+        peer[i].shard = &peer[i].local;
+        peer[i].local.effective_weight = 1;
         peer[i].max_conns = 0;
         peer[i].max_fails = 1;
         peer[i].fail_timeout = 10;
@@ -332,6 +335,7 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 
     peers->single = (ur->naddrs == 1);
     peers->number = ur->naddrs;
+    peers->nshards = 1;
     peers->name = &ur->host;
 
     if (ur->sockaddr) {
@@ -339,8 +343,8 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
         peer[0].socklen = ur->socklen;
         peer[0].name = ur->name.data ? ur->name : ur->host;
         peer[0].weight = 1;
-        peer[0].effective_weight = 1;
-        peer[0].current_weight = 0;
+        peer[0].shard = &peer[0].local;
+        peer[0].local.effective_weight = 1;
         peer[0].max_conns = 0;
         peer[0].max_fails = 1;
         peer[0].fail_timeout = 10;
@@ -373,8 +377,8 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
             peer[i].name.len = len;
             peer[i].name.data = p;
             peer[i].weight = 1;
-            peer[i].effective_weight = 1;
-            peer[i].current_weight = 0;
+            peer[i].shard = &peer[i].local;
+            peer[i].local.effective_weight = 1;
             peer[i].max_conns = 0;
             peer[i].max_fails = 1;
             peer[i].fail_timeout = 10;
@@ -422,6 +426,7 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     ngx_uint_t                     i, n;
     ngx_http_upstream_rr_peer_t   *peer;
     ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_rr_shard_t  *shard;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get rr peer, try: %ui", pc->tries);
@@ -429,8 +434,12 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     pc->cached = 0;
     pc->connection = NULL;
 
+    /*
+     * the weights and connections are counted in the slots of the worker,
+     * so no lock is needed to select a peer
+     */
+
     peers = rrp->peers;
-    ngx_http_upstream_rr_peers_wlock(peers);
 
     if (peers->single) {
         peer = peers->peer;
@@ -439,7 +448,9 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
             goto failed;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        if (peer->max_conns
+            && ngx_http_upstream_rr_peer_conns(peers, peer) >= peer->max_conns)
+        {
             goto failed;
         }
 
@@ -454,19 +465,19 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
         if (peer == NULL) {
             goto failed;
         }
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                       "get rr peer, current: %p %i",
-                       peer, peer->current_weight);
     }
 
+    shard = ngx_http_upstream_rr_peer_shard(peers, peer);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get rr peer, current: %p %i",
+                   peer, shard->current_weight);
+
     pc->sockaddr = peer->sockaddr;
     pc->socklen = peer->socklen;
     pc->name = &peer->name;
 
-    peer->conns++;
-
-    ngx_http_upstream_rr_peers_unlock(peers);
+    shard->conns++;
 
     return NGX_OK;
 
@@ -485,19 +496,13 @@ failed:
             rrp->tried[i] = 0;
         }
 
-        ngx_http_upstream_rr_peers_unlock(peers);
-
         rc = ngx_http_upstream_get_round_robin_peer(pc, rrp);
 
         if (rc != NGX_BUSY) {
             return rc;
         }
-
-        ngx_http_upstream_rr_peers_wlock(peers);
     }
 
-    ngx_http_upstream_rr_peers_unlock(peers);
-
     pc->name = peers->name;
 
     return NGX_BUSY;
@@ -507,22 +512,27 @@ failed:
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
-    time_t                        now;
-    uintptr_t                     m;
-    ngx_int_t                     total;
-    ngx_uint_t                    i, n, p;
-    ngx_http_upstream_rr_peer_t  *peer, *best;
+    time_t                         now;
+    uintptr_t                      m;
+    ngx_int_t                      total;
+    ngx_uint_t                     i, n, p;
+    ngx_http_upstream_rr_peer_t   *peer, *best;
+    ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_rr_shard_t  *shard, *best_shard;
 
     now = ngx_time();
 
+    peers = rrp->peers;
+
     best = NULL;
+    best_shard = NULL;
     total = 0;
 
 #if (NGX_SUPPRESS_WARN)
     p = 0;
 #endif
 
-    for (peer = rrp->peers->peer, i = 0;
+    for (peer = peers->peer, i = 0;
          peer;
          peer = peer->next, i++)
     {
@@ -544,19 +554,25 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
             continue;
         }
 
-        if (peer->max_conns && peer->conns >= peer->max_conns) {
+        if (peer->max_conns
+            && ngx_http_upstream_rr_peer_conns(peers, peer) >= peer->max_conns)
+        {
             continue;
         }
 
-        peer->current_weight += peer->effective_weight;
-        total += peer->effective_weight;
+        shard = ngx_http_upstream_rr_peer_shard(peers, peer);
 
-        if (peer->effective_weight < peer->weight) {
-            peer->effective_weight++;
+        shard->current_weight += shard->effective_weight;
+        total += shard->effective_weight;
+
+        if (shard->effective_weight < peer->weight) {
+            shard->effective_weight++;
         }
 
-        if (best == NULL || peer->current_weight > best->current_weight) {
+        if (best == NULL || shard->current_weight > best_shard->current_weight)
+        {
             best = peer;
+            best_shard = shard;
             p = i;
         }
     }
@@ -572,10 +588,23 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 
     rrp->tried[n] |= m;
 
-    best->current_weight -= total;
+    best_shard->current_weight -= total;
+
+    /*
+     * the check time only matters for a peer that has failed,
+     * so the shared state is not written for healthy peers
+     */
 
-    if (now - best->checked > best->fail_timeout) {
-        best->checked = now;
+    if (best->fails && now - best->checked > best->fail_timeout) {
+        ngx_http_upstream_rr_peers_rlock(peers);
+        ngx_http_upstream_rr_peer_lock(peers, best);
+
+        if (now - best->checked > best->fail_timeout) {
+            best->checked = now;
+        }
+
+        ngx_http_upstream_rr_peer_unlock(peers, best);
+        ngx_http_upstream_rr_peers_unlock(peers);
     }
 
     return best;
@@ -588,8 +617,10 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 {
     ngx_http_upstream_rr_peer_data_t  *rrp = data;
 
-    time_t                       now;
-    ngx_http_upstream_rr_peer_t  *peer;
+    time_t                         now;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_rr_shard_t  *shard;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free rr peer %ui %ui", pc->tries, state);
@@ -597,16 +628,13 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     /* TODO: NGX_PEER_KEEPALIVE */
 
     peer = rrp->current;
+    peers = rrp->peers;
 
-    ngx_http_upstream_rr_peers_rlock(rrp->peers);
-    ngx_http_upstream_rr_peer_lock(rrp->peers, peer);
-
-    if (rrp->peers->single) {
+    shard = ngx_http_upstream_rr_peer_shard(peers, peer);
 
-        peer->conns--;
+    if (peers->single) {
 
-        ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
-        ngx_http_upstream_rr_peers_unlock(rrp->peers);
+        shard->conns--;
 
         pc->tries = 0;
         return;
@@ -615,12 +643,15 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     if (state & NGX_PEER_FAILED) {
         now = ngx_time();
 
+        ngx_http_upstream_rr_peers_rlock(peers);
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
         peer->fails++;
         peer->accessed = now;
         peer->checked = now;
 
         if (peer->max_fails) {
-            peer->effective_weight -= peer->weight / peer->max_fails;
+            shard->effective_weight -= peer->weight / peer->max_fails;
 
             if (peer->fails >= peer->max_fails) {
                 ngx_log_error(NGX_LOG_WARN, pc->log, 0,
@@ -628,27 +659,35 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             }
         }
 
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+        ngx_http_upstream_rr_peers_unlock(peers);
+
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                        "free rr peer failed: %p %i",
-                       peer, peer->effective_weight);
+                       peer, shard->effective_weight);
 
-        if (peer->effective_weight < 0) {
-            peer->effective_weight = 0;
+        if (shard->effective_weight < 0) {
+            shard->effective_weight = 0;
         }
 
     } else {
 
         /* mark peer live if check passed */
 
-        if (peer->accessed < peer->checked) {
-            peer->fails = 0;
+        if (peer->fails && peer->accessed < peer->checked) {
+            ngx_http_upstream_rr_peers_rlock(peers);
+            ngx_http_upstream_rr_peer_lock(peers, peer);
+
+            if (peer->accessed < peer->checked) {
+                peer->fails = 0;
+            }
+
+            ngx_http_upstream_rr_peer_unlock(peers, peer);
+            ngx_http_upstream_rr_peers_unlock(peers);
         }
     }
 
-    peer->conns--;
-
-    ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
-    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+    shard->conns--;
 
     if (pc->tries) {
         pc->tries--;
@@ -656,6 +695,27 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+ngx_uint_t
+ngx_http_upstream_rr_peer_conns(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    u_char      *p;
+    ngx_uint_t   i, conns;
+
+    /* other workers' slots are read without a lock */
+
+    p = (u_char *) peer->shard;
+    conns = 0;
+
+    for (i = 0; i < peers->nshards; i++) {
+        conns += ((ngx_http_upstream_rr_shard_t *) p)->conns;
+        p += peers->shard_size;
+    }
+
+    return conns;
+}
+
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
@@ -14,6 +14,19 @@
 #include <ngx_http.h>
 
 
+/*
+ * the state changed by every request, kept by each worker process in its
+ * own slot; with upstream zone, the slots of a worker are in a separate
+ * cache line
+ */
+
+typedef struct {
+    ngx_int_t                       current_weight;
+    ngx_int_t                       effective_weight;
+    ngx_uint_t                      conns;
+} ngx_http_upstream_rr_shard_t;
+
+
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
 struct ngx_http_upstream_rr_peer_s {
@@ -22,11 +35,10 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_str_t                       name;
     ngx_str_t                       server;
 
-    ngx_int_t                       current_weight;
-    ngx_int_t                       effective_weight;
-    ngx_int_t                       weight;
+    ngx_http_upstream_rr_shard_t   *shard;
+    ngx_http_upstream_rr_shard_t    local;
 
-    ngx_uint_t                      conns;
+    ngx_int_t                       weight;
     ngx_uint_t                      max_conns;
 
     ngx_uint_t                      fails;
@@ -38,6 +50,9 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_msec_t                      slow_start;
     ngx_msec_t                      start_time;
 
+    ngx_uint_t                      ewma;
+    ngx_msec_t                      ewma_updated;
+
     ngx_uint_t                      down;
 
 #if (NGX_HTTP_SSL || NGX_COMPAT)
@@ -69,6 +84,9 @@ struct ngx_http_upstream_rr_peers_s {
 
     ngx_uint_t                      total_weight;
 
+    ngx_uint_t                      nshards;
+    size_t                          shard_size;
+
     unsigned                        single:1;
     unsigned                        weighted:1;
 
@@ -80,6 +98,11 @@ struct ngx_http_upstream_rr_peers_s {
 };
 
 
+#define ngx_http_upstream_rr_peer_shard(peers, peer)                          \
+    ((ngx_http_upstream_rr_shard_t *)                                         \
+         ((u_char *) (peer)->shard + ngx_worker * (peers)->shard_size))
+
+
 #if (NGX_HTTP_UPSTREAM_ZONE)
 
 #define ngx_http_upstream_rr_peers_rlock(peers)                               \
@@ -143,6 +166,8 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+ngx_uint_t ngx_http_upstream_rr_peer_conns(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer);
 
 #if (NGX_HTTP_SSL)
 ngx_int_t
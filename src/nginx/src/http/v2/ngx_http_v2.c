@@ -253,6 +253,16 @@ ngx_http_v2_init(ngx_event_t *rev)
         return;
     }
 
+    h2c->hpack_enc.max = h2scf->hpack_table_size;
+    h2c->hpack_enc.limit = NGX_HTTP_V2_TABLE_SIZE;
+    h2c->hpack_enc.size = ngx_min(h2c->hpack_enc.max, NGX_HTTP_V2_TABLE_SIZE);
+    h2c->hpack_enc.free = h2c->hpack_enc.size;
+
+    if (h2c->hpack_enc.max) {
+        h2c->hpack_enc.update = (h2c->hpack_enc.size
+                                 != NGX_HTTP_V2_TABLE_SIZE);
+    }
+
     cln = ngx_pool_cleanup_add(c->pool, 0);
     if (cln == NULL) {
         ngx_http_close_connection(c);
@@ -285,7 +295,11 @@ ngx_http_v2_init(ngx_event_t *rev)
     h2c->state.handler = hc->proxy_protocol ? ngx_http_v2_state_proxy_protocol
                                             : ngx_http_v2_state_preface;
 
-    ngx_queue_init(&h2c->waiting);
+    ngx_rbtree_init(&h2c->waiting, &h2c->waiting_sentinel,
+                    ngx_http_v2_sched_insert_value);
+    ngx_rbtree_init(&h2c->scheduled, &h2c->scheduled_sentinel,
+                    ngx_http_v2_sched_insert_value);
+
     ngx_queue_init(&h2c->dependencies);
     ngx_queue_init(&h2c->closed);
 
@@ -557,6 +571,16 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
     for ( /* void */ ; out; out = fn) {
         fn = out->next;
 
+        if (out->stream && !out->blocked) {
+            ngx_rbtree_delete(&h2c->scheduled, &out->sched.node);
+
+            if ((ngx_rbtree_key_int_t) (out->sched.node.key
+                                        - h2c->virtual_time) > 0)
+            {
+                h2c->virtual_time = out->sched.node.key;
+            }
+        }
+
         if (out->handler(h2c, out) != NGX_OK) {
             out->blocked = 1;
             break;
@@ -2034,6 +2058,15 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
             h2c->frame_size = value;
             break;
 
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+
+            if (h2c->hpack_enc.max) {
+                h2c->hpack_enc.limit = value;
+                h2c->hpack_enc.update = 1;
+            }
+
+            break;
+
         default:
             break;
         }
@@ -2141,7 +2174,7 @@ ngx_http_v2_state_window_update(ngx_http_v2_connection_t *h2c, u_char *pos,
 {
     size_t                 window;
     ngx_event_t           *wev;
-    ngx_queue_t           *q;
+    ngx_rbtree_node_t     *n;
     ngx_http_v2_node_t    *node;
     ngx_http_v2_stream_t  *stream;
 
@@ -2229,12 +2262,12 @@ ngx_http_v2_state_window_update(ngx_http_v2_connection_t *h2c, u_char *pos,
 
     h2c->send_window += window;
 
-    while (!ngx_queue_empty(&h2c->waiting)) {
-        q = ngx_queue_head(&h2c->waiting);
+    while (h2c->waiting.root != h2c->waiting.sentinel) {
+        n = ngx_rbtree_min(h2c->waiting.root, h2c->waiting.sentinel);
 
-        ngx_queue_remove(q);
+        ngx_rbtree_delete(&h2c->waiting, n);
 
-        stream = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
+        stream = ngx_http_v2_sched_data(n, ngx_http_v2_stream_t);
 
         stream->waiting = 0;
 
@@ -2946,13 +2979,11 @@ ngx_http_v2_get_closed_node(ngx_http_v2_connection_t *h2c)
 
     if (parent == NGX_HTTP_V2_ROOT) {
         node->rank = 0;
-        node->rel_weight = 1.0;
 
         children = &h2c->dependencies;
 
     } else {
         node->rank = parent->rank;
-        node->rel_weight = parent->rel_weight;
 
         children = &parent->children;
     }
@@ -4249,6 +4280,11 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
 
     h2c->last_out = NULL;
 
+    ngx_rbtree_init(&h2c->waiting, &h2c->waiting_sentinel,
+                    ngx_http_v2_sched_insert_value);
+    ngx_rbtree_init(&h2c->scheduled, &h2c->scheduled_sentinel,
+                    ngx_http_v2_sched_insert_value);
+
     h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
                                          ngx_http_v2_module);
 
@@ -4375,7 +4411,6 @@ ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
         }
 
         node->rank = 1;
-        node->rel_weight = (1.0 / 256) * node->weight;
 
         children = &h2c->dependencies;
 
@@ -4397,12 +4432,9 @@ ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
 
                 if (node->parent == NGX_HTTP_V2_ROOT) {
                     parent->rank = 1;
-                    parent->rel_weight = (1.0 / 256) * parent->weight;
 
                 } else {
                     parent->rank = node->parent->rank + 1;
-                    parent->rel_weight = (node->parent->rel_weight / 256)
-                                         * parent->weight;
                 }
 
                 if (!exclusive) {
@@ -4414,7 +4446,6 @@ ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
         }
 
         node->rank = parent->rank + 1;
-        node->rel_weight = (parent->rel_weight / 256) * node->weight;
 
         if (parent->stream == NULL) {
             ngx_queue_remove(&parent->reuse);
@@ -4462,13 +4493,50 @@ ngx_http_v2_node_children_update(ngx_http_v2_node_t *node)
         child = ngx_queue_data(q, ngx_http_v2_node_t, queue);
 
         child->rank = node->rank + 1;
-        child->rel_weight = (node->rel_weight / 256) * child->weight;
 
         ngx_http_v2_node_children_update(child);
     }
 }
 
 
+void
+ngx_http_v2_sched_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t        **p;
+    ngx_http_v2_sched_node_t  *n, *t;
+
+    n = (ngx_http_v2_sched_node_t *) node;
+
+    for ( ;; ) {
+
+        t = (ngx_http_v2_sched_node_t *) temp;
+
+        /* nodes with equal keys are kept in the order of insertion */
+
+        if (n->rank != t->rank) {
+            p = (n->rank < t->rank) ? &temp->left : &temp->right;
+
+        } else {
+            p = ((ngx_rbtree_key_int_t) (node->key - temp->key) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
 static void
 ngx_http_v2_pool_cleanup(void *data)
 {
@@ -26,6 +26,9 @@
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 /* frame types */
 #define NGX_HTTP_V2_DATA_FRAME           0x0
 #define NGX_HTTP_V2_HEADERS_FRAME        0x1
@@ -65,6 +68,12 @@ typedef struct {
 } ngx_http_v2_header_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_uint_t                       rank;
+} ngx_http_v2_sched_node_t;
+
+
 typedef struct {
     ngx_uint_t                       sid;
     size_t                           length;
@@ -110,6 +119,44 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    u_char                          *data;
+    uint32_t                         name_len;
+    uint32_t                         value_len;
+    uint32_t                         hash;
+    uint32_t                         name_hash;
+    ngx_uint_t                       next;
+    ngx_uint_t                       name_next;
+} ngx_http_v2_hpack_entry_t;
+
+
+/*
+ * The table of response headers, mirroring the client's decoder state.
+ * Entries are numbered from 1 in the order they are added, those not
+ * greater than "deleted" are evicted.  The hash index chains entries
+ * from the newest to the oldest, so evicted entries end the chains.
+ */
+
+typedef struct {
+    ngx_http_v2_hpack_entry_t       *entries;
+    ngx_uint_t                      *index;
+    ngx_uint_t                       mask;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           size;
+    size_t                           free;
+    size_t                           limit;
+    size_t                           max;
+    u_char                          *storage;
+    u_char                          *pos;
+
+    unsigned                         update:1;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -122,11 +169,13 @@ struct ngx_http_v2_connection_s {
 
     size_t                           frame_size;
 
-    ngx_queue_t                      waiting;
+    ngx_rbtree_t                     waiting;
+    ngx_rbtree_node_t                waiting_sentinel;
 
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -137,6 +186,10 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_out_frame_t         *last_out;
 
+    ngx_rbtree_t                     scheduled;
+    ngx_rbtree_node_t                scheduled_sentinel;
+    ngx_rbtree_key_t                 virtual_time;
+
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
 
@@ -158,7 +211,6 @@ struct ngx_http_v2_node_s {
     ngx_queue_t                      reuse;
     ngx_uint_t                       rank;
     ngx_uint_t                       weight;
-    double                           rel_weight;
     ngx_http_v2_stream_t            *stream;
 };
 
@@ -183,7 +235,8 @@ struct ngx_http_v2_stream_s {
     ngx_chain_t                     *free_frame_headers;
     ngx_chain_t                     *free_bufs;
 
-    ngx_queue_t                      queue;
+    ngx_http_v2_sched_node_t         sched;
+    ngx_rbtree_key_t                 finish;
 
     ngx_array_t                     *cookies;
 
@@ -212,34 +265,71 @@ struct ngx_http_v2_out_frame_s {
     ngx_http_v2_stream_t            *stream;
     size_t                           length;
 
+    ngx_http_v2_sched_node_t         sched;
+
     unsigned                         blocked:1;
     unsigned                         fin:1;
 };
 
 
+#define ngx_http_v2_sched_data(node, type)                                    \
+    ((type *) ((u_char *) (node) - offsetof(type, sched)))
+
+/*
+ * the length is scaled before it is divided by the weight, so frames
+ * shorter than the weight, up to 256, still advance the virtual time
+ */
+
+#define ngx_http_v2_sched_time(length, weight)                                \
+    (((ngx_rbtree_key_t) (length) << 8) / (weight))
+
+
 static ngx_inline void
 ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_rbtree_node_t        *next;
+    ngx_http_v2_stream_t     *stream;
+    ngx_http_v2_out_frame_t  *out;
+
+    stream = frame->stream;
+
+    /*
+     * frames are ordered by the depth of their streams in the dependency
+     * tree, and then by virtual finish time: streams at the same depth
+     * share the connection in proportion to their weights;
+     *
+     * a frame is put just before the next scheduled one, or last,
+     * and so it never overtakes blocked frames and frames without
+     * a stream, which all precede the scheduled ones
+     */
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    if ((ngx_rbtree_key_int_t) (stream->finish - h2c->virtual_time) < 0) {
+        stream->finish = h2c->virtual_time;
+    }
+
+    stream->finish += ngx_http_v2_sched_time(frame->length,
+                                             stream->node->weight);
+
+    frame->sched.node.key = stream->finish;
+    frame->sched.rank = stream->node->rank;
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    ngx_rbtree_insert(&h2c->scheduled, &frame->sched.node);
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
-            break;
-        }
+    /* the output queue is kept in reverse order */
+
+    next = ngx_rbtree_next(&h2c->scheduled, &frame->sched.node);
+
+    if (next == NULL) {
+        frame->next = h2c->last_out;
+        h2c->last_out = frame;
+        return;
     }
 
-    frame->next = *out;
-    *out = frame;
+    out = ngx_http_v2_sched_data(next, ngx_http_v2_out_frame_t);
+
+    frame->next = out->next;
+    out->next = frame;
 }
 
 
@@ -247,17 +337,28 @@ static ngx_inline void
 ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_rbtree_node_t        *node;
+    ngx_http_v2_out_frame_t  *out;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    /*
+     * blocked frames, such as HEADERS, and frames without a stream follow
+     * the scheduled ones in the output queue, that is, they are sent
+     * before them, in the order they were queued, and act as barriers:
+     * DATA frames queued later are sent after them
+     */
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    if (h2c->scheduled.root == h2c->scheduled.sentinel) {
+        frame->next = h2c->last_out;
+        h2c->last_out = frame;
+        return;
     }
 
-    frame->next = *out;
-    *out = frame;
+    node = ngx_rbtree_min(h2c->scheduled.root, h2c->scheduled.sentinel);
+
+    out = ngx_http_v2_sched_data(node, ngx_http_v2_out_frame_t);
+
+    frame->next = out->next;
+    out->next = frame;
 }
 
 
@@ -271,6 +372,8 @@ ngx_int_t ngx_http_v2_read_unbuffered_request_body(ngx_http_request_t *r);
 void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc);
 
 ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
+void ngx_http_v2_sched_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 
 ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
@@ -279,7 +382,14 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_find_header(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header, ngx_uint_t *index);
+ngx_int_t ngx_http_v2_index_header(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header);
+void ngx_http_v2_table_resize(ngx_http_v2_connection_t *h2c, size_t size);
+
 
+void ngx_http_v2_huff_decode_init(void);
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
 size_t ngx_http_v2_huff_encode(u_char *src, size_t len, u_char *dst,
@@ -33,6 +33,8 @@
 #define NGX_HTTP_V2_ENCODE_RAW            0
 #define NGX_HTTP_V2_ENCODE_HUFF           0x80
 
+#define NGX_HTTP_V2_TABLE_SIZE_UPDATE     0x20
+
 #define NGX_HTTP_V2_STATUS_INDEX          8
 #define NGX_HTTP_V2_STATUS_200_INDEX      8
 #define NGX_HTTP_V2_STATUS_204_INDEX      9
@@ -43,14 +45,21 @@
 #define NGX_HTTP_V2_STATUS_500_INDEX      14
 
 #define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
+#define NGX_HTTP_V2_CONTENT_RANGE_INDEX   30
 #define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
 #define NGX_HTTP_V2_DATE_INDEX            33
+#define NGX_HTTP_V2_ETAG_INDEX            34
 #define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
 #define NGX_HTTP_V2_LOCATION_INDEX        46
 #define NGX_HTTP_V2_SERVER_INDEX          54
+#define NGX_HTTP_V2_SET_COOKIE_INDEX      55
 #define NGX_HTTP_V2_VARY_INDEX            59
 
 
+static u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_uint_t index, ngx_http_v2_header_t *header,
+    ngx_str_t *encoded, u_char *tmp);
+static ngx_uint_t ngx_http_v2_indexing(ngx_uint_t index);
 static u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
 static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
@@ -126,18 +135,21 @@ static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_int_t
 ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
-    u_char                     status, *pos, *start, *p, *tmp;
+    u_char                     status, *pos, *start, *p, *tmp, *low;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, encoded;
     ngx_uint_t                 i, port;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *fc;
     ngx_http_cleanup_t        *cln;
+    ngx_http_v2_header_t       field;
     ngx_http_v2_out_frame_t   *frame;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_v2_connection_t  *h2c;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     value[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
     static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
 #if (NGX_HTTP_GZIP)
@@ -175,6 +187,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    h2c = r->stream->connection;
+
     if (r->method == NGX_HTTP_HEAD) {
         r->header_only = 1;
     }
@@ -410,15 +424,44 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    if (h2c->hpack_enc.max) {
+        /*
+         * a table size update, and indices of the headers
+         * which are not added to the table take up to 2 octets
+         */
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + 3;
+    }
+
     tmp = ngx_palloc(r->pool, tmp_len);
+    low = ngx_pnalloc(r->pool, tmp_len);
     pos = ngx_pnalloc(r->pool, len);
 
-    if (pos == NULL || tmp == NULL) {
+    if (pos == NULL || tmp == NULL || low == NULL) {
         return NGX_ERROR;
     }
 
+    cln = ngx_http_cleanup_add(r, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_v2_filter_cleanup;
+    cln->data = r->stream;
+
     start = pos;
 
+    if (h2c->hpack_enc.update) {
+        len = ngx_min(h2c->hpack_enc.max, h2c->hpack_enc.limit);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output hpack table size update: %uz", len);
+
+        *pos = NGX_HTTP_V2_TABLE_SIZE_UPDATE;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), len);
+
+        ngx_http_v2_table_resize(h2c, len);
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
                    r->headers_out.status);
@@ -427,9 +470,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        ngx_str_set(&field.name, ":status");
+
+        field.value.data = value;
+        field.value.len = ngx_sprintf(value, "%03ui", r->headers_out.status)
+                          - value;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       &field, NULL, tmp);
     }
 
     if (r->headers_out.server == NULL) {
@@ -449,7 +497,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                            "http2 output header: \"server: nginx\"");
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+        ngx_str_set(&field.name, "server");
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
             if (nginx_ver[0] == '\0') {
@@ -458,7 +506,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                 nginx_ver_len = p - nginx_ver;
             }
 
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
+            ngx_str_set(&field.value, NGINX_VER);
+
+            encoded.len = nginx_ver_len;
+            encoded.data = nginx_ver;
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
             if (nginx_ver_build[0] == '\0') {
@@ -468,11 +519,20 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                 nginx_ver_build_len = p - nginx_ver_build;
             }
 
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+            ngx_str_set(&field.value, NGINX_VER_BUILD);
+
+            encoded.len = nginx_ver_build_len;
+            encoded.data = nginx_ver_build;
 
         } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
+            ngx_str_set(&field.value, "nginx");
+
+            encoded.len = sizeof(nginx);
+            encoded.data = (u_char *) nginx;
         }
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       &field, &encoded, tmp);
     }
 
     if (r->headers_out.date == NULL) {
@@ -480,14 +540,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        ngx_str_set(&field.name, "date");
+        field.value = ngx_cached_http_time;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                       &field, NULL, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
@@ -517,8 +577,12 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        ngx_str_set(&field.name, "content-type");
+        field.value = r->headers_out.content_type;
+
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                       &field, NULL, tmp);
     }
 
     if (r->headers_out.content_length == NULL
@@ -528,30 +592,35 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        ngx_str_set(&field.name, "content-length");
+
+        field.value.data = value;
+        field.value.len = ngx_sprintf(value, "%O",
+                                      r->headers_out.content_length_n)
+                          - value;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                       &field, NULL, tmp);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        ngx_str_set(&field.name, "last-modified");
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+        field.value.data = value;
+        field.value.len = ngx_http_time(value,
+                                        r->headers_out.last_modified_time)
+                          - value;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"",
+                       &field.value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                       &field, NULL, tmp);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -559,9 +628,11 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        ngx_str_set(&field.name, "location");
+        field.value = r->headers_out.location->value;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       &field, NULL, tmp);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -569,8 +640,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        ngx_str_set(&field.name, "vary");
+        ngx_str_set(&field.value, "Accept-Encoding");
+
+        encoded.len = sizeof(accept_encoding);
+        encoded.data = (u_char *) accept_encoding;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       &field, &encoded, tmp);
     }
 #endif
 
@@ -593,39 +670,33 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             continue;
         }
 
-#if (NGX_DEBUG)
-        if (fc->log->log_level & NGX_LOG_DEBUG_HTTP) {
-            ngx_strlow(tmp, header[i].key.data, header[i].key.len);
-
-            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"%*s: %V\"",
-                           header[i].key.len, tmp, &header[i].value);
-        }
-#endif
+        field.name.len = header[i].key.len;
+        field.name.data = low;
+        field.value = header[i].value;
 
-        *pos++ = 0;
+        ngx_strlow(low, header[i].key.data, header[i].key.len);
 
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"%V: %V\"",
+                       &field.name, &field.value);
 
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &field, NULL, tmp);
     }
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos);
     if (frame == NULL) {
-        return NGX_ERROR;
-    }
 
-    ngx_http_v2_queue_blocked_frame(r->stream->connection, frame);
+        if (h2c->hpack_enc.max) {
+            /* the client will not see entries added to the table */
+            h2c->hpack_enc.deleted = h2c->hpack_enc.added;
+            h2c->hpack_enc.free = h2c->hpack_enc.size;
+            h2c->hpack_enc.update = 1;
+        }
 
-    cln = ngx_http_cleanup_add(r, 0);
-    if (cln == NULL) {
         return NGX_ERROR;
     }
 
-    cln->handler = ngx_http_v2_filter_cleanup;
-    cln->data = r->stream;
+    ngx_http_v2_queue_blocked_frame(r->stream->connection, frame);
 
     r->stream->queued = 1;
 
@@ -636,6 +707,92 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 }
 
 
+static u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_http_v2_header_t *header, ngx_str_t *encoded,
+    u_char *tmp)
+{
+    ngx_uint_t  indexing;
+
+    if (h2c->hpack_enc.max == 0) {
+
+        if (index) {
+            *pos++ = ngx_http_v2_inc_indexed(index);
+
+        } else {
+            *pos++ = 0;
+            pos = ngx_http_v2_write_name(pos, header->name.data,
+                                         header->name.len, tmp);
+        }
+
+        goto value;
+    }
+
+    indexing = ngx_http_v2_indexing(index);
+
+    if (indexing) {
+        if (ngx_http_v2_find_header(h2c, header, &index) == NGX_OK) {
+            *pos = 128;
+            return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+        }
+
+        indexing = ngx_http_v2_indexing(index);
+    }
+
+    /* large entries are not added to keep the table for common ones */
+
+    if (indexing
+        && 32 + header->name.len + header->value.len
+           <= h2c->hpack_enc.size / 4
+        && ngx_http_v2_index_header(h2c, header) == NGX_OK)
+    {
+        *pos = 64;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+    if (index == 0) {
+        pos = ngx_http_v2_write_name(pos, header->name.data, header->name.len,
+                                     tmp);
+    }
+
+value:
+
+    if (encoded) {
+        return ngx_cpymem(pos, encoded->data, encoded->len);
+    }
+
+    return ngx_http_v2_write_value(pos, header->value.data, header->value.len,
+                                   tmp);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_indexing(ngx_uint_t index)
+{
+    /*
+     * Values of these headers are mostly unique to a response,
+     * adding them would only evict the entries that are reused.
+     */
+
+    switch (index) {
+
+    case NGX_HTTP_V2_CONTENT_LENGTH_INDEX:
+    case NGX_HTTP_V2_CONTENT_RANGE_INDEX:
+    case NGX_HTTP_V2_ETAG_INDEX:
+    case NGX_HTTP_V2_LAST_MODIFIED_INDEX:
+    case NGX_HTTP_V2_LOCATION_INDEX:
+    case NGX_HTTP_V2_SET_COOKIE_INDEX:
+        return 0;
+    }
+
+    return 1;
+}
+
+
 static u_char *
 ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
     ngx_uint_t lower)
@@ -1092,6 +1249,28 @@ ngx_http_v2_filter_get_data_frame(ngx_http_v2_stream_t *stream,
 static ngx_inline ngx_int_t
 ngx_http_v2_filter_send(ngx_connection_t *fc, ngx_http_v2_stream_t *stream)
 {
+#if (NGX_HTTP_SSL)
+    ngx_connection_t  *c;
+
+    c = stream->connection->connection;
+
+    if (c->ssl && c->ssl->buffer && stream->queued
+        && stream->connection->processing > 1)
+    {
+        /*
+         * other streams may queue frames in this cycle too, so
+         * the output is left to the connection write handler,
+         * which packs frames into records of ssl_buffer_size
+         */
+
+        if (!c->write->posted) {
+            ngx_post_event(c->write, &ngx_posted_events);
+        }
+
+        goto queued;
+    }
+#endif
+
     stream->blocked = 1;
 
     if (ngx_http_v2_send_output_queue(stream->connection) == NGX_ERROR) {
@@ -1102,15 +1281,20 @@ ngx_http_v2_filter_send(ngx_connection_t *fc, ngx_http_v2_stream_t *stream)
     stream->blocked = 0;
 
     if (stream->queued) {
-        fc->buffered |= NGX_HTTP_V2_BUFFERED;
-        fc->write->active = 1;
-        fc->write->ready = 0;
-        return NGX_AGAIN;
+        goto queued;
     }
 
     fc->buffered &= ~NGX_HTTP_V2_BUFFERED;
 
     return NGX_OK;
+
+queued:
+
+    fc->buffered |= NGX_HTTP_V2_BUFFERED;
+    fc->write->active = 1;
+    fc->write->ready = 0;
+
+    return NGX_AGAIN;
 }
 
 
@@ -1140,8 +1324,7 @@ static void
 ngx_http_v2_waiting_queue(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_stream_t *stream)
 {
-    ngx_queue_t           *q;
-    ngx_http_v2_stream_t  *s;
+    ngx_rbtree_key_t  finish;
 
     if (stream->waiting) {
         return;
@@ -1149,21 +1332,20 @@ ngx_http_v2_waiting_queue(ngx_http_v2_connection_t *h2c,
 
     stream->waiting = 1;
 
-    for (q = ngx_queue_last(&h2c->waiting);
-         q != ngx_queue_sentinel(&h2c->waiting);
-         q = ngx_queue_prev(q))
-    {
-        s = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
+    /* streams get the window in the order their next frames would be sent */
 
-        if (s->node->rank < stream->node->rank
-            || (s->node->rank == stream->node->rank
-                && s->node->rel_weight >= stream->node->rel_weight))
-        {
-            break;
-        }
+    finish = stream->finish;
+
+    if ((ngx_rbtree_key_int_t) (finish - h2c->virtual_time) < 0) {
+        finish = h2c->virtual_time;
     }
 
-    ngx_queue_insert_after(q, &stream->queue);
+    stream->sched.node.key = finish
+                             + ngx_http_v2_sched_time(h2c->frame_size,
+                                                      stream->node->weight);
+    stream->sched.rank = stream->node->rank;
+
+    ngx_rbtree_insert(&h2c->waiting, &stream->sched.node);
 }
 
 
@@ -1373,13 +1555,15 @@ ngx_http_v2_filter_cleanup(void *data)
 
     size_t                     window;
     ngx_event_t               *wev;
-    ngx_queue_t               *q;
+    ngx_rbtree_node_t         *node;
     ngx_http_v2_out_frame_t   *frame, **fn;
     ngx_http_v2_connection_t  *h2c;
 
+    h2c = stream->connection;
+
     if (stream->waiting) {
         stream->waiting = 0;
-        ngx_queue_remove(&stream->queue);
+        ngx_rbtree_delete(&h2c->waiting, &stream->sched.node);
     }
 
     if (stream->queued == 0) {
@@ -1387,7 +1571,6 @@ ngx_http_v2_filter_cleanup(void *data)
     }
 
     window = 0;
-    h2c = stream->connection;
     fn = &h2c->last_out;
 
     for ( ;; ) {
@@ -1400,6 +1583,8 @@ ngx_http_v2_filter_cleanup(void *data)
         if (frame->stream == stream && !frame->blocked) {
             *fn = frame->next;
 
+            ngx_rbtree_delete(&h2c->scheduled, &frame->sched.node);
+
             window += frame->length;
 
             if (--stream->queued == 0) {
@@ -1414,12 +1599,12 @@ ngx_http_v2_filter_cleanup(void *data)
 
     if (h2c->send_window == 0 && window) {
 
-        while (!ngx_queue_empty(&h2c->waiting)) {
-            q = ngx_queue_head(&h2c->waiting);
+        while (h2c->waiting.root != h2c->waiting.sentinel) {
+            node = ngx_rbtree_min(h2c->waiting.root, h2c->waiting.sentinel);
 
-            ngx_queue_remove(q);
+            ngx_rbtree_delete(&h2c->waiting, node);
 
-            stream = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
+            stream = ngx_http_v2_sched_data(node, ngx_http_v2_stream_t);
 
             stream->waiting = 0;
 
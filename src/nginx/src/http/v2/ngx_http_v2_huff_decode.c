@@ -18,10 +18,25 @@ typedef struct {
 } ngx_http_v2_huff_decode_code_t;
 
 
+typedef struct {
+    u_char  next;
+    u_char  flags;
+    u_char  sym[2];
+} ngx_http_v2_huff_decode_byte_t;
+
+
+#define NGX_HTTP_V2_HUFF_EMIT    0x03
+#define NGX_HTTP_V2_HUFF_ENDING  0x04
+#define NGX_HTTP_V2_HUFF_FAIL    0x08
+
+
 static ngx_inline ngx_int_t ngx_http_v2_huff_decode_bits(u_char *state,
     u_char *ending, ngx_uint_t bits, u_char **dst);
 
 
+static ngx_http_v2_huff_decode_byte_t  ngx_http_v2_huff_decode_bytes[256][256];
+
+
 static ngx_http_v2_huff_decode_code_t  ngx_http_v2_huff_decode_codes[256][16] =
 {
     /* 0 */
@@ -2639,43 +2654,103 @@ static ngx_http_v2_huff_decode_code_t  ngx_http_v2_huff_decode_codes[256][16] =
 };
 
 
+void
+ngx_http_v2_huff_decode_init(void)
+{
+    u_char                           *p, buf[2], state, ending;
+    ngx_uint_t                        s, ch;
+    ngx_http_v2_huff_decode_byte_t   *code;
+
+    /*
+     * the byte table is derived from the nibble state machine above:
+     * each entry is the outcome of feeding both halves of a byte
+     * to a given state, which yields at most two symbols since
+     * the shortest code is 5 bits long
+     */
+
+    for (s = 0; s < 256; s++) {
+        for (ch = 0; ch < 256; ch++) {
+
+            code = &ngx_http_v2_huff_decode_bytes[s][ch];
+
+            state = (u_char) s;
+            ending = 0;
+            p = buf;
+
+            if (ngx_http_v2_huff_decode_bits(&state, &ending, ch >> 4, &p)
+                != NGX_OK
+                || ngx_http_v2_huff_decode_bits(&state, &ending, ch & 0xf, &p)
+                   != NGX_OK)
+            {
+                code->next = (u_char) s;
+                code->flags = NGX_HTTP_V2_HUFF_FAIL;
+                continue;
+            }
+
+            code->next = state;
+            code->flags = (u_char) (p - buf);
+            code->sym[0] = buf[0];
+            code->sym[1] = buf[1];
+
+            if (ending) {
+                code->flags |= NGX_HTTP_V2_HUFF_ENDING;
+            }
+        }
+    }
+}
+
+
 ngx_int_t
 ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
     ngx_uint_t last, ngx_log_t *log)
 {
-    u_char  *end, ch, ending;
+    u_char                          *d, *end, ch, st;
+    ngx_uint_t                       n;
+    ngx_http_v2_huff_decode_byte_t   code;
 
     ch = 0;
-    ending = 1;
+    st = *state;
+    d = *dst;
+
+    code.flags = NGX_HTTP_V2_HUFF_ENDING;
 
     end = src + len;
 
     while (src != end) {
         ch = *src++;
 
-        if (ngx_http_v2_huff_decode_bits(state, &ending, ch >> 4, dst)
-            != NGX_OK)
-        {
+        code = ngx_http_v2_huff_decode_bytes[st][ch];
+
+        if (code.flags & NGX_HTTP_V2_HUFF_FAIL) {
             ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
                            "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch >> 4);
+                           "bad code 0x%Xd", st, ch);
+
+            *state = st;
+            *dst = d;
 
             return NGX_ERROR;
         }
 
-        if (ngx_http_v2_huff_decode_bits(state, &ending, ch & 0xf, dst)
-            != NGX_OK)
-        {
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
-                           "http2 huffman decoding error at state %d: "
-                           "bad code 0x%Xd", *state, ch & 0xf);
+        n = code.flags & NGX_HTTP_V2_HUFF_EMIT;
 
-            return NGX_ERROR;
+        if (n) {
+            d[0] = code.sym[0];
+
+            if (n == 2) {
+                d[1] = code.sym[1];
+            }
+
+            d += n;
         }
+
+        st = code.next;
     }
 
+    *dst = d;
+
     if (last) {
-        if (!ending) {
+        if (!(code.flags & NGX_HTTP_V2_HUFF_ENDING)) {
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                            "http2 huffman decoding error: "
                            "incomplete code 0x%Xd", ch);
@@ -2683,14 +2758,15 @@ ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len, u_char **dst,
             return NGX_ERROR;
         }
 
-        *state = 0;
+        st = 0;
     }
 
+    *state = st;
+
     return NGX_OK;
 }
 
 
-
 static ngx_inline ngx_int_t
 ngx_http_v2_huff_decode_bits(u_char *state, u_char *ending, ngx_uint_t bits,
     u_char **dst)
@@ -10,11 +10,15 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *hpack);
+static void ngx_http_v2_table_hash(ngx_http_v2_header_t *header,
+    uint32_t *hash, uint32_t *name_hash);
+static ngx_int_t ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *hpack,
+    u_char *p, u_char *s, size_t len);
+static u_char *ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *hpack,
+    u_char *p, u_char *s, size_t len);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -347,3 +351,274 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+ngx_int_t
+ngx_http_v2_find_header(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header, ngx_uint_t *index)
+{
+    uint32_t                    hash, name_hash;
+    ngx_uint_t                  i, n;
+    ngx_http_v2_hpack_enc_t    *hpack;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    if (*index == 0) {
+        for (i = 0; i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES; i++) {
+
+            if (header->name.len == ngx_http_v2_static_table[i].name.len
+                && ngx_strncmp(header->name.data,
+                               ngx_http_v2_static_table[i].name.data,
+                               header->name.len)
+                   == 0)
+            {
+                *index = i + 1;
+                break;
+            }
+        }
+    }
+
+    hpack = &h2c->hpack_enc;
+
+    if (hpack->added == hpack->deleted) {
+        return NGX_DECLINED;
+    }
+
+    ngx_http_v2_table_hash(header, &hash, &name_hash);
+
+    for (n = hpack->index[hash & hpack->mask];
+         n > hpack->deleted;
+         n = entry->next)
+    {
+        entry = &hpack->entries[n % hpack->allocated];
+
+        if (entry->hash == hash
+            && entry->name_len == header->name.len
+            && entry->value_len == header->value.len
+            && ngx_http_v2_table_cmp(hpack, entry->data, header->name.data,
+                                     header->name.len)
+               == 0
+            && ngx_http_v2_table_cmp(hpack, entry->data + entry->name_len,
+                                     header->value.data, header->value.len)
+               == 0)
+        {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + hpack->added - n + 1;
+            return NGX_OK;
+        }
+    }
+
+    if (*index) {
+        return NGX_DECLINED;
+    }
+
+    for (n = hpack->index[hpack->mask + 1 + (name_hash & hpack->mask)];
+         n > hpack->deleted;
+         n = entry->name_next)
+    {
+        entry = &hpack->entries[n % hpack->allocated];
+
+        if (entry->name_hash == name_hash
+            && entry->name_len == header->name.len
+            && ngx_http_v2_table_cmp(hpack, entry->data, header->name.data,
+                                     header->name.len)
+               == 0)
+        {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + hpack->added - n + 1;
+            break;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_v2_index_header(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_header_t *header)
+{
+    size_t                      size;
+    uint32_t                    hash, name_hash;
+    ngx_uint_t                  n, *bucket;
+    ngx_http_v2_hpack_enc_t    *hpack;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 index header in hpack table: \"%V: %V\"",
+                   &header->name, &header->value);
+
+    hpack = &h2c->hpack_enc;
+
+    if (hpack->entries == NULL) {
+
+        /* an entry takes at least 32 octets of the table */
+
+        hpack->allocated = hpack->max / 32;
+
+        for (n = 1; n < hpack->allocated; n <<= 1) { /* void */ }
+
+        hpack->mask = n - 1;
+
+        hpack->entries = ngx_palloc(h2c->connection->pool,
+                                    sizeof(ngx_http_v2_hpack_entry_t)
+                                    * hpack->allocated);
+        if (hpack->entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        hpack->index = ngx_pcalloc(h2c->connection->pool,
+                                   2 * n * sizeof(ngx_uint_t));
+        if (hpack->index == NULL) {
+            return NGX_ERROR;
+        }
+
+        hpack->storage = ngx_palloc(h2c->connection->pool, hpack->max);
+        if (hpack->storage == NULL) {
+            return NGX_ERROR;
+        }
+
+        hpack->pos = hpack->storage;
+    }
+
+    size = 32 + header->name.len + header->value.len;
+
+    if (size > hpack->size) {
+        /* the client empties its table */
+        hpack->deleted = hpack->added;
+        hpack->free = hpack->size;
+        return NGX_OK;
+    }
+
+    while (size > hpack->free) {
+        ngx_http_v2_table_evict(hpack);
+    }
+
+    hpack->free -= size;
+
+    n = ++hpack->added;
+    entry = &hpack->entries[n % hpack->allocated];
+
+    entry->data = hpack->pos;
+    entry->name_len = header->name.len;
+    entry->value_len = header->value.len;
+
+    hpack->pos = ngx_http_v2_table_copy(hpack, hpack->pos, header->name.data,
+                                        header->name.len);
+    hpack->pos = ngx_http_v2_table_copy(hpack, hpack->pos, header->value.data,
+                                        header->value.len);
+
+    ngx_http_v2_table_hash(header, &hash, &name_hash);
+
+    entry->hash = hash;
+    entry->name_hash = name_hash;
+
+    bucket = &hpack->index[hash & hpack->mask];
+    entry->next = *bucket;
+    *bucket = n;
+
+    bucket = &hpack->index[hpack->mask + 1 + (name_hash & hpack->mask)];
+    entry->name_next = *bucket;
+    *bucket = n;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_resize(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    size_t                    used;
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack table resize: %uz was:%uz",
+                   size, hpack->size);
+
+    while (hpack->size - hpack->free > size) {
+        ngx_http_v2_table_evict(hpack);
+    }
+
+    used = hpack->size - hpack->free;
+
+    hpack->size = size;
+    hpack->free = size - used;
+    hpack->update = 0;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *hpack)
+{
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    entry = &hpack->entries[++hpack->deleted % hpack->allocated];
+    hpack->free += 32 + entry->name_len + entry->value_len;
+}
+
+
+static void
+ngx_http_v2_table_hash(ngx_http_v2_header_t *header, uint32_t *hash,
+    uint32_t *name_hash)
+{
+    u_char      *p, *end;
+    ngx_uint_t   key;
+
+    key = ngx_hash_key(header->name.data, header->name.len);
+
+    *name_hash = (uint32_t) key;
+
+    p = header->value.data;
+    end = p + header->value.len;
+
+    while (p < end) {
+        key = ngx_hash(key, *p++);
+    }
+
+    *hash = (uint32_t) key;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *hpack, u_char *p, u_char *s,
+    size_t len)
+{
+    size_t  rest;
+
+    if (p >= hpack->storage + hpack->max) {
+        p -= hpack->max;
+    }
+
+    rest = hpack->storage + hpack->max - p;
+
+    if (len > rest) {
+        if (ngx_memcmp(p, s, rest) != 0) {
+            return 1;
+        }
+
+        p = hpack->storage;
+        s += rest;
+        len -= rest;
+    }
+
+    return ngx_memcmp(p, s, len);
+}
+
+
+static u_char *
+ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *hpack, u_char *p, u_char *s,
+    size_t len)
+{
+    size_t  rest;
+
+    rest = hpack->storage + hpack->max - p;
+
+    if (len >= rest) {
+        ngx_memcpy(p, s, rest);
+
+        p = hpack->storage;
+        s += rest;
+        len -= rest;
+    }
+
+    return ngx_cpymem(p, s, len);
+}
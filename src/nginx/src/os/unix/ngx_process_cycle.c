@@ -26,6 +26,7 @@ static void ngx_channel_handler(ngx_event_t *ev);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
+static void ngx_cache_manager_process_exit(ngx_cycle_t *cycle);
 
 
 ngx_uint_t    ngx_process;
@@ -953,6 +954,10 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+#if (NGX_SLAB_MAGAZINES)
+    ngx_slab_flush_magazines(cycle->log);
+#endif
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
@@ -1126,6 +1131,11 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
     for ( ;; ) {
 
         if (ngx_terminate || ngx_quit) {
+
+            if (ctx == &ngx_cache_manager_ctx) {
+                ngx_cache_manager_process_exit(cycle);
+            }
+
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
             exit(0);
         }
@@ -1141,6 +1151,23 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 }
 
 
+static void
+ngx_cache_manager_process_exit(ngx_cycle_t *cycle)
+{
+    ngx_uint_t    i;
+    ngx_path_t  **path;
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+
+        if (path[i]->saver) {
+            path[i]->saver(path[i]->data);
+            ngx_time_update();
+        }
+    }
+}
+
+
 static void
 ngx_cache_manager_process_handler(ngx_event_t *ev)
 {